@@ -0,0 +1,934 @@
+#include "Closures.h"
+
+#include "Common.h"
+#include "Interpreter.h"
+
+#include <utility>
+
+using Statements = std::vector<std::unique_ptr<Statement>>;
+using CompiledCondition = std::function<Error(const Ref<Scope>& scope, bool& out)>;
+// Expression whose value is only used as a number, comments included in it can't be printed.
+using CompiledNumber = std::function<Error(const Ref<Scope>& scope, double& out)>;
+
+// Function and arguments of a call.
+struct CompiledCall {
+	CompiledExpression function;
+	std::vector<CompiledExpression> args;
+	CodePos functionPos;
+	CodePos pos;
+};
+
+// Conditions and bodies of an if statement, shared with the switch statement running it.
+struct CompiledIf {
+	std::vector<CompiledCondition> conditions;
+	std::vector<CompiledStatement> arms; // body of each condition, the else block last
+};
+
+static CompiledStatement CompileBlock(Statements& statements);
+static CompiledStatement CompileStatement(Statement& statement);
+static std::shared_ptr<const CompiledIf> CompileIf(IfStatement& ifStatement);
+[[nodiscard]] static Error RunIf(const CompiledIf& compiledIf, const Ref<Scope>& scope, std::optional<Value>& returned);
+static CompiledStatement CompileFor(ForStatement& forStatement);
+static CompiledCondition CompileCondition(Expression& condition, const char* errorMessage);
+template <typename Apply>
+static CompiledCondition CompileComparisonCondition(BinaryOperation& binaryOp, Apply apply);
+static CompiledExpression CompileExpression(Expression& expression);
+static CompiledExpression CompileBinary(BinaryOperation& binaryOp);
+template <typename Apply>
+static CompiledExpression CompileArithmetic(const BinaryOperation& binaryOp, CompiledExpression a, Apply apply);
+template <typename Apply>
+static CompiledExpression CompileComparison(const BinaryOperation& binaryOp, CompiledExpression a, Apply apply);
+static CompiledCall CompileCall(Call& call);
+[[nodiscard]] static Error PrepareCall(const CompiledCall& call, const Ref<Scope>& scope, Ref<Function>& callee, Ref<Scope>& innerScope);
+[[nodiscard]] static Error RunCall(const CompiledCall& call, const Ref<Scope>& scope, Value& out);
+[[nodiscard]] static Error RunCallee(Ref<Function> callee, Ref<Scope> innerScope, Value& out);
+static CompiledNumber CompileNumber(Expression& expression, const char* errorMessage);
+template <typename Apply>
+static CompiledNumber CompileArithmeticNumber(BinaryOperation& binaryOp, Apply apply);
+static bool IsNumeric(const Expression& expression);
+static CompiledExpression AttachComment(const Expression& expression, CompiledExpression compiled);
+static bool GetConstantNumber(const Expression& expression, double& out);
+
+// Call left by a return statement to the call running its function, so tail calls don't nest.
+static struct {
+	size_t depth;         // calls running, return statements at top level make their call themselves
+	Ref<Function> callee; // null unless a call is left
+	Ref<Scope> innerScope;
+} tailCallState;
+[[nodiscard]] static Error GetArray(const Ref<Scope>& scope, const std::string& name, CodePos pos, Ref<Array>& out);
+static void CombineOperandComments(const Value& b, Value& out);
+
+Error RunClosures(Statements& statements, const Ref<Scope>& scope, bool& returned)
+{
+	const CompiledStatement run = CompileBlock(statements);
+	tailCallState.depth = 0;
+	std::optional<Value> returnValue;
+	TRY(run(scope, returnValue));
+	returned = returnValue.has_value();
+	return Error::None;
+}
+
+// --- STATEMENTS --------------------------------------------------------------
+
+static CompiledStatement CompileBlock(Statements& statements)
+{
+	std::vector<CompiledStatement> compiled;
+	compiled.reserve(statements.size());
+	for (auto& statement : statements) compiled.push_back(CompileStatement(*statement));
+	if (compiled.size() == 1) return std::move(compiled.front());
+
+	return [compiled = std::move(compiled)](const Ref<Scope>& scope, std::optional<Value>& returned) -> Error {
+		for (const auto& statement : compiled)
+		{
+			TRY(statement(scope, returned));
+			if (returned) return Error::None;
+		}
+		return Error::None;
+	};
+}
+
+static CompiledStatement CompileStatement(Statement& statement)
+{
+	switch (statement.tag)
+	{
+	case StatementTag::If:
+	{
+		std::shared_ptr<const CompiledIf> compiledIf = CompileIf(static_cast<IfStatement&>(statement));
+		return [compiledIf = std::move(compiledIf)](const Ref<Scope>& scope, std::optional<Value>& returned) -> Error {
+			return RunIf(*compiledIf, scope, returned);
+		};
+	}
+	case StatementTag::While:
+	{
+		auto& whileStatement = static_cast<WhileStatement&>(statement);
+		CompiledCondition condition = CompileCondition(*whileStatement.condition, "Loop condition is not a boolean and not a number.");
+		CompiledStatement body = CompileBlock(whileStatement.statements);
+		return [condition = std::move(condition), body = std::move(body)](const Ref<Scope>& scope, std::optional<Value>& returned) -> Error {
+			for (;;)
+			{
+				bool conditionValue;
+				TRY(condition(scope, conditionValue));
+				if (!conditionValue) return Error::None;
+
+				TRY(body(scope, returned));
+				if (returned) return Error::None;
+			}
+		};
+	}
+	case StatementTag::For:
+		return CompileFor(static_cast<ForStatement&>(statement));
+	case StatementTag::GuardedLoop:
+		// NOTE Array accesses are checked anyway, so the original loop runs.
+		return CompileStatement(*static_cast<GuardedLoopStatement&>(statement).fallback.front());
+	case StatementTag::Kernel:
+		return CompileStatement(*static_cast<KernelStatement&>(statement).loop.front());
+	case StatementTag::Fused:
+		return CompileStatement(*static_cast<FusedStatement&>(statement).original.front());
+	case StatementTag::Switch:
+	{
+		// NOTE The if chain runs when the variable isn't a number, its arm is looked up otherwise.
+		const auto& switchStatement = static_cast<const SwitchStatement&>(statement);
+		std::shared_ptr<const CompiledIf> compiledIf = CompileIf(static_cast<IfStatement&>(*switchStatement.chain.front()));
+		return [&switchStatement, compiledIf = std::move(compiledIf)](const Ref<Scope>& scope, std::optional<Value>& returned) -> Error {
+			Value* value;
+			if (!scope->TryGetValue(switchStatement.variable, value) || value->Type() != TypeTag::Number) return RunIf(*compiledIf, scope, returned);
+			return compiledIf->arms[FindSwitchArm(switchStatement, value->number)](scope, returned);
+		};
+	}
+	case StatementTag::Assignment:
+	{
+		auto& assignment = static_cast<AssignmentStatement&>(statement);
+		if (!assignment.attachedComment && assignment.value->commentUnused && IsNumeric(*assignment.value))
+		{
+			return [name = assignment.name, value = CompileNumber(*assignment.value, nullptr)](const Ref<Scope>& scope, std::optional<Value>&) -> Error {
+				double number;
+				TRY(value(scope, number));
+				scope->SetNumber(name, number);
+				return Error::None;
+			};
+		}
+
+		CompiledExpression value = CompileExpression(*assignment.value);
+		return [name = assignment.name, value = std::move(value), comment = assignment.attachedComment.get()](const Ref<Scope>& scope, std::optional<Value>&) -> Error {
+			Value result;
+			TRY(value(scope, result));
+
+			if (result.Type() == TypeTag::Void) scope->Void(name);
+			else
+			{
+				if (comment) result.SetComment(MakeRef<Comment>(*comment, scope));
+				scope->SetValue(name, std::move(result));
+			}
+			return Error::None;
+		};
+	}
+	case StatementTag::ArrayWrite:
+	case StatementTag::InBoundsArrayWrite:
+	{
+		// NOTE Bounds are checked even where a loop guard proved them, the guard isn't compiled.
+		auto& arrayWrite = static_cast<ArrayWriteStatement&>(statement);
+		CompiledNumber index = CompileNumber(*arrayWrite.index, "Index to array is not a number.");
+		CompiledNumber value = CompileNumber(*arrayWrite.value, "Value written to array is not a number.");
+		return [name = arrayWrite.name, index = std::move(index), value = std::move(value), pos = statement.pos, indexPos = arrayWrite.index->pos](const Ref<Scope>& scope, std::optional<Value>&) -> Error {
+			Ref<Array> array;
+			TRY(GetArray(scope, name, pos, array));
+
+			double indexValue;
+			TRY(index(scope, indexValue));
+			const size_t i = static_cast<size_t>(indexValue);
+			if (i >= array->elements.size())
+			{
+				return Error{Format("Array index %zu out of bounds (array length is %zu).", i, array->elements.size()), indexPos};
+			}
+
+			double valueNumber;
+			TRY(value(scope, valueNumber));
+			if (i >= array->elements.size())
+			{
+				return Error{Format("Array index %zu out of bounds (array length is %zu).", i, array->elements.size()), indexPos};
+			}
+			array->elements[i] = valueNumber;
+			return Error::None;
+		};
+	}
+	case StatementTag::ArrayPush:
+	{
+		auto& arrayPush = static_cast<ArrayPushStatement&>(statement);
+		CompiledNumber value = CompileNumber(*arrayPush.value, "Value pushed is not a number.");
+		return [name = arrayPush.name, value = std::move(value), pos = statement.pos](const Ref<Scope>& scope, std::optional<Value>&) -> Error {
+			Ref<Array> array;
+			TRY(GetArray(scope, name, pos, array));
+
+			double valueNumber;
+			TRY(value(scope, valueNumber));
+			array->elements.push_back(valueNumber);
+			return Error::None;
+		};
+	}
+	case StatementTag::ArrayPop:
+	{
+		return [name = static_cast<const ArrayPopStatement&>(statement).name, pos = statement.pos](const Ref<Scope>& scope, std::optional<Value>&) -> Error {
+			Ref<Array> array;
+			TRY(GetArray(scope, name, pos, array));
+			if (array->elements.empty()) return Error{"Pop from an empty array.", pos};
+			array->elements.pop_back();
+			return Error::None;
+		};
+	}
+	case StatementTag::Return:
+	{
+		auto& returnStatement = static_cast<ExpressionStatement&>(statement);
+		if (returnStatement.value->tag == ExpressionTag::Call && !statement.attachedComment)
+		{
+			// NOTE The value set to `returned` only stops the enclosing statements, the call running the function
+			// makes the call left to it.
+			return [call = CompileCall(static_cast<Call&>(*returnStatement.value))](const Ref<Scope>& scope, std::optional<Value>& returned) -> Error {
+				if (tailCallState.depth == 0)
+				{
+					returned.emplace();
+					return RunCall(call, scope, *returned);
+				}
+				// NOTE Calls in the arguments run to the end first, so the call is only left once they were evaluated.
+				Ref<Function> callee;
+				Ref<Scope> innerScope;
+				TRY(PrepareCall(call, scope, callee, innerScope));
+				tailCallState.callee = std::move(callee);
+				tailCallState.innerScope = std::move(innerScope);
+				returned = Value();
+				return Error::None;
+			};
+		}
+
+		CompiledExpression value = CompileExpression(*returnStatement.value);
+		return [value = std::move(value), comment = statement.attachedComment.get()](const Ref<Scope>& scope, std::optional<Value>& returned) -> Error {
+			Value result;
+			TRY(value(scope, result));
+			if (comment) result.SetComment(MakeRef<Comment>(*comment, scope));
+			returned = std::move(result);
+			return Error::None;
+		};
+	}
+	case StatementTag::Expression:
+	{
+		CompiledExpression value = CompileExpression(*static_cast<ExpressionStatement&>(statement).value);
+		return [value = std::move(value)](const Ref<Scope>& scope, std::optional<Value>&) -> Error {
+			Value result;
+			TRY(value(scope, result));
+			PrintValue(result, false);
+			return Error::None;
+		};
+	}
+	}
+
+	return [pos = statement.pos](const Ref<Scope>&, std::optional<Value>&) -> Error {
+		return Error{"Internal error: Unrecognized statement.", pos};
+	};
+}
+
+static std::shared_ptr<const CompiledIf> CompileIf(IfStatement& ifStatement)
+{
+	auto compiledIf = std::make_shared<CompiledIf>();
+	for (auto& elif : ifStatement.elifChain)
+	{
+		compiledIf->conditions.push_back(CompileCondition(*elif.condition, "Condition is not a boolean and not a number."));
+		compiledIf->arms.push_back(CompileBlock(elif.statements));
+	}
+	compiledIf->arms.push_back(CompileBlock(ifStatement.elseBlock));
+	return compiledIf;
+}
+
+[[nodiscard]] static Error RunIf(const CompiledIf& compiledIf, const Ref<Scope>& scope, std::optional<Value>& returned)
+{
+	const size_t n = compiledIf.conditions.size();
+	for (size_t i = 0; i < n; ++i)
+	{
+		bool conditionValue;
+		TRY(compiledIf.conditions[i](scope, conditionValue));
+		if (conditionValue) return compiledIf.arms[i](scope, returned);
+	}
+	return compiledIf.arms[n](scope, returned);
+}
+
+static CompiledStatement CompileFor(ForStatement& forStatement)
+{
+	CompiledExpression start = CompileExpression(*forStatement.start);
+	CompiledExpression end = CompileExpression(*forStatement.end);
+	CompiledExpression step;
+	if (forStatement.step) step = CompileExpression(*forStatement.step);
+	CompiledStatement body = CompileBlock(forStatement.statements);
+	CompiledStatement fallback;
+	if (!forStatement.fallback.empty()) fallback = CompileStatement(*forStatement.fallback.front());
+
+	return [&forStatement, start = std::move(start), end = std::move(end), step = std::move(step), body = std::move(body), fallback = std::move(fallback)](const Ref<Scope>& scope, std::optional<Value>& returned) -> Error {
+		Value startValue;
+		TRY(start(scope, startValue));
+		Value endValue;
+		TRY(end(scope, endValue));
+		Value stepValue;
+		if (step) TRY(step(scope, stepValue));
+		else stepValue = Value(1.0);
+
+		if (fallback)
+		{
+			// NOTE Rewritten while loop. Unless its counter is a plain number going up, the original loop runs.
+			if (startValue.Type() != TypeTag::Number || startValue.GetComment() || endValue.Type() != TypeTag::Number || stepValue.Type() != TypeTag::Number || stepValue.GetComment() || !(stepValue.number > 0.0))
+			{
+				return fallback(scope, returned);
+			}
+		}
+		else
+		{
+			if (startValue.Type() != TypeTag::Number) return Error{"Loop start is not a number.", forStatement.start->pos};
+			if (endValue.Type() != TypeTag::Number) return Error{"Loop end is not a number.", forStatement.end->pos};
+			if (stepValue.Type() != TypeTag::Number) return Error{"Loop step is not a number.", forStatement.step->pos};
+			if (stepValue.number == 0.0) return Error{"Loop step is zero.", forStatement.step->pos};
+		}
+
+		double counter = startValue.number;
+		const double endNumber = endValue.number;
+		const double stepNumber = stepValue.number;
+
+		// NOTE The counter is only bound once the loop runs and holds the first value out of range afterwards.
+		bool ran = false;
+		while (stepNumber > 0.0 ? (forStatement.inclusive ? counter <= endNumber : counter < endNumber) : counter > endNumber)
+		{
+			scope->SetNumber(forStatement.counter, counter);
+			ran = true;
+
+			TRY(body(scope, returned));
+			if (returned) return Error::None;
+
+			counter += stepNumber;
+		}
+		if (ran) scope->SetNumber(forStatement.counter, counter);
+		return Error::None;
+	};
+}
+
+// Comparisons as conditions compare without creating a value, their comments can't be printed.
+static CompiledCondition CompileCondition(Expression& condition, const char* const errorMessage)
+{
+	if (condition.tag == ExpressionTag::Binary)
+	{
+		auto& binaryOp = static_cast<BinaryOperation&>(condition);
+		switch (binaryOp.op)
+		{
+		case TokenTag::LessThan: return CompileComparisonCondition(binaryOp, [](const double x, const double y) { return x < y; });
+		case TokenTag::GreaterThan: return CompileComparisonCondition(binaryOp, [](const double x, const double y) { return x > y; });
+		case TokenTag::LessEquals: return CompileComparisonCondition(binaryOp, [](const double x, const double y) { return x <= y; });
+		case TokenTag::GreaterEquals: return CompileComparisonCondition(binaryOp, [](const double x, const double y) { return x >= y; });
+		case TokenTag::EqualsEquals: return CompileComparisonCondition(binaryOp, [](const double x, const double y) { return x == y; });
+		case TokenTag::NotEquals: return CompileComparisonCondition(binaryOp, [](const double x, const double y) { return x != y; });
+		default: break;
+		}
+	}
+
+	return [value = CompileExpression(condition), pos = condition.pos, errorMessage](const Ref<Scope>& scope, bool& out) -> Error {
+		Value result;
+		TRY(value(scope, result));
+		if (result.Type() == TypeTag::Bool) out = result.boolean;
+		else if (result.Type() == TypeTag::Number) out = result.number != 0.0;
+		else return Error{errorMessage, pos};
+		return Error::None;
+	};
+}
+
+template <typename Apply>
+static CompiledCondition CompileComparisonCondition(BinaryOperation& binaryOp, const Apply apply)
+{
+	CompiledNumber a = CompileNumber(*binaryOp.a, "Comparison operand is not a number.");
+	CompiledNumber b = CompileNumber(*binaryOp.b, "Arithmetic operand is not a number.");
+	return [a = std::move(a), b = std::move(b), apply](const Ref<Scope>& scope, bool& out) -> Error {
+		double aNumber;
+		TRY(a(scope, aNumber));
+		double bNumber;
+		TRY(b(scope, bNumber));
+		out = apply(aNumber, bNumber);
+		return Error::None;
+	};
+}
+
+// --- EXPRESSIONS -------------------------------------------------------------
+
+static CompiledExpression CompileExpression(Expression& expression)
+{
+	switch (expression.tag)
+	{
+	case ExpressionTag::False:
+	case ExpressionTag::True:
+	{
+		const bool value = expression.tag == ExpressionTag::True;
+		return AttachComment(expression, [value](const Ref<Scope>&, Value& out) -> Error {
+			out = Value(value);
+			return Error::None;
+		});
+	}
+	case ExpressionTag::NumberLiteral:
+		return AttachComment(expression, [value = static_cast<const NumberLiteral&>(expression).value](const Ref<Scope>&, Value& out) -> Error {
+			out = Value(value);
+			return Error::None;
+		});
+	case ExpressionTag::ArrayLiteral:
+	{
+		auto& arrayLiteral = static_cast<ArrayLiteral&>(expression);
+		std::vector<CompiledNumber> values;
+		for (auto& value : arrayLiteral.values) values.push_back(CompileNumber(*value, "Array initializer is not a number."));
+		return AttachComment(expression, [values = std::move(values)](const Ref<Scope>& scope, Value& out) -> Error {
+			auto array = MakeRef<Array>();
+			array->elements.reserve(values.size());
+			for (const auto& value : values)
+			{
+				double number;
+				TRY(value(scope, number));
+				array->elements.push_back(number);
+			}
+			out = Value(std::move(array));
+			return Error::None;
+		});
+	}
+	case ExpressionTag::FunctionLiteral:
+		return AttachComment(expression, [&functionLiteral = static_cast<FunctionLiteral&>(expression)](const Ref<Scope>& scope, Value& out) -> Error {
+			if (!functionLiteral.code) functionLiteral.code = std::make_shared<FunctionCode>(functionLiteral.statements);
+			out = Value(MakeRef<Function>(functionLiteral.args, functionLiteral.code, scope));
+			return Error::None;
+		});
+	case ExpressionTag::Identifier:
+		return AttachComment(expression, [name = static_cast<const Identifier&>(expression).name](const Ref<Scope>& scope, Value& out) -> Error {
+			Value* value;
+			if (scope->TryGetValue(name, value)) out = *value;
+			else out = Value();
+			return Error::None;
+		});
+	case ExpressionTag::Constant:
+		return AttachComment(expression, [&value = static_cast<const Constant&>(expression).value](const Ref<Scope>&, Value& out) -> Error {
+			out = value;
+			return Error::None;
+		});
+	case ExpressionTag::Unary:
+	{
+		auto& unaryOp = static_cast<UnaryOperation&>(expression);
+		CompiledExpression a = CompileExpression(*unaryOp.a);
+		const CodePos aPos = unaryOp.a->pos;
+		switch (unaryOp.op)
+		{
+		case TokenTag::KeyNot:
+			return AttachComment(expression, [a = std::move(a), aPos](const Ref<Scope>& scope, Value& out) -> Error {
+				TRY(a(scope, out));
+				if (out.Type() != TypeTag::Bool) return Error("Logical not of non-boolean value.", aPos);
+				out.boolean = !out.boolean;
+				return Error::None;
+			});
+		case TokenTag::KeyNeg:
+			return AttachComment(expression, [a = std::move(a), aPos](const Ref<Scope>& scope, Value& out) -> Error {
+				TRY(a(scope, out));
+				if (out.Type() != TypeTag::Number) return Error("Negation of non-number value.", aPos);
+				out.number = -out.number;
+				return Error::None;
+			});
+		case TokenTag::KeyVoid:
+			return AttachComment(expression, [a = std::move(a)](const Ref<Scope>& scope, Value& out) -> Error {
+				// NOTE We don't skip evaluating voiding expression to allow side effects to happen.
+				TRY(a(scope, out));
+				Ref<Comment> comment = out.GetComment();
+				out = Value();
+				out.SetComment(std::move(comment));
+				return Error::None;
+			});
+		case TokenTag::Hash:
+			return AttachComment(expression, [a = std::move(a), aPos](const Ref<Scope>& scope, Value& out) -> Error {
+				TRY(a(scope, out));
+				if (out.Type() != TypeTag::Array) return Error("Array length operator used on non-array value.", aPos);
+				out = Value(static_cast<double>(out.GetArray().size()), out.GetComment());
+				return Error::None;
+			});
+		default:
+			break;
+		}
+		break;
+	}
+	case ExpressionTag::Binary:
+	case ExpressionTag::TypedBinary:
+	case ExpressionTag::InBoundsRead:
+		return CompileBinary(static_cast<BinaryOperation&>(expression));
+	case ExpressionTag::Call:
+		return [call = CompileCall(static_cast<Call&>(expression))](const Ref<Scope>& scope, Value& out) -> Error {
+			return RunCall(call, scope, out);
+		};
+	}
+
+	return [pos = expression.pos](const Ref<Scope>&, Value&) -> Error {
+		return Error{"Internal error: Unrecognized expression.", pos};
+	};
+}
+
+// NOTE Operand types proven by specialization and loop guards aren't relied on, every operation checks its operands.
+static CompiledExpression CompileBinary(BinaryOperation& binaryOp)
+{
+	if (binaryOp.commentUnused && IsNumeric(binaryOp))
+	{
+		return [number = CompileNumber(binaryOp, nullptr)](const Ref<Scope>& scope, Value& out) -> Error {
+			double value;
+			TRY(number(scope, value));
+			out = Value(value);
+			return Error::None;
+		};
+	}
+
+	CompiledExpression a = CompileExpression(*binaryOp.a);
+	switch (binaryOp.op)
+	{
+	case TokenTag::Plus: return CompileArithmetic(binaryOp, std::move(a), [](const double x, const double y) { return x + y; });
+	case TokenTag::Minus: return CompileArithmetic(binaryOp, std::move(a), [](const double x, const double y) { return x - y; });
+	case TokenTag::Star: return CompileArithmetic(binaryOp, std::move(a), [](const double x, const double y) { return x * y; });
+	case TokenTag::Slash: return CompileArithmetic(binaryOp, std::move(a), [](const double x, const double y) { return x / y; });
+	case TokenTag::Percent: return CompileArithmetic(binaryOp, std::move(a), [](const double x, const double y) { return Modulo(x, y); });
+	case TokenTag::LessThan: return CompileComparison(binaryOp, std::move(a), [](const double x, const double y) { return x < y; });
+	case TokenTag::GreaterThan: return CompileComparison(binaryOp, std::move(a), [](const double x, const double y) { return x > y; });
+	case TokenTag::LessEquals: return CompileComparison(binaryOp, std::move(a), [](const double x, const double y) { return x <= y; });
+	case TokenTag::GreaterEquals: return CompileComparison(binaryOp, std::move(a), [](const double x, const double y) { return x >= y; });
+	case TokenTag::EqualsEquals: return CompileComparison(binaryOp, std::move(a), [](const double x, const double y) { return x == y; });
+	case TokenTag::NotEquals: return CompileComparison(binaryOp, std::move(a), [](const double x, const double y) { return x != y; });
+	case TokenTag::KeyAnd:
+	case TokenTag::KeyOr:
+	{
+		// NOTE A short-circuited result keeps the first operand's comment, the expression's comment isn't attached.
+		const bool isAnd = binaryOp.op == TokenTag::KeyAnd;
+		return [isAnd, a = std::move(a), b = CompileExpression(*binaryOp.b), aPos = binaryOp.a->pos, bPos = binaryOp.b->pos, combine = !binaryOp.commentUnused, comment = binaryOp.commentUnused ? nullptr : binaryOp.attachedComment.get()](const Ref<Scope>& scope, Value& out) -> Error {
+			TRY(a(scope, out));
+			if (out.Type() != TypeTag::Bool) return Error(isAnd ? "Logical operand is not boolean." : "Logic operand is not boolean.", aPos);
+
+			if (out.boolean != isAnd) return Error::None;
+
+			Value bValue;
+			TRY(b(scope, bValue));
+			if (bValue.Type() != TypeTag::Bool) return Error("Logic operand is not boolean.", bPos);
+
+			out.boolean = bValue.boolean;
+			if (comment) out.SetComment(MakeRef<Comment>(*comment, scope));
+			else if (combine) CombineOperandComments(bValue, out);
+			return Error::None;
+		};
+	}
+	case TokenTag::KeyXor:
+		return AttachComment(binaryOp, [a = std::move(a), b = CompileExpression(*binaryOp.b), aPos = binaryOp.a->pos, bPos = binaryOp.b->pos, combine = !binaryOp.commentUnused](const Ref<Scope>& scope, Value& out) -> Error {
+			TRY(a(scope, out));
+			if (out.Type() != TypeTag::Bool) return Error("Logic operand is not boolean.", aPos);
+
+			Value bValue;
+			TRY(b(scope, bValue));
+			if (bValue.Type() != TypeTag::Bool) return Error("Logic operand is not boolean.", bPos);
+
+			out.boolean = out.boolean != bValue.boolean;
+			if (combine) CombineOperandComments(bValue, out);
+			return Error::None;
+		});
+	case TokenTag::At:
+		return AttachComment(binaryOp, [a = std::move(a), b = CompileExpression(*binaryOp.b), aPos = binaryOp.a->pos, bPos = binaryOp.b->pos, combine = !binaryOp.commentUnused](const Ref<Scope>& scope, Value& out) -> Error {
+			TRY(a(scope, out));
+			if (out.Type() != TypeTag::Array) return Error("Array read array operand is not an array.", aPos);
+
+			Value bValue;
+			TRY(b(scope, bValue));
+			if (bValue.Type() != TypeTag::Number) return Error("Array read index operand is not a number.", bPos);
+
+			const std::vector<double>& array = out.GetArray();
+			const size_t index = static_cast<size_t>(bValue.number);
+			if (index >= array.size())
+			{
+				return Error{Format("Array index %zu out of bounds (array length is %zu).", index, array.size()), bPos};
+			}
+
+			out = Value(array[index], out.GetComment());
+			if (combine) CombineOperandComments(bValue, out);
+			return Error::None;
+		});
+	case TokenTag::KeyMap:
+		return AttachComment(binaryOp, [a = std::move(a), b = CompileExpression(*binaryOp.b), aPos = binaryOp.a->pos, bPos = binaryOp.b->pos, pos = binaryOp.pos, combine = !binaryOp.commentUnused](const Ref<Scope>& scope, Value& out) -> Error {
+			TRY(a(scope, out));
+			if (out.Type() != TypeTag::Function) return Error("Map function operand is not a function.", aPos);
+
+			Value bValue;
+			TRY(b(scope, bValue));
+			if (bValue.Type() != TypeTag::Array) return Error("Map array operand is not an array.", bPos);
+
+			const Ref<Function> function = out.GetFunctionRef();
+			auto mapped = MakeRef<Array>();
+			TRY(MapArray(*function, bValue.GetArray(), pos, [&](const double element, Value& result) {
+				auto innerScope = MakeRef<Scope>();
+				innerScope->SetValue(function->args->front(), Value(element));
+				innerScope->parent_scope = function->closure;
+				return RunCallee(function, std::move(innerScope), result);
+			}, mapped->elements));
+
+			out = Value(std::move(mapped), out.GetComment());
+			if (combine) CombineOperandComments(bValue, out);
+			return Error::None;
+		});
+	default:
+		return [pos = binaryOp.pos](const Ref<Scope>&, Value&) -> Error {
+			return Error{"Internal error: Unrecognized binary operation.", pos};
+		};
+	}
+}
+
+// A constant second operand is bound as a number, it has no comment to combine.
+template <typename Apply>
+static CompiledExpression CompileArithmetic(const BinaryOperation& binaryOp, CompiledExpression a, const Apply apply)
+{
+	const CodePos aPos = binaryOp.a->pos;
+	double bNumber;
+	if (GetConstantNumber(*binaryOp.b, bNumber))
+	{
+		return AttachComment(binaryOp, [a = std::move(a), apply, aPos, bNumber](const Ref<Scope>& scope, Value& out) -> Error {
+			TRY(a(scope, out));
+			if (out.Type() != TypeTag::Number) return Error("Arithmetic operand is not a number.", aPos);
+			out.number = apply(out.number, bNumber);
+			return Error::None;
+		});
+	}
+
+	return AttachComment(binaryOp, [a = std::move(a), b = CompileExpression(*binaryOp.b), apply, aPos, bPos = binaryOp.b->pos, combine = !binaryOp.commentUnused](const Ref<Scope>& scope, Value& out) -> Error {
+		TRY(a(scope, out));
+		if (out.Type() != TypeTag::Number) return Error("Arithmetic operand is not a number.", aPos);
+
+		Value bValue;
+		TRY(b(scope, bValue));
+		if (bValue.Type() != TypeTag::Number) return Error("Arithmetic operand is not a number.", bPos);
+
+		out.number = apply(out.number, bValue.number);
+		if (combine) CombineOperandComments(bValue, out);
+		return Error::None;
+	});
+}
+
+template <typename Apply>
+static CompiledExpression CompileComparison(const BinaryOperation& binaryOp, CompiledExpression a, const Apply apply)
+{
+	const CodePos aPos = binaryOp.a->pos;
+	double bNumber;
+	if (GetConstantNumber(*binaryOp.b, bNumber))
+	{
+		return AttachComment(binaryOp, [a = std::move(a), apply, aPos, bNumber](const Ref<Scope>& scope, Value& out) -> Error {
+			TRY(a(scope, out));
+			if (out.Type() != TypeTag::Number) return Error("Comparison operand is not a number.", aPos);
+			out = Value(apply(out.number, bNumber), out.GetComment());
+			return Error::None;
+		});
+	}
+
+	return AttachComment(binaryOp, [a = std::move(a), b = CompileExpression(*binaryOp.b), apply, aPos, bPos = binaryOp.b->pos, combine = !binaryOp.commentUnused](const Ref<Scope>& scope, Value& out) -> Error {
+		TRY(a(scope, out));
+		if (out.Type() != TypeTag::Number) return Error("Comparison operand is not a number.", aPos);
+
+		Value bValue;
+		TRY(b(scope, bValue));
+		if (bValue.Type() != TypeTag::Number) return Error("Arithmetic operand is not a number.", bPos);
+
+		out = Value(apply(out.number, bValue.number), out.GetComment());
+		if (combine) CombineOperandComments(bValue, out);
+		return Error::None;
+	});
+}
+
+static CompiledCall CompileCall(Call& call)
+{
+	std::vector<CompiledExpression> args;
+	for (auto& value : call.values) args.push_back(CompileExpression(*value));
+	return CompiledCall{CompileExpression(*call.function), std::move(args), call.function->pos, call.pos};
+}
+
+[[nodiscard]] static Error PrepareCall(const CompiledCall& call, const Ref<Scope>& scope, Ref<Function>& callee, Ref<Scope>& innerScope)
+{
+	Value functionValue;
+	TRY(call.function(scope, functionValue));
+	if (functionValue.Type() != TypeTag::Function) return Error("Call on a a non-function value.", call.functionPos);
+
+	// NOTE `callee` keeps the function, and with it the compiled body, alive during the call.
+	callee = functionValue.GetFunctionRef();
+	const size_t n = call.args.size();
+	if (callee->args->size() != n)
+	{
+		return Error(Format("Provided %zu argument(s) for function that takes %zu.", n, callee->args->size()), call.pos);
+	}
+
+	innerScope = MakeRef<Scope>();
+	for (size_t i = 0; i < n; ++i)
+	{
+		Value argValue;
+		TRY(call.args[i](scope, argValue));
+		innerScope->SetValue((*callee->args)[i], std::move(argValue));
+	}
+	innerScope->parent_scope = callee->closure;
+	return Error::None;
+}
+
+// NOTE Comments attached to calls aren't attached to their results.
+[[nodiscard]] static Error RunCall(const CompiledCall& call, const Ref<Scope>& scope, Value& out)
+{
+	if (StackExhausted()) return Error{"Stack overflow.", call.pos};
+
+	Ref<Function> callee;
+	Ref<Scope> innerScope;
+	TRY(PrepareCall(call, scope, callee, innerScope));
+	return RunCallee(std::move(callee), std::move(innerScope), out);
+}
+
+// Runs `callee` with its arguments bound in `innerScope`, then the calls its return statements leave.
+[[nodiscard]] static Error RunCallee(Ref<Function> callee, Ref<Scope> innerScope, Value& out)
+{
+	while (true)
+	{
+		CollectCyclesIfDue();
+		FunctionCode& code = *callee->code;
+		if (!code.compiled) code.compiled = std::make_shared<CompiledBody>(CompiledBody{CompileBlock(*code.statements)});
+
+		std::optional<Value> returned;
+		++tailCallState.depth;
+		const Error error = code.compiled->run(innerScope, returned);
+		--tailCallState.depth;
+		TRY(error);
+		innerScope->frozen = true;
+		if (!tailCallState.callee)
+		{
+			out = returned ? std::move(*returned) : Value();
+			return Error::None;
+		}
+		callee = std::move(tailCallState.callee);
+		innerScope = std::move(tailCallState.innerScope);
+	}
+}
+
+// --- NUMBERS -----------------------------------------------------------------
+
+// Compiles `expression` to produce a number without creating a value, failing with `errorMessage` at its position if
+// its value isn't a number.
+static CompiledNumber CompileNumber(Expression& expression, const char* const errorMessage)
+{
+	double constant;
+	if (GetConstantNumber(expression, constant))
+	{
+		return [constant](const Ref<Scope>&, double& out) -> Error {
+			out = constant;
+			return Error::None;
+		};
+	}
+
+	const CodePos pos = expression.pos;
+	switch (expression.tag)
+	{
+	case ExpressionTag::Identifier:
+		return [name = static_cast<const Identifier&>(expression).name, errorMessage, pos](const Ref<Scope>& scope, double& out) -> Error {
+			Value* value;
+			if (!scope->TryGetValue(name, value) || value->Type() != TypeTag::Number) return Error{errorMessage, pos};
+			out = value->number;
+			return Error::None;
+		};
+	case ExpressionTag::Unary:
+	{
+		auto& unaryOp = static_cast<UnaryOperation&>(expression);
+		if (unaryOp.op != TokenTag::KeyNeg) break;
+		return [a = CompileNumber(*unaryOp.a, "Negation of non-number value.")](const Ref<Scope>& scope, double& out) -> Error {
+			TRY(a(scope, out));
+			out = -out;
+			return Error::None;
+		};
+	}
+	case ExpressionTag::Binary:
+	case ExpressionTag::TypedBinary:
+	case ExpressionTag::InBoundsRead:
+	{
+		auto& binaryOp = static_cast<BinaryOperation&>(expression);
+		switch (binaryOp.op)
+		{
+		case TokenTag::Plus: return CompileArithmeticNumber(binaryOp, [](const double x, const double y) { return x + y; });
+		case TokenTag::Minus: return CompileArithmeticNumber(binaryOp, [](const double x, const double y) { return x - y; });
+		case TokenTag::Star: return CompileArithmeticNumber(binaryOp, [](const double x, const double y) { return x * y; });
+		case TokenTag::Slash: return CompileArithmeticNumber(binaryOp, [](const double x, const double y) { return x / y; });
+		case TokenTag::Percent: return CompileArithmeticNumber(binaryOp, [](const double x, const double y) { return Modulo(x, y); });
+		case TokenTag::At:
+		{
+			// NOTE The array is held while the index runs, which could rebind it.
+			CompiledNumber index = CompileNumber(*binaryOp.b, "Array read index operand is not a number.");
+			const CodePos aPos = binaryOp.a->pos;
+			const CodePos bPos = binaryOp.b->pos;
+			if (binaryOp.a->tag == ExpressionTag::Identifier)
+			{
+				return [name = static_cast<const Identifier&>(*binaryOp.a).name, index = std::move(index), aPos, bPos](const Ref<Scope>& scope, double& out) -> Error {
+					Value* value;
+					if (!scope->TryGetValue(name, value) || value->Type() != TypeTag::Array) return Error{"Array read array operand is not an array.", aPos};
+					const Ref<Array> array = value->GetArrayRef();
+
+					double indexValue;
+					TRY(index(scope, indexValue));
+					const size_t i = static_cast<size_t>(indexValue);
+					if (i >= array->elements.size()) return Error{Format("Array index %zu out of bounds (array length is %zu).", i, array->elements.size()), bPos};
+					out = array->elements[i];
+					return Error::None;
+				};
+			}
+
+			return [a = CompileExpression(*binaryOp.a), index = std::move(index), aPos, bPos](const Ref<Scope>& scope, double& out) -> Error {
+				Value value;
+				TRY(a(scope, value));
+				if (value.Type() != TypeTag::Array) return Error{"Array read array operand is not an array.", aPos};
+				const std::vector<double>& array = value.GetArray();
+
+				double indexValue;
+				TRY(index(scope, indexValue));
+				const size_t i = static_cast<size_t>(indexValue);
+				if (i >= array.size()) return Error{Format("Array index %zu out of bounds (array length is %zu).", i, array.size()), bPos};
+				out = array[i];
+				return Error::None;
+			};
+		}
+		default:
+			break;
+		}
+		break;
+	}
+	default:
+		break;
+	}
+
+	return [value = CompileExpression(expression), errorMessage, pos](const Ref<Scope>& scope, double& out) -> Error {
+		Value result;
+		TRY(value(scope, result));
+		if (result.Type() != TypeTag::Number) return Error{errorMessage, pos};
+		out = result.number;
+		return Error::None;
+	};
+}
+
+template <typename Apply>
+static CompiledNumber CompileArithmeticNumber(BinaryOperation& binaryOp, const Apply apply)
+{
+	CompiledNumber a = CompileNumber(*binaryOp.a, "Arithmetic operand is not a number.");
+	CompiledNumber b = CompileNumber(*binaryOp.b, "Arithmetic operand is not a number.");
+	return [a = std::move(a), b = std::move(b), apply](const Ref<Scope>& scope, double& out) -> Error {
+		double aNumber;
+		TRY(a(scope, aNumber));
+		double bNumber;
+		TRY(b(scope, bNumber));
+		out = apply(aNumber, bNumber);
+		return Error::None;
+	};
+}
+
+// Returns true if `expression` always evaluates to a number unless it fails, so the number path needs no error message
+// of its own.
+static bool IsNumeric(const Expression& expression)
+{
+	switch (expression.tag)
+	{
+	case ExpressionTag::NumberLiteral:
+		return true;
+	case ExpressionTag::Unary:
+		return static_cast<const UnaryOperation&>(expression).op == TokenTag::KeyNeg;
+	case ExpressionTag::Binary:
+	case ExpressionTag::TypedBinary:
+	case ExpressionTag::InBoundsRead:
+		switch (static_cast<const BinaryOperation&>(expression).op)
+		{
+		case TokenTag::Plus:
+		case TokenTag::Minus:
+		case TokenTag::Star:
+		case TokenTag::Slash:
+		case TokenTag::Percent:
+		case TokenTag::At:
+			return true;
+		default:
+			return false;
+		}
+	default:
+		return false;
+	}
+}
+
+// --- HELPERS -----------------------------------------------------------------
+
+// Wraps `compiled` to attach the comment of `expression` to its value, unless the comment can't be printed.
+static CompiledExpression AttachComment(const Expression& expression, CompiledExpression compiled)
+{
+	if (!expression.attachedComment || expression.commentUnused) return compiled;
+
+	return [compiled = std::move(compiled), comment = expression.attachedComment.get()](const Ref<Scope>& scope, Value& out) -> Error {
+		TRY(compiled(scope, out));
+		out.SetComment(MakeRef<Comment>(*comment, scope));
+		return Error::None;
+	};
+}
+
+// Returns true if `expression` always evaluates to a number without comment, which is set to `out`.
+static bool GetConstantNumber(const Expression& expression, double& out)
+{
+	if (expression.attachedComment) return false;
+	if (expression.tag == ExpressionTag::NumberLiteral)
+	{
+		out = static_cast<const NumberLiteral&>(expression).value;
+		return true;
+	}
+	if (expression.tag == ExpressionTag::Constant)
+	{
+		const Value& value = static_cast<const Constant&>(expression).value;
+		if (value.Type() != TypeTag::Number || value.GetComment()) return false;
+		out = value.number;
+		return true;
+	}
+	return false;
+}
+
+[[nodiscard]] static Error GetArray(const Ref<Scope>& scope, const std::string& name, const CodePos pos, Ref<Array>& out)
+{
+	Value* value;
+	if (!scope->TryGetValue(name, value)) return Error{Format("No array named %s.", name.c_str()), pos};
+	if (value->Type() != TypeTag::Array) return Error{Format("%s is not an array.", name.c_str()), pos};
+	out = value->GetArrayRef();
+	return Error::None;
+}
+
+// Same as the tree walker's rule without the expression's own comment, which AttachComment attaches.
+static void CombineOperandComments(const Value& b, Value& out)
+{
+	if (out.GetComment() && b.GetComment()) out.SetComment(nullptr);
+	else if (b.GetComment()) out.SetComment(b.GetComment());
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "Error.h"
+#include "Parser.h"
+#include "Runtime.h"
+
+#include <functional>
+#include <memory>
+#include <optional>
+#include <vector>
+
+// Code compiled to closures runs in the scope it gets. A statement sets `returned` to the value of a return statement it
+// ran, which makes enclosing statements stop, an expression sets `out` to its value.
+using CompiledStatement = std::function<Error(const Ref<Scope>& scope, std::optional<Value>& returned)>;
+using CompiledExpression = std::function<Error(const Ref<Scope>& scope, Value& out)>;
+
+struct CompiledBody {
+	CompiledStatement run;
+};
+
+// Compiles `statements` to a tree of closures with operators and operands bound up front and runs them in `scope`. Sets
+// `returned` if the code returned at top level.
+[[nodiscard]] Error RunClosures(std::vector<std::unique_ptr<Statement>>& statements, const Ref<Scope>& scope, bool& returned);
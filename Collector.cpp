@@ -0,0 +1,300 @@
+#include "Collector.h"
+
+#include "Parser.h"
+
+#include <memory>
+#include <vector>
+
+using Statements = std::vector<std::unique_ptr<Statement>>;
+
+static void VisitValue(const Value& value, std::vector<Collected*>& out);
+static void VisitConstants(const Statements& statements, std::vector<Collected*>& out);
+static void VisitConstants(const Expression& expression, std::vector<Collected*>& out);
+static void VisitChildren(Collected& object, std::vector<Collected*>& out);
+static void ClearChildren(Collected& object);
+static size_t Delete(Collected* object);
+
+// NOTE This is trial deletion: counting the references objects in the list hold to each other and subtracting them
+// from their counts leaves the references from outside it. Objects with some are alive, as is what they refer to, the
+// others can only be reached through cycles.
+void CollectCycles(CollectorStats& stats)
+{
+	++stats.collections;
+	Collected::created = 0;
+
+	std::vector<Collected*> children;
+	for (Collected* object = Collected::first; object; object = object->next)
+	{
+		object->collectorRefs = object->refs;
+		object->reachable = false;
+	}
+	for (Collected* object = Collected::first; object; object = object->next)
+	{
+		children.clear();
+		VisitChildren(*object, children);
+		for (Collected* child : children) --child->collectorRefs;
+	}
+
+	std::vector<Collected*> worklist;
+	for (Collected* object = Collected::first; object; object = object->next)
+	{
+		if (object->collectorRefs == 0) continue;
+		object->reachable = true;
+		worklist.push_back(object);
+	}
+	while (!worklist.empty())
+	{
+		Collected* const object = worklist.back();
+		worklist.pop_back();
+		children.clear();
+		VisitChildren(*object, children);
+		for (Collected* child : children)
+		{
+			if (child->reachable) continue;
+			child->reachable = true;
+			worklist.push_back(child);
+		}
+	}
+
+	// NOTE Garbage is kept counted while references between it are cleared, so none is deleted before the end.
+	std::vector<Collected*> garbage;
+	for (Collected* object = Collected::first; object; object = object->next)
+	{
+		if (object->reachable) continue;
+		++object->refs;
+		garbage.push_back(object);
+	}
+	for (Collected* object : garbage) ClearChildren(*object);
+	for (Collected* object : garbage)
+	{
+		if (--object->refs != 0) continue;
+		++stats.objects;
+		stats.bytes += Delete(object);
+	}
+}
+
+static void VisitValue(const Value& value, std::vector<Collected*>& out)
+{
+	if (value.Type() == TypeTag::Function) out.push_back(&value.GetFunction());
+	if (Comment* const comment = value.GetComment()) out.push_back(comment);
+}
+
+// Appends the collected objects `object` counts references to, once per reference.
+static void VisitChildren(Collected& object, std::vector<Collected*>& out)
+{
+	switch (object.tag)
+	{
+	case CollectedTag::Scope:
+	{
+		Scope& scope = static_cast<Scope&>(object);
+		for (const auto& [name, value] : scope.bindings) VisitValue(value, out);
+		for (const Ref<Upvalue>& upvalue : scope.upvalues) out.push_back(upvalue.get());
+		if (scope.parent_scope) out.push_back(scope.parent_scope.get());
+		break;
+	}
+	case CollectedTag::Function:
+	{
+		Function& function = static_cast<Function&>(object);
+		if (function.closure) out.push_back(function.closure.get());
+		if (const FunctionCode* const code = function.closureCode.get())
+		{
+			VisitConstants(*code->statements, out);
+			if (code->fused) VisitConstants(*code->fused, out);
+			for (const TypeSpecialization& specialization : code->specializations)
+			{
+				if (specialization.statements) VisitConstants(*specialization.statements, out);
+			}
+		}
+		if (!function.memo) break;
+		for (const MemoTable::FreeVariable& variable : function.memo->freeVariables)
+		{
+			if (variable.scope) out.push_back(variable.scope.get());
+			VisitValue(variable.value, out);
+		}
+		for (const auto& [key, value] : function.memo->results) VisitValue(value, out);
+		break;
+	}
+	case CollectedTag::Comment:
+	{
+		Comment& comment = static_cast<Comment&>(object);
+		if (comment.scope) out.push_back(comment.scope.get());
+		break;
+	}
+	case CollectedTag::Upvalue:
+		VisitValue(static_cast<Upvalue&>(object).closed, out);
+		break;
+	}
+}
+
+// Appends the collected objects referred to by values closure specialization baked into `statements`, including those
+// in copies of loop bodies made when the loops got hot.
+static void VisitConstants(const Statements& statements, std::vector<Collected*>& out)
+{
+	for (const auto& statement : statements)
+	{
+		switch (statement->tag)
+		{
+		case StatementTag::If:
+		{
+			const auto& ifStatement = static_cast<const IfStatement&>(*statement);
+			for (const auto& elif : ifStatement.elifChain)
+			{
+				VisitConstants(*elif.condition, out);
+				VisitConstants(elif.statements, out);
+			}
+			VisitConstants(ifStatement.elseBlock, out);
+			break;
+		}
+		case StatementTag::While:
+		{
+			const auto& whileStatement = static_cast<const WhileStatement&>(*statement);
+			VisitConstants(*whileStatement.condition, out);
+			VisitConstants(whileStatement.statements, out);
+			VisitConstants(whileStatement.tier.body, out);
+			break;
+		}
+		case StatementTag::For:
+		{
+			const auto& forStatement = static_cast<const ForStatement&>(*statement);
+			VisitConstants(*forStatement.start, out);
+			VisitConstants(*forStatement.end, out);
+			if (forStatement.step) VisitConstants(*forStatement.step, out);
+			VisitConstants(forStatement.statements, out);
+			VisitConstants(forStatement.fallback, out);
+			VisitConstants(forStatement.tier.body, out);
+			break;
+		}
+		case StatementTag::GuardedLoop:
+		{
+			const auto& guardedLoop = static_cast<const GuardedLoopStatement&>(*statement);
+			VisitConstants(*guardedLoop.step, out);
+			if (guardedLoop.limit) VisitConstants(*guardedLoop.limit, out);
+			VisitConstants(guardedLoop.fast, out);
+			VisitConstants(guardedLoop.fallback, out);
+			break;
+		}
+		case StatementTag::Kernel:
+		{
+			const auto& kernel = static_cast<const KernelStatement&>(*statement);
+			if (kernel.value) VisitConstants(*kernel.value, out);
+			VisitConstants(kernel.loop, out);
+			break;
+		}
+		case StatementTag::Switch:
+			VisitConstants(static_cast<const SwitchStatement&>(*statement).chain, out);
+			break;
+		case StatementTag::Fused:
+			VisitConstants(static_cast<const FusedStatement&>(*statement).original, out);
+			break;
+		case StatementTag::Assignment:
+			VisitConstants(*static_cast<const AssignmentStatement&>(*statement).value, out);
+			break;
+		case StatementTag::ArrayWrite:
+		case StatementTag::InBoundsArrayWrite:
+		{
+			const auto& arrayWrite = static_cast<const ArrayWriteStatement&>(*statement);
+			VisitConstants(*arrayWrite.index, out);
+			VisitConstants(*arrayWrite.value, out);
+			break;
+		}
+		case StatementTag::ArrayPush:
+			VisitConstants(*static_cast<const ArrayPushStatement&>(*statement).value, out);
+			break;
+		case StatementTag::ArrayPop:
+			break;
+		case StatementTag::Return:
+		case StatementTag::Expression:
+			VisitConstants(*static_cast<const ExpressionStatement&>(*statement).value, out);
+			break;
+		}
+	}
+}
+
+static void VisitConstants(const Expression& expression, std::vector<Collected*>& out)
+{
+	switch (expression.tag)
+	{
+	case ExpressionTag::False:
+	case ExpressionTag::True:
+	case ExpressionTag::NumberLiteral:
+	case ExpressionTag::FunctionLiteral:
+	case ExpressionTag::Identifier:
+		break;
+	case ExpressionTag::Constant:
+		VisitValue(static_cast<const Constant&>(expression).value, out);
+		break;
+	case ExpressionTag::ArrayLiteral:
+		for (const auto& value : static_cast<const ArrayLiteral&>(expression).values) VisitConstants(*value, out);
+		break;
+	case ExpressionTag::Unary:
+		VisitConstants(*static_cast<const UnaryOperation&>(expression).a, out);
+		break;
+	case ExpressionTag::Binary:
+	case ExpressionTag::TypedBinary:
+	case ExpressionTag::InBoundsRead:
+	{
+		const auto& binaryOp = static_cast<const BinaryOperation&>(expression);
+		VisitConstants(*binaryOp.a, out);
+		VisitConstants(*binaryOp.b, out);
+		break;
+	}
+	case ExpressionTag::Call:
+	{
+		const auto& call = static_cast<const Call&>(expression);
+		VisitConstants(*call.function, out);
+		for (const auto& value : call.values) VisitConstants(*value, out);
+		break;
+	}
+	}
+}
+
+// Drops the references VisitChildren visits.
+static void ClearChildren(Collected& object)
+{
+	switch (object.tag)
+	{
+	case CollectedTag::Scope:
+	{
+		Scope& scope = static_cast<Scope&>(object);
+		scope.bindings.clear();
+		scope.upvalues.clear();
+		scope.parent_scope = nullptr;
+		break;
+	}
+	case CollectedTag::Function:
+	{
+		Function& function = static_cast<Function&>(object);
+		function.closure = nullptr;
+		function.closureCode.reset();
+		function.memo.reset();
+		break;
+	}
+	case CollectedTag::Comment:
+		static_cast<Comment&>(object).scope = nullptr;
+		break;
+	case CollectedTag::Upvalue:
+		static_cast<Upvalue&>(object).closed = Value();
+		break;
+	}
+}
+
+// Deletes `object` as what it is. Returns its size.
+static size_t Delete(Collected* const object)
+{
+	switch (object->tag)
+	{
+	case CollectedTag::Scope:
+		delete static_cast<Scope*>(object);
+		return sizeof(Scope);
+	case CollectedTag::Function:
+		delete static_cast<Function*>(object);
+		return sizeof(Function);
+	case CollectedTag::Comment:
+		delete static_cast<Comment*>(object);
+		return sizeof(Comment);
+	case CollectedTag::Upvalue:
+		delete static_cast<Upvalue*>(object);
+		return sizeof(Upvalue);
+	}
+	return 0;
+}
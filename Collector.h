@@ -0,0 +1,16 @@
+#pragma once
+
+#include "Runtime.h"
+
+#include <cstddef>
+
+struct CollectorStats {
+	size_t collections = 0;
+	size_t objects = 0; // objects freed
+	size_t bytes = 0;   // bytes of the objects freed, not counting what they own
+};
+
+// Frees the scopes, functions, comments and upvalues only reachable from each other through reference cycles. Objects
+// counted from anywhere else, such as values on the stack, in arrays or in compiled code, keep what they refer to alive.
+// Must only run where no object is being constructed or destroyed.
+void CollectCycles(CollectorStats& stats);
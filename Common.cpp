@@ -33,9 +33,12 @@ std::string Format(const char* const fmt, ...)
 
 std::string FormatV(const char* const fmt, va_list args)
 {
-	const int length = vsnprintf(nullptr, 0, fmt, args);
+	va_list argsCopy;
+	va_copy(argsCopy, args);
+	const int length = vsnprintf(nullptr, 0, fmt, argsCopy);
+	va_end(argsCopy);
 
 	std::string ret(length, '\0');
-	vsnprintf(ret.data(), length, fmt, args);
+	vsnprintf(ret.data(), length + 1, fmt, args);
 	return ret;
 }
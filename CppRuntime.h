@@ -0,0 +1,406 @@
+#pragma once
+
+// Runtime of the C++ programs written by `rjl --emit-cpp`. Values, scopes and comments behave like the interpreter's,
+// but variables are looked up by numbers the translator gave their names, and errors end the program.
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+enum class TypeTag {
+	Void,
+	Bool,
+	Number,
+	Array,
+	Function,
+};
+
+struct Scope;
+struct Value;
+
+// Part of a comment, text or the variable `name` if `text` is null.
+struct CommentPart {
+	const char* text;
+	int name;
+};
+
+struct CommentCode {
+	const CommentPart* parts;
+	size_t count;
+};
+
+struct Comment {
+	const CommentCode* code;
+	std::shared_ptr<Scope> scope;
+
+	Comment(const CommentCode* code, std::shared_ptr<Scope> scope) : code{code}, scope{std::move(scope)} {}
+};
+
+// Body of a function literal, run with arguments `args` in a new scope inside `closure`. Returns true if a return
+// statement ran, its value is set to `returned`.
+using FunctionBody = bool (*)(const std::shared_ptr<Scope>& closure, Value* args, Value& returned);
+
+struct FunctionCode {
+	const char* const* argNames;
+	size_t argCount;
+	FunctionBody body;
+};
+
+struct Function {
+	const FunctionCode* code;
+	std::shared_ptr<Scope> closure;
+
+	Function(const FunctionCode* code, std::shared_ptr<Scope> closure) : code{code}, closure{std::move(closure)} {}
+};
+
+struct Value {
+	TypeTag type = TypeTag::Void;
+	bool boolean = false;
+	double number = 0.0;
+	std::shared_ptr<std::vector<double>> array;
+	std::shared_ptr<Function> function;
+	std::shared_ptr<Comment> attachedComment;
+};
+
+inline Value MakeNumber(const double number)
+{
+	Value value;
+	value.type = TypeTag::Number;
+	value.number = number;
+	return value;
+}
+
+struct Binding {
+	Value value;
+	bool bound = false;
+};
+
+// Scope of a call or of the whole program. It has a slot for every variable its code can bind, which that code
+// accesses by index. Other code finds variables by number.
+struct Scope {
+	std::vector<Binding> slots;
+	const int* names; // variable of each slot, null in the global scope where slot i is variable i
+	std::shared_ptr<Scope> parent_scope;
+
+	Scope(const size_t count, const int* const names, std::shared_ptr<Scope> parent_scope) : slots(count), names{names}, parent_scope{std::move(parent_scope)} {}
+
+	Value* Find(const int name)
+	{
+		for (Scope* scope = this; scope; scope = scope->parent_scope.get())
+		{
+			const size_t n = scope->slots.size();
+			if (!scope->names)
+			{
+				if (static_cast<size_t>(name) < n && scope->slots[name].bound) return &scope->slots[name].value;
+				continue;
+			}
+			for (size_t i = 0; i < n; ++i)
+			{
+				if (scope->names[i] == name)
+				{
+					if (scope->slots[i].bound) return &scope->slots[i].value;
+					break;
+				}
+			}
+		}
+		return nullptr;
+	}
+
+	// Finds variable `name`, which the scope keeps in `slot`.
+	Value* Local(const size_t slot, const int name)
+	{
+		Binding& binding = slots[slot];
+		if (binding.bound) return &binding.value;
+		return parent_scope ? parent_scope->Find(name) : nullptr;
+	}
+
+	// Finds variable `name`, which the scope has no slot for.
+	Value* Outer(const int name)
+	{
+		return parent_scope ? parent_scope->Find(name) : nullptr;
+	}
+
+	void Void(const size_t slot)
+	{
+		slots[slot] = Binding{};
+	}
+
+	void SetValue(const size_t slot, Value value)
+	{
+		slots[slot].value = std::move(value);
+		slots[slot].bound = true;
+	}
+
+	// Same as SetValue with a number without comment, but reuses the bound value if possible.
+	void SetNumber(const size_t slot, const double value)
+	{
+		Binding& binding = slots[slot];
+		if (binding.bound && binding.value.type == TypeTag::Number && !binding.value.attachedComment) binding.value.number = value;
+		else
+		{
+			binding.value = MakeNumber(value);
+			binding.bound = true;
+		}
+	}
+};
+
+inline const char* filePrefix = ""; // script path errors are reported in
+
+// --- VALUES ------------------------------------------------------------------
+
+inline Value MakeBool(const bool boolean)
+{
+	Value value;
+	value.type = TypeTag::Bool;
+	value.boolean = boolean;
+	return value;
+}
+
+inline Value MakeVoid(std::shared_ptr<Comment> attachedComment)
+{
+	Value value;
+	value.attachedComment = std::move(attachedComment);
+	return value;
+}
+
+inline Value MakeArray(std::vector<double> array)
+{
+	Value value;
+	value.type = TypeTag::Array;
+	value.array = std::make_shared<std::vector<double>>(std::move(array));
+	return value;
+}
+
+inline Value MakeFunction(const FunctionCode& code, const std::shared_ptr<Scope>& closure)
+{
+	Value value;
+	value.type = TypeTag::Function;
+	value.function = std::make_shared<Function>(&code, closure);
+	return value;
+}
+
+// Functions reading variables take the variable's binding, null if it isn't bound.
+inline Value Read(const Value* const value)
+{
+	return value ? *value : Value{};
+}
+
+inline bool IsPlainNumber(const Value* const value)
+{
+	return value && value->type == TypeTag::Number && !value->attachedComment;
+}
+
+inline bool IsPlainArray(const Value* const value)
+{
+	return value && value->type == TypeTag::Array && !value->attachedComment;
+}
+
+// Same integer fast path as the interpreter's Modulo, with the same results.
+inline double Modulo(const double a, const double b)
+{
+	constexpr double limit = 4503599627370496.0;
+	if (a >= -2 * limit && a <= 2 * limit && b >= -limit && b <= limit)
+	{
+		const int64_t x = static_cast<int64_t>(a);
+		const int64_t y = static_cast<int64_t>(b);
+		if (y != 0 && static_cast<double>(x) == a && static_cast<double>(y) == b)
+		{
+			const int64_t result = (x % y + y) % y;
+			return result == 0 && y < 0 ? -0.0 : static_cast<double>(result);
+		}
+	}
+	return std::fmod(std::fmod(a, b) + b, b);
+}
+
+// Converts an array index like the interpreter's cast to size_t on x86-64 does, which g++ -O2 may not: negative indices
+// wrap around, NaN and indices below -2^63 end up as 2^63 and indices from 2^64 up as 0.
+inline size_t ToIndex(const double index)
+{
+	if (index >= 18446744073709551616.0) return 0;
+	if (index >= 9223372036854775808.0) return static_cast<size_t>(index);
+	if (index >= -9223372036854775808.0) return static_cast<size_t>(static_cast<int64_t>(index));
+	return 9223372036854775808u;
+}
+
+// Same as the tree walker's rule without the expression's own comment, which is attached separately.
+inline void CombineOperandComments(const Value& b, Value& out)
+{
+	if (out.attachedComment && b.attachedComment) out.attachedComment = nullptr;
+	else if (b.attachedComment) out.attachedComment = b.attachedComment;
+}
+
+// --- ERRORS ------------------------------------------------------------------
+
+// Reports a runtime error like the interpreter does and stops the program.
+[[noreturn]] inline void Fail(const char* const message, const size_t line, const size_t col)
+{
+	std::cerr << filePrefix << ':' << line << ':' << col << ": " << message << '\n';
+	std::exit(0);
+}
+
+[[noreturn]] inline void FailBounds(const size_t index, const size_t length, const size_t line, const size_t col)
+{
+	char message[128];
+	std::snprintf(message, sizeof(message), "Array index %zu out of bounds (array length is %zu).", index, length);
+	Fail(message, line, col);
+}
+
+[[noreturn]] inline void FailArgumentCount(const size_t provided, const size_t expected, const size_t line, const size_t col)
+{
+	char message[128];
+	std::snprintf(message, sizeof(message), "Provided %zu argument(s) for function that takes %zu.", provided, expected);
+	Fail(message, line, col);
+}
+
+inline double ReadNumber(const Value* const value, const char* const errorMessage, const size_t line, const size_t col)
+{
+	if (!value || value->type != TypeTag::Number) Fail(errorMessage, line, col);
+	return value->number;
+}
+
+// Array read by the `@` operator.
+inline const std::shared_ptr<std::vector<double>>& ReadArray(const Value* const value, const size_t line, const size_t col)
+{
+	if (!value || value->type != TypeTag::Array) Fail("Array read array operand is not an array.", line, col);
+	return value->array;
+}
+
+// Array modified by a statement.
+inline const std::shared_ptr<std::vector<double>>& GetArray(const Value* const value, const char* const nameText, const size_t line, const size_t col)
+{
+	if (!value || value->type != TypeTag::Array)
+	{
+		std::string message = value ? std::string{nameText} + " is not an array." : std::string{"No array named "} + nameText + ".";
+		Fail(message.c_str(), line, col);
+	}
+	return value->array;
+}
+
+inline bool IsTrue(const Value& value, const char* const errorMessage, const size_t line, const size_t col)
+{
+	if (value.type == TypeTag::Bool) return value.boolean;
+	if (value.type != TypeTag::Number) Fail(errorMessage, line, col);
+	return value.number != 0.0;
+}
+
+// Call a function body returned instead of running it, run by Call once the body returned so that tail calls don't
+// nest. Like the interpreter, only calls returned by a return statement without a comment are run this way.
+struct TailCall {
+	const FunctionCode* code = nullptr;
+	std::shared_ptr<Scope> closure;
+	std::vector<Value> args;
+};
+
+inline TailCall tailCall;
+
+// Sets the tail call to `function` with the `argCount` values in `args`, returns true for the body returning it.
+inline bool ReturnCall(const Function& function, Value* const args, const size_t argCount)
+{
+	tailCall.code = function.code;
+	tailCall.closure = function.closure;
+	tailCall.args.assign(std::make_move_iterator(args), std::make_move_iterator(args + argCount));
+	return true;
+}
+
+// Calls `function` with `args`, then the tail calls it returned, the last one's result is set to `returned`.
+inline void Call(const Function& function, Value* const args, Value& returned)
+{
+	function.code->body(function.closure, args, returned);
+	while (tailCall.code)
+	{
+		const FunctionCode* const code = std::exchange(tailCall.code, nullptr);
+		const std::shared_ptr<Scope> closure = std::move(tailCall.closure);
+		std::vector<Value> tailArgs = std::move(tailCall.args);
+		returned = Value{};
+		code->body(closure, tailArgs.data(), returned);
+	}
+}
+
+// Results of the `map` operator, calling `function` with each element of a copy of `array`.
+inline std::shared_ptr<std::vector<double>> Map(const Function& function, const std::vector<double> array, const size_t line, const size_t col)
+{
+	if (function.code->argCount != 1) FailArgumentCount(1, function.code->argCount, line, col);
+
+	auto mapped = std::make_shared<std::vector<double>>();
+	mapped->reserve(array.size());
+	for (const double element : array)
+	{
+		Value arg = MakeNumber(element);
+		Value returned;
+		Call(function, &arg, returned);
+		if (returned.type != TypeTag::Number) Fail("Mapped function returned a non-number value.", line, col);
+		mapped->push_back(returned.number);
+	}
+	return mapped;
+}
+
+// --- PRINTING ----------------------------------------------------------------
+
+// Prints `value` as an expression statement does, or as its value is printed inside a comment.
+inline void PrintValue(const Value& value, const bool inComment)
+{
+	if (!inComment && value.attachedComment)
+	{
+		std::cout << "/*";
+		const CommentCode& code = *value.attachedComment->code;
+		for (size_t i = 0; i < code.count; ++i)
+		{
+			const CommentPart& part = code.parts[i];
+			if (part.text)
+			{
+				std::cout << part.text;
+				continue;
+			}
+
+			const Value* referencedValue = value.attachedComment->scope->Find(part.name);
+			if (!referencedValue) std::cout << "void";
+			else PrintValue(*referencedValue, true);
+		}
+		std::cout << "*/\n";
+	}
+
+	switch (value.type)
+	{
+	case TypeTag::Void:
+		return;
+	case TypeTag::Bool:
+		std::cout << (value.boolean ? "true" : "false");
+		break;
+	case TypeTag::Number:
+		std::cout << value.number;
+		break;
+	case TypeTag::Array:
+	{
+		const std::vector<double>& array = *value.array;
+		std::cout << '[';
+		const size_t n = array.size();
+		for (size_t i = 0; i < n; ++i)
+		{
+			std::cout << array[i];
+			if (i < n - 1) std::cout << ' ';
+		}
+		std::cout << "]";
+		break;
+	}
+	case TypeTag::Function:
+	{
+		const FunctionCode& code = *value.function->code;
+		std::cout << "fn (";
+		for (size_t i = 0; i < code.argCount; ++i)
+		{
+			std::cout << code.argNames[i];
+			if (i < code.argCount - 1) std::cout << ' ';
+		}
+		std::cout << ")";
+		break;
+	}
+	}
+	if (!inComment) std::cout << '\n';
+}
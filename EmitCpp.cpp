@@ -0,0 +1,1560 @@
+#include "EmitCpp.h"
+
+#include "Common.h"
+#include "Optimizer.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+using Statements = std::vector<std::unique_ptr<Statement>>;
+
+// Loop running on C++ doubles and arrays, which holds if it only computes numbers and doesn't call or print. Nothing
+// else can see its variables until it ends, so they are read when it starts and written back when it ends.
+struct NumericLoop {
+	std::unordered_map<std::string, bool> numbers; // number variables, true if one may be read before being assigned
+	std::unordered_set<std::string> arrays;         // array variables, which aren't assigned
+	std::unordered_set<std::string> written;        // number variables assigned
+	std::unordered_map<std::string, std::string> locals; // C++ variable of each variable
+	std::unordered_map<std::string, std::string> flags;  // C++ variable set once a written variable is assigned
+};
+
+// Program being written. Variables are numbered, and comments and function literals become tables of their own.
+struct CppEmitter {
+	std::unordered_map<std::string, int> names;
+	std::unordered_map<const CommentToken*, std::string> comments;
+	std::unordered_map<const FunctionLiteral*, std::string> functions;
+	std::string prototypes;
+	std::string tables;
+	std::string definitions;
+
+	// Body of the function being written. Every subexpression gets a temporary of its own, assigned in the order the
+	// interpreter evaluates them.
+	std::string code;
+	size_t indent = 1;
+	size_t temps = 0;
+	bool global = false;                             // the body runs in the global scope, which has a slot per variable
+	std::unordered_map<std::string, size_t> locals; // slot of each variable a function body can bind
+	const NumericLoop* loop = nullptr;               // numeric loop being written
+};
+
+static void EmitBody(CppEmitter& emitter, const Statements& statements, const std::string& name, const std::vector<std::string>* args);
+static void CollectLocals(CppEmitter& emitter, const Statements& statements, std::vector<std::string>& slotNames);
+static void AddLocal(CppEmitter& emitter, const std::string& name, std::vector<std::string>& slotNames);
+static void EmitBlock(CppEmitter& emitter, const Statements& statements);
+static void EmitStatement(CppEmitter& emitter, const Statement& statement);
+static void EmitIf(CppEmitter& emitter, const IfStatement& ifStatement, size_t arm);
+static void EmitFor(CppEmitter& emitter, const ForStatement& forStatement);
+static void EmitWhile(CppEmitter& emitter, const WhileStatement& whileStatement);
+static bool AnalyzeBlock(NumericLoop& loop, const Statements& statements, std::unordered_set<std::string>& assigned);
+static bool AnalyzeStatement(NumericLoop& loop, const Statement& statement, std::unordered_set<std::string>& assigned);
+static bool AnalyzeCondition(NumericLoop& loop, const Expression& condition, const std::unordered_set<std::string>& assigned, bool top);
+static bool AnalyzeNumber(NumericLoop& loop, const Expression& expression, const std::unordered_set<std::string>& assigned, bool valueUsed);
+static void EmitNumericBlock(CppEmitter& emitter, const Statements& statements);
+static void EmitNumericStatement(CppEmitter& emitter, const Statement& statement);
+static void EmitNumericWhile(CppEmitter& emitter, const WhileStatement& whileStatement);
+static void EmitWriteBack(CppEmitter& emitter);
+static std::string EmitNumericCondition(CppEmitter& emitter, const Expression& condition);
+static std::string EmitNumericNumber(CppEmitter& emitter, const Expression& expression);
+static std::string EmitCondition(CppEmitter& emitter, const Expression& condition, const char* errorMessage);
+static std::string EmitExpression(CppEmitter& emitter, const Expression& expression);
+static std::string EmitBinary(CppEmitter& emitter, const BinaryOperation& binaryOp);
+static std::string EmitCallArguments(CppEmitter& emitter, const Call& call, std::string& args);
+static std::string EmitCall(CppEmitter& emitter, const Call& call);
+static void EmitTailCall(CppEmitter& emitter, const Call& call);
+static std::string EmitNumber(CppEmitter& emitter, const Expression& expression, const char* errorMessage);
+static bool IsPlainArithmetic(const Expression& expression);
+static void CollectOperands(CppEmitter& emitter, const Expression& expression, std::unordered_map<std::string, std::string>& operands, std::string& test);
+static std::string PlainNumber(const Expression& expression, const std::unordered_map<std::string, std::string>& operands);
+static std::string EmitFunction(CppEmitter& emitter, const FunctionLiteral& functionLiteral);
+static std::string EmitComment(CppEmitter& emitter, const CommentToken& comment);
+static void AttachComment(CppEmitter& emitter, const Expression& expression, const std::string& value);
+static void Line(CppEmitter& emitter, const std::string& text);
+static void Open(CppEmitter& emitter);
+static void Close(CppEmitter& emitter);
+static std::string NewTemp(CppEmitter& emitter);
+static std::string Name(CppEmitter& emitter, const std::string& name);
+static std::string Find(CppEmitter& emitter, const std::string& name);
+static std::string Slot(CppEmitter& emitter, const std::string& name);
+static std::string Pos(CodePos pos);
+static std::string Quote(const std::string& text);
+static std::string NumberText(double value);
+static const char* OperatorText(TokenTag op);
+static bool IsComparison(TokenTag op);
+static bool IsNumeric(const Expression& expression);
+static bool GetConstantNumber(const Expression& expression, double& out);
+static bool HasCall(const Expression& expression);
+
+void EmitCpp(const std::string_view filePrefix, Statements& statements, std::ostream& out)
+{
+	// NOTE Kernels are left out, g++ gets the loops as written.
+	Optimize(statements, false);
+
+	CppEmitter emitter;
+	EmitBody(emitter, statements, "program", nullptr);
+
+	out << "// Generated by rjl --emit-cpp from " << filePrefix << ", build with g++ -std=c++17 -O2 -I <rjl directory>\n\n"
+		<< "#include \"CppRuntime.h\"\n\n"
+		<< emitter.prototypes << '\n'
+		<< emitter.tables << '\n'
+		<< emitter.definitions
+		<< "int main()\n"
+		<< "{\n"
+		<< "\tfilePrefix = " << Quote(std::string{filePrefix}) << ";\n"
+		<< "\tconst std::shared_ptr<Scope> scope = std::make_shared<Scope>(" << emitter.names.size() << ", nullptr, nullptr);\n"
+		<< "\tValue returned;\n"
+		<< "\tif (program(scope, returned)) std::cerr << \"Returned from top-level code.\";\n"
+		<< "\treturn 0;\n"
+		<< "}\n";
+}
+
+// --- STATEMENTS --------------------------------------------------------------
+
+// Writes the program body if `args` is null, otherwise the body of a function with arguments `args`.
+static void EmitBody(CppEmitter& emitter, const Statements& statements, const std::string& name, const std::vector<std::string>* const args)
+{
+	std::string code;
+	size_t indent = 1;
+	size_t temps = 0;
+	bool global = !args;
+	std::unordered_map<std::string, size_t> locals;
+	std::swap(emitter.code, code);
+	std::swap(emitter.indent, indent);
+	std::swap(emitter.temps, temps);
+	std::swap(emitter.global, global);
+	std::swap(emitter.locals, locals);
+
+	std::string signature;
+	if (args)
+	{
+		std::vector<std::string> slotNames;
+		for (const std::string& arg : *args) AddLocal(emitter, arg, slotNames);
+		CollectLocals(emitter, statements, slotNames);
+
+		std::string names;
+		for (const std::string& slotName : slotNames) names += (names.empty() ? "" : ", ") + Name(emitter, slotName);
+		if (!slotNames.empty()) emitter.tables += "static const int " + name + "Locals[] = {" + names + "};\n";
+
+		Line(emitter, "const std::shared_ptr<Scope> scope = std::make_shared<Scope>(" + std::to_string(slotNames.size()) + ", " + (slotNames.empty() ? "nullptr" : name + "Locals") + ", closure);");
+		for (size_t i = 0; i < args->size(); ++i) Line(emitter, "scope->SetValue(" + Slot(emitter, (*args)[i]) + ", std::move(args[" + std::to_string(i) + "]));");
+		signature = "static bool " + name + "(const std::shared_ptr<Scope>& closure, [[maybe_unused]] Value* args, [[maybe_unused]] Value& returned)";
+	}
+	else signature = "static bool " + name + "([[maybe_unused]] const std::shared_ptr<Scope>& scope, [[maybe_unused]] Value& returned)";
+
+	EmitBlock(emitter, statements);
+	Line(emitter, "return false;");
+
+	std::swap(emitter.code, code);
+	std::swap(emitter.indent, indent);
+	std::swap(emitter.temps, temps);
+	std::swap(emitter.global, global);
+	std::swap(emitter.locals, locals);
+
+	emitter.prototypes += signature + ";\n";
+	emitter.definitions += signature + "\n{\n" + code + "}\n\n";
+}
+
+// Gives every variable assigned by `statements` a slot in the scope of the function body being written.
+static void CollectLocals(CppEmitter& emitter, const Statements& statements, std::vector<std::string>& slotNames)
+{
+	for (const auto& statement : statements)
+	{
+		switch (statement->tag)
+		{
+		case StatementTag::If:
+		{
+			const auto& ifStatement = static_cast<const IfStatement&>(*statement);
+			for (const auto& elif : ifStatement.elifChain) CollectLocals(emitter, elif.statements, slotNames);
+			CollectLocals(emitter, ifStatement.elseBlock, slotNames);
+			break;
+		}
+		case StatementTag::While:
+			CollectLocals(emitter, static_cast<const WhileStatement&>(*statement).statements, slotNames);
+			break;
+		case StatementTag::For:
+		{
+			const auto& forStatement = static_cast<const ForStatement&>(*statement);
+			AddLocal(emitter, forStatement.counter, slotNames);
+			CollectLocals(emitter, forStatement.statements, slotNames);
+			CollectLocals(emitter, forStatement.fallback, slotNames);
+			break;
+		}
+		case StatementTag::GuardedLoop:
+			CollectLocals(emitter, static_cast<const GuardedLoopStatement&>(*statement).fallback, slotNames);
+			break;
+		case StatementTag::Kernel:
+			CollectLocals(emitter, static_cast<const KernelStatement&>(*statement).loop, slotNames);
+			break;
+		case StatementTag::Switch:
+			CollectLocals(emitter, static_cast<const SwitchStatement&>(*statement).chain, slotNames);
+			break;
+		case StatementTag::Fused:
+			CollectLocals(emitter, static_cast<const FusedStatement&>(*statement).original, slotNames);
+			break;
+		case StatementTag::Assignment:
+			AddLocal(emitter, static_cast<const AssignmentStatement&>(*statement).name, slotNames);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+static void AddLocal(CppEmitter& emitter, const std::string& name, std::vector<std::string>& slotNames)
+{
+	if (emitter.locals.emplace(name, slotNames.size()).second) slotNames.push_back(name);
+}
+
+static void EmitBlock(CppEmitter& emitter, const Statements& statements)
+{
+	for (const auto& statement : statements) EmitStatement(emitter, *statement);
+}
+
+static void EmitStatement(CppEmitter& emitter, const Statement& statement)
+{
+	switch (statement.tag)
+	{
+	case StatementTag::If:
+		EmitIf(emitter, static_cast<const IfStatement&>(statement), 0);
+		return;
+	case StatementTag::While:
+		EmitWhile(emitter, static_cast<const WhileStatement&>(statement));
+		return;
+	case StatementTag::For:
+	{
+		// NOTE A rewritten while loop runs as written, the counter is a variable either way.
+		const auto& forStatement = static_cast<const ForStatement&>(statement);
+		if (!forStatement.fallback.empty()) EmitStatement(emitter, *forStatement.fallback.front());
+		else EmitFor(emitter, forStatement);
+		return;
+	}
+	case StatementTag::GuardedLoop:
+		// NOTE Array accesses are checked anyway, so the original loop runs.
+		EmitStatement(emitter, *static_cast<const GuardedLoopStatement&>(statement).fallback.front());
+		return;
+	case StatementTag::Kernel:
+		EmitStatement(emitter, *static_cast<const KernelStatement&>(statement).loop.front());
+		return;
+	case StatementTag::Switch:
+		// NOTE g++ turns the if chain into a jump table where it pays off.
+		EmitStatement(emitter, *static_cast<const SwitchStatement&>(statement).chain.front());
+		return;
+	case StatementTag::Fused:
+		EmitStatement(emitter, *static_cast<const FusedStatement&>(statement).original.front());
+		return;
+	case StatementTag::Assignment:
+	{
+		const auto& assignment = static_cast<const AssignmentStatement&>(statement);
+		if (!assignment.attachedComment && assignment.value->commentUnused && IsNumeric(*assignment.value))
+		{
+			const std::string number = EmitNumber(emitter, *assignment.value, nullptr);
+			Line(emitter, "scope->SetNumber(" + Slot(emitter, assignment.name) + ", " + number + ");");
+			return;
+		}
+
+		// NOTE Arithmetic on variables holding numbers without comments makes a number without comment, which is computed
+		// without creating values. Other operands take the general path, reading the variables again.
+		std::unordered_map<std::string, std::string> operands;
+		const bool plain = !assignment.attachedComment && IsNumeric(*assignment.value) && IsPlainArithmetic(*assignment.value);
+		if (plain)
+		{
+			std::string test;
+			CollectOperands(emitter, *assignment.value, operands, test);
+			const std::string setNumber = "scope->SetNumber(" + Slot(emitter, assignment.name) + ", " + PlainNumber(*assignment.value, operands) + ");";
+			if (test.empty())
+			{
+				Line(emitter, setNumber);
+				return;
+			}
+			Line(emitter, "if (" + test + ") " + setNumber);
+			Line(emitter, "else");
+			Open(emitter);
+		}
+
+		const std::string value = EmitExpression(emitter, *assignment.value);
+		Line(emitter, "if (" + value + ".type == TypeTag::Void) scope->Void(" + Slot(emitter, assignment.name) + ");");
+		Line(emitter, "else");
+		Open(emitter);
+		if (assignment.attachedComment) Line(emitter, value + ".attachedComment = std::make_shared<Comment>(" + EmitComment(emitter, *assignment.attachedComment) + ", scope);");
+		Line(emitter, "scope->SetValue(" + Slot(emitter, assignment.name) + ", std::move(" + value + "));");
+		Close(emitter);
+		if (plain) Close(emitter);
+		return;
+	}
+	case StatementTag::ArrayWrite:
+	case StatementTag::InBoundsArrayWrite:
+	{
+		// NOTE The array is only held when a call in the index or value could rebind it.
+		const auto& arrayWrite = static_cast<const ArrayWriteStatement&>(statement);
+		const bool hold = HasCall(*arrayWrite.index) || HasCall(*arrayWrite.value);
+		const std::string array = NewTemp(emitter);
+		const std::string getArray = "GetArray(" + Find(emitter, arrayWrite.name) + ", " + Quote(arrayWrite.name) + ", " + Pos(statement.pos) + ")";
+		if (hold) Line(emitter, "const std::shared_ptr<std::vector<double>> " + array + " = " + getArray + ";");
+		else Line(emitter, "std::vector<double>* const " + array + " = " + getArray + ".get();");
+
+		const std::string indexNumber = EmitNumber(emitter, *arrayWrite.index, "Index to array is not a number.");
+		const std::string index = NewTemp(emitter);
+		const std::string boundsCheck = "if (" + index + " >= " + array + "->size()) FailBounds(" + index + ", " + array + "->size(), " + Pos(arrayWrite.index->pos) + ");";
+		Line(emitter, "const size_t " + index + " = ToIndex(" + indexNumber + ");");
+		Line(emitter, boundsCheck);
+
+		const std::string value = EmitNumber(emitter, *arrayWrite.value, "Value written to array is not a number.");
+		if (hold) Line(emitter, boundsCheck);
+		Line(emitter, "(*" + array + ")[" + index + "] = " + value + ";");
+		return;
+	}
+	case StatementTag::ArrayPush:
+	{
+		const auto& arrayPush = static_cast<const ArrayPushStatement&>(statement);
+		const std::string array = NewTemp(emitter);
+		const std::string getArray = "GetArray(" + Find(emitter, arrayPush.name) + ", " + Quote(arrayPush.name) + ", " + Pos(statement.pos) + ")";
+		if (HasCall(*arrayPush.value)) Line(emitter, "const std::shared_ptr<std::vector<double>> " + array + " = " + getArray + ";");
+		else Line(emitter, "std::vector<double>* const " + array + " = " + getArray + ".get();");
+
+		const std::string value = EmitNumber(emitter, *arrayPush.value, "Value pushed is not a number.");
+		Line(emitter, array + "->push_back(" + value + ");");
+		return;
+	}
+	case StatementTag::ArrayPop:
+	{
+		const auto& arrayPop = static_cast<const ArrayPopStatement&>(statement);
+		const std::string array = NewTemp(emitter);
+		Line(emitter, "std::vector<double>& " + array + " = *GetArray(" + Find(emitter, arrayPop.name) + ", " + Quote(arrayPop.name) + ", " + Pos(statement.pos) + ");");
+		Line(emitter, "if (" + array + ".empty()) Fail(\"Pop from an empty array.\", " + Pos(statement.pos) + ");");
+		Line(emitter, array + ".pop_back();");
+		return;
+	}
+	case StatementTag::Return:
+	{
+		const Expression& returnedValue = *static_cast<const ExpressionStatement&>(statement).value;
+		// NOTE Calls returned from the program body aren't tail calls, as in the interpreter.
+		if (!emitter.global && returnedValue.tag == ExpressionTag::Call && !statement.attachedComment)
+		{
+			EmitTailCall(emitter, static_cast<const Call&>(returnedValue));
+			return;
+		}
+		const std::string value = EmitExpression(emitter, returnedValue);
+		if (statement.attachedComment) Line(emitter, value + ".attachedComment = std::make_shared<Comment>(" + EmitComment(emitter, *statement.attachedComment) + ", scope);");
+		Line(emitter, "returned = std::move(" + value + ");");
+		Line(emitter, "return true;");
+		return;
+	}
+	case StatementTag::Expression:
+	{
+		const std::string value = EmitExpression(emitter, *static_cast<const ExpressionStatement&>(statement).value);
+		Line(emitter, "PrintValue(" + value + ", false);");
+		return;
+	}
+	}
+
+	Line(emitter, "Fail(\"Internal error: Unrecognized statement.\", " + Pos(statement.pos) + ");");
+}
+
+// Conditions after the first are evaluated in the else branch of the one before.
+static void EmitIf(CppEmitter& emitter, const IfStatement& ifStatement, const size_t arm)
+{
+	if (arm == ifStatement.elifChain.size())
+	{
+		EmitBlock(emitter, ifStatement.elseBlock);
+		return;
+	}
+
+	const ConditionBlock& elif = ifStatement.elifChain[arm];
+	const std::string condition = EmitCondition(emitter, *elif.condition, "Condition is not a boolean and not a number.");
+	Line(emitter, "if (" + condition + ")");
+	Open(emitter);
+	EmitBlock(emitter, elif.statements);
+	Close(emitter);
+
+	if (arm + 1 < ifStatement.elifChain.size() || !ifStatement.elseBlock.empty())
+	{
+		Line(emitter, "else");
+		Open(emitter);
+		EmitIf(emitter, ifStatement, arm + 1);
+		Close(emitter);
+	}
+}
+
+static void EmitFor(CppEmitter& emitter, const ForStatement& forStatement)
+{
+	const std::string start = EmitExpression(emitter, *forStatement.start);
+	const std::string end = EmitExpression(emitter, *forStatement.end);
+	const std::string step = forStatement.step ? EmitExpression(emitter, *forStatement.step) : "";
+
+	Line(emitter, "if (" + start + ".type != TypeTag::Number) Fail(\"Loop start is not a number.\", " + Pos(forStatement.start->pos) + ");");
+	Line(emitter, "if (" + end + ".type != TypeTag::Number) Fail(\"Loop end is not a number.\", " + Pos(forStatement.end->pos) + ");");
+	if (forStatement.step)
+	{
+		Line(emitter, "if (" + step + ".type != TypeTag::Number) Fail(\"Loop step is not a number.\", " + Pos(forStatement.step->pos) + ");");
+		Line(emitter, "if (" + step + ".number == 0.0) Fail(\"Loop step is zero.\", " + Pos(forStatement.step->pos) + ");");
+	}
+
+	const std::string counter = NewTemp(emitter);
+	const std::string ran = NewTemp(emitter);
+	const std::string endNumber = end + ".number";
+	const std::string upTest = counter + (forStatement.inclusive ? " <= " : " < ") + endNumber;
+	const std::string test = forStatement.step ? "(" + step + ".number > 0.0 ? " + upTest + " : " + counter + " > " + endNumber + ")" : upTest;
+
+	// NOTE The counter is only bound once the loop runs and holds the first value out of range afterwards.
+	Line(emitter, "double " + counter + " = " + start + ".number;");
+	Line(emitter, "bool " + ran + " = false;");
+	Line(emitter, "while (" + test + ")");
+	Open(emitter);
+	Line(emitter, "scope->SetNumber(" + Slot(emitter, forStatement.counter) + ", " + counter + ");");
+	Line(emitter, ran + " = true;");
+	EmitBlock(emitter, forStatement.statements);
+	Line(emitter, counter + " += " + (forStatement.step ? step + ".number" : std::string{"1.0"}) + ";");
+	Close(emitter);
+	Line(emitter, "if (" + ran + ") scope->SetNumber(" + Slot(emitter, forStatement.counter) + ", " + counter + ");");
+}
+
+// A loop that only computes numbers runs as a numeric loop if its variables hold numbers and arrays without comments
+// when it starts, otherwise as written.
+static void EmitWhile(CppEmitter& emitter, const WhileStatement& whileStatement)
+{
+	NumericLoop loop;
+	std::unordered_set<std::string> assigned;
+	const bool numeric = AnalyzeCondition(loop, *whileStatement.condition, assigned, true) && AnalyzeBlock(loop, whileStatement.statements, assigned);
+	if (numeric)
+	{
+		Open(emitter);
+		std::vector<std::pair<std::string, std::string>> bindings;
+		std::string test;
+		for (const auto& [name, readFirst] : loop.numbers)
+		{
+			if (!readFirst) continue;
+			bindings.emplace_back(name, NewTemp(emitter));
+			Line(emitter, "const Value* const " + bindings.back().second + " = " + Find(emitter, name) + ";");
+			test += (test.empty() ? "IsPlainNumber(" : " && IsPlainNumber(") + bindings.back().second + ")";
+		}
+		for (const std::string& name : loop.arrays)
+		{
+			bindings.emplace_back(name, NewTemp(emitter));
+			Line(emitter, "const Value* const " + bindings.back().second + " = " + Find(emitter, name) + ";");
+			test += (test.empty() ? "IsPlainArray(" : " && IsPlainArray(") + bindings.back().second + ")";
+		}
+		if (!test.empty()) Line(emitter, "if (" + test + ")");
+		Open(emitter);
+
+		for (const auto& [name, binding] : bindings)
+		{
+			const std::string local = NewTemp(emitter);
+			loop.locals.emplace(name, local);
+			if (loop.arrays.count(name)) Line(emitter, "std::vector<double>& " + local + " = *" + binding + "->array;");
+			else Line(emitter, "double " + local + " = " + binding + "->number;");
+		}
+		for (const auto& [name, readFirst] : loop.numbers)
+		{
+			if (readFirst) continue;
+			const std::string local = NewTemp(emitter);
+			loop.locals.emplace(name, local);
+			Line(emitter, "double " + local + " = 0.0;");
+		}
+		for (const std::string& name : loop.written)
+		{
+			const std::string flag = NewTemp(emitter);
+			loop.flags.emplace(name, flag);
+			Line(emitter, "bool " + flag + " = false;");
+		}
+
+		emitter.loop = &loop;
+		EmitNumericWhile(emitter, whileStatement);
+		EmitWriteBack(emitter);
+		emitter.loop = nullptr;
+		Close(emitter);
+		if (test.empty())
+		{
+			Close(emitter);
+			return;
+		}
+		Line(emitter, "else");
+		Open(emitter);
+	}
+
+	Line(emitter, "for (;;)");
+	Open(emitter);
+	const std::string condition = EmitCondition(emitter, *whileStatement.condition, "Loop condition is not a boolean and not a number.");
+	Line(emitter, "if (!" + condition + ") break;");
+	EmitBlock(emitter, whileStatement.statements);
+	Close(emitter);
+	if (numeric)
+	{
+		Close(emitter);
+		Close(emitter);
+	}
+}
+
+// Comparisons as conditions compare without creating a value, their comments can't be printed.
+static std::string EmitCondition(CppEmitter& emitter, const Expression& condition, const char* const errorMessage)
+{
+	if (condition.tag == ExpressionTag::Binary)
+	{
+		const auto& binaryOp = static_cast<const BinaryOperation&>(condition);
+		if (IsComparison(binaryOp.op))
+		{
+			const std::string a = EmitNumber(emitter, *binaryOp.a, "Comparison operand is not a number.");
+			const std::string b = EmitNumber(emitter, *binaryOp.b, "Arithmetic operand is not a number.");
+			return "(" + a + " " + OperatorText(binaryOp.op) + " " + b + ")";
+		}
+	}
+
+	const std::string value = EmitExpression(emitter, condition);
+	return "IsTrue(" + value + ", " + Quote(errorMessage) + ", " + Pos(condition.pos) + ")";
+}
+
+// --- EXPRESSIONS -------------------------------------------------------------
+
+// Returns the temporary holding the value of `expression`, which its user may modify.
+static std::string EmitExpression(CppEmitter& emitter, const Expression& expression)
+{
+	switch (expression.tag)
+	{
+	case ExpressionTag::False:
+	case ExpressionTag::True:
+	{
+		const std::string value = NewTemp(emitter);
+		Line(emitter, "Value " + value + " = MakeBool(" + (expression.tag == ExpressionTag::True ? "true" : "false") + ");");
+		AttachComment(emitter, expression, value);
+		return value;
+	}
+	case ExpressionTag::NumberLiteral:
+	{
+		const std::string value = NewTemp(emitter);
+		Line(emitter, "Value " + value + " = MakeNumber(" + NumberText(static_cast<const NumberLiteral&>(expression).value) + ");");
+		AttachComment(emitter, expression, value);
+		return value;
+	}
+	case ExpressionTag::ArrayLiteral:
+	{
+		std::string values;
+		for (const auto& element : static_cast<const ArrayLiteral&>(expression).values)
+		{
+			if (!values.empty()) values += ", ";
+			values += EmitNumber(emitter, *element, "Array initializer is not a number.");
+		}
+		const std::string value = NewTemp(emitter);
+		Line(emitter, "Value " + value + " = MakeArray({" + values + "});");
+		AttachComment(emitter, expression, value);
+		return value;
+	}
+	case ExpressionTag::FunctionLiteral:
+	{
+		const std::string function = EmitFunction(emitter, static_cast<const FunctionLiteral&>(expression));
+		const std::string value = NewTemp(emitter);
+		Line(emitter, "Value " + value + " = MakeFunction(" + function + ", scope);");
+		AttachComment(emitter, expression, value);
+		return value;
+	}
+	case ExpressionTag::Identifier:
+	{
+		const std::string value = NewTemp(emitter);
+		Line(emitter, "Value " + value + " = Read(" + Find(emitter, static_cast<const Identifier&>(expression).name) + ");");
+		AttachComment(emitter, expression, value);
+		return value;
+	}
+	case ExpressionTag::Unary:
+	{
+		const auto& unaryOp = static_cast<const UnaryOperation&>(expression);
+		const std::string value = EmitExpression(emitter, *unaryOp.a);
+		const std::string aPos = Pos(unaryOp.a->pos);
+		switch (unaryOp.op)
+		{
+		case TokenTag::KeyNot:
+			Line(emitter, "if (" + value + ".type != TypeTag::Bool) Fail(\"Logical not of non-boolean value.\", " + aPos + ");");
+			Line(emitter, value + ".boolean = !" + value + ".boolean;");
+			break;
+		case TokenTag::KeyNeg:
+			Line(emitter, "if (" + value + ".type != TypeTag::Number) Fail(\"Negation of non-number value.\", " + aPos + ");");
+			Line(emitter, value + ".number = -" + value + ".number;");
+			break;
+		case TokenTag::KeyVoid:
+			// NOTE We don't skip evaluating voiding expression to allow side effects to happen.
+			Line(emitter, value + " = MakeVoid(std::move(" + value + ".attachedComment));");
+			break;
+		case TokenTag::Hash:
+			Line(emitter, "if (" + value + ".type != TypeTag::Array) Fail(\"Array length operator used on non-array value.\", " + aPos + ");");
+			Line(emitter, value + ".type = TypeTag::Number;");
+			Line(emitter, value + ".number = static_cast<double>(" + value + ".array->size());");
+			Line(emitter, value + ".array = nullptr;");
+			break;
+		default:
+			Line(emitter, "Fail(\"Internal error: Unrecognized expression.\", " + Pos(expression.pos) + ");");
+			break;
+		}
+		AttachComment(emitter, expression, value);
+		return value;
+	}
+	case ExpressionTag::Binary:
+	case ExpressionTag::TypedBinary:
+	case ExpressionTag::InBoundsRead:
+		return EmitBinary(emitter, static_cast<const BinaryOperation&>(expression));
+	case ExpressionTag::Call:
+		return EmitCall(emitter, static_cast<const Call&>(expression));
+	case ExpressionTag::Constant:
+		break;
+	}
+
+	const std::string value = NewTemp(emitter);
+	Line(emitter, "Value " + value + ";");
+	Line(emitter, "Fail(\"Internal error: Unrecognized expression.\", " + Pos(expression.pos) + ");");
+	return value;
+}
+
+// NOTE A short-circuited and/or result keeps the first operand's comment, the expression's comment isn't attached.
+static std::string EmitBinary(CppEmitter& emitter, const BinaryOperation& binaryOp)
+{
+	if (binaryOp.commentUnused && IsNumeric(binaryOp))
+	{
+		const std::string number = EmitNumber(emitter, binaryOp, nullptr);
+		const std::string value = NewTemp(emitter);
+		Line(emitter, "Value " + value + " = MakeNumber(" + number + ");");
+		return value;
+	}
+
+	const std::string a = EmitExpression(emitter, *binaryOp.a);
+	const std::string aPos = Pos(binaryOp.a->pos);
+	const std::string bPos = Pos(binaryOp.b->pos);
+	const bool combine = !binaryOp.commentUnused;
+	switch (binaryOp.op)
+	{
+	case TokenTag::Plus:
+	case TokenTag::Minus:
+	case TokenTag::Star:
+	case TokenTag::Slash:
+	case TokenTag::Percent:
+	case TokenTag::LessThan:
+	case TokenTag::GreaterThan:
+	case TokenTag::LessEquals:
+	case TokenTag::GreaterEquals:
+	case TokenTag::EqualsEquals:
+	case TokenTag::NotEquals:
+	{
+		// NOTE A constant second operand has no comment to combine.
+		const bool comparison = IsComparison(binaryOp.op);
+		Line(emitter, "if (" + a + ".type != TypeTag::Number) Fail(" + (comparison ? "\"Comparison operand is not a number.\"" : "\"Arithmetic operand is not a number.\"") + ", " + aPos + ");");
+
+		std::string b;
+		std::string bValue;
+		double bNumber;
+		if (GetConstantNumber(*binaryOp.b, bNumber)) b = NumberText(bNumber);
+		else
+		{
+			bValue = EmitExpression(emitter, *binaryOp.b);
+			Line(emitter, "if (" + bValue + ".type != TypeTag::Number) Fail(\"Arithmetic operand is not a number.\", " + bPos + ");");
+			b = bValue + ".number";
+		}
+
+		if (binaryOp.op == TokenTag::Percent) Line(emitter, a + ".number = Modulo(" + a + ".number, " + b + ");");
+		else if (!comparison) Line(emitter, a + ".number = " + a + ".number " + OperatorText(binaryOp.op) + " " + b + ";");
+		else
+		{
+			Line(emitter, a + ".boolean = " + a + ".number " + OperatorText(binaryOp.op) + " " + b + ";");
+			Line(emitter, a + ".type = TypeTag::Bool;");
+		}
+		if (combine && !bValue.empty()) Line(emitter, "CombineOperandComments(" + bValue + ", " + a + ");");
+		break;
+	}
+	case TokenTag::KeyAnd:
+	case TokenTag::KeyOr:
+	{
+		const bool isAnd = binaryOp.op == TokenTag::KeyAnd;
+		Line(emitter, "if (" + a + ".type != TypeTag::Bool) Fail(" + (isAnd ? "\"Logical operand is not boolean.\"" : "\"Logic operand is not boolean.\"") + ", " + aPos + ");");
+		Line(emitter, "if (" + (isAnd ? "" : std::string{"!"}) + a + ".boolean)");
+		Open(emitter);
+		const std::string b = EmitExpression(emitter, *binaryOp.b);
+		Line(emitter, "if (" + b + ".type != TypeTag::Bool) Fail(\"Logic operand is not boolean.\", " + bPos + ");");
+		Line(emitter, a + ".boolean = " + b + ".boolean;");
+		if (binaryOp.attachedComment && !binaryOp.commentUnused) Line(emitter, a + ".attachedComment = std::make_shared<Comment>(" + EmitComment(emitter, *binaryOp.attachedComment) + ", scope);");
+		else if (combine) Line(emitter, "CombineOperandComments(" + b + ", " + a + ");");
+		Close(emitter);
+		return a;
+	}
+	case TokenTag::KeyXor:
+	{
+		Line(emitter, "if (" + a + ".type != TypeTag::Bool) Fail(\"Logic operand is not boolean.\", " + aPos + ");");
+		const std::string b = EmitExpression(emitter, *binaryOp.b);
+		Line(emitter, "if (" + b + ".type != TypeTag::Bool) Fail(\"Logic operand is not boolean.\", " + bPos + ");");
+		Line(emitter, a + ".boolean = " + a + ".boolean != " + b + ".boolean;");
+		if (combine) Line(emitter, "CombineOperandComments(" + b + ", " + a + ");");
+		break;
+	}
+	case TokenTag::At:
+	{
+		Line(emitter, "if (" + a + ".type != TypeTag::Array) Fail(\"Array read array operand is not an array.\", " + aPos + ");");
+		const std::string b = EmitExpression(emitter, *binaryOp.b);
+		Line(emitter, "if (" + b + ".type != TypeTag::Number) Fail(\"Array read index operand is not a number.\", " + bPos + ");");
+		const std::string index = NewTemp(emitter);
+		Line(emitter, "const size_t " + index + " = ToIndex(" + b + ".number);");
+		Line(emitter, "if (" + index + " >= " + a + ".array->size()) FailBounds(" + index + ", " + a + ".array->size(), " + bPos + ");");
+		Line(emitter, a + ".number = (*" + a + ".array)[" + index + "];");
+		Line(emitter, a + ".type = TypeTag::Number;");
+		Line(emitter, a + ".array = nullptr;");
+		if (combine) Line(emitter, "CombineOperandComments(" + b + ", " + a + ");");
+		break;
+	}
+	case TokenTag::KeyMap:
+	{
+		Line(emitter, "if (" + a + ".type != TypeTag::Function) Fail(\"Map function operand is not a function.\", " + aPos + ");");
+		const std::string b = EmitExpression(emitter, *binaryOp.b);
+		Line(emitter, "if (" + b + ".type != TypeTag::Array) Fail(\"Map array operand is not an array.\", " + bPos + ");");
+		Line(emitter, a + ".array = Map(*" + a + ".function, *" + b + ".array, " + Pos(binaryOp.pos) + ");");
+		Line(emitter, a + ".type = TypeTag::Array;");
+		Line(emitter, a + ".function = nullptr;");
+		if (combine) Line(emitter, "CombineOperandComments(" + b + ", " + a + ");");
+		break;
+	}
+	default:
+		Line(emitter, "Fail(\"Internal error: Unrecognized binary operation.\", " + Pos(binaryOp.pos) + ");");
+		break;
+	}
+
+	AttachComment(emitter, binaryOp, a);
+	return a;
+}
+
+// Emits the checks of calling the function `call` calls with its arguments, and the array `args` of them. Returns the
+// function's value.
+static std::string EmitCallArguments(CppEmitter& emitter, const Call& call, std::string& args)
+{
+	const std::string function = EmitExpression(emitter, *call.function);
+	const std::string code = function + ".function->code";
+	const size_t n = call.values.size();
+	Line(emitter, "if (" + function + ".type != TypeTag::Function) Fail(\"Call on a a non-function value.\", " + Pos(call.function->pos) + ");");
+	Line(emitter, "if (" + code + "->argCount != " + std::to_string(n) + ") FailArgumentCount(" + std::to_string(n) + ", " + code + "->argCount, " + Pos(call.pos) + ");");
+
+	args = "nullptr";
+	if (n)
+	{
+		std::string values;
+		for (const auto& arg : call.values) values += (values.empty() ? "std::move(" : ", std::move(") + EmitExpression(emitter, *arg) + ")";
+		args = NewTemp(emitter);
+		Line(emitter, "Value " + args + "[] = {" + values + "};");
+	}
+	return function;
+}
+
+// NOTE Comments attached to calls aren't attached to their results.
+static std::string EmitCall(CppEmitter& emitter, const Call& call)
+{
+	std::string args;
+	const std::string function = EmitCallArguments(emitter, call, args);
+	const std::string value = NewTemp(emitter);
+	Line(emitter, "Value " + value + ";");
+	Line(emitter, "Call(*" + function + ".function, " + args + ", " + value + ");");
+	return value;
+}
+
+// Emits returning `call` from a function body as a tail call, run by the caller once the body returned.
+static void EmitTailCall(CppEmitter& emitter, const Call& call)
+{
+	std::string args;
+	const std::string function = EmitCallArguments(emitter, call, args);
+	Line(emitter, "return ReturnCall(*" + function + ".function, " + args + ", " + std::to_string(call.values.size()) + ");");
+}
+
+// --- NUMBERS -----------------------------------------------------------------
+
+// Returns C++ code of the number `expression` evaluates to without creating a value, failing with `errorMessage` at its
+// position if its value isn't a number.
+static std::string EmitNumber(CppEmitter& emitter, const Expression& expression, const char* const errorMessage)
+{
+	double constant;
+	if (GetConstantNumber(expression, constant)) return NumberText(constant);
+
+	switch (expression.tag)
+	{
+	case ExpressionTag::Identifier:
+	{
+		const std::string number = NewTemp(emitter);
+		Line(emitter, "const double " + number + " = ReadNumber(" + Find(emitter, static_cast<const Identifier&>(expression).name) + ", " + Quote(errorMessage) + ", " + Pos(expression.pos) + ");");
+		return number;
+	}
+	case ExpressionTag::Unary:
+	{
+		const auto& unaryOp = static_cast<const UnaryOperation&>(expression);
+		if (unaryOp.op != TokenTag::KeyNeg) break;
+		const std::string a = EmitNumber(emitter, *unaryOp.a, "Negation of non-number value.");
+		const std::string number = NewTemp(emitter);
+		Line(emitter, "const double " + number + " = -" + a + ";");
+		return number;
+	}
+	case ExpressionTag::Binary:
+	case ExpressionTag::TypedBinary:
+	case ExpressionTag::InBoundsRead:
+	{
+		const auto& binaryOp = static_cast<const BinaryOperation&>(expression);
+		switch (binaryOp.op)
+		{
+		case TokenTag::Plus:
+		case TokenTag::Minus:
+		case TokenTag::Star:
+		case TokenTag::Slash:
+		case TokenTag::Percent:
+		{
+			const std::string a = EmitNumber(emitter, *binaryOp.a, "Arithmetic operand is not a number.");
+			const std::string b = EmitNumber(emitter, *binaryOp.b, "Arithmetic operand is not a number.");
+			const std::string number = NewTemp(emitter);
+			if (binaryOp.op == TokenTag::Percent) Line(emitter, "const double " + number + " = Modulo(" + a + ", " + b + ");");
+			else Line(emitter, "const double " + number + " = " + a + " " + OperatorText(binaryOp.op) + " " + b + ";");
+			return number;
+		}
+		case TokenTag::At:
+		{
+			// NOTE The array is held while the index runs only when a call in it could rebind the array.
+			const std::string array = NewTemp(emitter);
+			if (binaryOp.a->tag == ExpressionTag::Identifier)
+			{
+				const std::string readArray = "ReadArray(" + Find(emitter, static_cast<const Identifier&>(*binaryOp.a).name) + ", " + Pos(binaryOp.a->pos) + ")";
+				if (HasCall(*binaryOp.b)) Line(emitter, "const std::shared_ptr<std::vector<double>> " + array + " = " + readArray + ";");
+				else Line(emitter, "const std::vector<double>* const " + array + " = " + readArray + ".get();");
+			}
+			else
+			{
+				const std::string value = EmitExpression(emitter, *binaryOp.a);
+				Line(emitter, "if (" + value + ".type != TypeTag::Array) Fail(\"Array read array operand is not an array.\", " + Pos(binaryOp.a->pos) + ");");
+				Line(emitter, "const std::vector<double>* const " + array + " = " + value + ".array.get();");
+			}
+
+			const std::string indexNumber = EmitNumber(emitter, *binaryOp.b, "Array read index operand is not a number.");
+			const std::string index = NewTemp(emitter);
+			Line(emitter, "const size_t " + index + " = ToIndex(" + indexNumber + ");");
+			Line(emitter, "if (" + index + " >= " + array + "->size()) FailBounds(" + index + ", " + array + "->size(), " + Pos(binaryOp.b->pos) + ");");
+			const std::string number = NewTemp(emitter);
+			Line(emitter, "const double " + number + " = (*" + array + ")[" + index + "];");
+			return number;
+		}
+		default:
+			break;
+		}
+		break;
+	}
+	default:
+		break;
+	}
+
+	const std::string value = EmitExpression(emitter, expression);
+	if (errorMessage) Line(emitter, "if (" + value + ".type != TypeTag::Number) Fail(" + Quote(errorMessage) + ", " + Pos(expression.pos) + ");");
+	return value + ".number";
+}
+
+// Returns true if `expression` is arithmetic on variables and constants whose result can't get a comment attached
+// from any of its parts.
+static bool IsPlainArithmetic(const Expression& expression)
+{
+	if (expression.attachedComment && !expression.commentUnused) return false;
+
+	double constant;
+	if (GetConstantNumber(expression, constant)) return true;
+
+	switch (expression.tag)
+	{
+	case ExpressionTag::Identifier:
+		return true;
+	case ExpressionTag::Unary:
+	{
+		const auto& unaryOp = static_cast<const UnaryOperation&>(expression);
+		return unaryOp.op == TokenTag::KeyNeg && IsPlainArithmetic(*unaryOp.a);
+	}
+	case ExpressionTag::Binary:
+	case ExpressionTag::TypedBinary:
+	{
+		const auto& binaryOp = static_cast<const BinaryOperation&>(expression);
+		return IsNumeric(binaryOp) && binaryOp.op != TokenTag::At && IsPlainArithmetic(*binaryOp.a) && IsPlainArithmetic(*binaryOp.b);
+	}
+	default:
+		return false;
+	}
+}
+
+// Finds the binding of every variable in plain arithmetic `expression` once, and appends the test that they all hold
+// numbers without comments to `test`.
+static void CollectOperands(CppEmitter& emitter, const Expression& expression, std::unordered_map<std::string, std::string>& operands, std::string& test)
+{
+	switch (expression.tag)
+	{
+	case ExpressionTag::Identifier:
+	{
+		const std::string& name = static_cast<const Identifier&>(expression).name;
+		if (operands.count(name)) return;
+		const std::string binding = NewTemp(emitter);
+		Line(emitter, "const Value* const " + binding + " = " + Find(emitter, name) + ";");
+		operands.emplace(name, binding);
+		test += (test.empty() ? "IsPlainNumber(" : " && IsPlainNumber(") + binding + ")";
+		return;
+	}
+	case ExpressionTag::Unary:
+		CollectOperands(emitter, *static_cast<const UnaryOperation&>(expression).a, operands, test);
+		return;
+	case ExpressionTag::Binary:
+	case ExpressionTag::TypedBinary:
+	{
+		const auto& binaryOp = static_cast<const BinaryOperation&>(expression);
+		CollectOperands(emitter, *binaryOp.a, operands, test);
+		CollectOperands(emitter, *binaryOp.b, operands, test);
+		return;
+	}
+	default:
+		return;
+	}
+}
+
+// Returns C++ code computing plain arithmetic `expression` from the bindings in `operands`.
+static std::string PlainNumber(const Expression& expression, const std::unordered_map<std::string, std::string>& operands)
+{
+	double constant;
+	if (GetConstantNumber(expression, constant)) return NumberText(constant);
+
+	switch (expression.tag)
+	{
+	case ExpressionTag::Identifier:
+		return operands.at(static_cast<const Identifier&>(expression).name) + "->number";
+	case ExpressionTag::Unary:
+		return "(-" + PlainNumber(*static_cast<const UnaryOperation&>(expression).a, operands) + ")";
+	default:
+	{
+		const auto& binaryOp = static_cast<const BinaryOperation&>(expression);
+		const std::string a = PlainNumber(*binaryOp.a, operands);
+		const std::string b = PlainNumber(*binaryOp.b, operands);
+		if (binaryOp.op == TokenTag::Percent) return "Modulo(" + a + ", " + b + ")";
+		return "(" + a + " " + OperatorText(binaryOp.op) + " " + b + ")";
+	}
+	}
+}
+
+// --- NUMERIC LOOPS -----------------------------------------------------------
+
+// Functions analyzing a numeric loop return false if it isn't one. `assigned` holds the variables every path through the
+// loop body assigns before the statement.
+static bool AnalyzeBlock(NumericLoop& loop, const Statements& statements, std::unordered_set<std::string>& assigned)
+{
+	for (const auto& statement : statements)
+	{
+		if (!AnalyzeStatement(loop, *statement, assigned)) return false;
+	}
+	return true;
+}
+
+static bool AnalyzeStatement(NumericLoop& loop, const Statement& statement, std::unordered_set<std::string>& assigned)
+{
+	switch (statement.tag)
+	{
+	case StatementTag::If:
+	{
+		const auto& ifStatement = static_cast<const IfStatement&>(statement);
+		std::unordered_set<std::string> common;
+		bool first = true;
+		const auto join = [&](const std::unordered_set<std::string>& armAssigned) {
+			if (first) common = armAssigned;
+			else
+			{
+				for (auto it = common.begin(); it != common.end();)
+				{
+					if (armAssigned.count(*it)) ++it;
+					else it = common.erase(it);
+				}
+			}
+			first = false;
+		};
+		for (const auto& elif : ifStatement.elifChain)
+		{
+			if (!AnalyzeCondition(loop, *elif.condition, assigned, true)) return false;
+			std::unordered_set<std::string> armAssigned = assigned;
+			if (!AnalyzeBlock(loop, elif.statements, armAssigned)) return false;
+			join(armAssigned);
+		}
+		std::unordered_set<std::string> elseAssigned = assigned;
+		if (!AnalyzeBlock(loop, ifStatement.elseBlock, elseAssigned)) return false;
+		join(elseAssigned);
+		assigned = std::move(common);
+		return true;
+	}
+	case StatementTag::While:
+	{
+		const auto& whileStatement = static_cast<const WhileStatement&>(statement);
+		std::unordered_set<std::string> bodyAssigned = assigned;
+		return AnalyzeCondition(loop, *whileStatement.condition, assigned, true) && AnalyzeBlock(loop, whileStatement.statements, bodyAssigned);
+	}
+	case StatementTag::For:
+	{
+		const auto& forStatement = static_cast<const ForStatement&>(statement);
+		return !forStatement.fallback.empty() && AnalyzeStatement(loop, *forStatement.fallback.front(), assigned);
+	}
+	case StatementTag::GuardedLoop:
+		return AnalyzeStatement(loop, *static_cast<const GuardedLoopStatement&>(statement).fallback.front(), assigned);
+	case StatementTag::Kernel:
+		return AnalyzeStatement(loop, *static_cast<const KernelStatement&>(statement).loop.front(), assigned);
+	case StatementTag::Switch:
+		return AnalyzeStatement(loop, *static_cast<const SwitchStatement&>(statement).chain.front(), assigned);
+	case StatementTag::Fused:
+		return AnalyzeStatement(loop, *static_cast<const FusedStatement&>(statement).original.front(), assigned);
+	case StatementTag::Assignment:
+	{
+		const auto& assignment = static_cast<const AssignmentStatement&>(statement);
+		if (assignment.attachedComment || !AnalyzeNumber(loop, *assignment.value, assigned, true) || loop.arrays.count(assignment.name)) return false;
+		loop.numbers.emplace(assignment.name, false);
+		loop.written.insert(assignment.name);
+		assigned.insert(assignment.name);
+		return true;
+	}
+	case StatementTag::ArrayWrite:
+	case StatementTag::InBoundsArrayWrite:
+	{
+		const auto& arrayWrite = static_cast<const ArrayWriteStatement&>(statement);
+		if (loop.numbers.count(arrayWrite.name)) return false;
+		loop.arrays.insert(arrayWrite.name);
+		return AnalyzeNumber(loop, *arrayWrite.index, assigned, false) && AnalyzeNumber(loop, *arrayWrite.value, assigned, false);
+	}
+	case StatementTag::ArrayPush:
+	{
+		const auto& arrayPush = static_cast<const ArrayPushStatement&>(statement);
+		if (loop.numbers.count(arrayPush.name)) return false;
+		loop.arrays.insert(arrayPush.name);
+		return AnalyzeNumber(loop, *arrayPush.value, assigned, false);
+	}
+	case StatementTag::ArrayPop:
+	{
+		const auto& arrayPop = static_cast<const ArrayPopStatement&>(statement);
+		if (loop.numbers.count(arrayPop.name)) return false;
+		loop.arrays.insert(arrayPop.name);
+		return true;
+	}
+	case StatementTag::Return:
+	{
+		const Expression& value = *static_cast<const ExpressionStatement&>(statement).value;
+		if (statement.attachedComment) return false;
+		if (value.tag == ExpressionTag::True || value.tag == ExpressionTag::False) return !value.attachedComment;
+		return AnalyzeNumber(loop, value, assigned, true);
+	}
+	default:
+		return false;
+	}
+}
+
+// Conditions are comparisons and logic on them, or numbers if `top`.
+static bool AnalyzeCondition(NumericLoop& loop, const Expression& condition, const std::unordered_set<std::string>& assigned, const bool top)
+{
+	switch (condition.tag)
+	{
+	case ExpressionTag::True:
+	case ExpressionTag::False:
+		return true;
+	case ExpressionTag::Unary:
+	{
+		const auto& unaryOp = static_cast<const UnaryOperation&>(condition);
+		if (unaryOp.op == TokenTag::KeyNot) return AnalyzeCondition(loop, *unaryOp.a, assigned, false);
+		break;
+	}
+	case ExpressionTag::Binary:
+	case ExpressionTag::TypedBinary:
+	{
+		const auto& binaryOp = static_cast<const BinaryOperation&>(condition);
+		if (IsComparison(binaryOp.op)) return AnalyzeNumber(loop, *binaryOp.a, assigned, false) && AnalyzeNumber(loop, *binaryOp.b, assigned, false);
+		if (binaryOp.op == TokenTag::KeyAnd || binaryOp.op == TokenTag::KeyOr || binaryOp.op == TokenTag::KeyXor)
+		{
+			return AnalyzeCondition(loop, *binaryOp.a, assigned, false) && AnalyzeCondition(loop, *binaryOp.b, assigned, false);
+		}
+		break;
+	}
+	default:
+		break;
+	}
+	return top && AnalyzeNumber(loop, condition, assigned, false);
+}
+
+// Numbers are arithmetic on number variables, constants and array reads. If `valueUsed`, the number is stored and its
+// parts can't have comments.
+static bool AnalyzeNumber(NumericLoop& loop, const Expression& expression, const std::unordered_set<std::string>& assigned, const bool valueUsed)
+{
+	if (valueUsed && expression.attachedComment && !expression.commentUnused) return false;
+
+	switch (expression.tag)
+	{
+	case ExpressionTag::NumberLiteral:
+		return true;
+	case ExpressionTag::Identifier:
+	{
+		const std::string& name = static_cast<const Identifier&>(expression).name;
+		if (loop.arrays.count(name)) return false;
+		bool& readFirst = loop.numbers[name];
+		if (!assigned.count(name)) readFirst = true;
+		return true;
+	}
+	case ExpressionTag::Unary:
+	{
+		const auto& unaryOp = static_cast<const UnaryOperation&>(expression);
+		if (unaryOp.op == TokenTag::KeyNeg) return AnalyzeNumber(loop, *unaryOp.a, assigned, valueUsed);
+		if (unaryOp.op != TokenTag::Hash || unaryOp.a->tag != ExpressionTag::Identifier) return false;
+		const std::string& name = static_cast<const Identifier&>(*unaryOp.a).name;
+		if (loop.numbers.count(name)) return false;
+		loop.arrays.insert(name);
+		return true;
+	}
+	case ExpressionTag::Binary:
+	case ExpressionTag::TypedBinary:
+	case ExpressionTag::InBoundsRead:
+	{
+		const auto& binaryOp = static_cast<const BinaryOperation&>(expression);
+		if (binaryOp.op == TokenTag::At)
+		{
+			if (binaryOp.a->tag != ExpressionTag::Identifier) return false;
+			const std::string& name = static_cast<const Identifier&>(*binaryOp.a).name;
+			if (loop.numbers.count(name)) return false;
+			loop.arrays.insert(name);
+			return AnalyzeNumber(loop, *binaryOp.b, assigned, valueUsed);
+		}
+		return IsNumeric(binaryOp) && AnalyzeNumber(loop, *binaryOp.a, assigned, valueUsed) && AnalyzeNumber(loop, *binaryOp.b, assigned, valueUsed);
+	}
+	default:
+		return false;
+	}
+}
+
+static void EmitNumericBlock(CppEmitter& emitter, const Statements& statements)
+{
+	for (const auto& statement : statements) EmitNumericStatement(emitter, *statement);
+}
+
+static void EmitNumericStatement(CppEmitter& emitter, const Statement& statement)
+{
+	const NumericLoop& loop = *emitter.loop;
+	switch (statement.tag)
+	{
+	case StatementTag::If:
+	{
+		const auto& ifStatement = static_cast<const IfStatement&>(statement);
+		size_t opened = 0;
+		for (size_t i = 0; i < ifStatement.elifChain.size(); ++i)
+		{
+			const ConditionBlock& elif = ifStatement.elifChain[i];
+			Line(emitter, "if (" + EmitNumericCondition(emitter, *elif.condition) + ")");
+			Open(emitter);
+			EmitNumericBlock(emitter, elif.statements);
+			Close(emitter);
+			if (i + 1 == ifStatement.elifChain.size() && ifStatement.elseBlock.empty()) break;
+			Line(emitter, "else");
+			Open(emitter);
+			++opened;
+		}
+		EmitNumericBlock(emitter, ifStatement.elseBlock);
+		for (size_t i = 0; i < opened; ++i) Close(emitter);
+		return;
+	}
+	case StatementTag::While:
+		EmitNumericWhile(emitter, static_cast<const WhileStatement&>(statement));
+		return;
+	case StatementTag::For:
+		EmitNumericStatement(emitter, *static_cast<const ForStatement&>(statement).fallback.front());
+		return;
+	case StatementTag::GuardedLoop:
+		EmitNumericStatement(emitter, *static_cast<const GuardedLoopStatement&>(statement).fallback.front());
+		return;
+	case StatementTag::Kernel:
+		EmitNumericStatement(emitter, *static_cast<const KernelStatement&>(statement).loop.front());
+		return;
+	case StatementTag::Switch:
+		EmitNumericStatement(emitter, *static_cast<const SwitchStatement&>(statement).chain.front());
+		return;
+	case StatementTag::Fused:
+		EmitNumericStatement(emitter, *static_cast<const FusedStatement&>(statement).original.front());
+		return;
+	case StatementTag::Assignment:
+	{
+		const auto& assignment = static_cast<const AssignmentStatement&>(statement);
+		const std::string number = EmitNumericNumber(emitter, *assignment.value);
+		Line(emitter, loop.locals.at(assignment.name) + " = " + number + ";");
+		Line(emitter, loop.flags.at(assignment.name) + " = true;");
+		return;
+	}
+	case StatementTag::ArrayWrite:
+	case StatementTag::InBoundsArrayWrite:
+	{
+		const auto& arrayWrite = static_cast<const ArrayWriteStatement&>(statement);
+		const std::string& array = loop.locals.at(arrayWrite.name);
+		const std::string index = NewTemp(emitter);
+		Line(emitter, "const size_t " + index + " = ToIndex(" + EmitNumericNumber(emitter, *arrayWrite.index) + ");");
+		Line(emitter, "if (" + index + " >= " + array + ".size()) FailBounds(" + index + ", " + array + ".size(), " + Pos(arrayWrite.index->pos) + ");");
+		const std::string value = EmitNumericNumber(emitter, *arrayWrite.value);
+		Line(emitter, array + "[" + index + "] = " + value + ";");
+		return;
+	}
+	case StatementTag::ArrayPush:
+	{
+		const auto& arrayPush = static_cast<const ArrayPushStatement&>(statement);
+		const std::string value = EmitNumericNumber(emitter, *arrayPush.value);
+		Line(emitter, loop.locals.at(arrayPush.name) + ".push_back(" + value + ");");
+		return;
+	}
+	case StatementTag::ArrayPop:
+	{
+		const std::string& array = loop.locals.at(static_cast<const ArrayPopStatement&>(statement).name);
+		Line(emitter, "if (" + array + ".empty()) Fail(\"Pop from an empty array.\", " + Pos(statement.pos) + ");");
+		Line(emitter, array + ".pop_back();");
+		return;
+	}
+	case StatementTag::Return:
+	{
+		const Expression& value = *static_cast<const ExpressionStatement&>(statement).value;
+		std::string returned;
+		if (value.tag == ExpressionTag::True || value.tag == ExpressionTag::False) returned = value.tag == ExpressionTag::True ? "MakeBool(true)" : "MakeBool(false)";
+		else returned = "MakeNumber(" + EmitNumericNumber(emitter, value) + ")";
+		Line(emitter, "returned = " + returned + ";");
+		EmitWriteBack(emitter);
+		Line(emitter, "return true;");
+		return;
+	}
+	default:
+		Line(emitter, "Fail(\"Internal error: Unrecognized statement.\", " + Pos(statement.pos) + ");");
+		return;
+	}
+}
+
+static void EmitNumericWhile(CppEmitter& emitter, const WhileStatement& whileStatement)
+{
+	Line(emitter, "for (;;)");
+	Open(emitter);
+	Line(emitter, "if (!" + EmitNumericCondition(emitter, *whileStatement.condition) + ") break;");
+	EmitNumericBlock(emitter, whileStatement.statements);
+	Close(emitter);
+}
+
+// Binds the variables the numeric loop assigned.
+static void EmitWriteBack(CppEmitter& emitter)
+{
+	for (const auto& [name, flag] : emitter.loop->flags) Line(emitter, "if (" + flag + ") scope->SetNumber(" + Slot(emitter, name) + ", " + emitter.loop->locals.at(name) + ");");
+}
+
+static std::string EmitNumericCondition(CppEmitter& emitter, const Expression& condition)
+{
+	switch (condition.tag)
+	{
+	case ExpressionTag::True:
+		return "true";
+	case ExpressionTag::False:
+		return "false";
+	case ExpressionTag::Unary:
+	{
+		const auto& unaryOp = static_cast<const UnaryOperation&>(condition);
+		if (unaryOp.op == TokenTag::KeyNot) return "!" + EmitNumericCondition(emitter, *unaryOp.a);
+		break;
+	}
+	case ExpressionTag::Binary:
+	case ExpressionTag::TypedBinary:
+	{
+		const auto& binaryOp = static_cast<const BinaryOperation&>(condition);
+		if (IsComparison(binaryOp.op))
+		{
+			const std::string a = EmitNumericNumber(emitter, *binaryOp.a);
+			const std::string b = EmitNumericNumber(emitter, *binaryOp.b);
+			return "(" + a + " " + OperatorText(binaryOp.op) + " " + b + ")";
+		}
+		if (binaryOp.op == TokenTag::KeyXor)
+		{
+			const std::string a = EmitNumericCondition(emitter, *binaryOp.a);
+			const std::string b = EmitNumericCondition(emitter, *binaryOp.b);
+			return "(" + a + " != " + b + ")";
+		}
+		if (binaryOp.op == TokenTag::KeyAnd || binaryOp.op == TokenTag::KeyOr)
+		{
+			// NOTE The second operand may read arrays, which only happens if it is evaluated.
+			const std::string result = NewTemp(emitter);
+			Line(emitter, "bool " + result + " = " + EmitNumericCondition(emitter, *binaryOp.a) + ";");
+			Line(emitter, std::string{"if ("} + (binaryOp.op == TokenTag::KeyAnd ? "" : "!") + result + ")");
+			Open(emitter);
+			Line(emitter, result + " = " + EmitNumericCondition(emitter, *binaryOp.b) + ";");
+			Close(emitter);
+			return result;
+		}
+		break;
+	}
+	default:
+		break;
+	}
+	return "(" + EmitNumericNumber(emitter, condition) + " != 0.0)";
+}
+
+// Returns C++ code of the number `expression` evaluates to. Array reads are done before, in order.
+static std::string EmitNumericNumber(CppEmitter& emitter, const Expression& expression)
+{
+	const NumericLoop& loop = *emitter.loop;
+	switch (expression.tag)
+	{
+	case ExpressionTag::NumberLiteral:
+		return NumberText(static_cast<const NumberLiteral&>(expression).value);
+	case ExpressionTag::Identifier:
+		return loop.locals.at(static_cast<const Identifier&>(expression).name);
+	case ExpressionTag::Unary:
+	{
+		const auto& unaryOp = static_cast<const UnaryOperation&>(expression);
+		if (unaryOp.op == TokenTag::KeyNeg) return "(-" + EmitNumericNumber(emitter, *unaryOp.a) + ")";
+		return "static_cast<double>(" + loop.locals.at(static_cast<const Identifier&>(*unaryOp.a).name) + ".size())";
+	}
+	default:
+	{
+		const auto& binaryOp = static_cast<const BinaryOperation&>(expression);
+		if (binaryOp.op == TokenTag::At)
+		{
+			const std::string& array = loop.locals.at(static_cast<const Identifier&>(*binaryOp.a).name);
+			const std::string index = NewTemp(emitter);
+			Line(emitter, "const size_t " + index + " = ToIndex(" + EmitNumericNumber(emitter, *binaryOp.b) + ");");
+			Line(emitter, "if (" + index + " >= " + array + ".size()) FailBounds(" + index + ", " + array + ".size(), " + Pos(binaryOp.b->pos) + ");");
+			const std::string number = NewTemp(emitter);
+			Line(emitter, "const double " + number + " = " + array + "[" + index + "];");
+			return number;
+		}
+		const std::string a = EmitNumericNumber(emitter, *binaryOp.a);
+		const std::string b = EmitNumericNumber(emitter, *binaryOp.b);
+		if (binaryOp.op == TokenTag::Percent) return "Modulo(" + a + ", " + b + ")";
+		return "(" + a + " " + OperatorText(binaryOp.op) + " " + b + ")";
+	}
+	}
+}
+
+// --- TABLES ------------------------------------------------------------------
+
+// Returns the FunctionCode of `functionLiteral`, writing its body the first time.
+static std::string EmitFunction(CppEmitter& emitter, const FunctionLiteral& functionLiteral)
+{
+	auto it = emitter.functions.find(&functionLiteral);
+	if (it != emitter.functions.end()) return it->second;
+
+	const std::string name = "function" + std::to_string(emitter.functions.size());
+	emitter.functions.emplace(&functionLiteral, name);
+	EmitBody(emitter, *functionLiteral.statements, name + "Body", functionLiteral.args.get());
+
+	const std::vector<std::string>& args = *functionLiteral.args;
+	if (args.empty())
+	{
+		emitter.tables += "static const FunctionCode " + name + " = {nullptr, 0, " + name + "Body};\n";
+		return name;
+	}
+
+	std::string argNames;
+	for (const std::string& arg : args) argNames += (argNames.empty() ? "" : ", ") + Quote(arg);
+	emitter.tables += "static const char* const " + name + "ArgNames[] = {" + argNames + "};\n";
+	emitter.tables += "static const FunctionCode " + name + " = {" + name + "ArgNames, " + std::to_string(args.size()) + ", " + name + "Body};\n";
+	return name;
+}
+
+// Returns a pointer to the CommentCode of `comment`.
+static std::string EmitComment(CppEmitter& emitter, const CommentToken& comment)
+{
+	auto it = emitter.comments.find(&comment);
+	if (it != emitter.comments.end()) return it->second;
+
+	const std::string name = "comment" + std::to_string(emitter.comments.size());
+	emitter.comments.emplace(&comment, "&" + name);
+
+	std::string parts;
+	for (const auto& node : comment.nodes)
+	{
+		if (!parts.empty()) parts += ", ";
+		switch (node->tag)
+		{
+		case CommentNodeTag::Text: parts += "{" + Quote(static_cast<const CommentTextNode&>(*node).text) + ", 0}"; break;
+		case CommentNodeTag::Identifier: parts += "{nullptr, " + Name(emitter, static_cast<const CommentIdentifierNode&>(*node).name) + "}"; break;
+		}
+	}
+
+	if (parts.empty()) emitter.tables += "static const CommentCode " + name + " = {nullptr, 0};\n";
+	else
+	{
+		emitter.tables += "static const CommentPart " + name + "Parts[] = {" + parts + "};\n";
+		emitter.tables += "static const CommentCode " + name + " = {" + name + "Parts, " + std::to_string(comment.nodes.size()) + "};\n";
+	}
+	return "&" + name;
+}
+
+// --- HELPERS -----------------------------------------------------------------
+
+// Attaches the comment of `expression` to temporary `value`, unless the comment can't be printed.
+static void AttachComment(CppEmitter& emitter, const Expression& expression, const std::string& value)
+{
+	if (!expression.attachedComment || expression.commentUnused) return;
+	Line(emitter, value + ".attachedComment = std::make_shared<Comment>(" + EmitComment(emitter, *expression.attachedComment) + ", scope);");
+}
+
+static void Line(CppEmitter& emitter, const std::string& text)
+{
+	emitter.code.append(emitter.indent, '\t');
+	emitter.code += text;
+	emitter.code += '\n';
+}
+
+static void Open(CppEmitter& emitter)
+{
+	Line(emitter, "{");
+	++emitter.indent;
+}
+
+static void Close(CppEmitter& emitter)
+{
+	--emitter.indent;
+	Line(emitter, "}");
+}
+
+static std::string NewTemp(CppEmitter& emitter)
+{
+	return "t" + std::to_string(emitter.temps++);
+}
+
+// Returns the number of variable `name`, with the name in a comment.
+static std::string Name(CppEmitter& emitter, const std::string& name)
+{
+	const int id = emitter.names.emplace(name, static_cast<int>(emitter.names.size())).first->second;
+	return std::to_string(id) + " /* " + name + " */";
+}
+
+// Returns code finding the binding of variable `name`, null if it isn't bound.
+static std::string Find(CppEmitter& emitter, const std::string& name)
+{
+	if (emitter.global || emitter.locals.count(name)) return "scope->Local(" + Slot(emitter, name) + ", " + Name(emitter, name) + ")";
+	return "scope->Outer(" + Name(emitter, name) + ")";
+}
+
+// Returns the slot of variable `name` in the scope of the body being written.
+static std::string Slot(CppEmitter& emitter, const std::string& name)
+{
+	if (emitter.global) return Name(emitter, name);
+	return std::to_string(emitter.locals.at(name)) + " /* " + name + " */";
+}
+
+static std::string Pos(const CodePos pos)
+{
+	return Format("%zu, %zu", pos.line, pos.col);
+}
+
+static std::string Quote(const std::string& text)
+{
+	std::string quoted = "\"";
+	for (const char c : text)
+	{
+		const unsigned char byte = static_cast<unsigned char>(c);
+		if (c == '"' || c == '\\') quoted += Format("\\%c", c);
+		else if (c == '\n') quoted += "\\n";
+		else if (c == '\t') quoted += "\\t";
+		else if (byte < 0x20 || byte >= 0x7f) quoted += Format("\\%03o", byte);
+		else quoted += c;
+	}
+	return quoted + "\"";
+}
+
+// Returns the shortest literal reading back as `value`.
+static std::string NumberText(const double value)
+{
+	if (std::isinf(value)) return value > 0.0 ? "HUGE_VAL" : "-HUGE_VAL";
+	if (std::isnan(value)) return "NAN";
+
+	if (value == std::floor(value) && std::fabs(value) < 1e15) return Format(value < 0.0 ? "(%.1f)" : "%.1f", value);
+
+	std::string text;
+	for (int precision = 1; precision <= 17; ++precision)
+	{
+		text = Format("%.*g", precision, value);
+		if (std::strtod(text.c_str(), nullptr) == value) break;
+	}
+	if (text.find_first_of(".e") == std::string::npos) text += ".0";
+	return value < 0.0 ? "(" + text + ")" : text;
+}
+
+// Returns the C++ operator of arithmetic or comparison `op`, null for other operators.
+static const char* OperatorText(const TokenTag op)
+{
+	switch (op)
+	{
+	case TokenTag::Plus: return "+";
+	case TokenTag::Minus: return "-";
+	case TokenTag::Star: return "*";
+	case TokenTag::Slash: return "/";
+	case TokenTag::LessThan: return "<";
+	case TokenTag::GreaterThan: return ">";
+	case TokenTag::LessEquals: return "<=";
+	case TokenTag::GreaterEquals: return ">=";
+	case TokenTag::EqualsEquals: return "==";
+	case TokenTag::NotEquals: return "!=";
+	default: return nullptr;
+	}
+}
+
+static bool IsComparison(const TokenTag op)
+{
+	switch (op)
+	{
+	case TokenTag::LessThan:
+	case TokenTag::GreaterThan:
+	case TokenTag::LessEquals:
+	case TokenTag::GreaterEquals:
+	case TokenTag::EqualsEquals:
+	case TokenTag::NotEquals:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// Returns true if `expression` always evaluates to a number unless it fails, so the number path needs no error message
+// of its own.
+static bool IsNumeric(const Expression& expression)
+{
+	switch (expression.tag)
+	{
+	case ExpressionTag::NumberLiteral:
+		return true;
+	case ExpressionTag::Unary:
+		return static_cast<const UnaryOperation&>(expression).op == TokenTag::KeyNeg;
+	case ExpressionTag::Binary:
+	case ExpressionTag::TypedBinary:
+	case ExpressionTag::InBoundsRead:
+		switch (static_cast<const BinaryOperation&>(expression).op)
+		{
+		case TokenTag::Plus:
+		case TokenTag::Minus:
+		case TokenTag::Star:
+		case TokenTag::Slash:
+		case TokenTag::Percent:
+		case TokenTag::At:
+			return true;
+		default:
+			return false;
+		}
+	default:
+		return false;
+	}
+}
+
+// Returns true if `expression` always evaluates to a number without comment, which is set to `out`.
+static bool GetConstantNumber(const Expression& expression, double& out)
+{
+	if (expression.attachedComment || expression.tag != ExpressionTag::NumberLiteral) return false;
+	out = static_cast<const NumberLiteral&>(expression).value;
+	return true;
+}
+
+// Returns true if evaluating `expression` can run a function, which could rebind any variable.
+static bool HasCall(const Expression& expression)
+{
+	switch (expression.tag)
+	{
+	case ExpressionTag::Call:
+		return true;
+	case ExpressionTag::Unary:
+		return HasCall(*static_cast<const UnaryOperation&>(expression).a);
+	case ExpressionTag::Binary:
+	case ExpressionTag::TypedBinary:
+	case ExpressionTag::InBoundsRead:
+	{
+		const auto& binaryOp = static_cast<const BinaryOperation&>(expression);
+		return binaryOp.op == TokenTag::KeyMap || HasCall(*binaryOp.a) || HasCall(*binaryOp.b);
+	}
+	case ExpressionTag::ArrayLiteral:
+		for (const auto& value : static_cast<const ArrayLiteral&>(expression).values)
+		{
+			if (HasCall(*value)) return true;
+		}
+		return false;
+	default:
+		return false;
+	}
+}
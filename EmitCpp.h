@@ -0,0 +1,12 @@
+#pragma once
+
+#include "Parser.h"
+
+#include <memory>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+// Writes `statements` to `out` as a C++ program built against CppRuntime.h. The program prints what the interpreter
+// prints for the script, errors included, which are reported in file `filePrefix`.
+void EmitCpp(std::string_view filePrefix, std::vector<std::unique_ptr<Statement>>& statements, std::ostream& out);
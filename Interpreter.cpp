@@ -1,230 +1,431 @@
 #include "Common.h"
 #include "Interpreter.h"
 
+#include "Closures.h"
+#include "Collector.h"
+#include "Jit.h"
+#include "Lanes.h"
+#include "Optimizer.h"
 #include "Parser.h"
+#include "Pool.h"
+#include "Runtime.h"
+#include "VM.h"
 
+#include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
 #include <iostream>
-#include <unordered_map>
+#include <optional>
+#include <unordered_set>
 #include <utility>
 
-enum class TypeTag {
-	Void,     // Value
-	Bool,     // BoolValue
-	Number,   // NumberValue
-	Array,    // ArrayRef
-	Function, // FunctionRef
-};
-
-struct Scope;
-
-struct Comment {
-	std::unique_ptr<CommentToken> token;
-	std::shared_ptr<Scope> scope;
+#include <pthread.h>
+
+// Signatures pack 3 bits of TypeTag per argument.
+constexpr size_t MAX_SPECIALIZED_ARGS = 21;
+constexpr size_t MAX_SPECIALIZATIONS = 4;
+// Counters of kernels stay below 2^52, so all of them and the step added to the last one are exact.
+constexpr double MAX_KERNEL_INDEX = 4503599627370496.0;
+constexpr size_t MAX_MEMO_RESULTS = 65536;
+// Memoization is disabled for a function once it missed this many times while less than 1 in MIN_MEMO_HIT_RATIO calls
+// hit.
+constexpr size_t MEMO_PROBATION_MISSES = 1024;
+constexpr size_t MIN_MEMO_HIT_RATIO = 4;
+constexpr size_t MAX_POOLED_FRAMES = 64;
+constexpr size_t MAX_PRINTED_NODE_PAIRS = 40;
+constexpr size_t MAX_PRINTED_PROMOTIONS = 20;
+// Stack left beyond the stack limit for code running between two checks, e.g. printing or evaluating a deeply nested
+// expression.
+constexpr size_t STACK_RESERVE = 4 << 20;
+// Node kinds of statements have this bit set, the tag in the low byte and the FusedTag above it. Expressions have their
+// tag in the low byte and the operator above it.
+constexpr uint32_t STATEMENT_NODE = 0x80000000;
+
+static InterpreterOptions interpreterOptions;
+static Ref<Scope> globalScope = MakeRef<Scope>();
+static std::vector<Ref<Scope>> framePool; // scopes of returned calls, reused by functions with local scopes
+static struct {
+	bool unwind;
+	Value returnValue;
+} unwindToken;
 
-	Comment(const CommentToken& token, std::shared_ptr<Scope> scope) : token{token.make_clone()}, scope{std::move(scope)} {}
+// Call whose function and arguments are evaluated, about to run.
+struct PreparedCall {
+	Ref<Function> function;
+	Ref<Scope> innerScope; // binds the arguments
+	bool localScope;
+	CodePos pos; // of the call
+	uint64_t signature;
+	bool memoize;
+	std::vector<uint64_t> memoKey;
 };
+static struct {
+	bool allowed; // return statements may leave their call to the caller, false at top level
+	bool pending; // a return statement left `call` to run
+	PreparedCall call;
+} tailCallState;
+static struct {
+	uintptr_t base; // address near the bottom of the native stack the tree walker runs on
+	size_t limit;
+} stackState;
+static struct {
+	size_t depth;   // memoized calls running
+	bool impure;    // an impure function was called since the innermost memoized call started
+	uint64_t epoch; // incremented by memoized calls not nested in another one
+	size_t hits;
+	size_t misses;
+} memoState;
+static struct {
+	struct Promotion {
+		bool loop;        // loop or function
+		CodePos pos;      // of the loop, or of the call promoting the function
+		size_t count;     // iterations or calls so far
+		bool machineCode; // the loop ran as machine code right away
+	};
+	std::vector<Promotion> promotions;
+} tierState;
+static struct {
+	size_t hits;   // lookups of identifiers answered from their cache
+	size_t misses; // lookups searching scopes by name
+} lookupState;
+static struct {
+	size_t elements; // mapped by map operations
+	size_t lanes;    // of the elements, computed in SIMD lanes
+} mapState;
+static struct {
+	CollectorStats stats;
+	size_t survivors; // objects left by the last collection
+} collectorState;
+static struct {
+	Pool::Lists lists; // of the thread that ran the last program, which the next one goes on with
+	Pool::Stats stats;
+} poolState;
+static struct {
+	const Statement* parent;                     // statement whose code runs, null at the top level
+	const Statement* pending;                    // statement counted and about to run
+	std::unordered_map<uint64_t, size_t> counts; // runs of each pair of node kinds, parent in the high half
+} nodePairState;
+
+[[nodiscard]] static Error RunStatement(const Statement& statement, const Ref<Scope>& scope);
+[[nodiscard]] static Error RunCountedStatement(const Statement& statement, const Ref<Scope>& scope);
+[[nodiscard]] static Error RunWhile(const WhileStatement& whileStatement, const FusedStatement* fused, const Ref<Scope>& scope);
+[[nodiscard]] static Error RunIf(const IfStatement& ifStatement, size_t firstArm, const Ref<Scope>& scope);
+[[nodiscard]] static Error RunFused(const FusedStatement& fused, const Ref<Scope>& scope);
+[[nodiscard]] static Error Evaluate(Expression& expression, const Ref<Scope>& scope, Value& out);
+[[nodiscard]] static Error EvaluateNumber(Expression& expression, const Ref<Scope>& scope, const char* errorMessage, double& out);
+[[nodiscard]] static Error EvaluateBool(Expression& expression, const Ref<Scope>& scope, const char* errorMessage, bool& out);
+[[nodiscard]] static Error EvaluateCondition(Expression& condition, const Ref<Scope>& scope, const char* errorMessage, bool& out);
+[[nodiscard]] static Error EvaluateQuickNumber(Expression& expression, const Ref<Scope>& scope, bool& quick, double& out);
+[[nodiscard]] static Error EvaluateQuickBool(Expression& expression, const Ref<Scope>& scope, bool& quick, bool& out);
+static bool LookUp(const Identifier& identifier, Scope& scope, Value*& out);
+static bool CanQuicken(const Expression& expression);
+static bool HasObservableComment(const Expression& expression);
+static bool IsNumberOperation(TokenTag op);
+static bool LoopGuardHolds(const GuardedLoopStatement& guardedLoop, const Ref<Scope>& scope);
+static bool RunKernel(const KernelStatement& kernel, const Ref<Scope>& scope);
+static LoopTier* GetLoopTier(const Statement& statement);
+[[nodiscard]] static Error PromoteLoop(const Statement& loop, LoopTier& tier, const std::vector<std::unique_ptr<Statement>>& body, const Ref<Scope>& scope, bool& ran);
+[[nodiscard]] static Error TryRunJitLoop(const Statement& loop, const Ref<Scope>& scope, bool& ran);
+static void PromoteFunction(FunctionCode& code, CodePos pos);
+static bool TryGetFusedOperands(const FusedStatement& fused, const Ref<Scope>& scope, double& a, double& b);
+static bool Compare(TokenTag op, double a, double b);
+static const std::vector<std::unique_ptr<Statement>>& SelectBody(FunctionCode& code, const std::vector<std::string>& args, uint64_t signature);
+[[nodiscard]] static Error PrepareCall(const Call& call, const Ref<Scope>& scope, PreparedCall& prepared);
+[[nodiscard]] static Error CheckArgCount(const Function& function, size_t argCount, CodePos pos);
+static void BeginCall(Ref<Function> function, CodePos pos, PreparedCall& prepared);
+static void BindArgument(PreparedCall& prepared, size_t i, Value value);
+[[nodiscard]] static Error RunCall(PreparedCall& prepared, Value& out);
+[[nodiscard]] static Error RunPreparedCall(PreparedCall& prepared, Value& out);
+[[nodiscard]] static Error RunFunctionBody(const std::vector<std::unique_ptr<Statement>>& statements, const Ref<Scope>& innerScope, Value& out);
+[[nodiscard]] static Error RunCallBody(FunctionCode& code, const std::vector<std::unique_ptr<Statement>>& statements, const Ref<Scope>& innerScope, Value& out);
+static bool IsPure(const Function& function);
+static bool HasLocalScope(const Function& function);
+static Ref<Scope> AcquireFrame();
+static void ReleaseFrame(Ref<Scope> frame);
+static bool AppendMemoKey(const Value& value, std::vector<uint64_t>& key);
+static bool ValidateMemo(Function& function);
+static void CombineComments(const Expression& expression, const Ref<Scope>& scope, const Value& b, Value& out);
+static void CountNodePairs(const Statement& statement);
+static void CountNodePairs(uint32_t parent, const Expression& expression);
+static uint32_t GetNodeKind(const Statement& statement);
+static uint32_t GetNodeKind(const Expression& expression);
+static std::string GetNodeName(uint32_t kind);
+static void PrintNodePairs();
+static void RunProgram(std::string_view filePrefix, std::vector<std::unique_ptr<Statement>>& statements);
+static bool RunOnStack(size_t size, const std::function<void()>& run);
+
+void Interpret(std::string_view filePrefix, std::vector<std::unique_ptr<Statement>>& statements, const InterpreterOptions& options)
+{
+	interpreterOptions = options;
+	Optimize(statements, options.kernels);
 
-struct Value {
-	TypeTag type;
-	std::shared_ptr<Comment> attachedComment;
-
-	explicit Value(const TypeTag type, std::shared_ptr<Comment> attachedComment) : type{type}, attachedComment{std::move(attachedComment)} {}
-	virtual ~Value() = default;
+	// NOTE Code runs on a stack of its own, which the engines check for stackLimit bytes left before every call, so
+	// deep recursion ends with an error instead of overflowing the stack of the process.
+	stackState.limit = options.stackLimit;
+	if (!RunOnStack(options.stackLimit + STACK_RESERVE, [&] { RunProgram(filePrefix, statements); }))
+	{
+		std::cerr << "Couldn't allocate a stack of " << options.stackLimit << " bytes.\n";
+		return;
+	}
 
-	virtual std::unique_ptr<Value> make_clone() const { return std::make_unique<Value>(type, attachedComment); }
-};
+	if (options.stats)
+	{
+		const size_t memoized = memoState.hits + memoState.misses;
+		std::cerr << "Memoized calls: " << memoState.hits << " hits, " << memoState.misses << " misses";
+		if (memoized) std::cerr << " (" << 100 * memoState.hits / memoized << "% hit rate)";
+		std::cerr << '\n';
+
+		const auto& promotions = tierState.promotions;
+		const size_t loops = std::count_if(promotions.begin(), promotions.end(), [](const auto& promotion) { return promotion.loop; });
+		std::cerr << "Promoted to hot: " << promotions.size() - loops << " functions, " << loops << " loops\n";
+		for (size_t i = 0; i < promotions.size() && i < MAX_PRINTED_PROMOTIONS; ++i)
+		{
+			const auto& promotion = promotions[i];
+			std::cerr << "  " << (promotion.loop ? "loop at " : "function called at ") << promotion.pos.line << ':' << promotion.pos.col << " after " << promotion.count << (promotion.loop ? " iterations" : " calls");
+			if (promotion.machineCode) std::cerr << ", ran as machine code";
+			std::cerr << '\n';
+		}
+		if (promotions.size() > MAX_PRINTED_PROMOTIONS) std::cerr << "  ...\n";
 
-struct BoolValue : public Value {
-	bool value;
+		const size_t lookups = lookupState.hits + lookupState.misses;
+		std::cerr << "Identifier lookups: " << lookupState.hits << " cached, " << lookupState.misses << " by name";
+		if (lookups) std::cerr << " (" << 100 * lookupState.hits / lookups << "% cached)";
+		std::cerr << '\n';
 
-	explicit BoolValue(const bool value, std::shared_ptr<Comment> attachedComment) : Value{TypeTag::Bool, std::move(attachedComment)}, value{value} {}
-	std::unique_ptr<Value> make_clone() const override { return std::make_unique<BoolValue>(value, attachedComment); }
-};
+		std::cerr << "Mapped elements: " << mapState.elements << ", " << mapState.lanes << " in SIMD lanes\n";
 
-struct NumberValue : public Value {
-	double value;
+		const CollectorStats& collected = collectorState.stats;
+		std::cerr << "Cycle collections: " << collected.collections << ", " << collected.objects << " objects freed (" << collected.bytes << " bytes)\n";
 
-	explicit NumberValue(const double value, std::shared_ptr<Comment> attachedComment) : Value{TypeTag::Number, std::move(attachedComment)}, value{value} {}
-	std::unique_ptr<Value> make_clone() const override { return std::make_unique<NumberValue>(value, attachedComment); }
-};
+		const Pool::Stats& allocated = poolState.stats;
+		std::cerr << "Allocated objects: " << allocated.allocations << ", " << allocated.reused << " reusing freed blocks";
+		if (allocated.allocations) std::cerr << " (" << 100 * allocated.reused / allocated.allocations << "%)";
+		std::cerr << ", " << allocated.chunks << " chunks of " << (Pool::CHUNK_SIZE >> 10) << " KB\n";
+	}
+	if (options.nodePairs) PrintNodePairs();
+}
 
-struct ArrayRef : public Value {
-	std::shared_ptr<std::vector<double>> array;
+bool StackExhausted(const size_t heapFrames)
+{
+	const char here = 0;
+	return stackState.base - reinterpret_cast<uintptr_t>(&here) + heapFrames > stackState.limit;
+}
 
-	explicit ArrayRef(std::shared_ptr<std::vector<double>> array, std::shared_ptr<Comment> attachedComment) : Value{TypeTag::Array, std::move(attachedComment)}, array{std::move(array)} {}
-	std::unique_ptr<Value> make_clone() const override { return std::make_unique<ArrayRef>(array, attachedComment); }
-};
+void CollectCyclesIfDue()
+{
+	// NOTE Waiting for as many new objects as survived the last collection keeps the time spent collecting linear in the
+	// number of objects created, however many stay alive.
+	const size_t threshold = interpreterOptions.collectThreshold;
+	if (threshold == 0 || Collected::created < std::max(threshold, collectorState.survivors)) return;
+	CollectCycles(collectorState.stats);
+	collectorState.survivors = Collected::live;
+}
 
-struct Function {
-	std::shared_ptr<std::vector<std::string>> args;
-	std::shared_ptr<std::vector<std::unique_ptr<Statement>>> statements;
-	std::shared_ptr<Scope> closure;
+[[nodiscard]] Error MapArray(Function& function, const std::vector<double>& array, const CodePos pos, const std::function<Error(double, Value&)>& call, std::vector<double>& out)
+{
+	TRY(CheckArgCount(function, 1, pos));
+	if (StackExhausted()) return Error{"Stack overflow.", pos};
 
-	Function(std::shared_ptr<std::vector<std::string>> args, std::shared_ptr<std::vector<std::unique_ptr<Statement>>> statements, std::shared_ptr<Scope> closure) : args{std::move(args)}, statements{std::move(statements)}, closure{std::move(closure)} {}
-};
+	out.clear();
+	out.reserve(array.size());
+	size_t i = 0;
+	if (interpreterOptions.lanes)
+	{
+		FunctionCode& code = *function.code;
+		if (!code.lanes) code.lanes = CompileLanes(function.args->front(), *code.statements);
+		i = RunLanes(*code.lanes, function.closure, array, out);
+		mapState.lanes += i;
+	}
+	mapState.elements += array.size();
 
-struct FunctionRef : public Value {
-	std::shared_ptr<Function> function;
-	// TODO NOTE Should we attach comments to function/array values or references?
+	for (; i < array.size(); ++i)
+	{
+		Value result;
+		TRY(call(array[i], result));
+		if (result.Type() != TypeTag::Number) return Error("Mapped function returned a non-number value.", pos);
+		out.push_back(result.number);
+	}
+	return Error::None;
+}
 
-	explicit FunctionRef(std::shared_ptr<Function> function, std::shared_ptr<Comment> attachedComment) : Value{TypeTag::Function, std::move(attachedComment)}, function{std::move(function)} {}
-	std::unique_ptr<Value> make_clone() const override { return std::make_unique<FunctionRef>(function, attachedComment); }
-};
+static void RunProgram(const std::string_view filePrefix, std::vector<std::unique_ptr<Statement>>& statements)
+{
+	// NOTE Each program runs on a new thread, REPL lines included, so the pool is handed from one to the next.
+	Pool::Adopt(poolState.lists);
+	Pool::stats = poolState.stats;
 
-struct Scope {
-	std::unordered_map<std::string, std::unique_ptr<Value>> bindings;
-	std::shared_ptr<Scope> parent_scope;
+	tailCallState.allowed = false;
+	tailCallState.pending = false;
 
-	bool TryGetValue(const std::string& name, std::unique_ptr<Value>*& out)
+	if (interpreterOptions.vm || interpreterOptions.closures)
 	{
-		out = nullptr;
-
-		auto it = bindings.find(name);
-		if (it == bindings.end())
-		{
-			return parent_scope ? parent_scope->TryGetValue(name, out) : false;
-		}
-		else
-		{
-			out = &it->second;
-			return true;
-		}
+		bool returned = false;
+		const Error error = interpreterOptions.vm ? RunBytecode(statements, globalScope, returned) : RunClosures(statements, globalScope, returned);
+		if (error) std::cerr << filePrefix << ':' << error.pos.line << ':' << error.pos.col << ": " << error.message << '\n';
+		else if (returned) std::cerr << "Returned from top-level code.";
 	}
-
-	void Void(const std::string& name)
+	else
 	{
-		auto it = bindings.find(name);
-		if (it != bindings.end())
+		for (const auto& statement : statements)
 		{
-			bindings.erase(it);
+			Error error = RunStatement(*statement, globalScope);
+			if (error)
+			{
+				std::cerr << filePrefix << ':' << error.pos.line << ':' << error.pos.col << ": " << error.message << '\n';
+				break;
+			}
+			if (unwindToken.unwind)
+			{
+				std::cerr << "Returned from top-level code.";
+				break;
+			}
+			CollectCyclesIfDue();
 		}
 	}
+	CollectCyclesIfDue();
+	poolState.lists = Pool::Take();
+	poolState.stats = Pool::stats;
+}
+
+// Runs `run` on a new thread with a stack of `size` bytes and waits for it. Returns false if the thread couldn't start.
+static bool RunOnStack(const size_t size, const std::function<void()>& run)
+{
+	const auto start = [](void* const run) -> void* {
+		const char here = 0;
+		stackState.base = reinterpret_cast<uintptr_t>(&here);
+		(*static_cast<const std::function<void()>*>(run))();
+		return nullptr;
+	};
+
+	pthread_attr_t attributes;
+	pthread_attr_init(&attributes);
+	pthread_t thread;
+	const bool started = pthread_attr_setstacksize(&attributes, size) == 0 && pthread_create(&thread, &attributes, start, const_cast<std::function<void()>*>(&run)) == 0;
+	pthread_attr_destroy(&attributes);
+	if (started) pthread_join(thread, nullptr);
+	return started;
+}
 
-	void SetValue(const std::string& name, std::unique_ptr<Value> value)
+[[nodiscard]] static Error RunStatement(const Statement& statement, const Ref<Scope>& scope)
+{
+	if (interpreterOptions.nodePairs)
 	{
-		bindings[name] = std::move(value);
+		if (nodePairState.pending != &statement) return RunCountedStatement(statement, scope);
+		nodePairState.pending = nullptr;
 	}
-};
-
-static std::shared_ptr<Scope> globalScope = std::make_shared<Scope>();
-static struct {
-	bool unwind;
-	std::unique_ptr<Value> returnValue;
-} unwindToken;
 
-[[nodiscard]] static Error RunStatement(const Statement& statement, const std::shared_ptr<Scope>& scope);
-[[nodiscard]] static Error Evaluate(Expression& expression, const std::shared_ptr<Scope>& scope, std::unique_ptr<Value>& out);
-static void PrintValue(const Value& value, bool inComment);
-
-void Interpret(std::string_view filePrefix, std::vector<std::unique_ptr<Statement>>& statements)
-{
-	for (const auto& statement : statements)
+	if (interpreterOptions.jit)
 	{
-		Error error = RunStatement(*statement, globalScope);
-		if (error)
-		{
-			std::cerr << filePrefix << ':' << error.pos.line << ':' << error.pos.col << ": " << error.message << '\n';
-			return;
-		}
-		if (unwindToken.unwind)
+		// NOTE Loops that got hot run as machine code from then on, other loops count their iterations first.
+		const LoopTier* tier = GetLoopTier(statement);
+		if (tier && tier->hot)
 		{
-			std::cerr << "Returned from top-level code.";
-			return;
+			bool ran;
+			TRY(TryRunJitLoop(statement, scope, ran));
+			if (ran) return Error::None;
 		}
 	}
-}
 
-[[nodiscard]] static Error RunStatement(const Statement& statement, const std::shared_ptr<Scope>& scope)
-{
 	switch (statement.tag)
 	{
 	case StatementTag::If:
+		return RunIf(static_cast<const IfStatement&>(statement), 0, scope);
+	case StatementTag::While:
+		return RunWhile(static_cast<const WhileStatement&>(statement), nullptr, scope);
+	case StatementTag::GuardedLoop:
+	{
+		const auto& guardedLoop = static_cast<const GuardedLoopStatement&>(statement);
+		return RunStatement(*(LoopGuardHolds(guardedLoop, scope) ? guardedLoop.fast : guardedLoop.fallback).front(), scope);
+	}
+	case StatementTag::For:
 	{
-		const auto& ifStatement = static_cast<const IfStatement&>(statement);
+		const auto& forStatement = static_cast<const ForStatement&>(statement);
 
-		for (const auto& elif : ifStatement.elifChain)
-		{
-			std::unique_ptr<Value> condition;
-			TRY(Evaluate(*elif.condition, scope, condition));
+		Value start;
+		TRY(Evaluate(*forStatement.start, scope, start));
 
-			bool conditionValue;
+		Value end;
+		TRY(Evaluate(*forStatement.end, scope, end));
 
-			if (condition->type == TypeTag::Bool)
-			{
-				conditionValue = static_cast<const BoolValue&>(*condition).value;
-			}
-			else if (condition->type == TypeTag::Number)
-			{
-				conditionValue = static_cast<const NumberValue&>(*condition).value != 0.0;
-			}
-			else
-			{
-				return Error{"Condition is not a boolean and not a number.", elif.condition->pos};
-			}
+		Value step;
+		if (forStatement.step) TRY(Evaluate(*forStatement.step, scope, step));
+		else step = Value(1.0);
 
-			if (conditionValue)
+		if (!forStatement.fallback.empty())
+		{
+			// NOTE Rewritten while loop. Unless its counter is a plain number going up, the original loop runs.
+			if (start.Type() != TypeTag::Number || start.GetComment() || end.Type() != TypeTag::Number || step.Type() != TypeTag::Number || step.GetComment() || !(step.number > 0.0))
 			{
-				for (const auto& statement : elif.statements)
-				{
-					TRY(RunStatement(*statement, scope));
-					if (unwindToken.unwind) return Error::None;
-				}
-				return Error::None;
+				return RunStatement(*forStatement.fallback.front(), scope);
 			}
 		}
-
-		for (const auto& statement : ifStatement.elseBlock)
+		else
 		{
-			TRY(RunStatement(*statement, scope));
-			if (unwindToken.unwind) return Error::None;
+			if (start.Type() != TypeTag::Number) return Error{"Loop start is not a number.", forStatement.start->pos};
+			if (end.Type() != TypeTag::Number) return Error{"Loop end is not a number.", forStatement.end->pos};
+			if (step.Type() != TypeTag::Number) return Error{"Loop step is not a number.", forStatement.step->pos};
+			if (step.number == 0.0) return Error{"Loop step is zero.", forStatement.step->pos};
 		}
-		return Error::None;
-	}
-	case StatementTag::While:
-	{
-		const auto& whileStatement = static_cast<const WhileStatement&>(statement);
-
-		while (true)
-		{
-			std::unique_ptr<Value> condition;
-			TRY(Evaluate(*whileStatement.condition, scope, condition));
 
-			bool conditionValue;
+		double counter = start.number;
+		const double endValue = end.number;
+		const double stepValue = step.number;
 
-			if (condition->type == TypeTag::Bool)
-			{
-				conditionValue = static_cast<const BoolValue&>(*condition).value;
-			}
-			else if (condition->type == TypeTag::Number)
-			{
-				conditionValue = static_cast<const NumberValue&>(*condition).value != 0.0;
-			}
-			else
-			{
-				return Error{"Loop condition is not a boolean and not a number.", whileStatement.condition->pos};
-			}
+		// NOTE A loop gets hot before it runs, once earlier runs or the trip count reach the threshold. Machine code
+		// evaluates the range again, which is fine since the JIT only compiles code without calls.
+		LoopTier& tier = forStatement.tier;
+		if (!tier.hot && (tier.iterations >= interpreterOptions.hotIterations || (endValue - counter) / stepValue >= static_cast<double>(interpreterOptions.hotIterations)))
+		{
+			bool jitRan;
+			TRY(PromoteLoop(forStatement, tier, forStatement.statements, scope, jitRan));
+			if (jitRan) return Error::None;
+		}
+		const auto& body = tier.body.empty() ? forStatement.statements : tier.body;
 
-			if (!conditionValue) return Error::None;
+		// NOTE The counter is only bound once the loop runs and holds the first value out of range afterwards.
+		bool ran = false;
+		while (stepValue > 0.0 ? (forStatement.inclusive ? counter <= endValue : counter < endValue) : counter > endValue)
+		{
+			scope->SetNumber(forStatement.counter, counter);
+			ran = true;
+			if (!tier.hot) ++tier.iterations;
 
-			for (const auto& statement : whileStatement.statements)
+			for (const auto& statement : body)
 			{
 				TRY(RunStatement(*statement, scope));
 				if (unwindToken.unwind) return Error::None;
 			}
+
+			counter += stepValue;
 		}
+		if (ran) scope->SetNumber(forStatement.counter, counter);
+		return Error::None;
 	}
 	case StatementTag::Assignment:
 	{
 		const auto& assignment = static_cast<const AssignmentStatement&>(statement);
 
-		std::unique_ptr<Value> value;
+		if (!assignment.attachedComment && !HasObservableComment(*assignment.value) && CanQuicken(*assignment.value) && IsNumberOperation(static_cast<const BinaryOperation&>(*assignment.value).op))
+		{
+			bool quick;
+			double number;
+			TRY(EvaluateQuickNumber(*assignment.value, scope, quick, number));
+			if (quick)
+			{
+				scope->SetNumber(assignment.name, number);
+				return Error::None;
+			}
+		}
+
+		Value value;
 		TRY(Evaluate(*assignment.value, scope, value));
 
-		if (value->type == TypeTag::Void) scope->Void(assignment.name);
+		if (value.Type() == TypeTag::Void) scope->Void(assignment.name);
 		else
 		{
-			if (assignment.attachedComment) value->attachedComment = std::make_shared<Comment>(*assignment.attachedComment, scope);
+			if (assignment.attachedComment) value.SetComment(MakeRef<Comment>(*assignment.attachedComment, scope));
 			scope->SetValue(assignment.name, std::move(value));
 		}
 		return Error::None;
@@ -232,176 +433,403 @@ void Interpret(std::string_view filePrefix, std::vector<std::unique_ptr<Statemen
 	case StatementTag::ArrayWrite:
 	{
 		const auto& arrayWrite = static_cast<const ArrayWriteStatement&>(statement);
-		std::unique_ptr<Value>* arrayValue;
+		Value* arrayValue;
 		if (!scope->TryGetValue(arrayWrite.name, arrayValue))
 		{
 			return Error{Format("No array named %s.", arrayWrite.name.c_str()), statement.pos};
 		}
-		else if ((*arrayValue)->type != TypeTag::Array)
+		else if (arrayValue->Type() != TypeTag::Array)
 		{
 			return Error{Format("%s is not an array.", arrayWrite.name.c_str()), statement.pos};
 		}
 		else
 		{
-			const auto& array = static_cast<const ArrayRef&>(**arrayValue);
+			std::vector<double>& array = arrayValue->GetArray();
 
-			std::unique_ptr<Value> index;
-			TRY(Evaluate(*arrayWrite.index, scope, index));
-			if (index->type != TypeTag::Number)
-			{
-				return Error{"Index to array is not a number.", arrayWrite.index->pos};
-			}
+			double index;
+			TRY(EvaluateNumber(*arrayWrite.index, scope, "Index to array is not a number.", index));
 
-			const size_t indexValue = static_cast<size_t>(static_cast<const NumberValue&>(*index).value);
+			const size_t indexValue = static_cast<size_t>(index);
 
-			if (indexValue >= array.array->size())
+			if (indexValue >= array.size())
 			{
-				return Error{Format("Array index %zu out of bounds (array length is %zu).", indexValue, array.array->size()), arrayWrite.index->pos};
+				return Error{Format("Array index %zu out of bounds (array length is %zu).", indexValue, array.size()), arrayWrite.index->pos};
 			}
 
-			std::unique_ptr<Value> value;
-			TRY(Evaluate(*arrayWrite.value, scope, value));
-			if (value->type != TypeTag::Number)
-			{
-				return Error{"Value written to array is not a number.", arrayWrite.value->pos};
-			}
+			double value;
+			TRY(EvaluateNumber(*arrayWrite.value, scope, "Value written to array is not a number.", value));
 
-			(*array.array)[indexValue] = static_cast<const NumberValue&>(*value).value;
+			array[indexValue] = value;
 			return Error::None;
 		}
 	}
+	case StatementTag::InBoundsArrayWrite:
+	{
+		// NOTE The loop guard proved the binding is an array and the index is a number in bounds.
+		const auto& arrayWrite = static_cast<const ArrayWriteStatement&>(statement);
+		Value* arrayValue;
+		scope->TryGetValue(arrayWrite.name, arrayValue);
+		std::vector<double>& array = arrayValue->GetArray();
+
+		double index;
+		TRY(EvaluateNumber(*arrayWrite.index, scope, "Index to array is not a number.", index));
+
+		double value;
+		TRY(EvaluateNumber(*arrayWrite.value, scope, "Value written to array is not a number.", value));
+
+		array[static_cast<size_t>(index)] = value;
+		return Error::None;
+	}
 	case StatementTag::ArrayPush:
 	{
 		const auto& arrayPush = static_cast<const ArrayPushStatement&>(statement);
-		std::unique_ptr<Value>* arrayValue;
+		Value* arrayValue;
 		if (!scope->TryGetValue(arrayPush.name, arrayValue))
 		{
 			return Error{Format("No array named %s.", arrayPush.name.c_str()), statement.pos};
 		}
-		else if ((*arrayValue)->type != TypeTag::Array)
+		else if (arrayValue->Type() != TypeTag::Array)
 		{
 			return Error{Format("%s is not an array.", arrayPush.name.c_str()), statement.pos};
 		}
 		else
 		{
-			const auto& array = static_cast<const ArrayRef&>(**arrayValue);
+			std::vector<double>& array = arrayValue->GetArray();
 
-			std::unique_ptr<Value> value;
-			TRY(Evaluate(*arrayPush.value, scope, value));
-			if (value->type != TypeTag::Number)
-			{
-				return Error{"Value pushed is not a number.", arrayPush.value->pos};
-			}
+			double value;
+			TRY(EvaluateNumber(*arrayPush.value, scope, "Value pushed is not a number.", value));
 
-			array.array->push_back(static_cast<const NumberValue&>(*value).value);
+			array.push_back(value);
 			return Error::None;
 		}
 	}
 	case StatementTag::ArrayPop:
 	{
 		const auto& arrayPop = static_cast<const ArrayPopStatement&>(statement);
-		std::unique_ptr<Value>* value;
+		Value* value;
 		if (!scope->TryGetValue(arrayPop.name, value))
 		{
 			return Error{Format("No array named %s.", arrayPop.name.c_str()), statement.pos};
 		}
-		else if ((*value)->type != TypeTag::Array)
+		else if (value->Type() != TypeTag::Array)
 		{
 			return Error{Format("%s is not an array.", arrayPop.name.c_str()), statement.pos};
 		}
 		else
 		{
-			const auto& array = static_cast<const ArrayRef&>(**value);
-			array.array->pop_back();
+			std::vector<double>& array = value->GetArray();
+			if (array.empty()) return Error{"Pop from an empty array.", statement.pos};
+			array.pop_back();
 			return Error::None;
 		}
 	}
 	case StatementTag::Return:
 	{
 		const auto& returnStatement = static_cast<const ExpressionStatement&>(statement);
-		std::unique_ptr<Value> value;
+		if (tailCallState.allowed && returnStatement.value->tag == ExpressionTag::Call && !returnStatement.attachedComment)
+		{
+			// NOTE Arguments may run calls ending in tail calls of their own, so this one is only left pending once
+			// they were evaluated.
+			PreparedCall prepared;
+			TRY(PrepareCall(static_cast<const Call&>(*returnStatement.value), scope, prepared));
+			tailCallState.call = std::move(prepared);
+			tailCallState.pending = true;
+			unwindToken.unwind = true;
+			return Error::None;
+		}
+
+		Value value;
+		TRY(Evaluate(*returnStatement.value, scope, value));
+		if (returnStatement.attachedComment) value.SetComment(MakeRef<Comment>(*returnStatement.attachedComment, scope));
 		unwindToken.unwind = true;
-		TRY(Evaluate(*returnStatement.value, scope, unwindToken.returnValue));
-		if (returnStatement.attachedComment) unwindToken.returnValue->attachedComment = std::make_shared<Comment>(*returnStatement.attachedComment, scope);
+		unwindToken.returnValue = std::move(value);
 		return Error::None;
 	}
 	case StatementTag::Expression:
 	{
 		const auto& expressionStatement = static_cast<const ExpressionStatement&>(statement);
-		std::unique_ptr<Value> value;
+		Value value;
 		TRY(Evaluate(*expressionStatement.value, scope, value));
-		PrintValue(*value, false);
+		PrintValue(value, false);
+		return Error::None;
+	}
+	case StatementTag::Switch:
+	{
+		const auto& switchStatement = static_cast<const SwitchStatement&>(statement);
+		const auto& ifStatement = static_cast<const IfStatement&>(*switchStatement.chain.front());
+
+		Value* value;
+		if (!scope->TryGetValue(switchStatement.variable, value) || value->Type() != TypeTag::Number) return RunStatement(ifStatement, scope);
+
+		const size_t arm = FindSwitchArm(switchStatement, value->number);
+		for (const auto& statement : arm < ifStatement.elifChain.size() ? ifStatement.elifChain[arm].statements : ifStatement.elseBlock)
+		{
+			TRY(RunStatement(*statement, scope));
+			if (unwindToken.unwind) return Error::None;
+		}
 		return Error::None;
 	}
+	case StatementTag::Kernel:
+	{
+		const auto& kernel = static_cast<const KernelStatement&>(statement);
+		if (RunKernel(kernel, scope)) return Error::None;
+		return RunStatement(*kernel.loop.front(), scope);
+	}
+	case StatementTag::Fused:
+		return RunFused(static_cast<const FusedStatement&>(statement), scope);
 	}
 	return Error{"Internal error: Unrecognized statement.", statement.pos};
 }
 
-[[nodiscard]] static Error Evaluate(Expression& expression, const std::shared_ptr<Scope>& scope, std::unique_ptr<Value>& out)
+// Counts the node pairs of `statement` and runs it as the parent of the statements it runs.
+[[nodiscard]] static Error RunCountedStatement(const Statement& statement, const Ref<Scope>& scope)
+{
+	CountNodePairs(statement);
+	const Statement* const parent = nodePairState.parent;
+	nodePairState.parent = &statement;
+	nodePairState.pending = &statement;
+	const Error error = RunStatement(statement, scope);
+	nodePairState.parent = parent;
+	return error;
+}
+
+// Runs `whileStatement`, whose condition `fused` computes if not null. The loop is promoted once it ran hotIterations
+// times, between two iterations where all of its state is in the scope.
+[[nodiscard]] static Error RunWhile(const WhileStatement& whileStatement, const FusedStatement* const fused, const Ref<Scope>& scope)
+{
+	LoopTier& tier = whileStatement.tier;
+	while (true)
+	{
+		if (!tier.hot && ++tier.iterations >= interpreterOptions.hotIterations)
+		{
+			bool ran;
+			TRY(PromoteLoop(whileStatement, tier, whileStatement.statements, scope, ran));
+			if (ran) return Error::None;
+		}
+
+		if (interpreterOptions.nodePairs && !fused) CountNodePairs(GetNodeKind(whileStatement), *whileStatement.condition);
+		double a;
+		double b;
+		bool conditionValue;
+		if (fused && TryGetFusedOperands(*fused, scope, a, b)) conditionValue = Compare(fused->op, a, b);
+		else TRY(EvaluateCondition(*whileStatement.condition, scope, "Loop condition is not a boolean and not a number.", conditionValue));
+
+		if (!conditionValue) return Error::None;
+
+		for (const auto& statement : tier.body.empty() ? whileStatement.statements : tier.body)
+		{
+			TRY(RunStatement(*statement, scope));
+			if (unwindToken.unwind) return Error::None;
+		}
+	}
+}
+
+// Returns the counters of `statement` if it's a loop the tree walker promotes, null otherwise. Versions of guarded loops
+// count on their own.
+static LoopTier* GetLoopTier(const Statement& statement)
+{
+	switch (statement.tag)
+	{
+	case StatementTag::While:
+		return &static_cast<const WhileStatement&>(statement).tier;
+	case StatementTag::For:
+		return &static_cast<const ForStatement&>(statement).tier;
+	case StatementTag::Fused:
+	{
+		const auto& fused = static_cast<const FusedStatement&>(statement);
+		return fused.fused == FusedTag::CompareLoop ? GetLoopTier(*fused.original.front()) : nullptr;
+	}
+	default:
+		return nullptr;
+	}
+}
+
+// Marks `loop`, whose counters are `tier`, as hot. With --jit the loop runs to completion as machine code right away,
+// which sets `ran`. Otherwise `body` is fused into `tier`, for the next iterations to run.
+[[nodiscard]] static Error PromoteLoop(const Statement& loop, LoopTier& tier, const std::vector<std::unique_ptr<Statement>>& body, const Ref<Scope>& scope, bool& ran)
+{
+	tier.hot = true;
+	ran = false;
+	if (interpreterOptions.jit) TRY(TryRunJitLoop(loop, scope, ran));
+	if (interpreterOptions.stats) tierState.promotions.push_back({true, loop.pos, tier.iterations, ran});
+	if (!ran && interpreterOptions.fuse)
+	{
+		tier.body = CloneStatements(body);
+		Fuse(tier.body);
+	}
+	return Error::None;
+}
+
+// Runs `loop` as machine code if the JIT can compile it, which sets `ran`.
+[[nodiscard]] static Error TryRunJitLoop(const Statement& loop, const Ref<Scope>& scope, bool& ran)
+{
+	std::optional<Value> returned;
+	TRY(RunJitLoop(loop, scope, ran, returned));
+	if (ran && returned)
+	{
+		unwindToken.unwind = true;
+		unwindToken.returnValue = std::move(*returned);
+	}
+	return Error::None;
+}
+
+// Marks function code `code` as hot on the call at `pos`. Calls run a fused copy of its body from then on, which is
+// specialized to argument types and with --jit compiled to machine code.
+static void PromoteFunction(FunctionCode& code, const CodePos pos)
+{
+	code.hot = true;
+	if (interpreterOptions.fuse)
+	{
+		code.fused = std::make_shared<std::vector<std::unique_ptr<Statement>>>(CloneStatements(*code.statements));
+		Fuse(*code.fused);
+	}
+	if (interpreterOptions.stats) tierState.promotions.push_back({false, pos, code.calls, false});
+}
+
+// Runs `ifStatement` from arm `firstArm` of its elif chain, earlier conditions having been false.
+[[nodiscard]] static Error RunIf(const IfStatement& ifStatement, const size_t firstArm, const Ref<Scope>& scope)
+{
+	const size_t n = ifStatement.elifChain.size();
+	for (size_t i = firstArm; i < n; ++i)
+	{
+		const ConditionBlock& elif = ifStatement.elifChain[i];
+		if (interpreterOptions.nodePairs) CountNodePairs(GetNodeKind(ifStatement), *elif.condition);
+		bool conditionValue;
+		TRY(EvaluateCondition(*elif.condition, scope, "Condition is not a boolean and not a number.", conditionValue));
+
+		if (conditionValue)
+		{
+			for (const auto& statement : elif.statements)
+			{
+				TRY(RunStatement(*statement, scope));
+				if (unwindToken.unwind) return Error::None;
+			}
+			return Error::None;
+		}
+	}
+
+	for (const auto& statement : ifStatement.elseBlock)
+	{
+		TRY(RunStatement(*statement, scope));
+		if (unwindToken.unwind) return Error::None;
+	}
+	return Error::None;
+}
+
+// Runs `fused` on raw numbers, or its original statement when a variable doesn't hold what the shape needs.
+[[nodiscard]] static Error RunFused(const FusedStatement& fused, const Ref<Scope>& scope)
+{
+	const Statement& original = *fused.original.front();
+	switch (fused.fused)
+	{
+	case FusedTag::AddConstant:
+		// NOTE Only a binding of this scope can be updated in place, the assignment binds the variable here otherwise.
+		if (scope->TryAddNumber(fused.variable, fused.number)) return Error::None;
+		return RunStatement(original, scope);
+	case FusedTag::CompareLoop:
+		return RunWhile(static_cast<const WhileStatement&>(original), &fused, scope);
+	case FusedTag::ModuloTest:
+	{
+		const auto& ifStatement = static_cast<const IfStatement&>(original);
+		double a;
+		double b;
+		if (!TryGetFusedOperands(fused, scope, a, b)) return RunStatement(original, scope);
+		if (!Compare(fused.op, Modulo(a, b), fused.constant)) return RunIf(ifStatement, 1, scope);
+
+		for (const auto& statement : ifStatement.elifChain.front().statements)
+		{
+			TRY(RunStatement(*statement, scope));
+			if (unwindToken.unwind) return Error::None;
+		}
+		return Error::None;
+	}
+	case FusedTag::StoreConstant:
+	{
+		Value* arrayValue;
+		Value* index;
+		if (!scope->TryGetValue(fused.variable, arrayValue) || arrayValue->Type() != TypeTag::Array) return RunStatement(original, scope);
+		if (!scope->TryGetValue(fused.operand, index) || index->Type() != TypeTag::Number) return RunStatement(original, scope);
+
+		std::vector<double>& array = arrayValue->GetArray();
+		const size_t indexValue = static_cast<size_t>(index->number);
+		if (indexValue >= array.size()) return RunStatement(original, scope);
+		array[indexValue] = fused.constant;
+		return Error::None;
+	}
+	}
+	return Error{"Internal error: Unrecognized fused statement.", fused.pos};
+}
+
+[[nodiscard]] static Error Evaluate(Expression& expression, const Ref<Scope>& scope, Value& out)
 {
 	switch (expression.tag)
 	{
 		case ExpressionTag::False:
 		{
-			std::shared_ptr<Comment> comment = expression.attachedComment ? std::make_shared<Comment>(*expression.attachedComment, scope) : nullptr;
-			out = std::make_unique<BoolValue>(false, std::move(comment));
+			Ref<Comment> comment = expression.attachedComment ? MakeRef<Comment>(*expression.attachedComment, scope) : nullptr;
+			out = Value(false, std::move(comment));
 			return Error::None;
 		}
 		case ExpressionTag::True:
 		{
-			std::shared_ptr<Comment> comment = expression.attachedComment ? std::make_shared<Comment>(*expression.attachedComment, scope) : nullptr;
-			out = std::make_unique<BoolValue>(true, std::move(comment));
+			Ref<Comment> comment = expression.attachedComment ? MakeRef<Comment>(*expression.attachedComment, scope) : nullptr;
+			out = Value(true, std::move(comment));
 			return Error::None;
 		}
 		case ExpressionTag::NumberLiteral:
 		{
-			std::shared_ptr<Comment> comment = expression.attachedComment ? std::make_shared<Comment>(*expression.attachedComment, scope) : nullptr;
-			out = std::make_unique<NumberValue>(static_cast<const NumberLiteral&>(expression).value, std::move(comment));
+			Ref<Comment> comment = expression.attachedComment ? MakeRef<Comment>(*expression.attachedComment, scope) : nullptr;
+			out = Value(static_cast<const NumberLiteral&>(expression).value, std::move(comment));
 			return Error::None;
 		}
 		case ExpressionTag::ArrayLiteral:
 		{
-			std::shared_ptr<Comment> comment = expression.attachedComment ? std::make_shared<Comment>(*expression.attachedComment, scope) : nullptr;
+			Ref<Comment> comment = expression.attachedComment ? MakeRef<Comment>(*expression.attachedComment, scope) : nullptr;
 			const auto& arrayLiteral = static_cast<const ArrayLiteral&>(expression);
 			std::vector<double> array;
 			array.reserve(arrayLiteral.values.size());
 			for (const auto& valueExpression : arrayLiteral.values)
 			{
-				std::unique_ptr<Value> value;
-				TRY(Evaluate(*valueExpression, scope, value));
-
-				if (value->type != TypeTag::Number)
-				{
-					return Error{"Array initializer is not a number.", valueExpression->pos};
-				}
-				array.push_back(static_cast<const NumberValue&>(*value).value);
+				double value;
+				TRY(EvaluateNumber(*valueExpression, scope, "Array initializer is not a number.", value));
+				array.push_back(value);
 			}
 
-			out = std::make_unique<ArrayRef>(std::make_shared<std::vector<double>>(std::move(array)), std::move(comment));
+			out = Value(MakeRef<Array>(std::move(array)), std::move(comment));
 			return Error::None;
 		}
 		case ExpressionTag::FunctionLiteral:
 		{
-			std::shared_ptr<Comment> comment = expression.attachedComment ? std::make_shared<Comment>(*expression.attachedComment, scope) : nullptr;
+			Ref<Comment> comment = expression.attachedComment ? MakeRef<Comment>(*expression.attachedComment, scope) : nullptr;
 			FunctionLiteral& functionLiteral = static_cast<FunctionLiteral&>(expression);
-			out = std::make_unique<FunctionRef>(std::make_shared<Function>(functionLiteral.args, functionLiteral.statements, scope), std::move(comment));
+			if (!functionLiteral.code) functionLiteral.code = std::make_shared<FunctionCode>(functionLiteral.statements);
+			out = Value(MakeRef<Function>(functionLiteral.args, functionLiteral.code, scope), std::move(comment));
 			return Error::None;
 		}
 		case ExpressionTag::Identifier:
 		{
 			const Identifier& identifier = static_cast<const Identifier&>(expression);
-			std::unique_ptr<Value>* value;
-			if (!scope->TryGetValue(identifier.name, value))
+			Value* value;
+			if (!LookUp(identifier, *scope, value))
 			{
-				out = std::make_unique<Value>(TypeTag::Void, nullptr);
+				out = Value();
 			}
 			else
 			{
-				out = (*value)->make_clone();
+				out = *value;
 			}
 			if (expression.attachedComment)
 			{
-				out->attachedComment = std::make_shared<Comment>(*expression.attachedComment, scope);
+				out.SetComment(MakeRef<Comment>(*expression.attachedComment, scope));
+			}
+			return Error::None;
+		}
+		case ExpressionTag::Constant:
+		{
+			out = static_cast<const Constant&>(expression).value;
+			if (expression.attachedComment)
+			{
+				out.SetComment(MakeRef<Comment>(*expression.attachedComment, scope));
 			}
 			return Error::None;
 		}
@@ -415,54 +843,55 @@ void Interpret(std::string_view filePrefix, std::vector<std::unique_ptr<Statemen
 			{
 			case TokenTag::KeyNot:
 			{
-				if (out->type != TypeTag::Bool)
+				if (out.Type() != TypeTag::Bool)
 				{
 					return Error("Logical not of non-boolean value.", unaryOp.a->pos);
 				}
 
-				auto& boolValue = static_cast<BoolValue&>(*out);
-				boolValue.value = !boolValue.value;
+				out.boolean = !out.boolean;
 				if (expression.attachedComment)
 				{
-					out->attachedComment = std::make_shared<Comment>(*expression.attachedComment, scope);
+					out.SetComment(MakeRef<Comment>(*expression.attachedComment, scope));
 				}
 				return Error::None;
 			}
 			case TokenTag::KeyNeg:
 			{
-				if (out->type != TypeTag::Number)
+				if (out.Type() != TypeTag::Number)
 				{
 					return Error("Negation of non-number value.", unaryOp.a->pos);
 				}
 
-				auto& numberValue = static_cast<NumberValue&>(*out);
-				numberValue.value = -numberValue.value;
+				out.number = -out.number;
 				if (expression.attachedComment)
 				{
-					out->attachedComment = std::make_shared<Comment>(*expression.attachedComment, scope);
+					out.SetComment(MakeRef<Comment>(*expression.attachedComment, scope));
 				}
 				return Error::None;
 			}
 			case TokenTag::KeyVoid:
+			{
 				// NOTE We don't skip evaluating voiding expression to allow side effects to happen.
-				out = std::make_unique<Value>(TypeTag::Void, out->attachedComment);
+				Ref<Comment> comment = out.GetComment();
+				out = Value();
+				out.SetComment(std::move(comment));
 				if (expression.attachedComment)
 				{
-					out->attachedComment = std::make_shared<Comment>(*expression.attachedComment, scope);
+					out.SetComment(MakeRef<Comment>(*expression.attachedComment, scope));
 				}
 				return Error::None;
+			}
 			case TokenTag::Hash:
 			{
-				if (out->type != TypeTag::Array)
+				if (out.Type() != TypeTag::Array)
 				{
 					return Error("Array length operator used on non-array value.", unaryOp.a->pos);
 				}
 
-				const auto& arrayRef = static_cast<const ArrayRef&>(*out);
-				out = std::make_unique<NumberValue>(static_cast<double>(arrayRef.array->size()), arrayRef.attachedComment);
+				out = Value(static_cast<double>(out.GetArray().size()), out.GetComment());
 				if (expression.attachedComment)
 				{
-					out->attachedComment = std::make_shared<Comment>(*expression.attachedComment, scope);
+					out.SetComment(MakeRef<Comment>(*expression.attachedComment, scope));
 				}
 				return Error::None;
 			}
@@ -474,6 +903,34 @@ void Interpret(std::string_view filePrefix, std::vector<std::unique_ptr<Statemen
 		{
 			const BinaryOperation& binaryOp = static_cast<const BinaryOperation&>(expression);
 
+			// NOTE A short-circuited and/or result doesn't get the expression's comment, which the quickened operation
+			// can't tell, so it only runs when the comment can't be observed.
+			if (CanQuicken(expression))
+			{
+				bool quick;
+				Ref<Comment> comment = HasObservableComment(expression) ? MakeRef<Comment>(*expression.attachedComment, scope) : nullptr;
+				if (IsNumberOperation(binaryOp.op))
+				{
+					double number;
+					TRY(EvaluateQuickNumber(expression, scope, quick, number));
+					if (quick)
+					{
+						out = Value(number, std::move(comment));
+						return Error::None;
+					}
+				}
+				else if (!comment || (binaryOp.op != TokenTag::KeyAnd && binaryOp.op != TokenTag::KeyOr))
+				{
+					bool boolean;
+					TRY(EvaluateQuickBool(expression, scope, quick, boolean));
+					if (quick)
+					{
+						out = Value(boolean, std::move(comment));
+						return Error::None;
+					}
+				}
+			}
+
 			TRY(Evaluate(*binaryOp.a, scope, out));
 
 			// NOTE Not evaluating second operand right now because of short-circuit guarantees.
@@ -482,303 +939,1550 @@ void Interpret(std::string_view filePrefix, std::vector<std::unique_ptr<Statemen
 			{
 			case TokenTag::Plus:
 			{
-				if (out->type != TypeTag::Number) return Error("Arithmetic operand is not a number.", binaryOp.a->pos);
-
-				NumberValue& numberValue = static_cast<NumberValue&>(*out);
+				if (out.Type() != TypeTag::Number) return Error("Arithmetic operand is not a number.", binaryOp.a->pos);
 
-				std::unique_ptr<Value> b;
+				Value b;
 				TRY(Evaluate(*binaryOp.b, scope, b));
-				if (b->type != TypeTag::Number) return Error("Arithmetic operand is not a number.", binaryOp.b->pos);
+				if (b.Type() != TypeTag::Number) return Error("Arithmetic operand is not a number.", binaryOp.b->pos);
 
-				numberValue.value += static_cast<const NumberValue&>(*b).value;
-				if (expression.attachedComment) out->attachedComment = std::make_shared<Comment>(*expression.attachedComment, scope);
-				else if (out->attachedComment && b->attachedComment) out->attachedComment = nullptr;
-				else if (b->attachedComment) out->attachedComment = b->attachedComment;
+				out.number += b.number;
+				CombineComments(expression, scope, b, out);
 				return Error::None;
 			}
 			case TokenTag::Minus:
 			{
-				if (out->type != TypeTag::Number) return Error("Arithmetic operand is not a number.", binaryOp.a->pos);
+				if (out.Type() != TypeTag::Number) return Error("Arithmetic operand is not a number.", binaryOp.a->pos);
 
-				NumberValue& numberValue = static_cast<NumberValue&>(*out);
-
-				std::unique_ptr<Value> b;
+				Value b;
 				TRY(Evaluate(*binaryOp.b, scope, b));
-				if (b->type != TypeTag::Number) return Error("Arithmetic operand is not a number.", binaryOp.b->pos);
+				if (b.Type() != TypeTag::Number) return Error("Arithmetic operand is not a number.", binaryOp.b->pos);
 
-				numberValue.value -= static_cast<const NumberValue&>(*b).value;
-				if (expression.attachedComment) out->attachedComment = std::make_shared<Comment>(*expression.attachedComment, scope);
-				else if (out->attachedComment && b->attachedComment) out->attachedComment = nullptr;
-				else if (b->attachedComment) out->attachedComment = b->attachedComment;
+				out.number -= b.number;
+				CombineComments(expression, scope, b, out);
 				return Error::None;
 			}
 			case TokenTag::Star:
 			{
-				if (out->type != TypeTag::Number) return Error("Arithmetic operand is not a number.", binaryOp.a->pos);
-
-				NumberValue& numberValue = static_cast<NumberValue&>(*out);
+				if (out.Type() != TypeTag::Number) return Error("Arithmetic operand is not a number.", binaryOp.a->pos);
 
-				std::unique_ptr<Value> b;
+				Value b;
 				TRY(Evaluate(*binaryOp.b, scope, b));
-				if (b->type != TypeTag::Number) return Error("Arithmetic operand is not a number.", binaryOp.b->pos);
+				if (b.Type() != TypeTag::Number) return Error("Arithmetic operand is not a number.", binaryOp.b->pos);
 
-				numberValue.value *= static_cast<const NumberValue&>(*b).value;
-				if (expression.attachedComment) out->attachedComment = std::make_shared<Comment>(*expression.attachedComment, scope);
-				else if (out->attachedComment && b->attachedComment) out->attachedComment = nullptr;
-				else if (b->attachedComment) out->attachedComment = b->attachedComment;
+				out.number *= b.number;
+				CombineComments(expression, scope, b, out);
 				return Error::None;
 			}
 			case TokenTag::Slash:
 			{
-				if (out->type != TypeTag::Number) return Error("Arithmetic operand is not a number.", binaryOp.a->pos);
+				if (out.Type() != TypeTag::Number) return Error("Arithmetic operand is not a number.", binaryOp.a->pos);
 
-				NumberValue& numberValue = static_cast<NumberValue&>(*out);
-
-				std::unique_ptr<Value> b;
+				Value b;
 				TRY(Evaluate(*binaryOp.b, scope, b));
-				if (b->type != TypeTag::Number) return Error("Arithmetic operand is not a number.", binaryOp.b->pos);
+				if (b.Type() != TypeTag::Number) return Error("Arithmetic operand is not a number.", binaryOp.b->pos);
 
-				numberValue.value /= static_cast<const NumberValue&>(*b).value;
-				if (expression.attachedComment) out->attachedComment = std::make_shared<Comment>(*expression.attachedComment, scope);
-				else if (out->attachedComment && b->attachedComment) out->attachedComment = nullptr;
-				else if (b->attachedComment) out->attachedComment = b->attachedComment;
+				out.number /= b.number;
+				CombineComments(expression, scope, b, out);
 				return Error::None;
 			}
 			case TokenTag::Percent:
 			{
-				if (out->type != TypeTag::Number) return Error("Arithmetic operand is not a number.", binaryOp.a->pos);
-
-				NumberValue& numberValue = static_cast<NumberValue&>(*out);
+				if (out.Type() != TypeTag::Number) return Error("Arithmetic operand is not a number.", binaryOp.a->pos);
 
-				std::unique_ptr<Value> b;
+				Value b;
 				TRY(Evaluate(*binaryOp.b, scope, b));
-				if (b->type != TypeTag::Number) return Error("Arithmetic operand is not a number.", binaryOp.b->pos);
+				if (b.Type() != TypeTag::Number) return Error("Arithmetic operand is not a number.", binaryOp.b->pos);
 
-				const double bValue = static_cast<const NumberValue&>(*b).value;
-				numberValue.value = fmod(fmod(numberValue.value, bValue) + bValue, bValue);
-				if (expression.attachedComment) out->attachedComment = std::make_shared<Comment>(*expression.attachedComment, scope);
-				else if (out->attachedComment && b->attachedComment) out->attachedComment = nullptr;
-				else if (b->attachedComment) out->attachedComment = b->attachedComment;
+				out.number = Modulo(out.number, b.number);
+				CombineComments(expression, scope, b, out);
 				return Error::None;
 			}
 			case TokenTag::KeyAnd:
 			{
-				if (out->type != TypeTag::Bool) return Error("Logical operand is not boolean.", binaryOp.a->pos);
-
-				BoolValue& boolValue = static_cast<BoolValue&>(*out);
+				if (out.Type() != TypeTag::Bool) return Error("Logical operand is not boolean.", binaryOp.a->pos);
 
 				// short-circuit
-				if (!boolValue.value) return Error::None;
+				if (!out.boolean) return Error::None;
 
-				std::unique_ptr<Value> b;
+				Value b;
 				TRY(Evaluate(*binaryOp.b, scope, b));
-				if (b->type != TypeTag::Bool) return Error("Logic operand is not boolean.", binaryOp.b->pos);
+				if (b.Type() != TypeTag::Bool) return Error("Logic operand is not boolean.", binaryOp.b->pos);
 
-				boolValue.value = boolValue.value && static_cast<const BoolValue&>(*b).value;
-				if (expression.attachedComment) out->attachedComment = std::make_shared<Comment>(*expression.attachedComment, scope);
-				else if (out->attachedComment && b->attachedComment) out->attachedComment = nullptr;
-				else if (b->attachedComment) out->attachedComment = b->attachedComment;
+				out.boolean = out.boolean && b.boolean;
+				CombineComments(expression, scope, b, out);
 				return Error::None;
 			}
 			case TokenTag::KeyOr:
 			{
-				if (out->type != TypeTag::Bool) return Error("Logic operand is not boolean.", binaryOp.a->pos);
-
-				BoolValue& boolValue = static_cast<BoolValue&>(*out);
+				if (out.Type() != TypeTag::Bool) return Error("Logic operand is not boolean.", binaryOp.a->pos);
 
 				// short-circuit
-				if (boolValue.value) return Error::None;
+				if (out.boolean) return Error::None;
 
-				std::unique_ptr<Value> b;
+				Value b;
 				TRY(Evaluate(*binaryOp.b, scope, b));
-				if (b->type != TypeTag::Bool) return Error("Logic operand is not boolean.", binaryOp.b->pos);
+				if (b.Type() != TypeTag::Bool) return Error("Logic operand is not boolean.", binaryOp.b->pos);
 
-				boolValue.value = boolValue.value || static_cast<const BoolValue&>(*b).value;
-				if (expression.attachedComment) out->attachedComment = std::make_shared<Comment>(*expression.attachedComment, scope);
-				else if (out->attachedComment && b->attachedComment) out->attachedComment = nullptr;
-				else if (b->attachedComment) out->attachedComment = b->attachedComment;
+				out.boolean = out.boolean || b.boolean;
+				CombineComments(expression, scope, b, out);
 				return Error::None;
 			}
 			case TokenTag::KeyXor:
 			{
-				if (out->type != TypeTag::Bool) return Error("Logic operand is not boolean.", binaryOp.a->pos);
+				if (out.Type() != TypeTag::Bool) return Error("Logic operand is not boolean.", binaryOp.a->pos);
 
-				BoolValue& boolValue = static_cast<BoolValue&>(*out);
-
-				std::unique_ptr<Value> b;
+				Value b;
 				TRY(Evaluate(*binaryOp.b, scope, b));
-				if (b->type != TypeTag::Bool) return Error("Logic operand is not boolean.", binaryOp.b->pos);
+				if (b.Type() != TypeTag::Bool) return Error("Logic operand is not boolean.", binaryOp.b->pos);
 
-				boolValue.value = boolValue.value != static_cast<const BoolValue&>(*b).value;
-				if (expression.attachedComment) out->attachedComment = std::make_shared<Comment>(*expression.attachedComment, scope);
-				else if (out->attachedComment && b->attachedComment) out->attachedComment = nullptr;
-				else if (b->attachedComment) out->attachedComment = b->attachedComment;
+				out.boolean = out.boolean != b.boolean;
+				CombineComments(expression, scope, b, out);
 				return Error::None;
 			}
 			case TokenTag::LessThan:
 			{
-				if (out->type != TypeTag::Number) return Error("Comparison operand is not a number.", binaryOp.a->pos);
+				if (out.Type() != TypeTag::Number) return Error("Comparison operand is not a number.", binaryOp.a->pos);
 
-				std::unique_ptr<Value> b;
+				Value b;
 				TRY(Evaluate(*binaryOp.b, scope, b));
-				if (b->type != TypeTag::Number) return Error("Arithmetic operand is not a number.", binaryOp.b->pos);
+				if (b.Type() != TypeTag::Number) return Error("Arithmetic operand is not a number.", binaryOp.b->pos);
 
-				out = std::make_unique<BoolValue>(static_cast<NumberValue&>(*out).value < static_cast<const NumberValue&>(*b).value, out->attachedComment);
-				if (expression.attachedComment) out->attachedComment = std::make_shared<Comment>(*expression.attachedComment, scope);
-				else if (out->attachedComment && b->attachedComment) out->attachedComment = nullptr;
-				else if (b->attachedComment) out->attachedComment = b->attachedComment;
+				out = Value(out.number < b.number, out.GetComment());
+				CombineComments(expression, scope, b, out);
 				return Error::None;
 			}
 			case TokenTag::GreaterThan:
 			{
-				if (out->type != TypeTag::Number) return Error("Comparison operand is not a number.", binaryOp.a->pos);
+				if (out.Type() != TypeTag::Number) return Error("Comparison operand is not a number.", binaryOp.a->pos);
 
-				std::unique_ptr<Value> b;
+				Value b;
 				TRY(Evaluate(*binaryOp.b, scope, b));
-				if (b->type != TypeTag::Number) return Error("Arithmetic operand is not a number.", binaryOp.b->pos);
+				if (b.Type() != TypeTag::Number) return Error("Arithmetic operand is not a number.", binaryOp.b->pos);
 
-				out = std::make_unique<BoolValue>(static_cast<NumberValue&>(*out).value > static_cast<const NumberValue&>(*b).value, out->attachedComment);
-				if (expression.attachedComment) out->attachedComment = std::make_shared<Comment>(*expression.attachedComment, scope);
-				else if (out->attachedComment && b->attachedComment) out->attachedComment = nullptr;
-				else if (b->attachedComment) out->attachedComment = b->attachedComment;
+				out = Value(out.number > b.number, out.GetComment());
+				CombineComments(expression, scope, b, out);
 				return Error::None;
 			}
 			case TokenTag::LessEquals:
 			{
-				if (out->type != TypeTag::Number) return Error("Comparison operand is not a number.", binaryOp.a->pos);
+				if (out.Type() != TypeTag::Number) return Error("Comparison operand is not a number.", binaryOp.a->pos);
 
-				std::unique_ptr<Value> b;
+				Value b;
 				TRY(Evaluate(*binaryOp.b, scope, b));
-				if (b->type != TypeTag::Number) return Error("Arithmetic operand is not a number.", binaryOp.b->pos);
+				if (b.Type() != TypeTag::Number) return Error("Arithmetic operand is not a number.", binaryOp.b->pos);
 
-				out = std::make_unique<BoolValue>(static_cast<NumberValue&>(*out).value <= static_cast<const NumberValue&>(*b).value, out->attachedComment);
-				if (expression.attachedComment) out->attachedComment = std::make_shared<Comment>(*expression.attachedComment, scope);
-				else if (out->attachedComment && b->attachedComment) out->attachedComment = nullptr;
-				else if (b->attachedComment) out->attachedComment = b->attachedComment;
+				out = Value(out.number <= b.number, out.GetComment());
+				CombineComments(expression, scope, b, out);
 				return Error::None;
 			}
 			case TokenTag::GreaterEquals:
 			{
-				if (out->type != TypeTag::Number) return Error("Comparison operand is not a number.", binaryOp.a->pos);
+				if (out.Type() != TypeTag::Number) return Error("Comparison operand is not a number.", binaryOp.a->pos);
 
-				std::unique_ptr<Value> b;
+				Value b;
 				TRY(Evaluate(*binaryOp.b, scope, b));
-				if (b->type != TypeTag::Number) return Error("Arithmetic operand is not a number.", binaryOp.b->pos);
+				if (b.Type() != TypeTag::Number) return Error("Arithmetic operand is not a number.", binaryOp.b->pos);
 
-				out = std::make_unique<BoolValue>(static_cast<NumberValue&>(*out).value >= static_cast<const NumberValue&>(*b).value, out->attachedComment);
-				if (expression.attachedComment) out->attachedComment = std::make_shared<Comment>(*expression.attachedComment, scope);
-				else if (out->attachedComment && b->attachedComment) out->attachedComment = nullptr;
-				else if (b->attachedComment) out->attachedComment = b->attachedComment;
+				out = Value(out.number >= b.number, out.GetComment());
+				CombineComments(expression, scope, b, out);
 				return Error::None;
 			}
 			case TokenTag::EqualsEquals:
 			{
-				if (out->type != TypeTag::Number) return Error("Comparison operand is not a number.", binaryOp.a->pos);
+				if (out.Type() != TypeTag::Number) return Error("Comparison operand is not a number.", binaryOp.a->pos);
 
-				std::unique_ptr<Value> b;
+				Value b;
 				TRY(Evaluate(*binaryOp.b, scope, b));
-				if (b->type != TypeTag::Number) return Error("Arithmetic operand is not a number.", binaryOp.b->pos);
+				if (b.Type() != TypeTag::Number) return Error("Arithmetic operand is not a number.", binaryOp.b->pos);
 
-				out = std::make_unique<BoolValue>(static_cast<NumberValue&>(*out).value == static_cast<const NumberValue&>(*b).value, out->attachedComment);
-				if (expression.attachedComment) out->attachedComment = std::make_shared<Comment>(*expression.attachedComment, scope);
-				else if (out->attachedComment && b->attachedComment) out->attachedComment = nullptr;
-				else if (b->attachedComment) out->attachedComment = b->attachedComment;
+				out = Value(out.number == b.number, out.GetComment());
+				CombineComments(expression, scope, b, out);
 				return Error::None;
 			}
 			case TokenTag::NotEquals:
 			{
-				if (out->type != TypeTag::Number) return Error("Comparison operand is not a number.", binaryOp.a->pos);
+				if (out.Type() != TypeTag::Number) return Error("Comparison operand is not a number.", binaryOp.a->pos);
 
-				std::unique_ptr<Value> b;
+				Value b;
 				TRY(Evaluate(*binaryOp.b, scope, b));
-				if (b->type != TypeTag::Number) return Error("Arithmetic operand is not a number.", binaryOp.b->pos);
+				if (b.Type() != TypeTag::Number) return Error("Arithmetic operand is not a number.", binaryOp.b->pos);
+
+				out = Value(out.number != b.number, out.GetComment());
+				CombineComments(expression, scope, b, out);
+				return Error::None;
+			}
+			case TokenTag::KeyMap:
+			{
+				if (out.Type() != TypeTag::Function) return Error("Map function operand is not a function.", binaryOp.a->pos);
 
-				out = std::make_unique<BoolValue>(static_cast<NumberValue&>(*out).value != static_cast<const NumberValue&>(*b).value, out->attachedComment);
-				if (expression.attachedComment) out->attachedComment = std::make_shared<Comment>(*expression.attachedComment, scope);
-				else if (out->attachedComment && b->attachedComment) out->attachedComment = nullptr;
-				else if (b->attachedComment) out->attachedComment = b->attachedComment;
+				Value b;
+				TRY(Evaluate(*binaryOp.b, scope, b));
+				if (b.Type() != TypeTag::Array) return Error("Map array operand is not an array.", binaryOp.b->pos);
+
+				const Ref<Function> function = out.GetFunctionRef();
+				auto mapped = MakeRef<Array>();
+				TRY(MapArray(*function, b.GetArray(), binaryOp.pos, [&](const double element, Value& result) {
+					PreparedCall prepared;
+					BeginCall(function, binaryOp.pos, prepared);
+					BindArgument(prepared, 0, Value(element));
+					return RunCall(prepared, result);
+				}, mapped->elements));
+
+				out = Value(std::move(mapped), out.GetComment());
+				CombineComments(expression, scope, b, out);
 				return Error::None;
 			}
 			case TokenTag::At:
 			{
-				if (out->type != TypeTag::Array) return Error("Array read array operand is not an array.", binaryOp.a->pos);
+				if (out.Type() != TypeTag::Array) return Error("Array read array operand is not an array.", binaryOp.a->pos);
 
-				const ArrayRef& array = static_cast<const ArrayRef&>(*out);
+				const std::vector<double>& array = out.GetArray();
 
-				std::unique_ptr<Value> b;
+				Value b;
 				TRY(Evaluate(*binaryOp.b, scope, b));
-				if (b->type != TypeTag::Number) return Error("Array read index operand is not a number.", binaryOp.b->pos);
+				if (b.Type() != TypeTag::Number) return Error("Array read index operand is not a number.", binaryOp.b->pos);
 
-				const size_t indexValue = static_cast<size_t>(static_cast<const NumberValue&>(*b).value);
+				const size_t indexValue = static_cast<size_t>(b.number);
 
-				if (indexValue >= array.array->size())
+				if (indexValue >= array.size())
 				{
-					return Error{Format("Array index %zu out of bounds (array length is %zu).", indexValue, array.array->size()), binaryOp.b->pos};
+					return Error{Format("Array index %zu out of bounds (array length is %zu).", indexValue, array.size()), binaryOp.b->pos};
 				}
 
-				out = std::make_unique<NumberValue>((*array.array)[indexValue], out->attachedComment);
-				if (expression.attachedComment) out->attachedComment = std::make_shared<Comment>(*expression.attachedComment, scope);
-				else if (out->attachedComment && b->attachedComment) out->attachedComment = nullptr;
-				else if (b->attachedComment) out->attachedComment = b->attachedComment;
+				out = Value(array[indexValue], out.GetComment());
+				CombineComments(expression, scope, b, out);
 				return Error::None;
 			}
 			default:
 				return Error{"Internal error: Unrecognized binary operation.", binaryOp.pos};
 			}
 		}
-		case ExpressionTag::Call:
+		case ExpressionTag::TypedBinary:
 		{
-			const Call& call = static_cast<const Call&>(expression);
+			// NOTE Operand types were proven by SpecializeFunction, only array bounds still need checking.
+			const BinaryOperation& binaryOp = static_cast<const BinaryOperation&>(expression);
 
-			std::unique_ptr<Value> functionValue;
-			TRY(Evaluate(*call.function, scope, functionValue));
-			if (functionValue->type != TypeTag::Function)
-			{
-				return Error("Call on a a non-function value.", call.function->pos);
+			TRY(Evaluate(*binaryOp.a, scope, out));
+
+			// short-circuit
+			if (binaryOp.op == TokenTag::KeyAnd && !out.boolean) return Error::None;
+			if (binaryOp.op == TokenTag::KeyOr && out.boolean) return Error::None;
+
+			Value b;
+			TRY(Evaluate(*binaryOp.b, scope, b));
+
+			const double aNumber = out.Type() == TypeTag::Number ? out.number : 0.0;
+			const double bNumber = b.Type() == TypeTag::Number ? b.number : 0.0;
+
+			switch (binaryOp.op)
+			{
+			case TokenTag::Plus: out.number = aNumber + bNumber; break;
+			case TokenTag::Minus: out.number = aNumber - bNumber; break;
+			case TokenTag::Star: out.number = aNumber * bNumber; break;
+			case TokenTag::Slash: out.number = aNumber / bNumber; break;
+			case TokenTag::Percent: out.number = Modulo(aNumber, bNumber); break;
+			case TokenTag::KeyAnd:
+			case TokenTag::KeyOr:
+				out.boolean = b.boolean;
+				break;
+			case TokenTag::KeyXor: out.boolean = out.boolean != b.boolean; break;
+			case TokenTag::LessThan: out = Value(aNumber < bNumber, out.GetComment()); break;
+			case TokenTag::GreaterThan: out = Value(aNumber > bNumber, out.GetComment()); break;
+			case TokenTag::LessEquals: out = Value(aNumber <= bNumber, out.GetComment()); break;
+			case TokenTag::GreaterEquals: out = Value(aNumber >= bNumber, out.GetComment()); break;
+			case TokenTag::EqualsEquals: out = Value(aNumber == bNumber, out.GetComment()); break;
+			case TokenTag::NotEquals: out = Value(aNumber != bNumber, out.GetComment()); break;
+			case TokenTag::At:
+			{
+				const std::vector<double>& array = out.GetArray();
+				const size_t indexValue = static_cast<size_t>(bNumber);
+
+				if (indexValue >= array.size())
+				{
+					return Error{Format("Array index %zu out of bounds (array length is %zu).", indexValue, array.size()), binaryOp.b->pos};
+				}
+
+				out = Value(array[indexValue], out.GetComment());
+				break;
 			}
+			default:
+				return Error{"Internal error: Unrecognized binary operation.", binaryOp.pos};
+			}
+
+			CombineComments(expression, scope, b, out);
+			return Error::None;
+		}
+		case ExpressionTag::InBoundsRead:
+		{
+			// NOTE The loop guard proved the operand types and that the index is in bounds.
+			const BinaryOperation& binaryOp = static_cast<const BinaryOperation&>(expression);
+
+			TRY(Evaluate(*binaryOp.a, scope, out));
+			Value b;
+			TRY(Evaluate(*binaryOp.b, scope, b));
+
+			const std::vector<double>& array = out.GetArray();
+			out = Value(array[static_cast<size_t>(b.number)], out.GetComment());
+			CombineComments(expression, scope, b, out);
+			return Error::None;
+		}
+		case ExpressionTag::Call:
+		{
+			const Call& call = static_cast<const Call&>(expression);
+			if (StackExhausted()) return Error{"Stack overflow.", call.pos};
 
-			const auto& functionRef = static_cast<const FunctionRef&>(*functionValue);
-			const Function& function = *functionRef.function;
+			PreparedCall prepared;
+			TRY(PrepareCall(call, scope, prepared));
+			return RunCall(prepared, out);
+		}
+	}
+	return Error{"Internal error: Unrecognized expression.", expression.pos};
+}
+
+// Evaluates an expression whose result is only used as a raw number, so comments are not tracked. Specialized
+// arithmetic and array reads are computed without allocating intermediate values.
+[[nodiscard]] static Error EvaluateNumber(Expression& expression, const Ref<Scope>& scope, const char* errorMessage, double& out)
+{
+	if (CanQuicken(expression) && IsNumberOperation(static_cast<const BinaryOperation&>(expression).op))
+	{
+		bool quick;
+		TRY(EvaluateQuickNumber(expression, scope, quick, out));
+		if (quick) return Error::None;
+	}
 
-			if (function.args->size() != call.values.size())
+	if (expression.tag == ExpressionTag::TypedBinary)
+	{
+		const BinaryOperation& binaryOp = static_cast<const BinaryOperation&>(expression);
+
+		if (binaryOp.op == TokenTag::At)
+		{
+			Value array;
+			TRY(Evaluate(*binaryOp.a, scope, array));
+			const std::vector<double>& elements = array.GetArray();
+
+			double index;
+			TRY(EvaluateNumber(*binaryOp.b, scope, "Array read index operand is not a number.", index));
+			const size_t indexValue = static_cast<size_t>(index);
+
+			if (indexValue >= elements.size())
 			{
-				return Error(Format("Provided %zu argument(s) for function that takes %zu.", call.values.size(), function.args->size()), call.pos);
+				return Error{Format("Array index %zu out of bounds (array length is %zu).", indexValue, elements.size()), binaryOp.b->pos};
 			}
 
-			std::shared_ptr<Scope> innerScope = std::make_shared<Scope>();
-			const size_t n = call.values.size();
-			for (size_t i = 0; i < n; ++i)
+			out = elements[indexValue];
+			return Error::None;
+		}
+
+		double a;
+		double b;
+		switch (binaryOp.op)
+		{
+		case TokenTag::Plus:
+		case TokenTag::Minus:
+		case TokenTag::Star:
+		case TokenTag::Slash:
+		case TokenTag::Percent:
+			TRY(EvaluateNumber(*binaryOp.a, scope, "Arithmetic operand is not a number.", a));
+			TRY(EvaluateNumber(*binaryOp.b, scope, "Arithmetic operand is not a number.", b));
+			break;
+		default:
+			break;
+		}
+
+		switch (binaryOp.op)
+		{
+		case TokenTag::Plus: out = a + b; return Error::None;
+		case TokenTag::Minus: out = a - b; return Error::None;
+		case TokenTag::Star: out = a * b; return Error::None;
+		case TokenTag::Slash: out = a / b; return Error::None;
+		case TokenTag::Percent: out = Modulo(a, b); return Error::None;
+		default: break;
+		}
+	}
+	else if (expression.tag == ExpressionTag::InBoundsRead)
+	{
+		const BinaryOperation& binaryOp = static_cast<const BinaryOperation&>(expression);
+
+		double index;
+		TRY(EvaluateNumber(*binaryOp.b, scope, "Array read index operand is not a number.", index));
+
+		Value* arrayValue;
+		if (binaryOp.a->tag == ExpressionTag::Identifier && LookUp(static_cast<const Identifier&>(*binaryOp.a), *scope, arrayValue))
+		{
+			out = arrayValue->GetArray()[static_cast<size_t>(index)];
+			return Error::None;
+		}
+
+		Value array;
+		TRY(Evaluate(*binaryOp.a, scope, array));
+		out = array.GetArray()[static_cast<size_t>(index)];
+		return Error::None;
+	}
+	else if (expression.tag == ExpressionTag::NumberLiteral)
+	{
+		out = static_cast<const NumberLiteral&>(expression).value;
+		return Error::None;
+	}
+	else if (expression.tag == ExpressionTag::Constant && static_cast<const Constant&>(expression).value.Type() == TypeTag::Number)
+	{
+		out = static_cast<const Constant&>(expression).value.number;
+		return Error::None;
+	}
+	else if (expression.tag == ExpressionTag::Identifier)
+	{
+		Value* value;
+		if (LookUp(static_cast<const Identifier&>(expression), *scope, value) && value->Type() == TypeTag::Number)
+		{
+			out = value->number;
+			return Error::None;
+		}
+	}
+
+	Value value;
+	TRY(Evaluate(expression, scope, value));
+	if (value.Type() != TypeTag::Number) return Error{errorMessage, expression.pos};
+	out = value.number;
+	return Error::None;
+}
+
+// Same as EvaluateNumber, but for boolean results.
+[[nodiscard]] static Error EvaluateBool(Expression& expression, const Ref<Scope>& scope, const char* errorMessage, bool& out)
+{
+	if (CanQuicken(expression) && !IsNumberOperation(static_cast<const BinaryOperation&>(expression).op))
+	{
+		bool quick;
+		TRY(EvaluateQuickBool(expression, scope, quick, out));
+		if (quick) return Error::None;
+	}
+
+	if (expression.tag == ExpressionTag::TypedBinary)
+	{
+		const BinaryOperation& binaryOp = static_cast<const BinaryOperation&>(expression);
+
+		switch (binaryOp.op)
+		{
+		case TokenTag::KeyAnd:
+			TRY(EvaluateBool(*binaryOp.a, scope, "Logical operand is not boolean.", out));
+			if (!out) return Error::None;
+			return EvaluateBool(*binaryOp.b, scope, "Logic operand is not boolean.", out);
+		case TokenTag::KeyOr:
+			TRY(EvaluateBool(*binaryOp.a, scope, "Logic operand is not boolean.", out));
+			if (out) return Error::None;
+			return EvaluateBool(*binaryOp.b, scope, "Logic operand is not boolean.", out);
+		case TokenTag::KeyXor:
+		{
+			bool a;
+			bool b;
+			TRY(EvaluateBool(*binaryOp.a, scope, "Logic operand is not boolean.", a));
+			TRY(EvaluateBool(*binaryOp.b, scope, "Logic operand is not boolean.", b));
+			out = a != b;
+			return Error::None;
+		}
+		case TokenTag::LessThan:
+		case TokenTag::GreaterThan:
+		case TokenTag::LessEquals:
+		case TokenTag::GreaterEquals:
+		case TokenTag::EqualsEquals:
+		case TokenTag::NotEquals:
+		{
+			double a;
+			double b;
+			TRY(EvaluateNumber(*binaryOp.a, scope, "Comparison operand is not a number.", a));
+			TRY(EvaluateNumber(*binaryOp.b, scope, "Arithmetic operand is not a number.", b));
+			switch (binaryOp.op)
 			{
-				Expression& argExpression = *call.values[i];
-				std::unique_ptr<Value> argValue;
-				TRY(Evaluate(argExpression, scope, argValue));
-				innerScope->SetValue((*function.args)[i], std::move(argValue));
+			case TokenTag::LessThan: out = a < b; break;
+			case TokenTag::GreaterThan: out = a > b; break;
+			case TokenTag::LessEquals: out = a <= b; break;
+			case TokenTag::GreaterEquals: out = a >= b; break;
+			case TokenTag::EqualsEquals: out = a == b; break;
+			default: out = a != b; break;
 			}
-			innerScope->parent_scope = function.closure;
+			return Error::None;
+		}
+		default:
+			break;
+		}
+	}
+
+	Value value;
+	TRY(Evaluate(expression, scope, value));
+	if (value.Type() != TypeTag::Bool) return Error{errorMessage, expression.pos};
+	out = value.boolean;
+	return Error::None;
+}
+
+[[nodiscard]] static Error EvaluateCondition(Expression& condition, const Ref<Scope>& scope, const char* errorMessage, bool& out)
+{
+	if (CanQuicken(condition))
+	{
+		bool quick;
+		if (IsNumberOperation(static_cast<const BinaryOperation&>(condition).op))
+		{
+			double value;
+			TRY(EvaluateQuickNumber(condition, scope, quick, value));
+			out = value != 0.0;
+		}
+		else TRY(EvaluateQuickBool(condition, scope, quick, out));
+		if (quick) return Error::None;
+	}
 
-			for (const auto& statement : *function.statements)
+	if (condition.tag == ExpressionTag::InBoundsRead)
+	{
+		double value;
+		TRY(EvaluateNumber(condition, scope, errorMessage, value));
+		out = value != 0.0;
+		return Error::None;
+	}
+	else if (condition.tag == ExpressionTag::TypedBinary)
+	{
+		switch (static_cast<const BinaryOperation&>(condition).op)
+		{
+		case TokenTag::Plus:
+		case TokenTag::Minus:
+		case TokenTag::Star:
+		case TokenTag::Slash:
+		case TokenTag::Percent:
+		case TokenTag::At:
+		{
+			double value;
+			TRY(EvaluateNumber(condition, scope, errorMessage, value));
+			out = value != 0.0;
+			return Error::None;
+		}
+		default:
+			return EvaluateBool(condition, scope, errorMessage, out);
+		}
+	}
+
+	Value value;
+	TRY(Evaluate(condition, scope, value));
+
+	if (value.Type() == TypeTag::Bool)
+	{
+		out = value.boolean;
+	}
+	else if (value.Type() == TypeTag::Number)
+	{
+		out = value.number != 0.0;
+	}
+	else
+	{
+		return Error{errorMessage, condition.pos};
+	}
+	return Error::None;
+}
+
+// Quickened operations evaluate operands that can't run code as raw numbers and bools. `quick` is cleared, without any
+// side effect having happened, if an operand isn't a number or bool without comment, or runs code. An operation whose
+// operands failed that guard becomes generic and isn't tried again.
+[[nodiscard]] static Error EvaluateQuickNumber(Expression& expression, const Ref<Scope>& scope, bool& quick, double& out)
+{
+	quick = false;
+	switch (expression.tag)
+	{
+	case ExpressionTag::NumberLiteral:
+		out = static_cast<const NumberLiteral&>(expression).value;
+		quick = true;
+		return Error::None;
+	case ExpressionTag::Constant:
+	{
+		const Value& value = static_cast<const Constant&>(expression).value;
+		if (value.Type() != TypeTag::Number || value.GetComment()) return Error::None;
+		out = value.number;
+		quick = true;
+		return Error::None;
+	}
+	case ExpressionTag::Identifier:
+	{
+		Value* value;
+		if (!LookUp(static_cast<const Identifier&>(expression), *scope, value) || value->Type() != TypeTag::Number || value->GetComment()) return Error::None;
+		out = value->number;
+		quick = true;
+		return Error::None;
+	}
+	case ExpressionTag::Unary:
+	{
+		const auto& unaryOp = static_cast<const UnaryOperation&>(expression);
+		if (unaryOp.op != TokenTag::KeyNeg || HasObservableComment(*unaryOp.a)) return Error::None;
+		TRY(EvaluateQuickNumber(*unaryOp.a, scope, quick, out));
+		out = -out;
+		return Error::None;
+	}
+	case ExpressionTag::Binary:
+	{
+		auto& binaryOp = static_cast<BinaryOperation&>(expression);
+		if (!CanQuicken(binaryOp) || !IsNumberOperation(binaryOp.op)) return Error::None;
+		binaryOp.quickening = Quickening::Generic;
+		if (HasObservableComment(*binaryOp.a) || HasObservableComment(*binaryOp.b)) return Error::None;
+
+		if (binaryOp.op == TokenTag::At)
+		{
+			Value* arrayValue;
+			if (binaryOp.a->tag != ExpressionTag::Identifier || !LookUp(static_cast<const Identifier&>(*binaryOp.a), *scope, arrayValue)) return Error::None;
+			if (arrayValue->Type() != TypeTag::Array || arrayValue->GetComment()) return Error::None;
+			const std::vector<double>& array = arrayValue->GetArray();
+
+			double index;
+			TRY(EvaluateQuickNumber(*binaryOp.b, scope, quick, index));
+			if (!quick) return Error::None;
+			const size_t indexValue = static_cast<size_t>(index);
+			if (indexValue >= array.size())
 			{
-				TRY(RunStatement(*statement, innerScope));
-				if (unwindToken.unwind)
-				{
-					unwindToken.unwind = false;
-					out = std::move(unwindToken.returnValue);
-					return Error::None;
-				}
+				return Error{Format("Array index %zu out of bounds (array length is %zu).", indexValue, array.size()), binaryOp.b->pos};
 			}
-			out = std::make_unique<Value>(TypeTag::Void, nullptr);
+			out = array[indexValue];
+			binaryOp.quickening = Quickening::Plain;
 			return Error::None;
 		}
+
+		double a;
+		double b;
+		TRY(EvaluateQuickNumber(*binaryOp.a, scope, quick, a));
+		if (!quick) return Error::None;
+		TRY(EvaluateQuickNumber(*binaryOp.b, scope, quick, b));
+		if (!quick) return Error::None;
+
+		switch (binaryOp.op)
+		{
+		case TokenTag::Plus: out = a + b; break;
+		case TokenTag::Minus: out = a - b; break;
+		case TokenTag::Star: out = a * b; break;
+		case TokenTag::Slash: out = a / b; break;
+		default: out = Modulo(a, b); break;
+		}
+		binaryOp.quickening = Quickening::Plain;
+		return Error::None;
+	}
+	default:
+		return Error::None;
+	}
+}
+
+[[nodiscard]] static Error EvaluateQuickBool(Expression& expression, const Ref<Scope>& scope, bool& quick, bool& out)
+{
+	quick = false;
+	switch (expression.tag)
+	{
+	case ExpressionTag::False:
+	case ExpressionTag::True:
+		out = expression.tag == ExpressionTag::True;
+		quick = true;
+		return Error::None;
+	case ExpressionTag::Identifier:
+	{
+		Value* value;
+		if (!LookUp(static_cast<const Identifier&>(expression), *scope, value) || value->Type() != TypeTag::Bool || value->GetComment()) return Error::None;
+		out = value->boolean;
+		quick = true;
+		return Error::None;
+	}
+	case ExpressionTag::Unary:
+	{
+		const auto& unaryOp = static_cast<const UnaryOperation&>(expression);
+		if (unaryOp.op != TokenTag::KeyNot || HasObservableComment(*unaryOp.a)) return Error::None;
+		TRY(EvaluateQuickBool(*unaryOp.a, scope, quick, out));
+		out = !out;
+		return Error::None;
+	}
+	case ExpressionTag::Binary:
+	{
+		auto& binaryOp = static_cast<BinaryOperation&>(expression);
+		if (!CanQuicken(binaryOp) || IsNumberOperation(binaryOp.op)) return Error::None;
+		binaryOp.quickening = Quickening::Generic;
+		if (HasObservableComment(*binaryOp.a) || HasObservableComment(*binaryOp.b)) return Error::None;
+
+		switch (binaryOp.op)
+		{
+		case TokenTag::KeyAnd:
+		case TokenTag::KeyOr:
+		case TokenTag::KeyXor:
+		{
+			bool a;
+			bool b;
+			TRY(EvaluateQuickBool(*binaryOp.a, scope, quick, a));
+			if (!quick) return Error::None;
+			if (binaryOp.op != TokenTag::KeyXor && a == (binaryOp.op == TokenTag::KeyOr))
+			{
+				out = a;
+				binaryOp.quickening = Quickening::Plain;
+				return Error::None;
+			}
+			TRY(EvaluateQuickBool(*binaryOp.b, scope, quick, b));
+			if (!quick) return Error::None;
+			out = binaryOp.op == TokenTag::KeyXor ? a != b : b;
+			break;
+		}
+		case TokenTag::KeyMap:
+			return Error::None;
+		default:
+		{
+			double a;
+			double b;
+			TRY(EvaluateQuickNumber(*binaryOp.a, scope, quick, a));
+			if (!quick) return Error::None;
+			TRY(EvaluateQuickNumber(*binaryOp.b, scope, quick, b));
+			if (!quick) return Error::None;
+			switch (binaryOp.op)
+			{
+			case TokenTag::LessThan: out = a < b; break;
+			case TokenTag::GreaterThan: out = a > b; break;
+			case TokenTag::LessEquals: out = a <= b; break;
+			case TokenTag::GreaterEquals: out = a >= b; break;
+			case TokenTag::EqualsEquals: out = a == b; break;
+			default: out = a != b; break;
+			}
+			break;
+		}
+		}
+		binaryOp.quickening = Quickening::Plain;
+		return Error::None;
+	}
+	default:
+		return Error::None;
 	}
-	return Error{"Internal error: Unrecognized expression.", expression.pos};
 }
 
-static void PrintValue(const Value& value, const bool inComment)
+// Sets `out` to the binding of `identifier` seen from `scope`, from its cache if the lookup would find the same one.
+// Returns false if the name isn't bound.
+static bool LookUp(const Identifier& identifier, Scope& scope, Value*& out)
 {
-	if (!inComment && value.attachedComment)
+	LookupCache& cache = identifier.cache;
+	if (cache.binding && cache.version == Scope::bindingVersion)
+	{
+		if (cache.local ? cache.scope == &scope : cache.scope == scope.parent_scope.get() && !scope.bindings.count(identifier.name))
+		{
+			++lookupState.hits;
+			out = cache.binding;
+			return true;
+		}
+	}
+
+	++lookupState.misses;
+	for (Scope* current = &scope; current; current = current->parent_scope.get())
+	{
+		auto it = current->bindings.find(identifier.name);
+		if (it == current->bindings.end()) continue;
+
+		out = &it->second;
+		// NOTE Only captured scopes change the version when names come and go, so lookups are only cached from
+		// them or from scopes right below them.
+		if (!interpreterOptions.caches) return true;
+		if (current == &scope && scope.captured) cache = {&scope, true, Scope::bindingVersion, out};
+		else if (current != &scope && scope.parent_scope->captured) cache = {scope.parent_scope.get(), false, Scope::bindingVersion, out};
+		return true;
+	}
+	return false;
+}
+
+// Returns true if `expression` is a binary operation that wasn't found generic yet.
+static bool CanQuicken(const Expression& expression)
+{
+	return interpreterOptions.quicken && expression.tag == ExpressionTag::Binary && static_cast<const BinaryOperation&>(expression).quickening != Quickening::Generic;
+}
+
+static bool HasObservableComment(const Expression& expression)
+{
+	return expression.attachedComment && !expression.commentUnused;
+}
+
+// Returns true if binary operator `op` results in a number.
+static bool IsNumberOperation(const TokenTag op)
+{
+	switch (op)
+	{
+	case TokenTag::Plus:
+	case TokenTag::Minus:
+	case TokenTag::Star:
+	case TokenTag::Slash:
+	case TokenTag::Percent:
+	case TokenTag::At:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// Reads a number from a loop guard operand without side effects. Returns false if it's not a number, or when `plain`
+// is set, if it has a comment.
+static bool TryGetGuardNumber(const Expression& expression, const Ref<Scope>& scope, const bool plain, double& out)
+{
+	if (plain && expression.attachedComment) return false;
+
+	const Value* value;
+	Value* binding;
+	switch (expression.tag)
+	{
+	case ExpressionTag::NumberLiteral:
+		out = static_cast<const NumberLiteral&>(expression).value;
+		return true;
+	case ExpressionTag::Constant:
+		value = &static_cast<const Constant&>(expression).value;
+		break;
+	case ExpressionTag::Identifier:
+		if (!LookUp(static_cast<const Identifier&>(expression), *scope, binding)) return false;
+		value = binding;
+		break;
+	default:
+		return false;
+	}
+
+	if (value->Type() != TypeTag::Number || (plain && value->GetComment())) return false;
+	out = value->number;
+	return true;
+}
+
+static bool LoopGuardHolds(const GuardedLoopStatement& guardedLoop, const Ref<Scope>& scope)
+{
+	Value* counter;
+	if (!scope->TryGetValue(guardedLoop.counter, counter) || counter->Type() != TypeTag::Number) return false;
+	if (!(counter->number >= 0.0)) return false;
+
+	double step;
+	if (!TryGetGuardNumber(*guardedLoop.step, scope, false, step) || !(step >= 0.0)) return false;
+
+	double limit = 0.0;
+	if (guardedLoop.limit && !TryGetGuardNumber(*guardedLoop.limit, scope, false, limit)) return false;
+
+	for (const std::string& name : guardedLoop.arrays)
+	{
+		Value* array;
+		if (!scope->TryGetValue(name, array) || array->Type() != TypeTag::Array) return false;
+		if (!guardedLoop.limit) continue;
+
+		const double length = static_cast<double>(array->GetArray().size());
+		if (guardedLoop.inclusive ? !(limit < length) : !(limit <= length)) return false;
+	}
+	return true;
+}
+
+// Returns the array bound to `name`, or null if it's not an array, or when `plain` is set, if it has a comment.
+static std::vector<double>* TryGetKernelArray(const std::string& name, const Ref<Scope>& scope, const bool plain)
+{
+	Value* value;
+	if (!scope->TryGetValue(name, value) || value->Type() != TypeTag::Array || (plain && value->GetComment())) return nullptr;
+	return &value->GetArray();
+}
+
+// Runs the loop of `kernel` natively. Returns false without side effects when the loop could behave any differently,
+// e.g. operands aren't numbers or arrays, an index would be out of bounds, or the counter isn't a non-negative integer.
+// The loop itself has to run then.
+static bool RunKernel(const KernelStatement& kernel, const Ref<Scope>& scope)
+{
+	const auto& loop = static_cast<const ForStatement&>(*kernel.loop.front());
+
+	double start;
+	double end;
+	double step = 1.0;
+	if (!TryGetGuardNumber(*loop.start, scope, true, start) || !TryGetGuardNumber(*loop.end, scope, false, end)) return false;
+	if (loop.step && !TryGetGuardNumber(*loop.step, scope, true, step)) return false;
+
+	if (!(start >= 0.0 && start <= MAX_KERNEL_INDEX && std::floor(start) == start)) return false;
+	if (!(step >= 1.0 && step <= MAX_KERNEL_INDEX && std::floor(step) == step)) return false;
+	if (!(end <= MAX_KERNEL_INDEX)) return false;
+
+	const double last = loop.inclusive ? std::floor(end) : std::ceil(end) - 1.0;
+	if (last < start) return true;
+
+	const size_t first = static_cast<size_t>(start);
+	const size_t stride = static_cast<size_t>(step);
+	const size_t count = static_cast<size_t>(last - start) / stride + 1;
+	const size_t lastIndex = first + (count - 1) * stride;
+
+	switch (kernel.kernel)
+	{
+	case KernelTag::Fill:
+	{
+		std::vector<double>* array = TryGetKernelArray(kernel.array, scope, false);
+		double value = 0.0;
+		if (!array || (kernel.value && !TryGetGuardNumber(*kernel.value, scope, false, value))) return false;
+
+		if (kernel.value)
+		{
+			array->insert(array->end(), count, value);
+		}
+		else
+		{
+			array->reserve(array->size() + count);
+			for (size_t index = first; index <= lastIndex; index += stride) array->push_back(static_cast<double>(index));
+		}
+		break;
+	}
+	case KernelTag::Store:
+	{
+		std::vector<double>* array = TryGetKernelArray(kernel.array, scope, false);
+		double value = 0.0;
+		if (!array || lastIndex >= array->size() || (kernel.value && !TryGetGuardNumber(*kernel.value, scope, false, value))) return false;
+
+		double* const data = array->data();
+		if (!kernel.value)
+		{
+			for (size_t index = first; index <= lastIndex; index += stride) data[index] = static_cast<double>(index);
+		}
+		else if (stride == 1)
+		{
+			std::fill(data + first, data + lastIndex + 1, value);
+		}
+		else
+		{
+			for (size_t index = first; index <= lastIndex; index += stride) data[index] = value;
+		}
+		break;
+	}
+	case KernelTag::Copy:
+	{
+		std::vector<double>* array = TryGetKernelArray(kernel.array, scope, false);
+		const std::vector<double>* source = TryGetKernelArray(kernel.source, scope, false);
+		if (!array || !source || lastIndex >= array->size() || lastIndex >= source->size()) return false;
+
+		// NOTE Both names can refer to the same array, each element is still only read by its own iteration.
+		double* const data = array->data();
+		const double* const sourceData = source->data();
+		for (size_t index = first; index <= lastIndex; index += stride) data[index] = sourceData[index];
+		break;
+	}
+	case KernelTag::Sum:
+	{
+		const std::vector<double>* source = TryGetKernelArray(kernel.source, scope, true);
+		Value* accumulator;
+		if (!source || lastIndex >= source->size() || !scope->TryGetValue(kernel.accumulator, accumulator)) return false;
+		if (accumulator->Type() != TypeTag::Number || accumulator->GetComment()) return false;
+
+		// NOTE Added in loop order, reassociating (or vectorizing) the sum would round differently.
+		double sum = accumulator->number;
+		const double* const sourceData = source->data();
+		for (size_t index = first; index <= lastIndex; index += stride) sum += sourceData[index];
+		scope->SetNumber(kernel.accumulator, sum);
+		break;
+	}
+	case KernelTag::Min:
+	case KernelTag::Max:
+	{
+		const std::vector<double>* source = TryGetKernelArray(kernel.source, scope, true);
+		Value* accumulator;
+		if (!source || lastIndex >= source->size() || !scope->TryGetValue(kernel.accumulator, accumulator)) return false;
+		if (accumulator->Type() != TypeTag::Number) return false;
+
+		// NOTE The accumulator is only assigned (and loses its comment) if some element compared true.
+		double extreme = accumulator->number;
+		bool assigned = false;
+		const double* const sourceData = source->data();
+		for (size_t index = first; index <= lastIndex; index += stride)
+		{
+			if (kernel.kernel == KernelTag::Min ? sourceData[index] < extreme : sourceData[index] > extreme)
+			{
+				extreme = sourceData[index];
+				assigned = true;
+			}
+		}
+		if (assigned) scope->SetNumber(kernel.accumulator, extreme);
+		break;
+	}
+	}
+
+	scope->SetNumber(loop.counter, static_cast<double>(lastIndex + stride));
+	return true;
+}
+
+// Reads the variable and the operand of `fused` as numbers. Returns false if either isn't one.
+static bool TryGetFusedOperands(const FusedStatement& fused, const Ref<Scope>& scope, double& a, double& b)
+{
+	Value* value;
+	if (!scope->TryGetValue(fused.variable, value) || value->Type() != TypeTag::Number) return false;
+	a = value->number;
+
+	if (fused.operand.empty())
+	{
+		b = fused.number;
+		return true;
+	}
+	if (!scope->TryGetValue(fused.operand, value) || value->Type() != TypeTag::Number) return false;
+	b = value->number;
+	return true;
+}
+
+static bool Compare(const TokenTag op, const double a, const double b)
+{
+	switch (op)
+	{
+	case TokenTag::LessThan: return a < b;
+	case TokenTag::GreaterThan: return a > b;
+	case TokenTag::LessEquals: return a <= b;
+	case TokenTag::GreaterEquals: return a >= b;
+	case TokenTag::EqualsEquals: return a == b;
+	default: return a != b;
+	}
+}
+
+// Evaluates the function and arguments of `call` in `scope` into `prepared`.
+[[nodiscard]] static Error PrepareCall(const Call& call, const Ref<Scope>& scope, PreparedCall& prepared)
+{
+	// NOTE A named function is used from its binding instead of a copy of it, which only differs from evaluating the
+	// name by the comment that would be attached to the copy, and calls can't observe that.
+	Value* binding;
+	Value functionValue;
+	if (call.function->tag != ExpressionTag::Identifier || !LookUp(static_cast<const Identifier&>(*call.function), *scope, binding))
+	{
+		TRY(Evaluate(*call.function, scope, functionValue));
+		binding = &functionValue;
+	}
+	if (binding->Type() != TypeTag::Function)
+	{
+		return Error("Call on a a non-function value.", call.function->pos);
+	}
+
+	Ref<Function> function = binding->GetFunctionRef();
+	// Argument names belong to the function literal, so functions sharing them take as many arguments.
+	if (function->args != call.checkedArgs)
+	{
+		TRY(CheckArgCount(*function, call.values.size(), call.pos));
+		if (interpreterOptions.caches) call.checkedArgs = function->args;
+	}
+	BeginCall(std::move(function), call.pos, prepared);
+	const size_t n = call.values.size();
+	for (size_t i = 0; i < n; ++i)
+	{
+		Expression& argExpression = *call.values[i];
+		Value argValue;
+		TRY(Evaluate(argExpression, scope, argValue));
+		BindArgument(prepared, i, std::move(argValue));
+	}
+	return Error::None;
+}
+
+[[nodiscard]] static Error CheckArgCount(const Function& function, const size_t argCount, const CodePos pos)
+{
+	if (function.args->size() != argCount)
+	{
+		return Error(Format("Provided %zu argument(s) for function that takes %zu.", argCount, function.args->size()), pos);
+	}
+	return Error::None;
+}
+
+// Sets up `prepared` to call `function` from `pos`, whose arguments are bound by BindArgument. The argument count has
+// to be checked before.
+static void BeginCall(Ref<Function> function, const CodePos pos, PreparedCall& prepared)
+{
+	prepared.function = std::move(function);
+	prepared.localScope = HasLocalScope(*prepared.function);
+	prepared.innerScope = prepared.localScope ? AcquireFrame() : MakeRef<Scope>();
+	prepared.innerScope->parent_scope = prepared.function->closure;
+	prepared.pos = pos;
+	prepared.signature = 0;
+	prepared.memoize = IsPure(*prepared.function) && interpreterOptions.memo && !(prepared.function->memo && prepared.function->memo->disabled);
+	prepared.memoKey.clear();
+}
+
+static void BindArgument(PreparedCall& prepared, const size_t i, Value value)
+{
+	if (i < MAX_SPECIALIZED_ARGS) prepared.signature |= static_cast<uint64_t>(value.Type()) << (3 * i);
+	if (prepared.memoize) prepared.memoize = AppendMemoKey(value, prepared.memoKey);
+	prepared.innerScope->SetValue((*prepared.function->args)[i], std::move(value));
+}
+
+// Runs `prepared` and the tail calls it leaves pending, setting `out` to the result of the last one.
+[[nodiscard]] static Error RunCall(PreparedCall& prepared, Value& out)
+{
+	// NOTE A call in a return statement of the body is prepared by it and runs here once the body returned, so tail
+	// calls don't nest.
+	while (true)
+	{
+		CollectCyclesIfDue();
+		TRY(RunPreparedCall(prepared, out));
+		if (!tailCallState.pending) return Error::None;
+		tailCallState.pending = false;
+		prepared = std::move(tailCallState.call);
+	}
+}
+
+// Runs `prepared`, setting `out` to its result. If the body ends with a tail call, `out` is left void and the call is
+// pending in tailCallState instead.
+[[nodiscard]] static Error RunPreparedCall(PreparedCall& prepared, Value& out)
+{
+	Function& function = *prepared.function;
+	Ref<Scope>& innerScope = prepared.innerScope;
+	const bool localScope = prepared.localScope;
+	bool memoize = prepared.memoize;
+	std::vector<uint64_t>& memoKey = prepared.memoKey;
+
+	if (!IsPure(function) && memoState.depth > 0) memoState.impure = true;
+	if (memoize) memoize = ValidateMemo(function);
+	if (memoize)
+	{
+		MemoTable& memo = *function.memo;
+		auto it = memo.results.find(memoKey);
+		if (it != memo.results.end())
+		{
+			++memo.hits;
+			++memoState.hits;
+			out = it->second;
+			if (localScope) ReleaseFrame(std::move(innerScope));
+			return Error::None;
+		}
+		++memo.misses;
+		++memoState.misses;
+		if (memo.misses >= MEMO_PROBATION_MISSES && memo.hits * MIN_MEMO_HIT_RATIO < memo.misses)
+		{
+			memo.disabled = true;
+			memo.results.clear();
+			memoize = false;
+		}
+	}
+
+	FunctionCode& generic = *function.code;
+	if (!generic.hot && ++generic.calls >= interpreterOptions.hotCalls) PromoteFunction(generic, prepared.pos);
+	if (++function.calls == std::max<size_t>(interpreterOptions.hotCalls, 1) && function.closure->frozen)
+	{
+		auto statements = SpecializeClosure(*function.args, generic.fused ? *generic.fused : *generic.statements, function.closure);
+		if (statements)
+		{
+			function.closureCode = std::make_shared<FunctionCode>(std::move(statements));
+			function.closureCode->hot = true;
+		}
+	}
+
+	FunctionCode& code = function.closureCode ? *function.closureCode : generic;
+	const auto& statements = SelectBody(code, *function.args, prepared.signature);
+
+	const bool outerTailCalls = tailCallState.allowed;
+	tailCallState.allowed = true;
+	if (!memoize)
+	{
+		const Error error = RunCallBody(code, statements, innerScope, out);
+		tailCallState.allowed = outerTailCalls;
+		TRY(error);
+		if (localScope) ReleaseFrame(std::move(innerScope));
+		return Error::None;
+	}
+
+	const bool outerImpure = memoState.impure;
+	memoState.impure = false;
+	++memoState.depth;
+	const Error error = RunCallBody(code, statements, innerScope, out);
+	--memoState.depth;
+	tailCallState.allowed = outerTailCalls;
+	const bool impure = memoState.impure;
+	memoState.impure = outerImpure || impure;
+	TRY(error);
+
+	// NOTE The result of a tail call isn't known yet, so it isn't memoized.
+	if (tailCallState.pending)
+	{
+		if (localScope) ReleaseFrame(std::move(innerScope));
+		return Error::None;
+	}
+
+	// NOTE A comment on the result keeps the scope of this call, whose bindings any call with the same arguments would
+	// repeat.
+	if (!impure && (out.Type() == TypeTag::Number || out.Type() == TypeTag::Bool))
+	{
+		auto& results = function.memo->results;
+		if (results.size() >= MAX_MEMO_RESULTS) results.clear();
+		results.emplace(std::move(memoKey), out);
+	}
+	if (localScope) ReleaseFrame(std::move(innerScope));
+	return Error::None;
+}
+
+[[nodiscard]] static Error RunFunctionBody(const std::vector<std::unique_ptr<Statement>>& statements, const Ref<Scope>& innerScope, Value& out)
+{
+	for (const auto& statement : statements)
+	{
+		TRY(RunStatement(*statement, innerScope));
+		if (unwindToken.unwind)
+		{
+			unwindToken.unwind = false;
+			innerScope->frozen = true;
+			out = std::move(unwindToken.returnValue);
+			return Error::None;
+		}
+	}
+	innerScope->frozen = true;
+	out = Value();
+	return Error::None;
+}
+
+// Runs the body of a call as machine code when the JIT can, otherwise walks `statements`, the body selected for it.
+[[nodiscard]] static Error RunCallBody(FunctionCode& code, const std::vector<std::unique_ptr<Statement>>& statements, const Ref<Scope>& innerScope, Value& out)
+{
+	if (interpreterOptions.jit && code.hot)
+	{
+		bool ran;
+		TRY(RunJitFunction(code, innerScope, ran, out));
+		if (ran)
+		{
+			innerScope->frozen = true;
+			return Error::None;
+		}
+	}
+	return RunFunctionBody(statements, innerScope, out);
+}
+
+// Analyzes the function's code on first use.
+static bool IsPure(const Function& function)
+{
+	FunctionCode& code = *function.code;
+	if (code.purity == Purity::Unknown) code.purity = AnalyzePurity(*function.args, *code.statements, code.freeVariables) ? Purity::Pure : Purity::Impure;
+	return code.purity == Purity::Pure;
+}
+
+// Analyzes the function's code on first use.
+static bool HasLocalScope(const Function& function)
+{
+	FunctionCode& code = *function.code;
+	if (code.escape == Escape::Unknown) code.escape = CapturesScope(*code.statements) ? Escape::Captured : Escape::Local;
+	return code.escape == Escape::Local;
+}
+
+static Ref<Scope> AcquireFrame()
+{
+	if (framePool.empty()) return MakeRef<Scope>();
+	Ref<Scope> frame = std::move(framePool.back());
+	framePool.pop_back();
+	return frame;
+}
+
+// Clears the scope of a returned call for reuse. Clearing keeps the allocated buckets of its bindings.
+static void ReleaseFrame(Ref<Scope> frame)
+{
+	// NOTE Nothing can reference the scope of a function with a local scope, this only guards against a mistake.
+	if (frame->refs != 1 || framePool.size() >= MAX_POOLED_FRAMES) return;
+	frame->bindings.clear();
+	frame->parent_scope = nullptr;
+	frame->frozen = false;
+	framePool.push_back(std::move(frame));
+}
+
+static uint64_t GetBits(const double value)
+{
+	uint64_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+// Appends the type and value of argument `value` to a memo key. Returns false if results can't be memoized for it:
+// only numbers and bools without comments can be told apart by value.
+static bool AppendMemoKey(const Value& value, std::vector<uint64_t>& key)
+{
+	if (value.GetComment()) return false;
+	if (value.Type() == TypeTag::Number) key.push_back(GetBits(value.number));
+	else if (value.Type() == TypeTag::Bool) key.push_back(value.boolean);
+	else return false;
+	key.push_back(static_cast<uint64_t>(value.Type()));
+	return true;
+}
+
+// NOTE Unbound names are compared as voids, names can't be bound to void.
+static bool IsSameMemoValue(const Value& a, const Value& b)
+{
+	if (a.Type() != b.Type() || a.GetComment() != b.GetComment()) return false;
+	switch (a.Type())
+	{
+	case TypeTag::Void:
+		return true;
+	case TypeTag::Number:
+	case TypeTag::Bool:
+	case TypeTag::Function:
+		return a.bits == b.bits;
+	default:
+		return false;
+	}
+}
+
+// Takes the values of free variables of `function` and of functions they refer to. Returns false if one of those
+// functions is impure or a free variable is an array, whose elements could change without rebinding it.
+static bool TakeMemoSnapshot(Function& function, std::vector<MemoTable::FreeVariable>& out)
+{
+	out.clear();
+	std::vector<Function*> pending{&function};
+	std::unordered_set<const Function*> visited{&function};
+	while (!pending.empty())
+	{
+		Function& current = *pending.back();
+		pending.pop_back();
+		if (!IsPure(current)) return false;
+
+		for (const std::string& name : current.code->freeVariables)
+		{
+			Value* value;
+			if (!current.closure->TryGetValue(name, value))
+			{
+				out.emplace_back(current.closure, name, Value());
+				continue;
+			}
+			if (value->Type() == TypeTag::Array) return false;
+			if (value->Type() == TypeTag::Function)
+			{
+				Function* referenced = &value->GetFunction();
+				if (visited.insert(referenced).second) pending.push_back(referenced);
+			}
+			out.emplace_back(current.closure, name, *value);
+		}
+	}
+	return true;
+}
+
+// Drops memoized results of `function` if a free variable changed since they were computed. Returns false if results
+// can't be memoized with the current values.
+static bool ValidateMemo(Function& function)
+{
+	if (!function.memo) function.memo = std::make_unique<MemoTable>();
+	MemoTable& memo = *function.memo;
+
+	// NOTE Calls can only bind names in their own scope and pure functions don't mutate arrays, so nothing memoized
+	// results depend on can change until the outermost memoized call returns. Tables are checked once during it.
+	if (memoState.depth == 0) ++memoState.epoch;
+	if (memo.epoch == memoState.epoch) return memo.valid;
+	memo.epoch = memoState.epoch;
+
+	if (memo.valid)
+	{
+		bool same = true;
+		for (const auto& freeVariable : memo.freeVariables)
+		{
+			Value* value;
+			if (!IsSameMemoValue(freeVariable.value, freeVariable.scope->TryGetValue(freeVariable.name, value) ? *value : Value()))
+			{
+				same = false;
+				break;
+			}
+		}
+		if (same) return true;
+	}
+
+	memo.results.clear();
+	memo.valid = TakeMemoSnapshot(function, memo.freeVariables);
+	return memo.valid;
+}
+
+// Returns the index of the first arm comparing equal to `value`, or the number of arms if none does.
+size_t FindSwitchArm(const SwitchStatement& switchStatement, const double value)
+{
+	if (switchStatement.table.empty())
+	{
+		auto it = switchStatement.arms.find(value);
+		return it != switchStatement.arms.end() ? it->second : static_cast<const IfStatement&>(*switchStatement.chain.front()).elifChain.size();
+	}
+
+	// NOTE A non-integer could round to an integer offset.
+	if (std::floor(value) == value)
+	{
+		const double offset = value - switchStatement.first;
+		if (offset >= 0.0 && offset < static_cast<double>(switchStatement.table.size())) return switchStatement.table[static_cast<size_t>(offset)];
+	}
+	return static_cast<const IfStatement&>(*switchStatement.chain.front()).elifChain.size();
+}
+
+// Returns the body specialized for argument types in `signature`, specializing it on first use. Falls back to the
+// generic body when the function has too many specializations already or nothing could be specialized.
+static const std::vector<std::unique_ptr<Statement>>& SelectBody(FunctionCode& code, const std::vector<std::string>& args, const uint64_t signature)
+{
+	if (!code.hot) return *code.statements;
+
+	const auto& base = code.fused ? *code.fused : *code.statements;
+	const size_t n = args.size();
+	if (n > MAX_SPECIALIZED_ARGS) return base;
+
+	for (const auto& specialization : code.specializations)
+	{
+		if (specialization.signature == signature) return specialization.statements ? *specialization.statements : base;
+	}
+
+	if (code.specializations.size() >= MAX_SPECIALIZATIONS) return base;
+
+	std::vector<TypeTag> argTypes;
+	argTypes.reserve(n);
+	for (size_t i = 0; i < n; ++i) argTypes.push_back(static_cast<TypeTag>((signature >> (3 * i)) & 7));
+
+	auto statements = SpecializeFunction(args, argTypes, base);
+	code.specializations.emplace_back(signature, statements);
+	return statements ? *statements : base;
+}
+
+// Gives the result `out` of a binary operation its comment: the one attached to the expression, otherwise the comment
+// of the only operand that has one. `out` starts with the comment of the first operand.
+static void CombineComments(const Expression& expression, const Ref<Scope>& scope, const Value& b, Value& out)
+{
+	if (expression.commentUnused) return;
+	if (expression.attachedComment) out.SetComment(MakeRef<Comment>(*expression.attachedComment, scope));
+	else if (out.GetComment() && b.GetComment()) out.SetComment(nullptr);
+	else if (b.GetComment()) out.SetComment(b.GetComment());
+}
+
+// Counts the pair of `statement` with the statement running it and with the expressions it evaluates once per run.
+// Conditions are counted by the loops and if statements evaluating them.
+static void CountNodePairs(const Statement& statement)
+{
+	const uint32_t kind = GetNodeKind(statement);
+	if (nodePairState.parent) ++nodePairState.counts[static_cast<uint64_t>(GetNodeKind(*nodePairState.parent)) << 32 | kind];
+
+	switch (statement.tag)
+	{
+	case StatementTag::For:
+	{
+		const auto& forStatement = static_cast<const ForStatement&>(statement);
+		CountNodePairs(kind, *forStatement.start);
+		CountNodePairs(kind, *forStatement.end);
+		if (forStatement.step) CountNodePairs(kind, *forStatement.step);
+		return;
+	}
+	case StatementTag::Assignment:
+		CountNodePairs(kind, *static_cast<const AssignmentStatement&>(statement).value);
+		return;
+	case StatementTag::ArrayWrite:
+	case StatementTag::InBoundsArrayWrite:
+	{
+		const auto& arrayWrite = static_cast<const ArrayWriteStatement&>(statement);
+		CountNodePairs(kind, *arrayWrite.index);
+		CountNodePairs(kind, *arrayWrite.value);
+		return;
+	}
+	case StatementTag::ArrayPush:
+		CountNodePairs(kind, *static_cast<const ArrayPushStatement&>(statement).value);
+		return;
+	case StatementTag::Return:
+	case StatementTag::Expression:
+		CountNodePairs(kind, *static_cast<const ExpressionStatement&>(statement).value);
+		return;
+	default:
+		return;
+	}
+}
+
+// Counts the pair of node kind `parent` with `expression`, and the pairs within `expression`. Bodies of function
+// literals count when they run.
+static void CountNodePairs(const uint32_t parent, const Expression& expression)
+{
+	const uint32_t kind = GetNodeKind(expression);
+	++nodePairState.counts[static_cast<uint64_t>(parent) << 32 | kind];
+
+	switch (expression.tag)
+	{
+	case ExpressionTag::ArrayLiteral:
+		for (const auto& value : static_cast<const ArrayLiteral&>(expression).values) CountNodePairs(kind, *value);
+		return;
+	case ExpressionTag::Unary:
+		CountNodePairs(kind, *static_cast<const UnaryOperation&>(expression).a);
+		return;
+	case ExpressionTag::Binary:
+	case ExpressionTag::TypedBinary:
+	case ExpressionTag::InBoundsRead:
+	{
+		const auto& binaryOp = static_cast<const BinaryOperation&>(expression);
+		CountNodePairs(kind, *binaryOp.a);
+		CountNodePairs(kind, *binaryOp.b);
+		return;
+	}
+	case ExpressionTag::Call:
+	{
+		const auto& call = static_cast<const Call&>(expression);
+		CountNodePairs(kind, *call.function);
+		for (const auto& value : call.values) CountNodePairs(kind, *value);
+		return;
+	}
+	default:
+		return;
+	}
+}
+
+static uint32_t GetNodeKind(const Statement& statement)
+{
+	uint32_t kind = STATEMENT_NODE | static_cast<uint32_t>(statement.tag);
+	if (statement.tag == StatementTag::Fused) kind |= static_cast<uint32_t>(static_cast<const FusedStatement&>(statement).fused) << 8;
+	return kind;
+}
+
+static uint32_t GetNodeKind(const Expression& expression)
+{
+	uint32_t kind = static_cast<uint32_t>(expression.tag);
+	switch (expression.tag)
+	{
+	case ExpressionTag::Unary:
+		kind |= static_cast<uint32_t>(static_cast<const UnaryOperation&>(expression).op) << 8;
+		break;
+	case ExpressionTag::Binary:
+	case ExpressionTag::TypedBinary:
+	case ExpressionTag::InBoundsRead:
+		kind |= static_cast<uint32_t>(static_cast<const BinaryOperation&>(expression).op) << 8;
+		break;
+	default:
+		break;
+	}
+	return kind;
+}
+
+static std::string GetNodeName(const uint32_t kind)
+{
+	static const char* const statementNames[] = {"If", "While", "For", "GuardedLoop", "Assignment", "ArrayWrite", "InBoundsArrayWrite", "ArrayPush", "ArrayPop", "Return", "Expression", "Kernel", "Switch", "Fused"};
+	static const char* const fusedNames[] = {"AddConstant", "CompareLoop", "ModuloTest", "StoreConstant"};
+	static const char* const expressionNames[] = {"False", "True", "NumberLiteral", "ArrayLiteral", "FunctionLiteral", "Identifier", "Constant", "Unary", "Binary", "TypedBinary", "InBoundsRead", "Call"};
+
+	if (kind & STATEMENT_NODE)
+	{
+		std::string name = statementNames[kind & 0xFF];
+		if (static_cast<StatementTag>(kind & 0xFF) == StatementTag::Fused) name = name + ' ' + fusedNames[(kind >> 8) & 0xFF];
+		return name;
+	}
+
+	std::string name = expressionNames[kind & 0xFF];
+	switch (static_cast<ExpressionTag>(kind & 0xFF))
+	{
+	case ExpressionTag::Unary:
+	case ExpressionTag::Binary:
+	case ExpressionTag::TypedBinary:
+	case ExpressionTag::InBoundsRead:
+		break;
+	default:
+		return name;
+	}
+	switch (static_cast<TokenTag>(kind >> 8))
+	{
+	case TokenTag::KeyNot: return name + " not";
+	case TokenTag::KeyAnd: return name + " and";
+	case TokenTag::KeyOr: return name + " or";
+	case TokenTag::KeyXor: return name + " xor";
+	case TokenTag::KeyNeg: return name + " neg";
+	case TokenTag::KeyMap: return name + " map";
+	case TokenTag::Plus: return name + " +";
+	case TokenTag::Minus: return name + " -";
+	case TokenTag::Star: return name + " *";
+	case TokenTag::Slash: return name + " /";
+	case TokenTag::Percent: return name + " %";
+	case TokenTag::LessThan: return name + " <";
+	case TokenTag::GreaterThan: return name + " >";
+	case TokenTag::LessEquals: return name + " <=";
+	case TokenTag::GreaterEquals: return name + " >=";
+	case TokenTag::EqualsEquals: return name + " ==";
+	case TokenTag::NotEquals: return name + " !=";
+	case TokenTag::At: return name + " @";
+	case TokenTag::Hash: return name + " #";
+	default: return name;
+	}
+}
+
+// Prints the most frequent node pairs counted since the last call, most frequent first.
+static void PrintNodePairs()
+{
+	std::vector<std::pair<size_t, uint64_t>> pairs;
+	pairs.reserve(nodePairState.counts.size());
+	for (const auto& [pair, count] : nodePairState.counts) pairs.emplace_back(count, pair);
+	std::sort(pairs.begin(), pairs.end(), [](const auto& a, const auto& b) { return a.first != b.first ? a.first > b.first : a.second < b.second; });
+	if (pairs.size() > MAX_PRINTED_NODE_PAIRS) pairs.resize(MAX_PRINTED_NODE_PAIRS);
+
+	std::cerr << "Node pairs:\n";
+	for (const auto& [count, pair] : pairs)
+	{
+		std::cerr << "  " << count << "  " << GetNodeName(static_cast<uint32_t>(pair >> 32)) << " -> " << GetNodeName(static_cast<uint32_t>(pair)) << '\n';
+	}
+	nodePairState.counts.clear();
+}
+
+void PrintValue(const Value& value, const bool inComment)
+{
+	if (!inComment && value.GetComment())
 	{
 		std::cout << "/*";
-		for (const auto& node : value.attachedComment->token->nodes)
+		for (const auto& node : value.GetComment()->token->nodes)
 		{
 			switch(node->tag)
 			{
@@ -786,14 +2490,14 @@ static void PrintValue(const Value& value, const bool inComment)
 				case CommentNodeTag::Identifier:
 				{
 					const auto& identifierNode = static_cast<const CommentIdentifierNode&>(*node);
-					std::unique_ptr<Value>* referencedValue;
-					if (!value.attachedComment->scope->TryGetValue(identifierNode.name, referencedValue))
+					Value* referencedValue;
+					if (!value.GetComment()->scope->TryGetValue(identifierNode.name, referencedValue))
 					{
 						std::cout << "void";
 					}
 					else
 					{
-						PrintValue(**referencedValue, true);
+						PrintValue(*referencedValue, true);
 					}
 				}
 			}
@@ -801,26 +2505,19 @@ static void PrintValue(const Value& value, const bool inComment)
 		std::cout << "*/\n";
 	}
 
-	switch(value.type)
+	switch(value.Type())
 	{
 	case TypeTag::Void:
 		return;
 	case TypeTag::Bool:
-	{
-		auto const& boolValue = static_cast<const BoolValue&>(value);
-		std::cout << (boolValue.value ? "true" : "false");
+		std::cout << (value.boolean ? "true" : "false");
 		break;
-	}
 	case TypeTag::Number:
-	{
-		auto const& numberValue = static_cast<const NumberValue&>(value);
-		std::cout << numberValue.value;
+		std::cout << value.number;
 		break;
-	}
 	case TypeTag::Array:
 	{
-		auto const& arrayRef = static_cast<const ArrayRef&>(value);
-		const std::vector<double>& array = *arrayRef.array;
+		const std::vector<double>& array = value.GetArray();
 		std::cout << '[';
 		const size_t n = array.size();
 		for (size_t i = 0; i < n; ++i)
@@ -833,8 +2530,7 @@ static void PrintValue(const Value& value, const bool inComment)
 	}
 	case TypeTag::Function:
 	{
-		auto const& functionRef = static_cast<const FunctionRef&>(value);
-		const Function& function = *functionRef.function;
+		const Function& function = value.GetFunction();
 		std::cout << "fn (";
 		const size_t n = function.args->size();
 		for (size_t i = 0; i < n; ++i)
@@ -1,9 +1,54 @@
 #pragma once
 
+#include "CodePos.h"
+#include "Error.h"
+
+#include <cstddef>
+#include <functional>
 #include <memory>
 #include <string_view>
 #include <vector>
 
+struct Function;
 struct Statement;
+struct SwitchStatement;
+class Value;
+
+struct InterpreterOptions {
+	bool kernels = true;             // run loop idioms like fills and sums with native kernels
+	bool memo = true;                // cache results of pure functions
+	bool quicken = true;             // specialize binary operations to the operand types they see
+	bool fuse = true;                // run common statement shapes as single operations in hot code
+	bool stats = false;              // report memoization hit rates, code promoted to hot, cycles collected and allocations
+	bool nodePairs = false;          // report how often each parent/child node pair ran in the tree walker
+	bool vm = false;                 // compile to bytecode and run it on the VM instead of walking the tree
+	bool closures = false;           // compile to closures and run them instead of walking the tree
+	bool jit = false;                // compile hot numeric loops and functions to x86-64 machine code
+	bool lanes = true;               // run map operations in SIMD lanes where the function allows
+	bool caches = true;              // cache the binding identifiers and called functions were last found in
+	size_t hotCalls = 2;             // calls after which a function is hot
+	size_t hotIterations = 64;       // iterations after which a loop is hot
+	size_t stackLimit = 256 << 20;   // bytes of stack and call frames running code may use
+	size_t collectThreshold = 10000; // objects created after which reference cycles are collected, 0 for never
+};
+
+void Interpret(std::string_view filePrefix, std::vector<std::unique_ptr<Statement>>& statements, const InterpreterOptions& options);
+
+// Returns true if code run by Interpret uses more than its stack limit, counting `heapFrames` bytes of call frames an
+// engine keeps on the heap. Calls fail with "Stack overflow." then.
+bool StackExhausted(size_t heapFrames = 0);
+
+// Frees objects only kept alive by reference cycles if enough were created since the last collection. Engines call it
+// where calls start and after running top level code, where every object still used is counted.
+void CollectCyclesIfDue();
+
+// Sets `out` to the results of `function` of one argument for each element of `array` in order, for map operations at
+// `pos`. Calls the function with `call`, which runs it as the engine does, unless the calls can be computed in SIMD
+// lanes. Fails if a call fails or returns something else than a number.
+[[nodiscard]] Error MapArray(Function& function, const std::vector<double>& array, CodePos pos, const std::function<Error(double, Value&)>& call, std::vector<double>& out);
+
+// Prints `value` as an expression statement does, or as its value is printed inside a comment.
+void PrintValue(const Value& value, bool inComment);
 
-void Interpret(std::string_view filePrefix, std::vector<std::unique_ptr<Statement>>& statements);
+// Returns the arm of `switchStatement` that runs when its variable is `value`.
+size_t FindSwitchArm(const SwitchStatement& switchStatement, double value);
@@ -0,0 +1,1095 @@
+#include "Jit.h"
+
+#include "Common.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) && defined(__linux__)
+#define RJL_JIT
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using Statements = std::vector<std::unique_ptr<Statement>>;
+
+// --- CODE --------------------------------------------------------------------
+
+struct JitArray {
+	double* data;
+	uint64_t size;
+};
+
+// Passed to the machine code. A flag is set for each variable the code assigned, which is written back to the scope
+// when the code exits.
+struct JitFrame {
+	double* slots;
+	double* temps;
+	uint8_t* assigned;
+	JitArray* arrays;
+	double value;   // returned number
+	uint64_t index; // index out of bounds
+	uint64_t size;  // length of the array it indexed
+};
+
+// Exit status of the machine code, error k exits with JIT_ERROR + k.
+enum : int {
+	JIT_DONE,
+	JIT_RETURNED_NUMBER,
+	JIT_RETURNED_VOID,
+	JIT_RETURNED_FALSE,
+	JIT_RETURNED_TRUE,
+	JIT_ERROR,
+};
+
+struct JitError {
+	const char* message; // null for an index out of bounds
+	CodePos pos;
+};
+
+// Number variable the code keeps in a slot.
+struct JitSlot {
+	std::string name;
+	bool read; // read before the code surely assigned it, so it must hold a number when the code starts
+};
+
+struct JitCode {
+	void* memory = nullptr;
+	size_t size = 0;
+	int (*entry)(JitFrame* frame) = nullptr; // null if the code couldn't be compiled
+	std::vector<JitSlot> slots;
+	std::vector<std::string> arrays;
+	size_t tempCount = 0;
+	std::vector<JitError> errors;
+
+	JitCode() = default;
+	JitCode(const JitCode&) = delete;
+	JitCode& operator=(const JitCode&) = delete;
+	~JitCode();
+};
+
+JitCode::~JitCode()
+{
+#ifdef RJL_JIT
+	if (memory) munmap(memory, size);
+#endif
+}
+
+#ifdef RJL_JIT
+
+static std::shared_ptr<JitCode> Compile(const Statements* statements, const Statement* loop, const char* kind, CodePos pos);
+[[nodiscard]] static Error Run(const JitCode& jit, const Ref<Scope>& scope, bool& ran, int& status, double& value);
+static Value ReturnedValue(int status, double value);
+
+#endif
+
+Error RunJitLoop(const Statement& loop, const Ref<Scope>& scope, bool& ran, std::optional<Value>& returned)
+{
+	ran = false;
+#ifdef RJL_JIT
+	// NOTE Loops rewritten by the optimizer are compiled from the original while loop, which runs without a guard.
+	const Statement* target = &loop;
+	while (true)
+	{
+		if (target->tag == StatementTag::For && !static_cast<const ForStatement*>(target)->fallback.empty()) target = static_cast<const ForStatement*>(target)->fallback.front().get();
+		else if (target->tag == StatementTag::GuardedLoop) target = static_cast<const GuardedLoopStatement*>(target)->fallback.front().get();
+		else if (target->tag == StatementTag::Fused) target = static_cast<const FusedStatement*>(target)->original.front().get();
+		else break;
+	}
+
+	std::shared_ptr<JitCode>* jit;
+	if (target->tag == StatementTag::While) jit = &static_cast<const WhileStatement*>(target)->jit;
+	else if (target->tag == StatementTag::For) jit = &static_cast<const ForStatement*>(target)->jit;
+	else return Error::None;
+
+	if (!*jit) *jit = Compile(nullptr, target, "loop", target->pos);
+
+	int status;
+	double value;
+	TRY(Run(**jit, scope, ran, status, value));
+	if (ran && status != JIT_DONE) returned = ReturnedValue(status, value);
+#else
+	(void)loop;
+	(void)scope;
+	(void)returned;
+#endif
+	return Error::None;
+}
+
+Error RunJitFunction(FunctionCode& code, const Ref<Scope>& scope, bool& ran, Value& out)
+{
+	ran = false;
+#ifdef RJL_JIT
+	if (!code.jit)
+	{
+		const CodePos pos = code.statements->empty() ? CodePos{0, 0} : code.statements->front()->pos;
+		code.jit = Compile(code.statements.get(), nullptr, "function", pos);
+	}
+
+	int status;
+	double value;
+	TRY(Run(*code.jit, scope, ran, status, value));
+	if (ran) out = status == JIT_DONE ? Value() : ReturnedValue(status, value);
+#else
+	(void)code;
+	(void)scope;
+	(void)out;
+#endif
+	return Error::None;
+}
+
+#ifdef RJL_JIT
+
+// NOTE Only one piece of machine code runs at a time, since it can't call functions, so they share these buffers.
+static std::vector<double> jitSlots;
+static std::vector<double> jitTemps;
+static std::vector<uint8_t> jitAssigned;
+static std::vector<JitArray> jitArrays;
+
+// Binds the variables of `jit` from `scope` and runs it. Doesn't run the code if a variable doesn't hold a number or
+// an array without comment as the code expects.
+// NOTE Since variables the code reads are bound and it only copies numbers, the code can't void a variable or fail on
+// one that isn't a number. Walking the code reports those errors instead.
+[[nodiscard]] static Error Run(const JitCode& jit, const Ref<Scope>& scope, bool& ran, int& status, double& value)
+{
+	ran = false;
+	if (!jit.entry) return Error::None;
+
+	if (jitSlots.size() < jit.slots.size()) jitSlots.resize(jit.slots.size());
+	if (jitTemps.size() < jit.tempCount) jitTemps.resize(jit.tempCount);
+	jitAssigned.assign(jit.slots.size(), 0);
+	jitArrays.resize(jit.arrays.size());
+
+	for (size_t i = 0; i < jit.arrays.size(); ++i)
+	{
+		Value* binding;
+		if (!scope->TryGetValue(jit.arrays[i], binding) || binding->Type() != TypeTag::Array || binding->GetComment()) return Error::None;
+		std::vector<double>& array = binding->GetArray();
+		jitArrays[i] = JitArray{array.data(), array.size()};
+	}
+	for (size_t i = 0; i < jit.slots.size(); ++i)
+	{
+		if (!jit.slots[i].read) continue;
+		Value* binding;
+		if (!scope->TryGetValue(jit.slots[i].name, binding) || binding->Type() != TypeTag::Number || binding->GetComment()) return Error::None;
+		jitSlots[i] = binding->number;
+	}
+
+	ran = true;
+	JitFrame frame{jitSlots.data(), jitTemps.data(), jitAssigned.data(), jitArrays.data(), 0.0, 0, 0};
+	status = jit.entry(&frame);
+	value = frame.value;
+
+	for (size_t i = 0; i < jit.slots.size(); ++i)
+	{
+		if (jitAssigned[i]) scope->SetNumber(jit.slots[i].name, jitSlots[i]);
+	}
+
+	if (status < JIT_ERROR) return Error::None;
+	const JitError& error = jit.errors[status - JIT_ERROR];
+	if (!error.message) return Error{Format("Array index %zu out of bounds (array length is %zu).", static_cast<size_t>(frame.index), static_cast<size_t>(frame.size)), error.pos};
+	return Error{error.message, error.pos};
+}
+
+static Value ReturnedValue(const int status, const double value)
+{
+	switch (status)
+	{
+	case JIT_RETURNED_NUMBER: return Value(value);
+	case JIT_RETURNED_FALSE: return Value(false);
+	case JIT_RETURNED_TRUE: return Value(true);
+	default: return Value();
+	}
+}
+
+// --- ASSEMBLER ---------------------------------------------------------------
+
+enum : int { RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RDI = 7, R12 = 12, R13 = 13, R14 = 14, R15 = 15 };
+enum : int { XMM0 = 0, XMM1 = 1, XMM2 = 2, XMM3 = 3 };
+
+// Condition codes of jcc after ucomisd, which sets the flags of an unsigned comparison and PF if an operand is NaN.
+enum : uint8_t { JB = 0x82, JAE = 0x83, JE = 0x84, JNE = 0x85, JBE = 0x86, JA = 0x87, JP = 0x8A, JMP = 0xE9 };
+
+// Opcodes of scalar double arithmetic after F2 0F.
+enum : uint8_t { ADDSD = 0x58, MULSD = 0x59, SUBSD = 0x5C, DIVSD = 0x5E };
+
+struct Assembler {
+	std::vector<uint8_t> code;
+	std::vector<size_t> labels;                          // offset of each label
+	std::vector<std::pair<size_t, size_t>> jumps;        // offset of a rel32 and its label
+	std::vector<double> constants;
+	std::vector<std::pair<size_t, size_t>> constantUses; // offset of a rip-relative disp32 and its constant
+};
+
+static void EmitByte(Assembler& as, const uint8_t byte)
+{
+	as.code.push_back(byte);
+}
+
+static void EmitInt32(Assembler& as, const uint32_t value)
+{
+	for (int i = 0; i < 4; ++i) EmitByte(as, static_cast<uint8_t>(value >> (8 * i)));
+}
+
+static void EmitInt64(Assembler& as, const uint64_t value)
+{
+	for (int i = 0; i < 8; ++i) EmitByte(as, static_cast<uint8_t>(value >> (8 * i)));
+}
+
+static void EmitPrefix(Assembler& as, const uint8_t prefix, const bool wide, const int reg, const int rm, const std::initializer_list<uint8_t> opcode)
+{
+	if (prefix) EmitByte(as, prefix);
+	const uint8_t rex = 0x40 | (wide ? 8 : 0) | (reg & 8 ? 4 : 0) | (rm & 8 ? 1 : 0);
+	if (rex != 0x40) EmitByte(as, rex);
+	for (const uint8_t byte : opcode) EmitByte(as, byte);
+}
+
+// Instruction with operands `reg` and [base + disp].
+static void EmitMemory(Assembler& as, const uint8_t prefix, const bool wide, const std::initializer_list<uint8_t> opcode, const int reg, const int base, const size_t disp)
+{
+	EmitPrefix(as, prefix, wide, reg, base, opcode);
+	EmitByte(as, static_cast<uint8_t>(0x80 | (reg & 7) << 3 | (base & 7)));
+	if ((base & 7) == RSP) EmitByte(as, 0x24);
+	EmitInt32(as, static_cast<uint32_t>(disp));
+}
+
+// Instruction with register operands `reg` and `rm`.
+static void EmitRegisters(Assembler& as, const uint8_t prefix, const bool wide, const std::initializer_list<uint8_t> opcode, const int reg, const int rm)
+{
+	EmitPrefix(as, prefix, wide, reg, rm, opcode);
+	EmitByte(as, static_cast<uint8_t>(0xC0 | (reg & 7) << 3 | (rm & 7)));
+}
+
+// Instruction with operands `reg` and the constant `value` addressed relative to rip.
+static void EmitConstant(Assembler& as, const uint8_t prefix, const std::initializer_list<uint8_t> opcode, const int reg, const double value)
+{
+	EmitPrefix(as, prefix, false, reg, 0, opcode);
+	EmitByte(as, static_cast<uint8_t>((reg & 7) << 3 | 5));
+
+	size_t constant = 0;
+	while (constant < as.constants.size() && std::memcmp(&as.constants[constant], &value, sizeof value) != 0) ++constant;
+	if (constant == as.constants.size()) as.constants.push_back(value);
+	as.constantUses.emplace_back(as.code.size(), constant);
+	EmitInt32(as, 0);
+}
+
+static size_t NewLabel(Assembler& as)
+{
+	as.labels.push_back(SIZE_MAX);
+	return as.labels.size() - 1;
+}
+
+static void BindLabel(Assembler& as, const size_t label)
+{
+	as.labels[label] = as.code.size();
+}
+
+// Jumps to `label`, conditionally unless `op` is JMP.
+static void EmitJump(Assembler& as, const uint8_t op, const size_t label)
+{
+	if (op != JMP) EmitByte(as, 0x0F);
+	EmitByte(as, op);
+	as.jumps.emplace_back(as.code.size(), label);
+	EmitInt32(as, 0);
+}
+
+static void EmitLoad(Assembler& as, const int xmm, const int base, const size_t index)
+{
+	EmitMemory(as, 0xF2, false, {0x0F, 0x10}, xmm, base, 8 * index);
+}
+
+static void EmitStore(Assembler& as, const int xmm, const int base, const size_t index)
+{
+	EmitMemory(as, 0xF2, false, {0x0F, 0x11}, xmm, base, 8 * index);
+}
+
+static void EmitReturn(Assembler& as, const int status, const size_t epilogue)
+{
+	EmitByte(as, 0xB8); // mov eax, status
+	EmitInt32(as, static_cast<uint32_t>(status));
+	EmitJump(as, JMP, epilogue);
+}
+
+// --- COMPILER ----------------------------------------------------------------
+
+// NOTE Registers hold the frame while the code runs: rbx its slots, r15 its temporaries, r14 its assigned flags, r13
+// its arrays, r12 the frame itself. Expressions compute their result in xmm0, intermediate values are kept in
+// temporaries. The most used slots live in xmm8 to xmm15 and are only stored to the frame around calls and on exit.
+struct JitCompiler {
+	JitCode& jit;
+	Assembler as;
+	std::unordered_map<std::string, size_t> slots;  // slot of each number variable
+	std::unordered_map<std::string, size_t> arrays; // index of each array variable in the frame
+	std::vector<bool> assigned;                     // whether each slot is surely assigned where code is emitted
+	std::vector<int> registers;                     // register holding each slot, -1 if it's kept in the frame
+	std::vector<size_t> uses;                       // uses of each slot, weighted by the depth of loops
+	size_t loopDepth = 0;
+	std::vector<std::pair<size_t, size_t>> errors;  // label of each error exit and its error
+	size_t epilogue = 0;
+
+	explicit JitCompiler(JitCode& jit) : jit{jit} {}
+};
+
+constexpr int FIRST_SLOT_REGISTER = 8;
+constexpr size_t SLOT_REGISTER_COUNT = 8;
+
+static bool Assemble(JitCompiler& compiler, const Statements* statements, const Statement* loop);
+static bool CompileBlock(JitCompiler& compiler, const Statements& statements, size_t temp);
+static bool CompileStatement(JitCompiler& compiler, const Statement& statement, size_t temp);
+static bool CompileFor(JitCompiler& compiler, const ForStatement& forStatement, size_t temp);
+static void CompileForTest(JitCompiler& compiler, size_t counter, size_t end, size_t step, bool inclusive, size_t done);
+static bool CompileCondition(JitCompiler& compiler, const Expression& condition, size_t temp, bool jumpIf, size_t label, bool top);
+static void CompileEqualsBranch(JitCompiler& compiler, bool jumpIfEqual, size_t label);
+static bool CompileNumber(JitCompiler& compiler, const Expression& expression, size_t temp);
+static bool CompileOperand(JitCompiler& compiler, const Expression& expression, int xmm);
+static bool CompileIndex(JitCompiler& compiler, size_t array, const Expression& index, size_t temp);
+static bool IsBool(const Expression& expression);
+static bool IsOperand(const Expression& expression);
+static bool FindSlot(JitCompiler& compiler, const std::string& name, size_t& slot);
+static bool FindArray(JitCompiler& compiler, const std::string& name, size_t& array);
+static size_t NewSlot(JitCompiler& compiler, std::string name);
+static void LoadSlot(JitCompiler& compiler, int xmm, size_t slot);
+static void StoreSlot(JitCompiler& compiler, int xmm, size_t slot);
+static void SaveRegisters(JitCompiler& compiler);
+static void RestoreRegisters(JitCompiler& compiler);
+static void SetAssigned(JitCompiler& compiler, size_t slot);
+static size_t UseTemp(JitCompiler& compiler, size_t temp);
+static size_t ErrorLabel(JitCompiler& compiler, const char* message, CodePos pos);
+static void WritePerfMap(const void* address, size_t size, const char* kind, CodePos pos);
+
+// Compiles either the function body `statements` or `loop`. The code has no entry if they do anything but compute
+// with numbers and arrays of numbers without comments, e.g. print, call functions or change the length of arrays.
+static std::shared_ptr<JitCode> Compile(const Statements* statements, const Statement* loop, const char* kind, const CodePos pos)
+{
+	auto jit = std::make_shared<JitCode>();
+
+	// NOTE A first pass counts uses of slots to pick the ones kept in registers, the second emits the code.
+	std::vector<int> registers;
+	{
+		JitCode counted;
+		JitCompiler counter{counted};
+		if (!Assemble(counter, statements, loop)) return jit;
+
+		std::vector<size_t> order(counted.slots.size());
+		for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+		std::stable_sort(order.begin(), order.end(), [&](const size_t a, const size_t b) { return counter.uses[a] > counter.uses[b]; });
+		registers.assign(order.size(), -1);
+		for (size_t i = 0; i < order.size() && i < SLOT_REGISTER_COUNT; ++i) registers[order[i]] = FIRST_SLOT_REGISTER + static_cast<int>(i);
+	}
+
+	JitCompiler compiler{*jit};
+	compiler.registers = std::move(registers);
+	if (!Assemble(compiler, statements, loop)) return jit;
+	const Assembler& as = compiler.as;
+
+	// NOTE The code is written before the memory becomes executable, so it's never writable and executable at once.
+	const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	const size_t size = (as.code.size() + pageSize - 1) / pageSize * pageSize;
+	void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED) return jit;
+	std::memcpy(memory, as.code.data(), as.code.size());
+	if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0)
+	{
+		munmap(memory, size);
+		return jit;
+	}
+
+	jit->memory = memory;
+	jit->size = size;
+	std::memcpy(&jit->entry, &memory, sizeof memory);
+	WritePerfMap(memory, as.code.size(), kind, pos);
+	return jit;
+}
+
+// Emits the whole code with its prologue, epilogue, error exits and constants.
+static bool Assemble(JitCompiler& compiler, const Statements* statements, const Statement* loop)
+{
+	Assembler& as = compiler.as;
+
+	// push rbx, r12, r13, r14, r15, which also aligns the stack for calls
+	EmitByte(as, 0x53);
+	for (uint8_t reg = 0x54; reg <= 0x57; ++reg)
+	{
+		EmitByte(as, 0x41);
+		EmitByte(as, reg);
+	}
+	EmitRegisters(as, 0, true, {0x89}, RDI, R12); // mov r12, rdi
+	EmitMemory(as, 0, true, {0x8B}, RBX, R12, offsetof(JitFrame, slots));
+	EmitMemory(as, 0, true, {0x8B}, R15, R12, offsetof(JitFrame, temps));
+	EmitMemory(as, 0, true, {0x8B}, R14, R12, offsetof(JitFrame, assigned));
+	EmitMemory(as, 0, true, {0x8B}, R13, R12, offsetof(JitFrame, arrays));
+	RestoreRegisters(compiler);
+
+	compiler.epilogue = NewLabel(as);
+	if (!(statements ? CompileBlock(compiler, *statements, 0) : CompileStatement(compiler, *loop, 0))) return false;
+	EmitReturn(as, JIT_DONE, compiler.epilogue);
+
+	BindLabel(as, compiler.epilogue);
+	SaveRegisters(compiler);
+	for (uint8_t reg = 0x5F; reg >= 0x5C; --reg)
+	{
+		EmitByte(as, 0x41);
+		EmitByte(as, reg);
+	}
+	EmitByte(as, 0x5B); // pop rbx
+	EmitByte(as, 0xC3); // ret
+
+	for (const auto& [label, error] : compiler.errors)
+	{
+		BindLabel(as, label);
+		if (!compiler.jit.errors[error].message)
+		{
+			EmitMemory(as, 0, true, {0x89}, RAX, R12, offsetof(JitFrame, index));
+			EmitMemory(as, 0, true, {0x89}, RCX, R12, offsetof(JitFrame, size));
+		}
+		EmitReturn(as, JIT_ERROR + static_cast<int>(error), compiler.epilogue);
+	}
+
+	while (as.code.size() % sizeof(double) != 0) EmitByte(as, 0xCC);
+	const size_t constantsOffset = as.code.size();
+	for (const double constant : as.constants)
+	{
+		uint64_t bits;
+		std::memcpy(&bits, &constant, sizeof bits);
+		EmitInt64(as, bits);
+	}
+
+	for (const auto& [offset, label] : as.jumps)
+	{
+		const uint32_t rel = static_cast<uint32_t>(as.labels[label] - (offset + 4));
+		std::memcpy(&as.code[offset], &rel, sizeof rel);
+	}
+	for (const auto& [offset, constant] : as.constantUses)
+	{
+		const uint32_t rel = static_cast<uint32_t>(constantsOffset + sizeof(double) * constant - (offset + 4));
+		std::memcpy(&as.code[offset], &rel, sizeof rel);
+	}
+	return true;
+}
+
+static bool CompileBlock(JitCompiler& compiler, const Statements& statements, const size_t temp)
+{
+	for (const auto& statement : statements)
+	{
+		if (!CompileStatement(compiler, *statement, temp)) return false;
+	}
+	return true;
+}
+
+// NOTE A variable assigned in an arm of an if statement or in a loop isn't surely assigned after it.
+static bool CompileStatement(JitCompiler& compiler, const Statement& statement, const size_t temp)
+{
+	Assembler& as = compiler.as;
+	if (statement.attachedComment) return false;
+
+	switch (statement.tag)
+	{
+	case StatementTag::If:
+	{
+		const auto& ifStatement = static_cast<const IfStatement&>(statement);
+
+		const std::vector<bool> before = compiler.assigned;
+		std::vector<bool> after;
+		bool firstArm = true;
+		const auto mergeArm = [&]()
+		{
+			if (firstArm) after = compiler.assigned;
+			for (size_t i = 0; i < after.size(); ++i) after[i] = after[i] && compiler.assigned[i];
+			after.resize(compiler.assigned.size(), false);
+			compiler.assigned = before;
+			compiler.assigned.resize(after.size(), false);
+			firstArm = false;
+		};
+
+		const size_t end = NewLabel(as);
+		for (const auto& elif : ifStatement.elifChain)
+		{
+			const size_t next = NewLabel(as);
+			if (!CompileCondition(compiler, *elif.condition, temp, false, next, true)) return false;
+			if (!CompileBlock(compiler, elif.statements, temp)) return false;
+			mergeArm();
+			EmitJump(as, JMP, end);
+			BindLabel(as, next);
+		}
+		if (!CompileBlock(compiler, ifStatement.elseBlock, temp)) return false;
+		mergeArm();
+		BindLabel(as, end);
+		compiler.assigned = after;
+		return true;
+	}
+	case StatementTag::Switch:
+		// NOTE Branches of the if chain are as cheap as a table lookup here.
+		return CompileStatement(compiler, *static_cast<const SwitchStatement&>(statement).chain.front(), temp);
+	case StatementTag::While:
+	{
+		const auto& whileStatement = static_cast<const WhileStatement&>(statement);
+
+		// NOTE The condition is tested at the bottom, so an iteration takes one jump.
+		const std::vector<bool> before = compiler.assigned;
+		const size_t top = NewLabel(as);
+		const size_t test = NewLabel(as);
+		++compiler.loopDepth;
+		EmitJump(as, JMP, test);
+		BindLabel(as, top);
+		if (!CompileBlock(compiler, whileStatement.statements, temp)) return false;
+		compiler.assigned = before;
+		compiler.assigned.resize(compiler.jit.slots.size(), false);
+		BindLabel(as, test);
+		if (!CompileCondition(compiler, *whileStatement.condition, temp, true, top, true)) return false;
+		--compiler.loopDepth;
+		compiler.assigned = before;
+		compiler.assigned.resize(compiler.jit.slots.size(), false);
+		return true;
+	}
+	case StatementTag::For:
+	{
+		const auto& forStatement = static_cast<const ForStatement&>(statement);
+		if (!forStatement.fallback.empty()) return CompileStatement(compiler, *forStatement.fallback.front(), temp);
+		return CompileFor(compiler, forStatement, temp);
+	}
+	case StatementTag::GuardedLoop:
+		return CompileStatement(compiler, *static_cast<const GuardedLoopStatement&>(statement).fallback.front(), temp);
+	case StatementTag::Kernel:
+		return CompileStatement(compiler, *static_cast<const KernelStatement&>(statement).loop.front(), temp);
+	case StatementTag::Fused:
+		return CompileStatement(compiler, *static_cast<const FusedStatement&>(statement).original.front(), temp);
+	case StatementTag::Assignment:
+	{
+		const auto& assignment = static_cast<const AssignmentStatement&>(statement);
+
+		size_t slot;
+		if (!FindSlot(compiler, assignment.name, slot)) return false;
+		if (!CompileNumber(compiler, *assignment.value, temp)) return false;
+		StoreSlot(compiler, XMM0, slot);
+		SetAssigned(compiler, slot);
+		return true;
+	}
+	case StatementTag::ArrayWrite:
+	case StatementTag::InBoundsArrayWrite:
+	{
+		const auto& arrayWrite = static_cast<const ArrayWriteStatement&>(statement);
+
+		size_t array;
+		if (!FindArray(compiler, arrayWrite.name, array)) return false;
+		if (!CompileIndex(compiler, array, *arrayWrite.index, temp)) return false;
+		if (IsOperand(*arrayWrite.value))
+		{
+			if (!CompileOperand(compiler, *arrayWrite.value, XMM0)) return false;
+		}
+		else
+		{
+			EmitMemory(as, 0, true, {0x89}, RAX, R15, 8 * UseTemp(compiler, temp));
+			if (!CompileNumber(compiler, *arrayWrite.value, temp + 1)) return false;
+			EmitMemory(as, 0, true, {0x8B}, RAX, R15, 8 * temp);
+		}
+		EmitMemory(as, 0, true, {0x8B}, RDX, R13, sizeof(JitArray) * array + offsetof(JitArray, data));
+		EmitPrefix(as, 0xF2, false, XMM0, 0, {0x0F, 0x11}); // movsd [rdx + rax * 8], xmm0
+		EmitByte(as, 0x04);
+		EmitByte(as, 0xC2);
+		return true;
+	}
+	case StatementTag::Return:
+	{
+		const auto& value = *static_cast<const ExpressionStatement&>(statement).value;
+
+		if (IsBool(value))
+		{
+			const size_t isFalse = NewLabel(as);
+			if (!CompileCondition(compiler, value, temp, false, isFalse, false)) return false;
+			EmitReturn(as, JIT_RETURNED_TRUE, compiler.epilogue);
+			BindLabel(as, isFalse);
+			EmitReturn(as, JIT_RETURNED_FALSE, compiler.epilogue);
+			return true;
+		}
+
+		if (!CompileNumber(compiler, value, temp)) return false;
+		EmitMemory(as, 0xF2, false, {0x0F, 0x11}, XMM0, R12, offsetof(JitFrame, value));
+		EmitReturn(as, JIT_RETURNED_NUMBER, compiler.epilogue);
+		return true;
+	}
+	default:
+		return false;
+	}
+}
+
+// The counter, end and step are kept in slots without a name while the loop runs.
+static bool CompileFor(JitCompiler& compiler, const ForStatement& forStatement, const size_t temp)
+{
+	Assembler& as = compiler.as;
+
+	size_t variable;
+	if (!FindSlot(compiler, forStatement.counter, variable)) return false;
+	const size_t counter = NewSlot(compiler, std::string{});
+	const size_t end = NewSlot(compiler, std::string{});
+	const size_t step = NewSlot(compiler, std::string{});
+
+	if (!CompileNumber(compiler, *forStatement.start, temp)) return false;
+	StoreSlot(compiler, XMM0, counter);
+	if (!CompileNumber(compiler, *forStatement.end, temp)) return false;
+	StoreSlot(compiler, XMM0, end);
+	if (forStatement.step)
+	{
+		if (!CompileNumber(compiler, *forStatement.step, temp)) return false;
+		EmitRegisters(as, 0x66, false, {0x0F, 0x57}, XMM1, XMM1); // xorpd xmm1, xmm1
+		EmitRegisters(as, 0x66, false, {0x0F, 0x2E}, XMM0, XMM1); // ucomisd xmm0, xmm1
+		CompileEqualsBranch(compiler, true, ErrorLabel(compiler, "Loop step is zero.", forStatement.step->pos));
+	}
+	else EmitConstant(as, 0xF2, {0x0F, 0x10}, XMM0, 1.0);
+	StoreSlot(compiler, XMM0, step);
+
+	// NOTE The counter is only bound once the loop runs and holds the first value out of range afterwards.
+	const std::vector<bool> before = compiler.assigned;
+	const size_t loop = NewLabel(as);
+	const size_t last = NewLabel(as);
+	const size_t done = NewLabel(as);
+	++compiler.loopDepth;
+	CompileForTest(compiler, counter, end, step, forStatement.inclusive, done);
+
+	BindLabel(as, loop);
+	LoadSlot(compiler, XMM0, counter);
+	StoreSlot(compiler, XMM0, variable);
+	SetAssigned(compiler, variable);
+	if (!CompileBlock(compiler, forStatement.statements, temp)) return false;
+	LoadSlot(compiler, XMM0, counter);
+	LoadSlot(compiler, XMM1, step);
+	EmitRegisters(as, 0xF2, false, {0x0F, ADDSD}, XMM0, XMM1);
+	StoreSlot(compiler, XMM0, counter);
+	CompileForTest(compiler, counter, end, step, forStatement.inclusive, last);
+	EmitJump(as, JMP, loop);
+	--compiler.loopDepth;
+
+	BindLabel(as, last);
+	LoadSlot(compiler, XMM0, counter);
+	StoreSlot(compiler, XMM0, variable);
+	BindLabel(as, done);
+	compiler.assigned = before;
+	compiler.assigned.resize(compiler.jit.slots.size(), false);
+	return true;
+}
+
+// Jumps to `done` unless the counter is in range.
+static void CompileForTest(JitCompiler& compiler, const size_t counter, const size_t end, const size_t step, const bool inclusive, const size_t done)
+{
+	Assembler& as = compiler.as;
+
+	LoadSlot(compiler, XMM0, counter);
+	LoadSlot(compiler, XMM1, end);
+	LoadSlot(compiler, XMM2, step);
+	EmitRegisters(as, 0x66, false, {0x0F, 0x57}, XMM3, XMM3);
+	const size_t down = NewLabel(as);
+	const size_t run = NewLabel(as);
+	EmitRegisters(as, 0x66, false, {0x0F, 0x2E}, XMM2, XMM3);
+	EmitJump(as, JBE, down);
+	EmitRegisters(as, 0x66, false, {0x0F, 0x2E}, XMM1, XMM0);
+	EmitJump(as, inclusive ? JB : JBE, done);
+	EmitJump(as, JMP, run);
+	BindLabel(as, down);
+	EmitRegisters(as, 0x66, false, {0x0F, 0x2E}, XMM0, XMM1);
+	EmitJump(as, JBE, done);
+	BindLabel(as, run);
+}
+
+// Jumps to `label` if `condition` is `jumpIf`. Only the `top` condition of an if statement or loop may be a number.
+static bool CompileCondition(JitCompiler& compiler, const Expression& condition, const size_t temp, const bool jumpIf, const size_t label, const bool top)
+{
+	Assembler& as = compiler.as;
+	if (condition.attachedComment) return false;
+
+	switch (condition.tag)
+	{
+	case ExpressionTag::False:
+	case ExpressionTag::True:
+		if ((condition.tag == ExpressionTag::True) == jumpIf) EmitJump(as, JMP, label);
+		return true;
+	case ExpressionTag::Unary:
+	{
+		const auto& unaryOp = static_cast<const UnaryOperation&>(condition);
+		if (unaryOp.op != TokenTag::KeyNot) break;
+		return IsBool(*unaryOp.a) && CompileCondition(compiler, *unaryOp.a, temp, !jumpIf, label, false);
+	}
+	case ExpressionTag::Binary:
+	case ExpressionTag::TypedBinary:
+	{
+		const auto& binaryOp = static_cast<const BinaryOperation&>(condition);
+
+		switch (binaryOp.op)
+		{
+		case TokenTag::KeyAnd:
+		case TokenTag::KeyOr:
+		{
+			if (!IsBool(*binaryOp.a) || !IsBool(*binaryOp.b)) return false;
+
+			// NOTE `and` jumps on its first false operand, `or` on its first true one.
+			const bool shortCircuit = binaryOp.op == TokenTag::KeyOr;
+			if (jumpIf == shortCircuit)
+			{
+				return CompileCondition(compiler, *binaryOp.a, temp, jumpIf, label, false) && CompileCondition(compiler, *binaryOp.b, temp, jumpIf, label, false);
+			}
+			const size_t skip = NewLabel(as);
+			if (!CompileCondition(compiler, *binaryOp.a, temp, shortCircuit, skip, false)) return false;
+			if (!CompileCondition(compiler, *binaryOp.b, temp, jumpIf, label, false)) return false;
+			BindLabel(as, skip);
+			return true;
+		}
+		case TokenTag::LessThan:
+		case TokenTag::GreaterThan:
+		case TokenTag::LessEquals:
+		case TokenTag::GreaterEquals:
+		case TokenTag::EqualsEquals:
+		case TokenTag::NotEquals:
+		{
+			if (!CompileNumber(compiler, *binaryOp.a, temp)) return false;
+			if (IsOperand(*binaryOp.b))
+			{
+				if (!CompileOperand(compiler, *binaryOp.b, XMM1)) return false;
+			}
+			else
+			{
+				EmitStore(as, XMM0, R15, UseTemp(compiler, temp));
+				if (!CompileNumber(compiler, *binaryOp.b, temp + 1)) return false;
+				EmitRegisters(as, 0x66, false, {0x0F, 0x28}, XMM1, XMM0); // movapd xmm1, xmm0
+				EmitLoad(as, XMM0, R15, temp);
+			}
+
+			// NOTE ucomisd sets CF for "below" and for NaN, so < and <= compare swapped operands with "above".
+			switch (binaryOp.op)
+			{
+			case TokenTag::LessThan:
+				EmitRegisters(as, 0x66, false, {0x0F, 0x2E}, XMM1, XMM0);
+				EmitJump(as, jumpIf ? JA : JBE, label);
+				return true;
+			case TokenTag::GreaterThan:
+				EmitRegisters(as, 0x66, false, {0x0F, 0x2E}, XMM0, XMM1);
+				EmitJump(as, jumpIf ? JA : JBE, label);
+				return true;
+			case TokenTag::LessEquals:
+				EmitRegisters(as, 0x66, false, {0x0F, 0x2E}, XMM1, XMM0);
+				EmitJump(as, jumpIf ? JAE : JB, label);
+				return true;
+			case TokenTag::GreaterEquals:
+				EmitRegisters(as, 0x66, false, {0x0F, 0x2E}, XMM0, XMM1);
+				EmitJump(as, jumpIf ? JAE : JB, label);
+				return true;
+			default:
+				EmitRegisters(as, 0x66, false, {0x0F, 0x2E}, XMM0, XMM1);
+				CompileEqualsBranch(compiler, jumpIf == (binaryOp.op == TokenTag::EqualsEquals), label);
+				return true;
+			}
+		}
+		default:
+			break;
+		}
+		break;
+	}
+	default:
+		break;
+	}
+
+	if (!top || IsBool(condition)) return false;
+	if (!CompileNumber(compiler, condition, temp)) return false;
+	EmitRegisters(as, 0x66, false, {0x0F, 0x57}, XMM1, XMM1);
+	EmitRegisters(as, 0x66, false, {0x0F, 0x2E}, XMM0, XMM1);
+	CompileEqualsBranch(compiler, !jumpIf, label);
+	return true;
+}
+
+// Jumps to `label` after ucomisd if the operands are equal, or if they aren't. NaN is unequal to everything.
+static void CompileEqualsBranch(JitCompiler& compiler, const bool jumpIfEqual, const size_t label)
+{
+	Assembler& as = compiler.as;
+	if (jumpIfEqual)
+	{
+		const size_t unordered = NewLabel(as);
+		EmitJump(as, JP, unordered);
+		EmitJump(as, JE, label);
+		BindLabel(as, unordered);
+	}
+	else
+	{
+		EmitJump(as, JP, label);
+		EmitJump(as, JNE, label);
+	}
+}
+
+// Computes `expression` in xmm0.
+static bool CompileNumber(JitCompiler& compiler, const Expression& expression, const size_t temp)
+{
+	Assembler& as = compiler.as;
+	if (expression.attachedComment) return false;
+
+	switch (expression.tag)
+	{
+	case ExpressionTag::NumberLiteral:
+	case ExpressionTag::Constant:
+	case ExpressionTag::Identifier:
+		return CompileOperand(compiler, expression, XMM0);
+	case ExpressionTag::Unary:
+	{
+		const auto& unaryOp = static_cast<const UnaryOperation&>(expression);
+
+		if (unaryOp.op == TokenTag::KeyNeg)
+		{
+			if (!CompileNumber(compiler, *unaryOp.a, temp)) return false;
+			EmitRegisters(as, 0x66, true, {0x0F, 0x7E}, XMM0, RAX); // movq rax, xmm0
+			EmitRegisters(as, 0, true, {0x0F, 0xBA}, 7, RAX);      // btc rax, 63
+			EmitByte(as, 63);
+			EmitRegisters(as, 0x66, true, {0x0F, 0x6E}, XMM0, RAX); // movq xmm0, rax
+			return true;
+		}
+		else if (unaryOp.op == TokenTag::Hash)
+		{
+			size_t array;
+			if (unaryOp.a->tag != ExpressionTag::Identifier || unaryOp.a->attachedComment) return false;
+			if (!FindArray(compiler, static_cast<const Identifier&>(*unaryOp.a).name, array)) return false;
+			EmitMemory(as, 0, true, {0x8B}, RAX, R13, sizeof(JitArray) * array + offsetof(JitArray, size));
+			EmitRegisters(as, 0xF2, true, {0x0F, 0x2A}, XMM0, RAX); // cvtsi2sd xmm0, rax
+			return true;
+		}
+		return false;
+	}
+	case ExpressionTag::Binary:
+	case ExpressionTag::TypedBinary:
+	case ExpressionTag::InBoundsRead:
+	{
+		const auto& binaryOp = static_cast<const BinaryOperation&>(expression);
+
+		uint8_t op;
+		switch (binaryOp.op)
+		{
+		case TokenTag::Plus: op = ADDSD; break;
+		case TokenTag::Minus: op = SUBSD; break;
+		case TokenTag::Star: op = MULSD; break;
+		case TokenTag::Slash: op = DIVSD; break;
+		case TokenTag::Percent:
+		{
+			if (!CompileNumber(compiler, *binaryOp.a, temp)) return false;
+			EmitStore(as, XMM0, R15, UseTemp(compiler, temp));
+			if (!CompileNumber(compiler, *binaryOp.b, temp + 1)) return false;
+			EmitRegisters(as, 0x66, false, {0x0F, 0x28}, XMM1, XMM0);
+			EmitLoad(as, XMM0, R15, temp);
+			SaveRegisters(compiler);
+			EmitByte(as, 0x48); // mov rax, Modulo
+			EmitByte(as, 0xB8);
+			EmitInt64(as, reinterpret_cast<uint64_t>(&Modulo));
+			EmitByte(as, 0xFF); // call rax
+			EmitByte(as, 0xD0);
+			RestoreRegisters(compiler);
+			return true;
+		}
+		case TokenTag::At:
+		{
+			size_t array;
+			if (binaryOp.a->tag != ExpressionTag::Identifier || binaryOp.a->attachedComment) return false;
+			if (!FindArray(compiler, static_cast<const Identifier&>(*binaryOp.a).name, array)) return false;
+			if (!CompileIndex(compiler, array, *binaryOp.b, temp)) return false;
+			EmitMemory(as, 0, true, {0x8B}, RDX, R13, sizeof(JitArray) * array + offsetof(JitArray, data));
+			EmitPrefix(as, 0xF2, false, XMM0, 0, {0x0F, 0x10}); // movsd xmm0, [rdx + rax * 8]
+			EmitByte(as, 0x04);
+			EmitByte(as, 0xC2);
+			return true;
+		}
+		default:
+			return false;
+		}
+
+		if (!CompileNumber(compiler, *binaryOp.a, temp)) return false;
+		if (IsOperand(*binaryOp.b))
+		{
+			if (!CompileOperand(compiler, *binaryOp.b, XMM1)) return false;
+		}
+		else
+		{
+			EmitStore(as, XMM0, R15, UseTemp(compiler, temp));
+			if (!CompileNumber(compiler, *binaryOp.b, temp + 1)) return false;
+			EmitRegisters(as, 0x66, false, {0x0F, 0x28}, XMM1, XMM0);
+			EmitLoad(as, XMM0, R15, temp);
+		}
+		EmitRegisters(as, 0xF2, false, {0x0F, op}, XMM0, XMM1);
+		return true;
+	}
+	default:
+		return false;
+	}
+}
+
+// Loads a number literal, constant or variable to `xmm`.
+static bool CompileOperand(JitCompiler& compiler, const Expression& expression, const int xmm)
+{
+	if (expression.attachedComment) return false;
+
+	if (expression.tag == ExpressionTag::NumberLiteral)
+	{
+		EmitConstant(compiler.as, 0xF2, {0x0F, 0x10}, xmm, static_cast<const NumberLiteral&>(expression).value);
+		return true;
+	}
+	else if (expression.tag == ExpressionTag::Constant)
+	{
+		const Value& value = static_cast<const Constant&>(expression).value;
+		if (value.Type() != TypeTag::Number || value.GetComment()) return false;
+		EmitConstant(compiler.as, 0xF2, {0x0F, 0x10}, xmm, value.number);
+		return true;
+	}
+
+	size_t slot;
+	if (!FindSlot(compiler, static_cast<const Identifier&>(expression).name, slot)) return false;
+	if (!compiler.assigned[slot]) compiler.jit.slots[slot].read = true;
+	LoadSlot(compiler, xmm, slot);
+	return true;
+}
+
+// Computes `index` into `array` in rax and checks it's in bounds, the array's length is left in rcx.
+static bool CompileIndex(JitCompiler& compiler, const size_t array, const Expression& index, const size_t temp)
+{
+	Assembler& as = compiler.as;
+	if (!CompileNumber(compiler, index, temp)) return false;
+
+	// NOTE cvttsd2si truncates like the cast to size_t in the tree walker, negative indices wrap around.
+	EmitRegisters(as, 0xF2, true, {0x0F, 0x2C}, RAX, XMM0); // cvttsd2si rax, xmm0
+	EmitMemory(as, 0, true, {0x8B}, RCX, R13, sizeof(JitArray) * array + offsetof(JitArray, size));
+	EmitRegisters(as, 0, true, {0x39}, RCX, RAX); // cmp rax, rcx
+	EmitJump(as, JAE, ErrorLabel(compiler, nullptr, index.pos));
+	return true;
+}
+
+static bool IsBool(const Expression& expression)
+{
+	switch (expression.tag)
+	{
+	case ExpressionTag::False:
+	case ExpressionTag::True:
+		return true;
+	case ExpressionTag::Unary:
+		return static_cast<const UnaryOperation&>(expression).op == TokenTag::KeyNot;
+	case ExpressionTag::Binary:
+	case ExpressionTag::TypedBinary:
+		switch (static_cast<const BinaryOperation&>(expression).op)
+		{
+		case TokenTag::KeyAnd:
+		case TokenTag::KeyOr:
+		case TokenTag::KeyXor:
+		case TokenTag::LessThan:
+		case TokenTag::GreaterThan:
+		case TokenTag::LessEquals:
+		case TokenTag::GreaterEquals:
+		case TokenTag::EqualsEquals:
+		case TokenTag::NotEquals:
+			return true;
+		default:
+			return false;
+		}
+	default:
+		return false;
+	}
+}
+
+static bool IsOperand(const Expression& expression)
+{
+	return expression.tag == ExpressionTag::NumberLiteral || expression.tag == ExpressionTag::Constant || expression.tag == ExpressionTag::Identifier;
+}
+
+// A name is either a number variable or an array variable throughout the code.
+static bool FindSlot(JitCompiler& compiler, const std::string& name, size_t& slot)
+{
+	if (compiler.arrays.count(name)) return false;
+
+	auto it = compiler.slots.find(name);
+	if (it == compiler.slots.end()) it = compiler.slots.emplace(name, NewSlot(compiler, name)).first;
+	slot = it->second;
+	return true;
+}
+
+static bool FindArray(JitCompiler& compiler, const std::string& name, size_t& array)
+{
+	if (compiler.slots.count(name)) return false;
+
+	auto [it, inserted] = compiler.arrays.try_emplace(name, compiler.jit.arrays.size());
+	if (inserted) compiler.jit.arrays.push_back(name);
+	array = it->second;
+	return true;
+}
+
+// Adds a slot, one without a name isn't a variable and isn't written back.
+static size_t NewSlot(JitCompiler& compiler, std::string name)
+{
+	compiler.jit.slots.push_back(JitSlot{std::move(name), false});
+	compiler.assigned.push_back(false);
+	compiler.uses.push_back(0);
+	if (compiler.registers.size() < compiler.jit.slots.size()) compiler.registers.push_back(-1);
+	return compiler.jit.slots.size() - 1;
+}
+
+static void LoadSlot(JitCompiler& compiler, const int xmm, const size_t slot)
+{
+	compiler.uses[slot] += size_t{1} << (3 * std::min<size_t>(compiler.loopDepth, 6));
+	const int reg = compiler.registers[slot];
+	if (reg < 0) EmitLoad(compiler.as, xmm, RBX, slot);
+	else EmitRegisters(compiler.as, 0x66, false, {0x0F, 0x28}, xmm, reg); // movapd xmm, reg
+}
+
+static void StoreSlot(JitCompiler& compiler, const int xmm, const size_t slot)
+{
+	compiler.uses[slot] += size_t{1} << (3 * std::min<size_t>(compiler.loopDepth, 6));
+	const int reg = compiler.registers[slot];
+	if (reg < 0) EmitStore(compiler.as, xmm, RBX, slot);
+	else EmitRegisters(compiler.as, 0x66, false, {0x0F, 0x28}, reg, xmm);
+}
+
+// Stores slots kept in registers to the frame, before calls, which don't preserve xmm registers, and on exit.
+static void SaveRegisters(JitCompiler& compiler)
+{
+	for (size_t slot = 0; slot < compiler.registers.size(); ++slot)
+	{
+		if (compiler.registers[slot] >= 0) EmitStore(compiler.as, compiler.registers[slot], RBX, slot);
+	}
+}
+
+static void RestoreRegisters(JitCompiler& compiler)
+{
+	for (size_t slot = 0; slot < compiler.registers.size(); ++slot)
+	{
+		if (compiler.registers[slot] >= 0) EmitLoad(compiler.as, compiler.registers[slot], RBX, slot);
+	}
+}
+
+// Flags the slot for writing back, unless it's surely flagged already.
+static void SetAssigned(JitCompiler& compiler, const size_t slot)
+{
+	if (compiler.assigned[slot]) return;
+	compiler.assigned[slot] = true;
+	EmitMemory(compiler.as, 0, false, {0xC6}, 0, R14, slot); // mov byte [assigned], 1
+	EmitByte(compiler.as, 1);
+}
+
+static size_t UseTemp(JitCompiler& compiler, const size_t temp)
+{
+	if (compiler.jit.tempCount <= temp) compiler.jit.tempCount = temp + 1;
+	return temp;
+}
+
+// Returns a label exiting the code with an error, one of an index out of bounds if `message` is null.
+static size_t ErrorLabel(JitCompiler& compiler, const char* message, const CodePos pos)
+{
+	const size_t label = NewLabel(compiler.as);
+	compiler.errors.emplace_back(label, compiler.jit.errors.size());
+	compiler.jit.errors.push_back(JitError{message, pos});
+	return label;
+}
+
+// NOTE perf reads symbols of generated code from /tmp/perf-PID.map, one "START SIZE NAME" line per function.
+static void WritePerfMap(const void* address, const size_t size, const char* kind, const CodePos pos)
+{
+	static FILE* file = fopen(Format("/tmp/perf-%d.map", static_cast<int>(getpid())).c_str(), "w");
+	if (!file) return;
+	fprintf(file, "%llx %zx rjl_%s_%zu_%zu\n", static_cast<unsigned long long>(reinterpret_cast<uintptr_t>(address)), size, kind, pos.line, pos.col);
+	fflush(file);
+}
+
+#endif
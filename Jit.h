@@ -0,0 +1,19 @@
+#pragma once
+
+#include "Error.h"
+#include "Parser.h"
+#include "Runtime.h"
+
+#include <memory>
+#include <optional>
+
+// Machine code of a loop or function body. Code that can't be compiled keeps an empty JitCode, so it's tried once.
+struct JitCode;
+
+// Runs `loop` (a while or for loop, possibly rewritten by the optimizer) as x86-64 machine code, compiling it on first
+// use. `ran` is false when the loop can't be compiled or its variables don't hold the types it was compiled for, the
+// caller then runs it itself. `returned` is set if a return statement ran.
+[[nodiscard]] Error RunJitLoop(const Statement& loop, const Ref<Scope>& scope, bool& ran, std::optional<Value>& returned);
+
+// Same for the body of a call of `code` with arguments bound in `scope`. `out` is set to the result of the call.
+[[nodiscard]] Error RunJitFunction(FunctionCode& code, const Ref<Scope>& scope, bool& ran, Value& out);
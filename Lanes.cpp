@@ -0,0 +1,523 @@
+#include "Lanes.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+#if defined(__GNUC__)
+#define RJL_VECTOR_LANES
+#endif
+
+using Statements = std::vector<std::unique_ptr<Statement>>;
+using NameSet = std::unordered_set<std::string>;
+
+constexpr size_t LANES = 4;
+
+// Number registers with a fixed use. The others hold constants, names read from the closure, variables and
+// intermediate results.
+constexpr uint32_t ARGUMENT = 0;
+constexpr uint32_t RESULT = 1;
+
+// Mask registers with a fixed use. A mask has all bits of a lane set where it holds and none elsewhere, bools are masks.
+constexpr uint32_t ALL = 0;  // every lane, also `true`
+constexpr uint32_t NONE = 1; // no lane, also `false`
+constexpr uint32_t DONE = 2; // lanes whose call returned
+
+enum class LaneOp : uint8_t {
+	Add,           // numbers[a] = numbers[b] + numbers[c]
+	Subtract,      // numbers[a] = numbers[b] - numbers[c]
+	Multiply,      // numbers[a] = numbers[b] * numbers[c]
+	Divide,        // numbers[a] = numbers[b] / numbers[c]
+	Modulo,        // numbers[a] = numbers[b] % numbers[c]
+	Negate,        // numbers[a] = -numbers[b]
+	Less,          // masks[a] = numbers[b] < numbers[c]
+	Greater,       // masks[a] = numbers[b] > numbers[c]
+	LessEquals,    // masks[a] = numbers[b] <= numbers[c]
+	GreaterEquals, // masks[a] = numbers[b] >= numbers[c]
+	Equals,        // masks[a] = numbers[b] == numbers[c]
+	NotEquals,     // masks[a] = numbers[b] != numbers[c]
+	IsTrue,        // masks[a] = numbers[b] != 0
+	And,           // masks[a] = masks[b] and masks[c]
+	Or,            // masks[a] = masks[b] or masks[c]
+	Xor,           // masks[a] = masks[b] xor masks[c]
+	AndNot,        // masks[a] = masks[b] and not masks[c]
+	Not,           // masks[a] = not masks[b]
+	MoveNumber,    // numbers[a] = numbers[b] in lanes masks[c]
+	MoveMask,      // masks[a] = masks[b] in lanes masks[c]
+	Return,        // numbers[RESULT] = numbers[b] in lanes masks[c], which join DONE
+};
+
+struct LaneInstruction {
+	LaneOp op;
+	uint32_t a;
+	uint32_t b;
+	uint32_t c;
+};
+
+struct LaneCode {
+	bool valid = false;
+	std::vector<LaneInstruction> code;
+	std::vector<std::pair<uint32_t, double>> constants;          // number register and its value
+	std::vector<std::pair<uint32_t, std::string>> freeVariables; // number register and the name read into it
+	uint32_t numberCount = RESULT + 1;
+	uint32_t maskCount = DONE + 1;
+};
+
+enum class LaneType {
+	Number,
+	Bool,
+};
+
+struct LaneVariable {
+	LaneType type;
+	uint32_t reg;
+};
+
+struct LaneCompiler {
+	LaneCode& code;
+	std::string arg;
+	NameSet locals;                                          // the argument and names the body assigns
+	std::unordered_map<std::string, LaneVariable> variables; // register of each local and name read from the closure
+};
+
+static void CollectAssignedNames(const Statements& statements, NameSet& out);
+[[nodiscard]] static bool CompileBlock(LaneCompiler& compiler, const Statements& statements, uint32_t& mask, NameSet& assigned, bool& returns, bool& ends);
+[[nodiscard]] static bool CompileStatement(LaneCompiler& compiler, const Statement& statement, uint32_t& mask, NameSet& assigned, bool& returns, bool& ends);
+[[nodiscard]] static bool CompileIf(LaneCompiler& compiler, const IfStatement& ifStatement, uint32_t& mask, NameSet& assigned, bool& returns, bool& ends);
+[[nodiscard]] static bool CompileCondition(LaneCompiler& compiler, const Expression& condition, const NameSet& assigned, uint32_t& out);
+[[nodiscard]] static bool CompileExpression(LaneCompiler& compiler, const Expression& expression, const NameSet& assigned, LaneType& type, uint32_t& out);
+[[nodiscard]] static bool CompileBinary(LaneCompiler& compiler, const BinaryOperation& binaryOp, const NameSet& assigned, LaneType& type, uint32_t& out);
+static uint32_t AddConstant(LaneCompiler& compiler, double value);
+static uint32_t NewNumber(LaneCompiler& compiler);
+static uint32_t NewMask(LaneCompiler& compiler);
+static void Emit(LaneCompiler& compiler, LaneOp op, uint32_t a, uint32_t b, uint32_t c);
+
+std::shared_ptr<LaneCode> CompileLanes(const std::string& arg, const Statements& statements)
+{
+	auto code = std::make_shared<LaneCode>();
+	LaneCompiler compiler{*code, arg, {arg}, {}};
+	CollectAssignedNames(statements, compiler.locals);
+	compiler.variables.emplace(arg, LaneVariable{LaneType::Number, ARGUMENT});
+
+	uint32_t mask = ALL;
+	NameSet assigned{arg};
+	bool returns = false;
+	bool ends = false;
+	if (!CompileBlock(compiler, statements, mask, assigned, returns, ends) || !returns)
+	{
+		return std::make_shared<LaneCode>();
+	}
+	code->valid = true;
+	return code;
+}
+
+// --- COMPILER ----------------------------------------------------------------
+
+static void CollectAssignedNames(const Statements& statements, NameSet& out)
+{
+	for (const auto& statement : statements)
+	{
+		switch (statement->tag)
+		{
+		case StatementTag::If:
+		{
+			const auto& ifStatement = static_cast<const IfStatement&>(*statement);
+			for (const auto& elif : ifStatement.elifChain) CollectAssignedNames(elif.statements, out);
+			CollectAssignedNames(ifStatement.elseBlock, out);
+			break;
+		}
+		case StatementTag::Switch:
+			CollectAssignedNames(static_cast<const SwitchStatement&>(*statement).chain, out);
+			break;
+		case StatementTag::Fused:
+			CollectAssignedNames(static_cast<const FusedStatement&>(*statement).original, out);
+			break;
+		case StatementTag::Assignment:
+			out.insert(static_cast<const AssignmentStatement&>(*statement).name);
+			break;
+		default:
+			// NOTE Other statements aren't compiled, so the names they bind don't matter.
+			break;
+		}
+	}
+}
+
+// Compiles `statements` to run in lanes `mask`, which narrows to the lanes that didn't return yet after statements
+// that can return. `assigned` holds the locals assigned on every way to the current statement. Sets `returns` if a
+// return statement can run and `ends` if every lane returns, the statements after that aren't compiled.
+[[nodiscard]] static bool CompileBlock(LaneCompiler& compiler, const Statements& statements, uint32_t& mask, NameSet& assigned, bool& returns, bool& ends)
+{
+	for (const auto& statement : statements)
+	{
+		if (!CompileStatement(compiler, *statement, mask, assigned, returns, ends)) return false;
+		if (ends) return true;
+	}
+	return true;
+}
+
+[[nodiscard]] static bool CompileStatement(LaneCompiler& compiler, const Statement& statement, uint32_t& mask, NameSet& assigned, bool& returns, bool& ends)
+{
+	switch (statement.tag)
+	{
+	case StatementTag::If:
+		return CompileIf(compiler, static_cast<const IfStatement&>(statement), mask, assigned, returns, ends);
+	case StatementTag::Switch:
+		return CompileStatement(compiler, *static_cast<const SwitchStatement&>(statement).chain.front(), mask, assigned, returns, ends);
+	case StatementTag::Fused:
+		return CompileStatement(compiler, *static_cast<const FusedStatement&>(statement).original.front(), mask, assigned, returns, ends);
+	case StatementTag::Assignment:
+	{
+		const auto& assignment = static_cast<const AssignmentStatement&>(statement);
+		LaneType type;
+		uint32_t value;
+		if (!CompileExpression(compiler, *assignment.value, assigned, type, value)) return false;
+
+		// NOTE A variable keeps one type in every lane, so it has one register.
+		auto it = compiler.variables.find(assignment.name);
+		if (it == compiler.variables.end())
+		{
+			const uint32_t reg = type == LaneType::Number ? NewNumber(compiler) : NewMask(compiler);
+			it = compiler.variables.emplace(assignment.name, LaneVariable{type, reg}).first;
+		}
+		else if (it->second.type != type) return false;
+
+		Emit(compiler, type == LaneType::Number ? LaneOp::MoveNumber : LaneOp::MoveMask, it->second.reg, value, mask);
+		assigned.insert(assignment.name);
+		return true;
+	}
+	case StatementTag::Return:
+	{
+		LaneType type;
+		uint32_t value;
+		if (!CompileExpression(compiler, *static_cast<const ExpressionStatement&>(statement).value, assigned, type, value)) return false;
+		if (type != LaneType::Number) return false;
+
+		Emit(compiler, LaneOp::Return, 0, value, mask);
+		returns = true;
+		ends = true;
+		return true;
+	}
+	default:
+		return false;
+	}
+}
+
+// Every arm runs in the lanes where its condition is the first to hold. Conditions after the first one run in lanes
+// that took an earlier arm too, which only compute values no lane uses.
+[[nodiscard]] static bool CompileIf(LaneCompiler& compiler, const IfStatement& ifStatement, uint32_t& mask, NameSet& assigned, bool& returns, bool& ends)
+{
+	NameSet joined;
+	bool fallsThrough = false;
+	bool armReturns = false;
+	const auto compileArm = [&](const Statements& statements, uint32_t armMask) {
+		NameSet armAssigned = assigned;
+		bool armEnds = false;
+		if (!CompileBlock(compiler, statements, armMask, armAssigned, armReturns, armEnds)) return false;
+		if (armEnds) return true;
+
+		if (!fallsThrough) joined = std::move(armAssigned);
+		else
+		{
+			for (auto it = joined.begin(); it != joined.end();)
+			{
+				if (armAssigned.count(*it)) ++it;
+				else it = joined.erase(it);
+			}
+		}
+		fallsThrough = true;
+		return true;
+	};
+
+	uint32_t rest = mask;
+	for (const auto& elif : ifStatement.elifChain)
+	{
+		uint32_t condition;
+		if (!CompileCondition(compiler, *elif.condition, assigned, condition)) return false;
+
+		uint32_t armMask = condition;
+		if (rest != ALL)
+		{
+			armMask = NewMask(compiler);
+			Emit(compiler, LaneOp::And, armMask, rest, condition);
+		}
+		const uint32_t next = NewMask(compiler);
+		Emit(compiler, LaneOp::AndNot, next, rest, condition);
+
+		if (!compileArm(elif.statements, armMask)) return false;
+		rest = next;
+	}
+	if (!compileArm(ifStatement.elseBlock, rest)) return false;
+
+	if (armReturns)
+	{
+		returns = true;
+		if (!fallsThrough)
+		{
+			ends = true;
+			return true;
+		}
+		const uint32_t live = NewMask(compiler);
+		Emit(compiler, LaneOp::AndNot, live, mask, DONE);
+		mask = live;
+	}
+	assigned = std::move(joined);
+	return true;
+}
+
+// Compiles a condition of an if statement, numbers hold where they aren't zero.
+[[nodiscard]] static bool CompileCondition(LaneCompiler& compiler, const Expression& condition, const NameSet& assigned, uint32_t& out)
+{
+	LaneType type;
+	uint32_t value;
+	if (!CompileExpression(compiler, condition, assigned, type, value)) return false;
+	if (type == LaneType::Bool)
+	{
+		out = value;
+		return true;
+	}
+	out = NewMask(compiler);
+	Emit(compiler, LaneOp::IsTrue, out, value, 0);
+	return true;
+}
+
+// Compiles `expression` to leave its value in register `out` of `type`. Fails for expressions that could fail, print
+// or compute anything else than numbers and bools.
+[[nodiscard]] static bool CompileExpression(LaneCompiler& compiler, const Expression& expression, const NameSet& assigned, LaneType& type, uint32_t& out)
+{
+	switch (expression.tag)
+	{
+	case ExpressionTag::False:
+	case ExpressionTag::True:
+		type = LaneType::Bool;
+		out = expression.tag == ExpressionTag::True ? ALL : NONE;
+		return true;
+	case ExpressionTag::NumberLiteral:
+		type = LaneType::Number;
+		out = AddConstant(compiler, static_cast<const NumberLiteral&>(expression).value);
+		return true;
+	case ExpressionTag::Constant:
+	{
+		const Value& value = static_cast<const Constant&>(expression).value;
+		if (value.Type() == TypeTag::Number)
+		{
+			type = LaneType::Number;
+			out = AddConstant(compiler, value.number);
+			return true;
+		}
+		if (value.Type() != TypeTag::Bool) return false;
+		type = LaneType::Bool;
+		out = value.boolean ? ALL : NONE;
+		return true;
+	}
+	case ExpressionTag::Identifier:
+	{
+		// NOTE A local may only be read where it's assigned on every way there, it could be unbound otherwise.
+		const std::string& name = static_cast<const Identifier&>(expression).name;
+		if (compiler.locals.count(name))
+		{
+			if (!assigned.count(name)) return false;
+			const LaneVariable& variable = compiler.variables.at(name);
+			type = variable.type;
+			out = variable.reg;
+			return true;
+		}
+
+		auto it = compiler.variables.find(name);
+		if (it == compiler.variables.end())
+		{
+			const uint32_t reg = NewNumber(compiler);
+			compiler.code.freeVariables.emplace_back(reg, name);
+			it = compiler.variables.emplace(name, LaneVariable{LaneType::Number, reg}).first;
+		}
+		type = LaneType::Number;
+		out = it->second.reg;
+		return true;
+	}
+	case ExpressionTag::Unary:
+	{
+		const auto& unaryOp = static_cast<const UnaryOperation&>(expression);
+		uint32_t a;
+		if (!CompileExpression(compiler, *unaryOp.a, assigned, type, a)) return false;
+		if (unaryOp.op == TokenTag::KeyNeg && type == LaneType::Number)
+		{
+			out = NewNumber(compiler);
+			Emit(compiler, LaneOp::Negate, out, a, 0);
+			return true;
+		}
+		if (unaryOp.op == TokenTag::KeyNot && type == LaneType::Bool)
+		{
+			out = NewMask(compiler);
+			Emit(compiler, LaneOp::Not, out, a, 0);
+			return true;
+		}
+		return false;
+	}
+	case ExpressionTag::Binary:
+	case ExpressionTag::TypedBinary:
+		return CompileBinary(compiler, static_cast<const BinaryOperation&>(expression), assigned, type, out);
+	default:
+		return false;
+	}
+}
+
+// NOTE Both operands of `and` and `or` run, which can't be told apart from short-circuiting when neither can fail.
+[[nodiscard]] static bool CompileBinary(LaneCompiler& compiler, const BinaryOperation& binaryOp, const NameSet& assigned, LaneType& type, uint32_t& out)
+{
+	LaneOp op;
+	LaneType operandType = LaneType::Number;
+	type = LaneType::Bool;
+	switch (binaryOp.op)
+	{
+	case TokenTag::Plus: op = LaneOp::Add; type = LaneType::Number; break;
+	case TokenTag::Minus: op = LaneOp::Subtract; type = LaneType::Number; break;
+	case TokenTag::Star: op = LaneOp::Multiply; type = LaneType::Number; break;
+	case TokenTag::Slash: op = LaneOp::Divide; type = LaneType::Number; break;
+	case TokenTag::Percent: op = LaneOp::Modulo; type = LaneType::Number; break;
+	case TokenTag::LessThan: op = LaneOp::Less; break;
+	case TokenTag::GreaterThan: op = LaneOp::Greater; break;
+	case TokenTag::LessEquals: op = LaneOp::LessEquals; break;
+	case TokenTag::GreaterEquals: op = LaneOp::GreaterEquals; break;
+	case TokenTag::EqualsEquals: op = LaneOp::Equals; break;
+	case TokenTag::NotEquals: op = LaneOp::NotEquals; break;
+	case TokenTag::KeyAnd: op = LaneOp::And; operandType = LaneType::Bool; break;
+	case TokenTag::KeyOr: op = LaneOp::Or; operandType = LaneType::Bool; break;
+	case TokenTag::KeyXor: op = LaneOp::Xor; operandType = LaneType::Bool; break;
+	default: return false;
+	}
+
+	LaneType aType;
+	LaneType bType;
+	uint32_t a;
+	uint32_t b;
+	if (!CompileExpression(compiler, *binaryOp.a, assigned, aType, a) || aType != operandType) return false;
+	if (!CompileExpression(compiler, *binaryOp.b, assigned, bType, b) || bType != operandType) return false;
+
+	out = type == LaneType::Number ? NewNumber(compiler) : NewMask(compiler);
+	Emit(compiler, op, out, a, b);
+	return true;
+}
+
+static uint32_t AddConstant(LaneCompiler& compiler, const double value)
+{
+	const uint32_t reg = NewNumber(compiler);
+	compiler.code.constants.emplace_back(reg, value);
+	return reg;
+}
+
+static uint32_t NewNumber(LaneCompiler& compiler)
+{
+	return compiler.code.numberCount++;
+}
+
+static uint32_t NewMask(LaneCompiler& compiler)
+{
+	return compiler.code.maskCount++;
+}
+
+static void Emit(LaneCompiler& compiler, const LaneOp op, const uint32_t a, const uint32_t b, const uint32_t c)
+{
+	compiler.code.code.push_back(LaneInstruction{op, a, b, c});
+}
+
+// --- RUNNER ------------------------------------------------------------------
+
+#ifdef RJL_VECTOR_LANES
+
+typedef double NumberLanes __attribute__((vector_size(LANES * sizeof(double))));
+typedef int64_t MaskLanes __attribute__((vector_size(LANES * sizeof(int64_t))));
+
+static void Fill(NumberLanes& lanes, const double value)
+{
+	for (size_t i = 0; i < LANES; ++i) lanes[i] = value;
+}
+
+// Runs `code` once in every lane, masked statements change lanes of their mask only.
+static void Run(const LaneCode& code, NumberLanes* const numbers, MaskLanes* const masks)
+{
+	for (const LaneInstruction& instruction : code.code)
+	{
+		const uint32_t a = instruction.a;
+		const uint32_t b = instruction.b;
+		const uint32_t c = instruction.c;
+		switch (instruction.op)
+		{
+		case LaneOp::Add: numbers[a] = numbers[b] + numbers[c]; break;
+		case LaneOp::Subtract: numbers[a] = numbers[b] - numbers[c]; break;
+		case LaneOp::Multiply: numbers[a] = numbers[b] * numbers[c]; break;
+		case LaneOp::Divide: numbers[a] = numbers[b] / numbers[c]; break;
+		case LaneOp::Modulo:
+			for (size_t i = 0; i < LANES; ++i) numbers[a][i] = Modulo(numbers[b][i], numbers[c][i]);
+			break;
+		case LaneOp::Negate: numbers[a] = -numbers[b]; break;
+		case LaneOp::Less: masks[a] = numbers[b] < numbers[c]; break;
+		case LaneOp::Greater: masks[a] = numbers[b] > numbers[c]; break;
+		case LaneOp::LessEquals: masks[a] = numbers[b] <= numbers[c]; break;
+		case LaneOp::GreaterEquals: masks[a] = numbers[b] >= numbers[c]; break;
+		case LaneOp::Equals: masks[a] = numbers[b] == numbers[c]; break;
+		case LaneOp::NotEquals: masks[a] = numbers[b] != numbers[c]; break;
+		case LaneOp::IsTrue: masks[a] = numbers[b] != NumberLanes{}; break;
+		case LaneOp::And: masks[a] = masks[b] & masks[c]; break;
+		case LaneOp::Or: masks[a] = masks[b] | masks[c]; break;
+		case LaneOp::Xor: masks[a] = masks[b] ^ masks[c]; break;
+		case LaneOp::AndNot: masks[a] = masks[b] & ~masks[c]; break;
+		case LaneOp::Not: masks[a] = ~masks[b]; break;
+		case LaneOp::MoveNumber:
+			if (c == ALL) numbers[a] = numbers[b];
+			else numbers[a] = masks[c] ? numbers[b] : numbers[a];
+			break;
+		case LaneOp::MoveMask:
+			if (c == ALL) masks[a] = masks[b];
+			else masks[a] = (masks[b] & masks[c]) | (masks[a] & ~masks[c]);
+			break;
+		case LaneOp::Return:
+			numbers[RESULT] = masks[c] ? numbers[b] : numbers[RESULT];
+			masks[DONE] |= masks[c];
+			break;
+		}
+	}
+}
+
+#endif
+
+size_t RunLanes(const LaneCode& code, const Ref<Scope>& closure, const std::vector<double>& array, std::vector<double>& out)
+{
+#ifdef RJL_VECTOR_LANES
+	if (!code.valid) return 0;
+
+	std::vector<NumberLanes> numbers(code.numberCount);
+	std::vector<MaskLanes> masks(code.maskCount);
+	for (const auto& [reg, value] : code.constants) Fill(numbers[reg], value);
+	for (const auto& [reg, name] : code.freeVariables)
+	{
+		Value* value;
+		if (!closure->TryGetValue(name, value) || value->Type() != TypeTag::Number) return 0;
+		Fill(numbers[reg], value->number);
+	}
+	masks[ALL] = ~MaskLanes{};
+
+	// NOTE Lanes past the end of the array compute on zeros, their results are dropped.
+	const size_t n = array.size();
+	for (size_t i = 0; i < n; i += LANES)
+	{
+		const size_t count = std::min(LANES, n - i);
+		for (size_t j = 0; j < LANES; ++j) numbers[ARGUMENT][j] = j < count ? array[i + j] : 0.0;
+		masks[DONE] = MaskLanes{};
+		Run(code, numbers.data(), masks.data());
+
+		for (size_t j = 0; j < count; ++j)
+		{
+			if (!masks[DONE][j]) return i;
+		}
+		for (size_t j = 0; j < count; ++j) out.push_back(numbers[RESULT][j]);
+	}
+	return n;
+#else
+	(void)code;
+	(void)closure;
+	(void)array;
+	(void)out;
+	return 0;
+#endif
+}
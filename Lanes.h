@@ -0,0 +1,23 @@
+#pragma once
+
+#include "Parser.h"
+#include "Runtime.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// Body of a function of one number compiled to compute several calls at once, one in each SIMD lane. Code that can't be
+// compiled keeps an empty LaneCode, so it's tried once.
+struct LaneCode;
+
+// Compiles function body `statements` with argument `arg` to run in lanes. The body may only assign numbers and bools to
+// variables, branch with if statements and return numbers. Names it doesn't assign are read from the closure and have
+// to hold numbers.
+std::shared_ptr<LaneCode> CompileLanes(const std::string& arg, const std::vector<std::unique_ptr<Statement>>& statements);
+
+// Computes calls of a function with body `code` closing over `closure` for the elements of `array` from the first one,
+// a group of lanes at a time, and appends the results to `out`. Stops before the first group where some call doesn't
+// return. Returns the number of calls computed, which is 0 if the code can't run in lanes or a name it reads from the
+// closure doesn't hold a number.
+size_t RunLanes(const LaneCode& code, const Ref<Scope>& closure, const std::vector<double>& array, std::vector<double>& out);
@@ -34,13 +34,14 @@ struct CodePtr {
 	}
 };
 
-constexpr size_t KEYWORD_COUNT = 17;
+constexpr size_t KEYWORD_COUNT = 19;
 constexpr std::string_view KEYWORDS[KEYWORD_COUNT] = {
 	"void"sv,
 	"if"sv,
 	"elif"sv,
 	"else"sv,
 	"while"sv,
+	"for"sv,
 	"end"sv,
 	"fn"sv,
 	"return"sv,
@@ -53,6 +54,7 @@ constexpr std::string_view KEYWORDS[KEYWORD_COUNT] = {
 	"neg"sv,
 	"false"sv,
 	"true"sv,
+	"map"sv,
 };
 
 static bool success;
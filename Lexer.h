@@ -16,6 +16,7 @@ enum class TokenTag {
 	KeyElif,
 	KeyElse,
 	KeyWhile,
+	KeyFor,
 	KeyEnd,
 	KeyFn,
 	KeyReturn,
@@ -28,6 +29,7 @@ enum class TokenTag {
 	KeyNeg,
 	KeyFalse,
 	KeyTrue,
+	KeyMap,
 
 	BracketOpen,   // [
 	BracketClose,  // ]
@@ -2,31 +2,108 @@
 #include "Lexer.h"
 #include "Parser.h"
 #include "Interpreter.h"
+#include "EmitCpp.h"
 
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 
-static int RunFile(const char* filepath);
-static int Repl();
+constexpr size_t MAX_STACK_LIMIT = 65536;
+
+static bool ParseCount(const char* text, size_t& out);
+static int RunFile(const char* filepath, const InterpreterOptions& options, bool emitCpp);
+static int Repl(const InterpreterOptions& options);
 static void PrintLexResults(std::string_view filePrefix, const std::vector<std::unique_ptr<Token>>& tokens);
 static void PrintExpression(const std::string_view filePrefix, const std::unique_ptr<Expression>& expression, size_t level);
 static void PrintParseResults(std::string_view filePrefix, const std::vector<std::unique_ptr<Statement>>& statements, size_t level = 0);
 
 int main(int argc, char* argv[])
 {
-	if (argc == 1)
+	InterpreterOptions options;
+	bool emitCpp = false;
+	int arg = 1;
+	for (; arg < argc && argv[arg][0] == '-'; ++arg)
+	{
+		if (std::strcmp(argv[arg], "--no-kernels") == 0) options.kernels = false;
+		else if (std::strcmp(argv[arg], "--no-memo") == 0) options.memo = false;
+		else if (std::strcmp(argv[arg], "--no-quicken") == 0) options.quicken = false;
+		else if (std::strcmp(argv[arg], "--no-fuse") == 0) options.fuse = false;
+		else if (std::strcmp(argv[arg], "--stats") == 0) options.stats = true;
+		else if (std::strcmp(argv[arg], "--node-pairs") == 0) options.nodePairs = true;
+		else if (std::strcmp(argv[arg], "--vm") == 0) options.vm = true;
+		else if (std::strcmp(argv[arg], "--closures") == 0) options.closures = true;
+		else if (std::strcmp(argv[arg], "--jit") == 0) options.jit = true;
+		else if (std::strcmp(argv[arg], "--no-lanes") == 0) options.lanes = false;
+		else if (std::strcmp(argv[arg], "--no-caches") == 0) options.caches = false;
+		else if (std::strcmp(argv[arg], "--hot-calls") == 0 || std::strcmp(argv[arg], "--hot-loops") == 0)
+		{
+			size_t& threshold = argv[arg][6] == 'c' ? options.hotCalls : options.hotIterations;
+			if (arg + 1 == argc || !ParseCount(argv[arg + 1], threshold))
+			{
+				std::cerr << "Expected a count after " << argv[arg] << '\n';
+				return 1;
+			}
+			++arg;
+		}
+		else if (std::strcmp(argv[arg], "--gc-threshold") == 0)
+		{
+			if (arg + 1 == argc || !ParseCount(argv[arg + 1], options.collectThreshold))
+			{
+				std::cerr << "Expected a count after --gc-threshold\n";
+				return 1;
+			}
+			++arg;
+		}
+		else if (std::strcmp(argv[arg], "--stack-limit") == 0)
+		{
+			size_t megabytes;
+			if (arg + 1 == argc || !ParseCount(argv[arg + 1], megabytes) || megabytes == 0 || megabytes > MAX_STACK_LIMIT)
+			{
+				std::cerr << "Expected a size in MB up to " << MAX_STACK_LIMIT << " after --stack-limit\n";
+				return 1;
+			}
+			options.stackLimit = megabytes << 20;
+			++arg;
+		}
+		else if (std::strcmp(argv[arg], "--emit-cpp") == 0) emitCpp = true;
+		else
+		{
+			std::cerr << "Unknown option " << argv[arg] << '\n';
+			return 1;
+		}
+	}
+
+	if (argc - arg == 0 && !emitCpp)
 	{
-		return Repl();
+		return Repl(options);
 	}
-	else if (argc == 2)
+	else if (argc - arg == 1)
 	{
-		return RunFile(argv[1]);
+		return RunFile(argv[arg], options, emitCpp);
 	}
 	else
 	{
-		std::cerr << "Usage: " << argv[0] << " [FILE]\n"
+		std::cerr << "Usage: " << argv[0] << " [OPTIONS] [FILE]\n"
 			<< "Omit the file to start REPL\n"
-			<< "Expected 0-1 arguments, got " << (argc - 1) << '\n';
+			<< "Options:\n"
+			<< "  --no-kernels     Run loop idioms like fills and sums without native kernels\n"
+			<< "  --no-memo        Don't cache results of pure functions\n"
+			<< "  --no-quicken     Don't specialize operations to the operand types they see\n"
+			<< "  --no-fuse        Don't run common statement shapes as single operations\n"
+			<< "  --stats          Print memoization hit rates, code promoted to hot, cycles collected and allocations to stderr\n"
+			<< "  --node-pairs     Print how often each parent/child node pair ran to stderr\n"
+			<< "  --vm             Compile to bytecode and run it on the VM\n"
+			<< "  --closures       Compile to closures and run them instead of walking the tree\n"
+			<< "  --jit            Compile hot numeric loops and functions to x86-64 machine code\n"
+			<< "  --no-lanes       Don't run map operations in SIMD lanes\n"
+			<< "  --no-caches      Look up every identifier and called function by name\n"
+			<< "  --hot-calls N    Promote functions to hot after N calls (default 2)\n"
+			<< "  --hot-loops N    Promote loops to hot after N iterations (default 64)\n"
+			<< "  --gc-threshold N Collect reference cycles once N objects were created, 0 for never (default 10000)\n"
+			<< "  --stack-limit MB Fail calls with a stack overflow past MB megabytes of stack (default 256)\n"
+			<< "  --emit-cpp       Print the script as a C++ program instead of running it\n"
+			<< "Expected 0-1 arguments, got " << (argc - arg) << '\n';
 		return 1;
 	}
 
@@ -36,7 +113,18 @@ int main(int argc, char* argv[])
 	(void)PrintParseResults;
 }
 
-static int RunFile(const char* const filepath)
+// Parses a non-negative decimal integer.
+static bool ParseCount(const char* const text, size_t& out)
+{
+	if (*text < '0' || *text > '9') return false;
+	char* end;
+	const unsigned long long count = std::strtoull(text, &end, 10);
+	if (*end) return false;
+	out = static_cast<size_t>(count);
+	return true;
+}
+
+static int RunFile(const char* const filepath, const InterpreterOptions& options, const bool emitCpp)
 {
 	std::string code;
 	if (!ReadFile(filepath, code))
@@ -65,11 +153,12 @@ static int RunFile(const char* const filepath)
 
 	// PrintParseResults(filepath, statements);
 
-	Interpret(filepath, statements);
+	if (emitCpp) EmitCpp(filepath, statements, std::cout);
+	else Interpret(filepath, statements, options);
 	return 0;
 }
 
-static int Repl()
+static int Repl(const InterpreterOptions& options)
 {
 	std::cout << "^C to exit\n";
 
@@ -112,7 +201,7 @@ static int Repl()
 		}
 		else
 		{
-			Interpret("", statements);
+			Interpret("", statements, options);
 			tokens.clear();
 			continuation = false;
 		}
@@ -132,6 +221,7 @@ static void PrintLexResults(const std::string_view filePrefix, const std::vector
 			case TokenTag::KeyElif: std::cout << "KeyElif"; break;
 			case TokenTag::KeyElse: std::cout << "KeyElse"; break;
 			case TokenTag::KeyWhile: std::cout << "KeyWhile"; break;
+			case TokenTag::KeyFor: std::cout << "KeyFor"; break;
 			case TokenTag::KeyEnd: std::cout << "KeyEnd"; break;
 			case TokenTag::KeyFn: std::cout << "KeyFn"; break;
 			case TokenTag::KeyReturn: std::cout << "KeyReturn"; break;
@@ -144,6 +234,7 @@ static void PrintLexResults(const std::string_view filePrefix, const std::vector
 			case TokenTag::KeyNeg: std::cout << "KeyNeg"; break;
 			case TokenTag::KeyFalse: std::cout << "KeyFalse"; break;
 			case TokenTag::KeyTrue: std::cout << "KeyTrue"; break;
+			case TokenTag::KeyMap: std::cout << "KeyMap"; break;
 			case TokenTag::BracketOpen: std::cout << "BracketOpen"; break;
 			case TokenTag::BracketClose: std::cout << "BracketClose"; break;
 			case TokenTag::ParenOpen: std::cout << "ParenOpen"; break;
@@ -225,6 +316,7 @@ static void PrintExpression(const std::string_view filePrefix, const std::unique
 		std::cout << "Identifier " << identifier->name;
 		break;
 	}
+	case ExpressionTag::Constant: std::cout << "Constant"; break;
 	case ExpressionTag::Unary:
 	{
 		auto unary = static_cast<UnaryOperation*>(expression.get());
@@ -233,6 +325,8 @@ static void PrintExpression(const std::string_view filePrefix, const std::unique
 		return;
 	}
 	case ExpressionTag::Binary:
+	case ExpressionTag::TypedBinary:
+	case ExpressionTag::InBoundsRead:
 	{
 		auto binary = static_cast<BinaryOperation*>(expression.get());
 		std::cout << "Binary " << static_cast<int>(binary->op) << '\n';
@@ -285,6 +379,22 @@ static void PrintParseResults(const std::string_view filePrefix, const std::vect
 			PrintParseResults(filePrefix, whileStatement->statements, level + 1);
 			continue;
 		}
+		case StatementTag::For:
+		{
+			auto forStatement = static_cast<ForStatement*>(statement.get());
+			std::cout << "For " << forStatement->counter << '\n';
+			PrintExpression(filePrefix, forStatement->start, level + 1);
+			PrintExpression(filePrefix, forStatement->end, level + 1);
+			if (forStatement->step) PrintExpression(filePrefix, forStatement->step, level + 1);
+			PrintParseResults(filePrefix, forStatement->statements, level + 1);
+			continue;
+		}
+		case StatementTag::GuardedLoop:
+		{
+			auto guardedLoop = static_cast<GuardedLoopStatement*>(statement.get());
+			std::cout << "GuardedLoop " << guardedLoop->counter;
+			break;
+		}
 		case StatementTag::Assignment:
 		{
 			auto assignment = static_cast<AssignmentStatement*>(statement.get());
@@ -293,6 +403,7 @@ static void PrintParseResults(const std::string_view filePrefix, const std::vect
 			continue;
 		}
 		case StatementTag::ArrayWrite:
+		case StatementTag::InBoundsArrayWrite:
 		{
 			auto arrayWrite = static_cast<ArrayWriteStatement*>(statement.get());
 			std::cout << "ArrayWrite " << arrayWrite->name << '\n';
@@ -327,6 +438,27 @@ static void PrintParseResults(const std::string_view filePrefix, const std::vect
 			PrintExpression(filePrefix, expressionStatement->value, level + 1);
 			continue;
 		}
+		case StatementTag::Kernel:
+		{
+			auto kernel = static_cast<KernelStatement*>(statement.get());
+			std::cout << "Kernel " << static_cast<int>(kernel->kernel) << '\n';
+			PrintParseResults(filePrefix, kernel->loop, level + 1);
+			continue;
+		}
+		case StatementTag::Switch:
+		{
+			auto switchStatement = static_cast<SwitchStatement*>(statement.get());
+			std::cout << "Switch " << switchStatement->variable << '\n';
+			PrintParseResults(filePrefix, switchStatement->chain, level + 1);
+			continue;
+		}
+		case StatementTag::Fused:
+		{
+			auto fused = static_cast<FusedStatement*>(statement.get());
+			std::cout << "Fused " << static_cast<int>(fused->fused) << ' ' << fused->variable << '\n';
+			PrintParseResults(filePrefix, fused->original, level + 1);
+			continue;
+		}
 		}
 		std::cout << '\n';
 	}
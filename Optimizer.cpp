@@ -0,0 +1,2364 @@
+#include "Optimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+using Statements = std::vector<std::unique_ptr<Statement>>;
+using TypeEnvironment = std::unordered_map<std::string, TypeTag>;
+using NameSet = std::unordered_set<std::string>;
+
+constexpr size_t MAX_TYPE_ITERATIONS = 16;
+constexpr size_t MIN_SWITCH_ARMS = 4;
+// Switches use a table when it has at most this many entries per arm.
+constexpr size_t MAX_SWITCH_TABLE_SPREAD = 4;
+
+static std::unique_ptr<Expression> CloneNode(const Expression& expression);
+static std::unique_ptr<CommentToken> CloneComment(const std::unique_ptr<CommentToken>& comment);
+static std::unique_ptr<WhileStatement> CloneWhile(const WhileStatement& whileStatement);
+static bool InferType(const Expression& expression, const TypeEnvironment& types, TypeTag& out);
+static void CollectAssignments(const Statements& statements, std::unordered_map<std::string, std::vector<const Expression*>>& out);
+static void CollectReadsBeforeAssignment(const Statements& statements, NameSet& assigned, NameSet& out);
+static void CollectReadsBeforeAssignment(const Expression& expression, const NameSet& assigned, NameSet& out);
+static size_t MarkTypedOperations(Statements& statements, const TypeEnvironment& types);
+static size_t MarkTypedOperations(Expression& expression, const TypeEnvironment& types);
+static size_t BakeConstants(Statements& statements, const NameSet& locals, const Ref<Scope>& closure);
+static size_t BakeConstants(std::unique_ptr<Expression>& expression, const NameSet& locals, const Ref<Scope>& closure);
+static bool HasSideEffects(const Statements& statements);
+static bool HasFunctionLiterals(const Expression& expression);
+static void MarkUnusedComments(Statements& statements, bool function);
+static bool HasFunctionLiterals(const Statements& statements);
+static void CollectLiveVariables(const Statements& statements, NameSet& live);
+static void CollectLiveVariables(const Expression& expression, bool used, NameSet& live);
+static void MarkUnusedComments(Statements& statements, bool allLive, const NameSet& live);
+static void MarkUnusedComments(Expression& expression, bool used);
+static bool CapturesScope(const Expression& expression);
+static void OptimizeStatements(Statements& statements, bool kernels);
+static void OptimizeExpression(Expression& expression, bool kernels);
+static void TryGuardLoop(std::unique_ptr<Statement>& statement);
+static void TryCountLoop(std::unique_ptr<Statement>& statement);
+static void TryKernel(std::unique_ptr<Statement>& statement);
+static bool IsLoopOperand(const Expression& expression);
+static void TrySwitch(std::unique_ptr<Statement>& statement);
+static bool IsIdentifier(const Expression& expression, const std::string& name);
+static bool HasCallsOrPops(const Statements& statements);
+static bool HasCalls(const Expression& expression);
+static bool IsArrayRead(const Expression& expression, const std::string& counter);
+static bool IsPlainArrayRead(const Expression& expression, const std::string& counter);
+static const std::string& GetReadArray(const Expression& arrayRead);
+static void CollectIndexedArrays(const Statements& statements, const std::string& counter, NameSet& out);
+static void CollectIndexedArrays(const Expression& expression, const std::string& counter, NameSet& out);
+static void MarkInBounds(Statements& statements, const std::string& counter, const NameSet& arrays);
+static void MarkInBounds(Expression& expression, const std::string& counter, const NameSet& arrays);
+static void FuseStatement(std::unique_ptr<Statement>& statement);
+static void TryFuse(std::unique_ptr<Statement>& statement);
+static bool IsComparison(TokenTag op);
+static bool IsFusedOperand(const Expression& expression);
+
+// --- CLONING -----------------------------------------------------------------
+
+std::unique_ptr<Expression> CloneExpression(const Expression& expression)
+{
+	std::unique_ptr<Expression> clone = CloneNode(expression);
+	clone->commentUnused = expression.commentUnused;
+	return clone;
+}
+
+static std::unique_ptr<Expression> CloneNode(const Expression& expression)
+{
+	switch (expression.tag)
+	{
+	case ExpressionTag::False:
+	case ExpressionTag::True:
+		return std::make_unique<Expression>(expression.tag, expression.pos, CloneComment(expression.attachedComment));
+	case ExpressionTag::NumberLiteral:
+		return std::make_unique<NumberLiteral>(static_cast<const NumberLiteral&>(expression).value, expression.pos, CloneComment(expression.attachedComment));
+	case ExpressionTag::ArrayLiteral:
+	{
+		const auto& arrayLiteral = static_cast<const ArrayLiteral&>(expression);
+		std::vector<std::unique_ptr<Expression>> values;
+		values.reserve(arrayLiteral.values.size());
+		for (const auto& value : arrayLiteral.values) values.push_back(CloneExpression(*value));
+		return std::make_unique<ArrayLiteral>(std::move(values), expression.pos, CloneComment(expression.attachedComment));
+	}
+	case ExpressionTag::FunctionLiteral:
+	{
+		// Function bodies are shared, they get specialized on their own when called.
+		const auto& functionLiteral = static_cast<const FunctionLiteral&>(expression);
+		auto clone = std::make_unique<FunctionLiteral>(functionLiteral.args, functionLiteral.statements, expression.pos, CloneComment(expression.attachedComment));
+		clone->code = functionLiteral.code;
+		return clone;
+	}
+	case ExpressionTag::Identifier:
+		return std::make_unique<Identifier>(static_cast<const Identifier&>(expression).name, expression.pos, CloneComment(expression.attachedComment));
+	case ExpressionTag::Constant:
+		return std::make_unique<Constant>(static_cast<const Constant&>(expression).value, expression.pos, CloneComment(expression.attachedComment));
+	case ExpressionTag::Unary:
+	{
+		const auto& unaryOp = static_cast<const UnaryOperation&>(expression);
+		return std::make_unique<UnaryOperation>(unaryOp.op, CloneExpression(*unaryOp.a), expression.pos, CloneComment(expression.attachedComment));
+	}
+	case ExpressionTag::Binary:
+	case ExpressionTag::TypedBinary:
+	case ExpressionTag::InBoundsRead:
+	{
+		const auto& binaryOp = static_cast<const BinaryOperation&>(expression);
+		auto clone = std::make_unique<BinaryOperation>(binaryOp.op, CloneExpression(*binaryOp.a), CloneExpression(*binaryOp.b), expression.pos, CloneComment(expression.attachedComment));
+		clone->tag = expression.tag;
+		return clone;
+	}
+	case ExpressionTag::Call:
+	{
+		const auto& call = static_cast<const Call&>(expression);
+		std::vector<std::unique_ptr<Expression>> values;
+		values.reserve(call.values.size());
+		for (const auto& value : call.values) values.push_back(CloneExpression(*value));
+		return std::make_unique<Call>(CloneExpression(*call.function), std::move(values), expression.pos, CloneComment(expression.attachedComment));
+	}
+	}
+	return nullptr;
+}
+
+std::unique_ptr<Statement> CloneStatement(const Statement& statement)
+{
+	switch (statement.tag)
+	{
+	case StatementTag::If:
+	{
+		const auto& ifStatement = static_cast<const IfStatement&>(statement);
+		std::vector<ConditionBlock> elifChain;
+		elifChain.reserve(ifStatement.elifChain.size());
+		for (const auto& elif : ifStatement.elifChain) elifChain.emplace_back(CloneExpression(*elif.condition), CloneStatements(elif.statements));
+		return std::make_unique<IfStatement>(std::move(elifChain), CloneStatements(ifStatement.elseBlock), statement.pos, CloneComment(statement.attachedComment));
+	}
+	case StatementTag::While:
+		return CloneWhile(static_cast<const WhileStatement&>(statement));
+	case StatementTag::For:
+	{
+		const auto& forStatement = static_cast<const ForStatement&>(statement);
+		return std::make_unique<ForStatement>(forStatement.counter, CloneExpression(*forStatement.start), CloneExpression(*forStatement.end), forStatement.step ? CloneExpression(*forStatement.step) : nullptr, forStatement.inclusive, CloneStatements(forStatement.statements), CloneStatements(forStatement.fallback), statement.pos, CloneComment(statement.attachedComment));
+	}
+	case StatementTag::GuardedLoop:
+	{
+		const auto& guardedLoop = static_cast<const GuardedLoopStatement&>(statement);
+		return std::make_unique<GuardedLoopStatement>(guardedLoop.counter, CloneExpression(*guardedLoop.step), guardedLoop.limit ? CloneExpression(*guardedLoop.limit) : nullptr, guardedLoop.inclusive, guardedLoop.arrays, CloneStatements(guardedLoop.fast), CloneStatements(guardedLoop.fallback), statement.pos);
+	}
+	case StatementTag::Assignment:
+	{
+		const auto& assignment = static_cast<const AssignmentStatement&>(statement);
+		return std::make_unique<AssignmentStatement>(assignment.name, CloneExpression(*assignment.value), statement.pos, CloneComment(statement.attachedComment));
+	}
+	case StatementTag::ArrayWrite:
+	case StatementTag::InBoundsArrayWrite:
+	{
+		const auto& arrayWrite = static_cast<const ArrayWriteStatement&>(statement);
+		auto clone = std::make_unique<ArrayWriteStatement>(arrayWrite.name, CloneExpression(*arrayWrite.index), CloneExpression(*arrayWrite.value), statement.pos, CloneComment(statement.attachedComment));
+		clone->tag = statement.tag;
+		return clone;
+	}
+	case StatementTag::ArrayPush:
+	{
+		const auto& arrayPush = static_cast<const ArrayPushStatement&>(statement);
+		return std::make_unique<ArrayPushStatement>(arrayPush.name, CloneExpression(*arrayPush.value), statement.pos, CloneComment(statement.attachedComment));
+	}
+	case StatementTag::ArrayPop:
+		return std::make_unique<ArrayPopStatement>(static_cast<const ArrayPopStatement&>(statement).name, statement.pos, CloneComment(statement.attachedComment));
+	case StatementTag::Return:
+	case StatementTag::Expression:
+	{
+		const auto& expressionStatement = static_cast<const ExpressionStatement&>(statement);
+		return std::make_unique<ExpressionStatement>(statement.tag, CloneExpression(*expressionStatement.value), statement.pos, CloneComment(statement.attachedComment));
+	}
+	case StatementTag::Kernel:
+	{
+		const auto& kernel = static_cast<const KernelStatement&>(statement);
+		return std::make_unique<KernelStatement>(kernel.kernel, kernel.array, kernel.source, kernel.accumulator, kernel.value ? CloneExpression(*kernel.value) : nullptr, CloneStatements(kernel.loop), statement.pos);
+	}
+	case StatementTag::Switch:
+	{
+		const auto& switchStatement = static_cast<const SwitchStatement&>(statement);
+		return std::make_unique<SwitchStatement>(switchStatement.variable, switchStatement.first, switchStatement.table, switchStatement.arms, CloneStatements(switchStatement.chain), statement.pos);
+	}
+	case StatementTag::Fused:
+	{
+		const auto& fused = static_cast<const FusedStatement&>(statement);
+		return std::make_unique<FusedStatement>(fused.fused, fused.op, fused.variable, fused.operand, fused.number, fused.constant, CloneStatements(fused.original), statement.pos);
+	}
+	}
+	return nullptr;
+}
+
+Statements CloneStatements(const Statements& statements)
+{
+	Statements clone;
+	clone.reserve(statements.size());
+	for (const auto& statement : statements) clone.push_back(CloneStatement(*statement));
+	return clone;
+}
+
+static std::unique_ptr<CommentToken> CloneComment(const std::unique_ptr<CommentToken>& comment)
+{
+	return comment ? comment->make_clone() : nullptr;
+}
+
+static std::unique_ptr<WhileStatement> CloneWhile(const WhileStatement& whileStatement)
+{
+	return std::make_unique<WhileStatement>(CloneExpression(*whileStatement.condition), CloneStatements(whileStatement.statements), whileStatement.pos, CloneComment(whileStatement.attachedComment));
+}
+
+// --- TYPE SPECIALIZATION -----------------------------------------------------
+
+std::shared_ptr<Statements> SpecializeFunction(const std::vector<std::string>& args, const std::vector<TypeTag>& argTypes, const Statements& statements)
+{
+	// NOTE Only the function's own scope is analyzed. Nested functions can't assign to it (assignment always binds in
+	// the innermost scope), so a variable keeps its type if every assignment in the body agrees on it. Locals also
+	// need to be assigned before being read, otherwise the read would fall through to the enclosing scope.
+
+	std::unordered_map<std::string, std::vector<const Expression*>> assignments;
+	CollectAssignments(statements, assignments);
+
+	NameSet params{args.begin(), args.end()};
+	NameSet assigned = params;
+	NameSet readsBeforeAssignment;
+	CollectReadsBeforeAssignment(statements, assigned, readsBeforeAssignment);
+
+	TypeEnvironment types;
+	const size_t n = args.size();
+	for (size_t i = 0; i < n; ++i)
+	{
+		if (argTypes[i] != TypeTag::Void) types[args[i]] = argTypes[i];
+	}
+
+	bool changed = true;
+	for (size_t iteration = 0; changed; ++iteration)
+	{
+		if (iteration == MAX_TYPE_ITERATIONS) return nullptr;
+		changed = false;
+
+		for (const auto& [name, values] : assignments)
+		{
+			const bool isParam = params.count(name) != 0;
+			if (!isParam && readsBeforeAssignment.count(name) != 0) continue;
+
+			auto it = types.find(name);
+			if (isParam && it == types.end()) continue;
+
+			// All assignments have to agree on a type (the parameter type for parameters).
+			bool consistent = true;
+			TypeTag type = isParam ? it->second : TypeTag::Void;
+			for (const Expression* value : values)
+			{
+				TypeTag valueType;
+				if (!InferType(*value, types, valueType) || valueType == TypeTag::Void || (type != TypeTag::Void && valueType != type))
+				{
+					consistent = false;
+					break;
+				}
+				type = valueType;
+			}
+
+			if (consistent && it == types.end())
+			{
+				types[name] = type;
+				changed = true;
+			}
+			else if (!consistent && it != types.end())
+			{
+				types.erase(it);
+				changed = true;
+			}
+		}
+	}
+
+	auto specialized = std::make_shared<Statements>(CloneStatements(statements));
+	if (MarkTypedOperations(*specialized, types) == 0) return nullptr;
+	return specialized;
+}
+
+static bool InferType(const Expression& expression, const TypeEnvironment& types, TypeTag& out)
+{
+	switch (expression.tag)
+	{
+	case ExpressionTag::False:
+	case ExpressionTag::True:
+		out = TypeTag::Bool;
+		return true;
+	case ExpressionTag::NumberLiteral:
+		out = TypeTag::Number;
+		return true;
+	case ExpressionTag::ArrayLiteral:
+		out = TypeTag::Array;
+		return true;
+	case ExpressionTag::FunctionLiteral:
+		out = TypeTag::Function;
+		return true;
+	case ExpressionTag::Identifier:
+	{
+		auto it = types.find(static_cast<const Identifier&>(expression).name);
+		if (it == types.end()) return false;
+		out = it->second;
+		return true;
+	}
+	case ExpressionTag::Constant:
+		out = static_cast<const Constant&>(expression).value.Type();
+		return true;
+	case ExpressionTag::Unary:
+		// NOTE Operations either fail or produce a value of the type below, whatever the operand types are.
+		switch (static_cast<const UnaryOperation&>(expression).op)
+		{
+		case TokenTag::KeyNot: out = TypeTag::Bool; return true;
+		case TokenTag::KeyNeg: out = TypeTag::Number; return true;
+		case TokenTag::KeyVoid: out = TypeTag::Void; return true;
+		case TokenTag::Hash: out = TypeTag::Number; return true;
+		default: return false;
+		}
+	case ExpressionTag::Binary:
+	case ExpressionTag::TypedBinary:
+	case ExpressionTag::InBoundsRead:
+		switch (static_cast<const BinaryOperation&>(expression).op)
+		{
+		case TokenTag::Plus:
+		case TokenTag::Minus:
+		case TokenTag::Star:
+		case TokenTag::Slash:
+		case TokenTag::Percent:
+		case TokenTag::At:
+			out = TypeTag::Number;
+			return true;
+		case TokenTag::KeyAnd:
+		case TokenTag::KeyOr:
+		case TokenTag::KeyXor:
+		case TokenTag::LessThan:
+		case TokenTag::GreaterThan:
+		case TokenTag::LessEquals:
+		case TokenTag::GreaterEquals:
+		case TokenTag::EqualsEquals:
+		case TokenTag::NotEquals:
+			out = TypeTag::Bool;
+			return true;
+		case TokenTag::KeyMap:
+			out = TypeTag::Array;
+			return true;
+		default:
+			return false;
+		}
+	case ExpressionTag::Call:
+		return false;
+	}
+	return false;
+}
+
+static void CollectAssignments(const Statements& statements, std::unordered_map<std::string, std::vector<const Expression*>>& out)
+{
+	for (const auto& statement : statements)
+	{
+		switch (statement->tag)
+		{
+		case StatementTag::If:
+		{
+			const auto& ifStatement = static_cast<const IfStatement&>(*statement);
+			for (const auto& elif : ifStatement.elifChain) CollectAssignments(elif.statements, out);
+			CollectAssignments(ifStatement.elseBlock, out);
+			break;
+		}
+		case StatementTag::While:
+			CollectAssignments(static_cast<const WhileStatement&>(*statement).statements, out);
+			break;
+		case StatementTag::For:
+		{
+			// NOTE The loop only binds numbers to its counter.
+			static const NumberLiteral counterValue{0.0, CodePos{}, nullptr};
+			const auto& forStatement = static_cast<const ForStatement&>(*statement);
+			out[forStatement.counter].push_back(&counterValue);
+			CollectAssignments(forStatement.statements, out);
+			CollectAssignments(forStatement.fallback, out);
+			break;
+		}
+		case StatementTag::GuardedLoop:
+			CollectAssignments(static_cast<const GuardedLoopStatement&>(*statement).fallback, out);
+			break;
+		case StatementTag::Kernel:
+			CollectAssignments(static_cast<const KernelStatement&>(*statement).loop, out);
+			break;
+		case StatementTag::Switch:
+			CollectAssignments(static_cast<const SwitchStatement&>(*statement).chain, out);
+			break;
+		case StatementTag::Fused:
+			CollectAssignments(static_cast<const FusedStatement&>(*statement).original, out);
+			break;
+		case StatementTag::Assignment:
+		{
+			const auto& assignment = static_cast<const AssignmentStatement&>(*statement);
+			out[assignment.name].push_back(assignment.value.get());
+			break;
+		}
+		case StatementTag::ArrayWrite:
+		case StatementTag::InBoundsArrayWrite:
+		case StatementTag::ArrayPush:
+		case StatementTag::ArrayPop:
+		case StatementTag::Return:
+		case StatementTag::Expression:
+			break;
+		}
+	}
+}
+
+// Collects names read while they may still be unbound. `assigned` holds names definitely bound at the start of
+// `statements` and is updated to the names definitely bound at the end.
+static void CollectReadsBeforeAssignment(const Statements& statements, NameSet& assigned, NameSet& out)
+{
+	for (const auto& statement : statements)
+	{
+		switch (statement->tag)
+		{
+		case StatementTag::If:
+		{
+			const auto& ifStatement = static_cast<const IfStatement&>(*statement);
+
+			// Names assigned in every branch are bound after the statement.
+			NameSet common;
+			bool first = true;
+			const auto visitBranch = [&](const Statements& branch) {
+				NameSet branchAssigned = assigned;
+				CollectReadsBeforeAssignment(branch, branchAssigned, out);
+				if (first) common = std::move(branchAssigned);
+				else for (auto it = common.begin(); it != common.end();) it = branchAssigned.count(*it) ? std::next(it) : common.erase(it);
+				first = false;
+			};
+
+			for (const auto& elif : ifStatement.elifChain)
+			{
+				CollectReadsBeforeAssignment(*elif.condition, assigned, out);
+				visitBranch(elif.statements);
+			}
+			visitBranch(ifStatement.elseBlock);
+			assigned = std::move(common);
+			break;
+		}
+		case StatementTag::While:
+		{
+			const auto& whileStatement = static_cast<const WhileStatement&>(*statement);
+			CollectReadsBeforeAssignment(*whileStatement.condition, assigned, out);
+			NameSet bodyAssigned = assigned;
+			CollectReadsBeforeAssignment(whileStatement.statements, bodyAssigned, out);
+			break;
+		}
+		case StatementTag::For:
+		{
+			// NOTE The counter isn't bound after a loop that didn't run.
+			const auto& forStatement = static_cast<const ForStatement&>(*statement);
+			CollectReadsBeforeAssignment(*forStatement.start, assigned, out);
+			CollectReadsBeforeAssignment(*forStatement.end, assigned, out);
+			if (forStatement.step) CollectReadsBeforeAssignment(*forStatement.step, assigned, out);
+			NameSet bodyAssigned = assigned;
+			bodyAssigned.insert(forStatement.counter);
+			CollectReadsBeforeAssignment(forStatement.statements, bodyAssigned, out);
+			NameSet fallbackAssigned = assigned;
+			CollectReadsBeforeAssignment(forStatement.fallback, fallbackAssigned, out);
+			break;
+		}
+		case StatementTag::GuardedLoop:
+		{
+			// NOTE Both versions of a guarded loop read and assign the same names.
+			NameSet loopAssigned = assigned;
+			CollectReadsBeforeAssignment(static_cast<const GuardedLoopStatement&>(*statement).fallback, loopAssigned, out);
+			break;
+		}
+		case StatementTag::Kernel:
+			CollectReadsBeforeAssignment(static_cast<const KernelStatement&>(*statement).loop, assigned, out);
+			break;
+		case StatementTag::Switch:
+			CollectReadsBeforeAssignment(static_cast<const SwitchStatement&>(*statement).chain, assigned, out);
+			break;
+		case StatementTag::Fused:
+			CollectReadsBeforeAssignment(static_cast<const FusedStatement&>(*statement).original, assigned, out);
+			break;
+		case StatementTag::Assignment:
+		{
+			const auto& assignment = static_cast<const AssignmentStatement&>(*statement);
+			CollectReadsBeforeAssignment(*assignment.value, assigned, out);
+			assigned.insert(assignment.name);
+			break;
+		}
+		case StatementTag::ArrayWrite:
+		case StatementTag::InBoundsArrayWrite:
+		{
+			const auto& arrayWrite = static_cast<const ArrayWriteStatement&>(*statement);
+			if (!assigned.count(arrayWrite.name)) out.insert(arrayWrite.name);
+			CollectReadsBeforeAssignment(*arrayWrite.index, assigned, out);
+			CollectReadsBeforeAssignment(*arrayWrite.value, assigned, out);
+			break;
+		}
+		case StatementTag::ArrayPush:
+		{
+			const auto& arrayPush = static_cast<const ArrayPushStatement&>(*statement);
+			if (!assigned.count(arrayPush.name)) out.insert(arrayPush.name);
+			CollectReadsBeforeAssignment(*arrayPush.value, assigned, out);
+			break;
+		}
+		case StatementTag::ArrayPop:
+		{
+			const auto& arrayPop = static_cast<const ArrayPopStatement&>(*statement);
+			if (!assigned.count(arrayPop.name)) out.insert(arrayPop.name);
+			break;
+		}
+		case StatementTag::Return:
+		case StatementTag::Expression:
+			CollectReadsBeforeAssignment(*static_cast<const ExpressionStatement&>(*statement).value, assigned, out);
+			break;
+		}
+	}
+}
+
+static void CollectReadsBeforeAssignment(const Expression& expression, const NameSet& assigned, NameSet& out)
+{
+	switch (expression.tag)
+	{
+	case ExpressionTag::False:
+	case ExpressionTag::True:
+	case ExpressionTag::NumberLiteral:
+	case ExpressionTag::FunctionLiteral:
+	case ExpressionTag::Constant:
+		return;
+	case ExpressionTag::ArrayLiteral:
+		for (const auto& value : static_cast<const ArrayLiteral&>(expression).values) CollectReadsBeforeAssignment(*value, assigned, out);
+		return;
+	case ExpressionTag::Identifier:
+	{
+		const std::string& name = static_cast<const Identifier&>(expression).name;
+		if (!assigned.count(name)) out.insert(name);
+		return;
+	}
+	case ExpressionTag::Unary:
+		CollectReadsBeforeAssignment(*static_cast<const UnaryOperation&>(expression).a, assigned, out);
+		return;
+	case ExpressionTag::Binary:
+	case ExpressionTag::TypedBinary:
+	case ExpressionTag::InBoundsRead:
+	{
+		const auto& binaryOp = static_cast<const BinaryOperation&>(expression);
+		CollectReadsBeforeAssignment(*binaryOp.a, assigned, out);
+		CollectReadsBeforeAssignment(*binaryOp.b, assigned, out);
+		return;
+	}
+	case ExpressionTag::Call:
+	{
+		const auto& call = static_cast<const Call&>(expression);
+		CollectReadsBeforeAssignment(*call.function, assigned, out);
+		for (const auto& value : call.values) CollectReadsBeforeAssignment(*value, assigned, out);
+		return;
+	}
+	}
+}
+
+static size_t MarkTypedOperations(Statements& statements, const TypeEnvironment& types)
+{
+	size_t count = 0;
+	for (auto& statement : statements)
+	{
+		switch (statement->tag)
+		{
+		case StatementTag::If:
+		{
+			auto& ifStatement = static_cast<IfStatement&>(*statement);
+			for (auto& elif : ifStatement.elifChain)
+			{
+				count += MarkTypedOperations(*elif.condition, types);
+				count += MarkTypedOperations(elif.statements, types);
+			}
+			count += MarkTypedOperations(ifStatement.elseBlock, types);
+			break;
+		}
+		case StatementTag::While:
+		{
+			auto& whileStatement = static_cast<WhileStatement&>(*statement);
+			count += MarkTypedOperations(*whileStatement.condition, types);
+			count += MarkTypedOperations(whileStatement.statements, types);
+			break;
+		}
+		case StatementTag::For:
+		{
+			auto& forStatement = static_cast<ForStatement&>(*statement);
+			count += MarkTypedOperations(*forStatement.start, types);
+			count += MarkTypedOperations(*forStatement.end, types);
+			if (forStatement.step) count += MarkTypedOperations(*forStatement.step, types);
+			count += MarkTypedOperations(forStatement.statements, types);
+			count += MarkTypedOperations(forStatement.fallback, types);
+			break;
+		}
+		case StatementTag::GuardedLoop:
+		{
+			auto& guardedLoop = static_cast<GuardedLoopStatement&>(*statement);
+			count += MarkTypedOperations(guardedLoop.fast, types);
+			count += MarkTypedOperations(guardedLoop.fallback, types);
+			break;
+		}
+		case StatementTag::Kernel:
+			count += MarkTypedOperations(static_cast<KernelStatement&>(*statement).loop, types);
+			break;
+		case StatementTag::Switch:
+			count += MarkTypedOperations(static_cast<SwitchStatement&>(*statement).chain, types);
+			break;
+		case StatementTag::Fused:
+			count += MarkTypedOperations(static_cast<FusedStatement&>(*statement).original, types);
+			break;
+		case StatementTag::Assignment:
+			count += MarkTypedOperations(*static_cast<AssignmentStatement&>(*statement).value, types);
+			break;
+		case StatementTag::ArrayWrite:
+		case StatementTag::InBoundsArrayWrite:
+		{
+			auto& arrayWrite = static_cast<ArrayWriteStatement&>(*statement);
+			count += MarkTypedOperations(*arrayWrite.index, types);
+			count += MarkTypedOperations(*arrayWrite.value, types);
+			break;
+		}
+		case StatementTag::ArrayPush:
+			count += MarkTypedOperations(*static_cast<ArrayPushStatement&>(*statement).value, types);
+			break;
+		case StatementTag::ArrayPop:
+			break;
+		case StatementTag::Return:
+		case StatementTag::Expression:
+			count += MarkTypedOperations(*static_cast<ExpressionStatement&>(*statement).value, types);
+			break;
+		}
+	}
+	return count;
+}
+
+static size_t MarkTypedOperations(Expression& expression, const TypeEnvironment& types)
+{
+	switch (expression.tag)
+	{
+	case ExpressionTag::False:
+	case ExpressionTag::True:
+	case ExpressionTag::NumberLiteral:
+	case ExpressionTag::FunctionLiteral:
+	case ExpressionTag::Identifier:
+	case ExpressionTag::Constant:
+		return 0;
+	case ExpressionTag::ArrayLiteral:
+	{
+		size_t count = 0;
+		for (auto& value : static_cast<ArrayLiteral&>(expression).values) count += MarkTypedOperations(*value, types);
+		return count;
+	}
+	case ExpressionTag::Unary:
+		return MarkTypedOperations(*static_cast<UnaryOperation&>(expression).a, types);
+	case ExpressionTag::InBoundsRead:
+	{
+		auto& binaryOp = static_cast<BinaryOperation&>(expression);
+		return MarkTypedOperations(*binaryOp.a, types) + MarkTypedOperations(*binaryOp.b, types);
+	}
+	case ExpressionTag::Binary:
+	case ExpressionTag::TypedBinary:
+	{
+		auto& binaryOp = static_cast<BinaryOperation&>(expression);
+		size_t count = MarkTypedOperations(*binaryOp.a, types) + MarkTypedOperations(*binaryOp.b, types);
+
+		TypeTag a;
+		TypeTag b;
+		if (expression.tag == ExpressionTag::TypedBinary || !InferType(*binaryOp.a, types, a) || !InferType(*binaryOp.b, types, b)) return count;
+
+		bool typed = false;
+		switch (binaryOp.op)
+		{
+		case TokenTag::Plus:
+		case TokenTag::Minus:
+		case TokenTag::Star:
+		case TokenTag::Slash:
+		case TokenTag::Percent:
+		case TokenTag::LessThan:
+		case TokenTag::GreaterThan:
+		case TokenTag::LessEquals:
+		case TokenTag::GreaterEquals:
+		case TokenTag::EqualsEquals:
+		case TokenTag::NotEquals:
+			typed = a == TypeTag::Number && b == TypeTag::Number;
+			break;
+		case TokenTag::KeyAnd:
+		case TokenTag::KeyOr:
+		case TokenTag::KeyXor:
+			typed = a == TypeTag::Bool && b == TypeTag::Bool;
+			break;
+		case TokenTag::At:
+			typed = a == TypeTag::Array && b == TypeTag::Number;
+			break;
+		default:
+			break;
+		}
+
+		if (!typed) return count;
+		expression.tag = ExpressionTag::TypedBinary;
+		return count + 1;
+	}
+	case ExpressionTag::Call:
+	{
+		auto& call = static_cast<Call&>(expression);
+		size_t count = MarkTypedOperations(*call.function, types);
+		for (auto& value : call.values) count += MarkTypedOperations(*value, types);
+		return count;
+	}
+	}
+	return 0;
+}
+
+// --- CLOSURE SPECIALIZATION --------------------------------------------------
+
+std::shared_ptr<Statements> SpecializeClosure(const std::vector<std::string>& args, const Statements& statements, const Ref<Scope>& closure)
+{
+	// NOTE Names assigned anywhere in the body are treated as locals, even where they'd still read the captured value.
+	std::unordered_map<std::string, std::vector<const Expression*>> assignments;
+	CollectAssignments(statements, assignments);
+
+	NameSet locals{args.begin(), args.end()};
+	for (const auto& assignment : assignments) locals.insert(assignment.first);
+
+	auto specialized = std::make_shared<Statements>(CloneStatements(statements));
+	if (BakeConstants(*specialized, locals, closure) == 0) return nullptr;
+	return specialized;
+}
+
+static size_t BakeConstants(Statements& statements, const NameSet& locals, const Ref<Scope>& closure)
+{
+	size_t count = 0;
+	for (auto& statement : statements)
+	{
+		switch (statement->tag)
+		{
+		case StatementTag::If:
+		{
+			auto& ifStatement = static_cast<IfStatement&>(*statement);
+			for (auto& elif : ifStatement.elifChain)
+			{
+				count += BakeConstants(elif.condition, locals, closure);
+				count += BakeConstants(elif.statements, locals, closure);
+			}
+			count += BakeConstants(ifStatement.elseBlock, locals, closure);
+			break;
+		}
+		case StatementTag::While:
+		{
+			auto& whileStatement = static_cast<WhileStatement&>(*statement);
+			count += BakeConstants(whileStatement.condition, locals, closure);
+			count += BakeConstants(whileStatement.statements, locals, closure);
+			break;
+		}
+		case StatementTag::For:
+		{
+			auto& forStatement = static_cast<ForStatement&>(*statement);
+			count += BakeConstants(forStatement.start, locals, closure);
+			count += BakeConstants(forStatement.end, locals, closure);
+			if (forStatement.step) count += BakeConstants(forStatement.step, locals, closure);
+			count += BakeConstants(forStatement.statements, locals, closure);
+			count += BakeConstants(forStatement.fallback, locals, closure);
+			break;
+		}
+		case StatementTag::GuardedLoop:
+		{
+			auto& guardedLoop = static_cast<GuardedLoopStatement&>(*statement);
+			count += BakeConstants(guardedLoop.step, locals, closure);
+			if (guardedLoop.limit) count += BakeConstants(guardedLoop.limit, locals, closure);
+			count += BakeConstants(guardedLoop.fast, locals, closure);
+			count += BakeConstants(guardedLoop.fallback, locals, closure);
+			break;
+		}
+		case StatementTag::Kernel:
+		{
+			auto& kernel = static_cast<KernelStatement&>(*statement);
+			if (kernel.value) count += BakeConstants(kernel.value, locals, closure);
+			count += BakeConstants(kernel.loop, locals, closure);
+			break;
+		}
+		case StatementTag::Switch:
+			count += BakeConstants(static_cast<SwitchStatement&>(*statement).chain, locals, closure);
+			break;
+		case StatementTag::Fused:
+			count += BakeConstants(static_cast<FusedStatement&>(*statement).original, locals, closure);
+			break;
+		case StatementTag::Assignment:
+			count += BakeConstants(static_cast<AssignmentStatement&>(*statement).value, locals, closure);
+			break;
+		case StatementTag::ArrayWrite:
+		case StatementTag::InBoundsArrayWrite:
+		{
+			auto& arrayWrite = static_cast<ArrayWriteStatement&>(*statement);
+			count += BakeConstants(arrayWrite.index, locals, closure);
+			count += BakeConstants(arrayWrite.value, locals, closure);
+			break;
+		}
+		case StatementTag::ArrayPush:
+			count += BakeConstants(static_cast<ArrayPushStatement&>(*statement).value, locals, closure);
+			break;
+		case StatementTag::ArrayPop:
+			break;
+		case StatementTag::Return:
+		case StatementTag::Expression:
+			count += BakeConstants(static_cast<ExpressionStatement&>(*statement).value, locals, closure);
+			break;
+		}
+	}
+	return count;
+}
+
+static size_t BakeConstants(std::unique_ptr<Expression>& expression, const NameSet& locals, const Ref<Scope>& closure)
+{
+	switch (expression->tag)
+	{
+	case ExpressionTag::False:
+	case ExpressionTag::True:
+	case ExpressionTag::NumberLiteral:
+	case ExpressionTag::FunctionLiteral:
+	case ExpressionTag::Constant:
+		return 0;
+	case ExpressionTag::ArrayLiteral:
+	{
+		size_t count = 0;
+		for (auto& value : static_cast<ArrayLiteral&>(*expression).values) count += BakeConstants(value, locals, closure);
+		return count;
+	}
+	case ExpressionTag::Identifier:
+	{
+		const std::string& name = static_cast<const Identifier&>(*expression).name;
+		if (locals.count(name)) return 0;
+
+		// Every scope up to the binding has to be frozen, otherwise the name could still be (re)bound.
+		for (Scope* scope = closure.get(); scope && scope->frozen; scope = scope->parent_scope.get())
+		{
+			auto it = scope->bindings.find(name);
+			if (it == scope->bindings.end()) continue;
+
+			const bool commentUnused = expression->commentUnused;
+			expression = std::make_unique<Constant>(it->second, expression->pos, std::move(expression->attachedComment));
+			expression->commentUnused = commentUnused;
+			if (commentUnused) static_cast<Constant&>(*expression).value.SetComment(nullptr);
+			return 1;
+		}
+		return 0;
+	}
+	case ExpressionTag::Unary:
+		return BakeConstants(static_cast<UnaryOperation&>(*expression).a, locals, closure);
+	case ExpressionTag::Binary:
+	case ExpressionTag::TypedBinary:
+	case ExpressionTag::InBoundsRead:
+	{
+		auto& binaryOp = static_cast<BinaryOperation&>(*expression);
+		return BakeConstants(binaryOp.a, locals, closure) + BakeConstants(binaryOp.b, locals, closure);
+	}
+	case ExpressionTag::Call:
+	{
+		auto& call = static_cast<Call&>(*expression);
+		size_t count = BakeConstants(call.function, locals, closure);
+		for (auto& value : call.values) count += BakeConstants(value, locals, closure);
+		return count;
+	}
+	}
+	return 0;
+}
+
+// --- PURITY ------------------------------------------------------------------
+
+bool AnalyzePurity(const std::vector<std::string>& args, const Statements& statements, std::vector<std::string>& freeVariables)
+{
+	// NOTE Assignments always bind in the call's own scope, so they can't change anything the caller sees. Function
+	// literals are rejected because their free variables wouldn't be collected.
+	if (HasSideEffects(statements)) return false;
+
+	NameSet assigned{args.begin(), args.end()};
+	NameSet reads;
+	CollectReadsBeforeAssignment(statements, assigned, reads);
+	freeVariables.assign(reads.begin(), reads.end());
+	return true;
+}
+
+static bool HasSideEffects(const Statements& statements)
+{
+	for (const auto& statement : statements)
+	{
+		switch (statement->tag)
+		{
+		case StatementTag::If:
+		{
+			const auto& ifStatement = static_cast<const IfStatement&>(*statement);
+			for (const auto& elif : ifStatement.elifChain)
+			{
+				if (HasFunctionLiterals(*elif.condition) || HasSideEffects(elif.statements)) return true;
+			}
+			if (HasSideEffects(ifStatement.elseBlock)) return true;
+			break;
+		}
+		case StatementTag::While:
+		{
+			const auto& whileStatement = static_cast<const WhileStatement&>(*statement);
+			if (HasFunctionLiterals(*whileStatement.condition) || HasSideEffects(whileStatement.statements)) return true;
+			break;
+		}
+		case StatementTag::For:
+		{
+			const auto& forStatement = static_cast<const ForStatement&>(*statement);
+			if (HasFunctionLiterals(*forStatement.start) || HasFunctionLiterals(*forStatement.end) || (forStatement.step && HasFunctionLiterals(*forStatement.step))) return true;
+			if (HasSideEffects(forStatement.statements) || HasSideEffects(forStatement.fallback)) return true;
+			break;
+		}
+		case StatementTag::GuardedLoop:
+			if (HasSideEffects(static_cast<const GuardedLoopStatement&>(*statement).fallback)) return true;
+			break;
+		case StatementTag::Kernel:
+			if (HasSideEffects(static_cast<const KernelStatement&>(*statement).loop)) return true;
+			break;
+		case StatementTag::Switch:
+			if (HasSideEffects(static_cast<const SwitchStatement&>(*statement).chain)) return true;
+			break;
+		case StatementTag::Fused:
+			if (HasSideEffects(static_cast<const FusedStatement&>(*statement).original)) return true;
+			break;
+		case StatementTag::Assignment:
+			if (HasFunctionLiterals(*static_cast<const AssignmentStatement&>(*statement).value)) return true;
+			break;
+		case StatementTag::ArrayWrite:
+		case StatementTag::InBoundsArrayWrite:
+		case StatementTag::ArrayPush:
+		case StatementTag::ArrayPop:
+		case StatementTag::Expression:
+			return true;
+		case StatementTag::Return:
+			if (HasFunctionLiterals(*static_cast<const ExpressionStatement&>(*statement).value)) return true;
+			break;
+		}
+	}
+	return false;
+}
+
+static bool HasFunctionLiterals(const Expression& expression)
+{
+	switch (expression.tag)
+	{
+	case ExpressionTag::False:
+	case ExpressionTag::True:
+	case ExpressionTag::NumberLiteral:
+	case ExpressionTag::Identifier:
+	case ExpressionTag::Constant:
+		return false;
+	case ExpressionTag::FunctionLiteral:
+		return true;
+	case ExpressionTag::ArrayLiteral:
+		for (const auto& value : static_cast<const ArrayLiteral&>(expression).values)
+		{
+			if (HasFunctionLiterals(*value)) return true;
+		}
+		return false;
+	case ExpressionTag::Unary:
+		return HasFunctionLiterals(*static_cast<const UnaryOperation&>(expression).a);
+	case ExpressionTag::Binary:
+	case ExpressionTag::TypedBinary:
+	case ExpressionTag::InBoundsRead:
+	{
+		const auto& binaryOp = static_cast<const BinaryOperation&>(expression);
+		return HasFunctionLiterals(*binaryOp.a) || HasFunctionLiterals(*binaryOp.b);
+	}
+	case ExpressionTag::Call:
+	{
+		const auto& call = static_cast<const Call&>(expression);
+		if (HasFunctionLiterals(*call.function)) return true;
+		for (const auto& value : call.values)
+		{
+			if (HasFunctionLiterals(*value)) return true;
+		}
+		return false;
+	}
+	}
+	return true;
+}
+
+// --- COMMENTS ----------------------------------------------------------------
+
+// Comments are only observed when an expression statement prints a value. Conditions, loop bounds and values stored in
+// arrays drop their comment, and so do reads of local variables only ever used there. Comments in those places are
+// removed and their nodes marked, so the interpreter neither creates nor propagates comments that can't be printed.
+static void MarkUnusedComments(Statements& statements, const bool function)
+{
+	// NOTE Top level variables are global and can be printed by later input, nested functions can read any local.
+	const bool allLive = !function || HasFunctionLiterals(statements);
+
+	NameSet live;
+	if (!allLive)
+	{
+		size_t count;
+		do
+		{
+			count = live.size();
+			CollectLiveVariables(statements, live);
+		} while (live.size() != count);
+	}
+	MarkUnusedComments(statements, allLive, live);
+}
+
+static bool HasFunctionLiterals(const Statements& statements)
+{
+	for (const auto& statement : statements)
+	{
+		switch (statement->tag)
+		{
+		case StatementTag::If:
+		{
+			const auto& ifStatement = static_cast<const IfStatement&>(*statement);
+			for (const auto& elif : ifStatement.elifChain)
+			{
+				if (HasFunctionLiterals(*elif.condition) || HasFunctionLiterals(elif.statements)) return true;
+			}
+			if (HasFunctionLiterals(ifStatement.elseBlock)) return true;
+			break;
+		}
+		case StatementTag::While:
+		{
+			const auto& whileStatement = static_cast<const WhileStatement&>(*statement);
+			if (HasFunctionLiterals(*whileStatement.condition) || HasFunctionLiterals(whileStatement.statements)) return true;
+			break;
+		}
+		case StatementTag::For:
+		{
+			const auto& forStatement = static_cast<const ForStatement&>(*statement);
+			if (HasFunctionLiterals(*forStatement.start) || HasFunctionLiterals(*forStatement.end) || (forStatement.step && HasFunctionLiterals(*forStatement.step))) return true;
+			if (HasFunctionLiterals(forStatement.statements) || HasFunctionLiterals(forStatement.fallback)) return true;
+			break;
+		}
+		case StatementTag::GuardedLoop:
+			if (HasFunctionLiterals(static_cast<const GuardedLoopStatement&>(*statement).fallback)) return true;
+			break;
+		case StatementTag::Kernel:
+			if (HasFunctionLiterals(static_cast<const KernelStatement&>(*statement).loop)) return true;
+			break;
+		case StatementTag::Switch:
+			if (HasFunctionLiterals(static_cast<const SwitchStatement&>(*statement).chain)) return true;
+			break;
+		case StatementTag::Fused:
+			if (HasFunctionLiterals(static_cast<const FusedStatement&>(*statement).original)) return true;
+			break;
+		case StatementTag::Assignment:
+			if (HasFunctionLiterals(*static_cast<const AssignmentStatement&>(*statement).value)) return true;
+			break;
+		case StatementTag::ArrayWrite:
+		case StatementTag::InBoundsArrayWrite:
+		{
+			const auto& arrayWrite = static_cast<const ArrayWriteStatement&>(*statement);
+			if (HasFunctionLiterals(*arrayWrite.index) || HasFunctionLiterals(*arrayWrite.value)) return true;
+			break;
+		}
+		case StatementTag::ArrayPush:
+			if (HasFunctionLiterals(*static_cast<const ArrayPushStatement&>(*statement).value)) return true;
+			break;
+		case StatementTag::ArrayPop:
+			break;
+		case StatementTag::Return:
+		case StatementTag::Expression:
+			if (HasFunctionLiterals(*static_cast<const ExpressionStatement&>(*statement).value)) return true;
+			break;
+		}
+	}
+	return false;
+}
+
+// Adds variables read where their comment can be printed to `live`. Values assigned to live variables can be printed
+// too, so this runs until `live` stops growing.
+static void CollectLiveVariables(const Statements& statements, NameSet& live)
+{
+	for (const auto& statement : statements)
+	{
+		switch (statement->tag)
+		{
+		case StatementTag::If:
+		{
+			const auto& ifStatement = static_cast<const IfStatement&>(*statement);
+			for (const auto& elif : ifStatement.elifChain)
+			{
+				CollectLiveVariables(*elif.condition, false, live);
+				CollectLiveVariables(elif.statements, live);
+			}
+			CollectLiveVariables(ifStatement.elseBlock, live);
+			break;
+		}
+		case StatementTag::While:
+		{
+			const auto& whileStatement = static_cast<const WhileStatement&>(*statement);
+			CollectLiveVariables(*whileStatement.condition, false, live);
+			CollectLiveVariables(whileStatement.statements, live);
+			break;
+		}
+		case StatementTag::For:
+		{
+			// NOTE Comments decide whether a rewritten while loop falls back to the original, so they are kept.
+			const auto& forStatement = static_cast<const ForStatement&>(*statement);
+			const bool used = !forStatement.fallback.empty();
+			CollectLiveVariables(*forStatement.start, used, live);
+			CollectLiveVariables(*forStatement.end, used, live);
+			if (forStatement.step) CollectLiveVariables(*forStatement.step, used, live);
+			CollectLiveVariables(forStatement.statements, live);
+			CollectLiveVariables(forStatement.fallback, live);
+			break;
+		}
+		case StatementTag::GuardedLoop:
+		{
+			const auto& guardedLoop = static_cast<const GuardedLoopStatement&>(*statement);
+			CollectLiveVariables(guardedLoop.fast, live);
+			CollectLiveVariables(guardedLoop.fallback, live);
+			break;
+		}
+		case StatementTag::Kernel:
+		{
+			const auto& kernel = static_cast<const KernelStatement&>(*statement);
+			if (kernel.value) CollectLiveVariables(*kernel.value, false, live);
+			CollectLiveVariables(kernel.loop, live);
+			break;
+		}
+		case StatementTag::Switch:
+			CollectLiveVariables(static_cast<const SwitchStatement&>(*statement).chain, live);
+			break;
+		case StatementTag::Fused:
+			CollectLiveVariables(static_cast<const FusedStatement&>(*statement).original, live);
+			break;
+		case StatementTag::Assignment:
+		{
+			const auto& assignment = static_cast<const AssignmentStatement&>(*statement);
+			CollectLiveVariables(*assignment.value, live.count(assignment.name) != 0, live);
+			break;
+		}
+		case StatementTag::ArrayWrite:
+		case StatementTag::InBoundsArrayWrite:
+		{
+			const auto& arrayWrite = static_cast<const ArrayWriteStatement&>(*statement);
+			CollectLiveVariables(*arrayWrite.index, false, live);
+			CollectLiveVariables(*arrayWrite.value, false, live);
+			break;
+		}
+		case StatementTag::ArrayPush:
+			CollectLiveVariables(*static_cast<const ArrayPushStatement&>(*statement).value, false, live);
+			break;
+		case StatementTag::ArrayPop:
+			break;
+		case StatementTag::Return:
+		case StatementTag::Expression:
+			CollectLiveVariables(*static_cast<const ExpressionStatement&>(*statement).value, true, live);
+			break;
+		}
+	}
+}
+
+static void CollectLiveVariables(const Expression& expression, const bool used, NameSet& live)
+{
+	switch (expression.tag)
+	{
+	case ExpressionTag::False:
+	case ExpressionTag::True:
+	case ExpressionTag::NumberLiteral:
+	case ExpressionTag::FunctionLiteral:
+	case ExpressionTag::Constant:
+		return;
+	case ExpressionTag::ArrayLiteral:
+		for (const auto& value : static_cast<const ArrayLiteral&>(expression).values) CollectLiveVariables(*value, false, live);
+		return;
+	case ExpressionTag::Identifier:
+		if (used) live.insert(static_cast<const Identifier&>(expression).name);
+		return;
+	case ExpressionTag::Unary:
+		CollectLiveVariables(*static_cast<const UnaryOperation&>(expression).a, used, live);
+		return;
+	case ExpressionTag::Binary:
+	case ExpressionTag::TypedBinary:
+	case ExpressionTag::InBoundsRead:
+	{
+		const auto& binaryOp = static_cast<const BinaryOperation&>(expression);
+		CollectLiveVariables(*binaryOp.a, used, live);
+		CollectLiveVariables(*binaryOp.b, used, live);
+		return;
+	}
+	case ExpressionTag::Call:
+	{
+		// NOTE Arguments keep their comments as parameters, which the callee may print.
+		const auto& call = static_cast<const Call&>(expression);
+		CollectLiveVariables(*call.function, false, live);
+		for (const auto& value : call.values) CollectLiveVariables(*value, true, live);
+		return;
+	}
+	}
+}
+
+static void MarkUnusedComments(Statements& statements, const bool allLive, const NameSet& live)
+{
+	for (auto& statement : statements)
+	{
+		switch (statement->tag)
+		{
+		case StatementTag::If:
+		{
+			auto& ifStatement = static_cast<IfStatement&>(*statement);
+			for (auto& elif : ifStatement.elifChain)
+			{
+				MarkUnusedComments(*elif.condition, false);
+				MarkUnusedComments(elif.statements, allLive, live);
+			}
+			MarkUnusedComments(ifStatement.elseBlock, allLive, live);
+			break;
+		}
+		case StatementTag::While:
+		{
+			auto& whileStatement = static_cast<WhileStatement&>(*statement);
+			MarkUnusedComments(*whileStatement.condition, false);
+			MarkUnusedComments(whileStatement.statements, allLive, live);
+			break;
+		}
+		case StatementTag::For:
+		{
+			auto& forStatement = static_cast<ForStatement&>(*statement);
+			const bool used = !forStatement.fallback.empty();
+			MarkUnusedComments(*forStatement.start, used);
+			MarkUnusedComments(*forStatement.end, used);
+			if (forStatement.step) MarkUnusedComments(*forStatement.step, used);
+			MarkUnusedComments(forStatement.statements, allLive, live);
+			MarkUnusedComments(forStatement.fallback, allLive, live);
+			break;
+		}
+		case StatementTag::GuardedLoop:
+		{
+			auto& guardedLoop = static_cast<GuardedLoopStatement&>(*statement);
+			MarkUnusedComments(guardedLoop.fast, allLive, live);
+			MarkUnusedComments(guardedLoop.fallback, allLive, live);
+			break;
+		}
+		case StatementTag::Kernel:
+		{
+			auto& kernel = static_cast<KernelStatement&>(*statement);
+			if (kernel.value) MarkUnusedComments(*kernel.value, false);
+			MarkUnusedComments(kernel.loop, allLive, live);
+			break;
+		}
+		case StatementTag::Switch:
+			MarkUnusedComments(static_cast<SwitchStatement&>(*statement).chain, allLive, live);
+			break;
+		case StatementTag::Fused:
+			MarkUnusedComments(static_cast<FusedStatement&>(*statement).original, allLive, live);
+			break;
+		case StatementTag::Assignment:
+		{
+			auto& assignment = static_cast<AssignmentStatement&>(*statement);
+			const bool used = allLive || live.count(assignment.name);
+			if (!used) assignment.attachedComment = nullptr;
+			MarkUnusedComments(*assignment.value, used);
+			break;
+		}
+		case StatementTag::ArrayWrite:
+		case StatementTag::InBoundsArrayWrite:
+		{
+			auto& arrayWrite = static_cast<ArrayWriteStatement&>(*statement);
+			MarkUnusedComments(*arrayWrite.index, false);
+			MarkUnusedComments(*arrayWrite.value, false);
+			break;
+		}
+		case StatementTag::ArrayPush:
+			MarkUnusedComments(*static_cast<ArrayPushStatement&>(*statement).value, false);
+			break;
+		case StatementTag::ArrayPop:
+			break;
+		case StatementTag::Return:
+		case StatementTag::Expression:
+			MarkUnusedComments(*static_cast<ExpressionStatement&>(*statement).value, true);
+			break;
+		}
+	}
+}
+
+static void MarkUnusedComments(Expression& expression, const bool used)
+{
+	if (!used)
+	{
+		expression.attachedComment = nullptr;
+		expression.commentUnused = true;
+	}
+
+	switch (expression.tag)
+	{
+	case ExpressionTag::False:
+	case ExpressionTag::True:
+	case ExpressionTag::NumberLiteral:
+	case ExpressionTag::FunctionLiteral:
+	case ExpressionTag::Identifier:
+	case ExpressionTag::Constant:
+		return;
+	case ExpressionTag::ArrayLiteral:
+		for (auto& value : static_cast<ArrayLiteral&>(expression).values) MarkUnusedComments(*value, false);
+		return;
+	case ExpressionTag::Unary:
+		MarkUnusedComments(*static_cast<UnaryOperation&>(expression).a, used);
+		return;
+	case ExpressionTag::Binary:
+	case ExpressionTag::TypedBinary:
+	case ExpressionTag::InBoundsRead:
+	{
+		auto& binaryOp = static_cast<BinaryOperation&>(expression);
+		MarkUnusedComments(*binaryOp.a, used);
+		MarkUnusedComments(*binaryOp.b, used);
+		return;
+	}
+	case ExpressionTag::Call:
+	{
+		auto& call = static_cast<Call&>(expression);
+		MarkUnusedComments(*call.function, false);
+		for (auto& value : call.values) MarkUnusedComments(*value, true);
+		return;
+	}
+	}
+}
+
+// --- ESCAPES -----------------------------------------------------------------
+
+bool CapturesScope(const Statements& statements)
+{
+	for (const auto& statement : statements)
+	{
+		if (statement->attachedComment) return true;
+
+		switch (statement->tag)
+		{
+		case StatementTag::If:
+		{
+			const auto& ifStatement = static_cast<const IfStatement&>(*statement);
+			for (const auto& elif : ifStatement.elifChain)
+			{
+				if (CapturesScope(*elif.condition) || CapturesScope(elif.statements)) return true;
+			}
+			if (CapturesScope(ifStatement.elseBlock)) return true;
+			break;
+		}
+		case StatementTag::While:
+		{
+			const auto& whileStatement = static_cast<const WhileStatement&>(*statement);
+			if (CapturesScope(*whileStatement.condition) || CapturesScope(whileStatement.statements)) return true;
+			break;
+		}
+		case StatementTag::For:
+		{
+			const auto& forStatement = static_cast<const ForStatement&>(*statement);
+			if (CapturesScope(*forStatement.start) || CapturesScope(*forStatement.end) || (forStatement.step && CapturesScope(*forStatement.step))) return true;
+			if (CapturesScope(forStatement.statements) || CapturesScope(forStatement.fallback)) return true;
+			break;
+		}
+		case StatementTag::GuardedLoop:
+		{
+			const auto& guardedLoop = static_cast<const GuardedLoopStatement&>(*statement);
+			if (CapturesScope(*guardedLoop.step) || (guardedLoop.limit && CapturesScope(*guardedLoop.limit))) return true;
+			if (CapturesScope(guardedLoop.fast) || CapturesScope(guardedLoop.fallback)) return true;
+			break;
+		}
+		case StatementTag::Kernel:
+		{
+			const auto& kernel = static_cast<const KernelStatement&>(*statement);
+			if ((kernel.value && CapturesScope(*kernel.value)) || CapturesScope(kernel.loop)) return true;
+			break;
+		}
+		case StatementTag::Switch:
+			if (CapturesScope(static_cast<const SwitchStatement&>(*statement).chain)) return true;
+			break;
+		case StatementTag::Fused:
+			if (CapturesScope(static_cast<const FusedStatement&>(*statement).original)) return true;
+			break;
+		case StatementTag::Assignment:
+			if (CapturesScope(*static_cast<const AssignmentStatement&>(*statement).value)) return true;
+			break;
+		case StatementTag::ArrayWrite:
+		case StatementTag::InBoundsArrayWrite:
+		{
+			const auto& arrayWrite = static_cast<const ArrayWriteStatement&>(*statement);
+			if (CapturesScope(*arrayWrite.index) || CapturesScope(*arrayWrite.value)) return true;
+			break;
+		}
+		case StatementTag::ArrayPush:
+			if (CapturesScope(*static_cast<const ArrayPushStatement&>(*statement).value)) return true;
+			break;
+		case StatementTag::ArrayPop:
+			break;
+		case StatementTag::Return:
+		case StatementTag::Expression:
+			if (CapturesScope(*static_cast<const ExpressionStatement&>(*statement).value)) return true;
+			break;
+		}
+	}
+	return false;
+}
+
+static bool CapturesScope(const Expression& expression)
+{
+	if (expression.attachedComment) return true;
+
+	switch (expression.tag)
+	{
+	case ExpressionTag::False:
+	case ExpressionTag::True:
+	case ExpressionTag::NumberLiteral:
+	case ExpressionTag::Identifier:
+	case ExpressionTag::Constant:
+		return false;
+	case ExpressionTag::FunctionLiteral:
+		return true;
+	case ExpressionTag::ArrayLiteral:
+		for (const auto& value : static_cast<const ArrayLiteral&>(expression).values)
+		{
+			if (CapturesScope(*value)) return true;
+		}
+		return false;
+	case ExpressionTag::Unary:
+		return CapturesScope(*static_cast<const UnaryOperation&>(expression).a);
+	case ExpressionTag::Binary:
+	case ExpressionTag::TypedBinary:
+	case ExpressionTag::InBoundsRead:
+	{
+		const auto& binaryOp = static_cast<const BinaryOperation&>(expression);
+		return CapturesScope(*binaryOp.a) || CapturesScope(*binaryOp.b);
+	}
+	case ExpressionTag::Call:
+	{
+		const auto& call = static_cast<const Call&>(expression);
+		if (CapturesScope(*call.function)) return true;
+		for (const auto& value : call.values)
+		{
+			if (CapturesScope(*value)) return true;
+		}
+		return false;
+	}
+	}
+	return true;
+}
+
+// --- LOOPS -------------------------------------------------------------------
+
+void Optimize(Statements& statements, const bool kernels)
+{
+	MarkUnusedComments(statements, false);
+	OptimizeStatements(statements, kernels);
+}
+
+static void OptimizeStatements(Statements& statements, const bool kernels)
+{
+	for (auto& statement : statements)
+	{
+		switch (statement->tag)
+		{
+		case StatementTag::If:
+		{
+			auto& ifStatement = static_cast<IfStatement&>(*statement);
+			for (auto& elif : ifStatement.elifChain)
+			{
+				OptimizeExpression(*elif.condition, kernels);
+				OptimizeStatements(elif.statements, kernels);
+			}
+			OptimizeStatements(ifStatement.elseBlock, kernels);
+			TrySwitch(statement);
+			break;
+		}
+		case StatementTag::While:
+		{
+			// NOTE Inner loops go first, the outer loop then treats them as ordinary statements.
+			auto& whileStatement = static_cast<WhileStatement&>(*statement);
+			OptimizeExpression(*whileStatement.condition, kernels);
+			OptimizeStatements(whileStatement.statements, kernels);
+			TryGuardLoop(statement);
+			if (statement->tag == StatementTag::GuardedLoop)
+			{
+				auto& guardedLoop = static_cast<GuardedLoopStatement&>(*statement);
+				TryCountLoop(guardedLoop.fast.front());
+				TryCountLoop(guardedLoop.fallback.front());
+				if (kernels)
+				{
+					TryKernel(guardedLoop.fast.front());
+					TryKernel(guardedLoop.fallback.front());
+				}
+			}
+			else
+			{
+				TryCountLoop(statement);
+				if (kernels) TryKernel(statement);
+			}
+			break;
+		}
+		case StatementTag::For:
+		{
+			auto& forStatement = static_cast<ForStatement&>(*statement);
+			OptimizeExpression(*forStatement.start, kernels);
+			OptimizeExpression(*forStatement.end, kernels);
+			if (forStatement.step) OptimizeExpression(*forStatement.step, kernels);
+			OptimizeStatements(forStatement.statements, kernels);
+			if (kernels) TryKernel(statement);
+			break;
+		}
+		case StatementTag::GuardedLoop:
+		case StatementTag::Kernel:
+		case StatementTag::Switch:
+		case StatementTag::Fused:
+			break;
+		case StatementTag::Assignment:
+			OptimizeExpression(*static_cast<AssignmentStatement&>(*statement).value, kernels);
+			break;
+		case StatementTag::ArrayWrite:
+		case StatementTag::InBoundsArrayWrite:
+		{
+			auto& arrayWrite = static_cast<ArrayWriteStatement&>(*statement);
+			OptimizeExpression(*arrayWrite.index, kernels);
+			OptimizeExpression(*arrayWrite.value, kernels);
+			break;
+		}
+		case StatementTag::ArrayPush:
+			OptimizeExpression(*static_cast<ArrayPushStatement&>(*statement).value, kernels);
+			break;
+		case StatementTag::ArrayPop:
+			break;
+		case StatementTag::Return:
+		case StatementTag::Expression:
+			OptimizeExpression(*static_cast<ExpressionStatement&>(*statement).value, kernels);
+			break;
+		}
+	}
+}
+
+static void OptimizeExpression(Expression& expression, const bool kernels)
+{
+	switch (expression.tag)
+	{
+	case ExpressionTag::False:
+	case ExpressionTag::True:
+	case ExpressionTag::NumberLiteral:
+	case ExpressionTag::Identifier:
+	case ExpressionTag::Constant:
+		return;
+	case ExpressionTag::ArrayLiteral:
+		for (auto& value : static_cast<ArrayLiteral&>(expression).values) OptimizeExpression(*value, kernels);
+		return;
+	case ExpressionTag::FunctionLiteral:
+	{
+		Statements& body = *static_cast<FunctionLiteral&>(expression).statements;
+		MarkUnusedComments(body, true);
+		OptimizeStatements(body, kernels);
+		return;
+	}
+	case ExpressionTag::Unary:
+		OptimizeExpression(*static_cast<UnaryOperation&>(expression).a, kernels);
+		return;
+	case ExpressionTag::Binary:
+	case ExpressionTag::TypedBinary:
+	case ExpressionTag::InBoundsRead:
+	{
+		auto& binaryOp = static_cast<BinaryOperation&>(expression);
+		OptimizeExpression(*binaryOp.a, kernels);
+		OptimizeExpression(*binaryOp.b, kernels);
+		return;
+	}
+	case ExpressionTag::Call:
+	{
+		auto& call = static_cast<Call&>(expression);
+		OptimizeExpression(*call.function, kernels);
+		for (auto& value : call.values) OptimizeExpression(*value, kernels);
+		return;
+	}
+	}
+}
+
+// Recognizes loops of the form
+//
+//     while < i LIMIT     (or <= i LIMIT)
+//       ...
+//       = i + i STEP
+//     end
+//
+// where the increment is the only assignment to the counter and the body has no calls and no array pops. STEP and
+// LIMIT are number literals or variables not assigned in the loop, LIMIT can also be the length of an array. The
+// counter then only grows and stays below the limit wherever the body reads it, so with a non-negative counter and
+// step on entry, accesses `@ A i` and `= @ A i v` to arrays not assigned in the loop and longer than the limit are in
+// bounds. Arrays can't shrink without a pop, and without calls nothing else can pop them.
+static void TryGuardLoop(std::unique_ptr<Statement>& statement)
+{
+	auto& whileStatement = static_cast<WhileStatement&>(*statement);
+	if (whileStatement.condition->tag != ExpressionTag::Binary) return;
+
+	const auto& condition = static_cast<const BinaryOperation&>(*whileStatement.condition);
+	if ((condition.op != TokenTag::LessThan && condition.op != TokenTag::LessEquals) || condition.a->tag != ExpressionTag::Identifier) return;
+	const std::string& counter = static_cast<const Identifier&>(*condition.a).name;
+
+	if (whileStatement.statements.empty() || whileStatement.statements.back()->tag != StatementTag::Assignment) return;
+	const auto& increment = static_cast<const AssignmentStatement&>(*whileStatement.statements.back());
+	if (increment.name != counter || increment.value->tag != ExpressionTag::Binary) return;
+
+	const auto& incrementOp = static_cast<const BinaryOperation&>(*increment.value);
+	if (incrementOp.op != TokenTag::Plus || incrementOp.a->tag != ExpressionTag::Identifier || static_cast<const Identifier&>(*incrementOp.a).name != counter) return;
+	if (incrementOp.b->tag != ExpressionTag::NumberLiteral && incrementOp.b->tag != ExpressionTag::Identifier) return;
+
+	if (HasCallsOrPops(whileStatement.statements)) return;
+
+	std::unordered_map<std::string, std::vector<const Expression*>> assignments;
+	CollectAssignments(whileStatement.statements, assignments);
+	if (assignments[counter].size() != 1) return;
+	if (incrementOp.b->tag == ExpressionTag::Identifier && assignments.count(static_cast<const Identifier&>(*incrementOp.b).name)) return;
+
+	const bool inclusive = condition.op == TokenTag::LessEquals;
+	std::unique_ptr<Expression> limit;
+	std::string lengthArray;
+	switch (condition.b->tag)
+	{
+	case ExpressionTag::NumberLiteral:
+		break;
+	case ExpressionTag::Identifier:
+		if (assignments.count(static_cast<const Identifier&>(*condition.b).name)) return;
+		break;
+	case ExpressionTag::Unary:
+	{
+		// NOTE The length is read again on each check, so the bound only holds for that array itself.
+		const auto& length = static_cast<const UnaryOperation&>(*condition.b);
+		if (length.op != TokenTag::Hash || length.a->tag != ExpressionTag::Identifier || inclusive) return;
+		lengthArray = static_cast<const Identifier&>(*length.a).name;
+		break;
+	}
+	default:
+		return;
+	}
+
+	NameSet indexedArrays;
+	CollectIndexedArrays(whileStatement.statements, counter, indexedArrays);
+
+	NameSet arrays;
+	for (const std::string& name : indexedArrays)
+	{
+		if (assignments.count(name)) continue;
+		if (!lengthArray.empty() && name != lengthArray) continue;
+		arrays.insert(name);
+	}
+	if (arrays.empty()) return;
+
+	if (lengthArray.empty()) limit = CloneExpression(*condition.b);
+	std::unique_ptr<Expression> step = CloneExpression(*incrementOp.b);
+
+	Statements fast;
+	fast.push_back(CloneWhile(whileStatement));
+	MarkInBounds(static_cast<WhileStatement&>(*fast.front()).statements, counter, arrays);
+
+	const CodePos pos = statement->pos;
+	Statements fallback;
+	fallback.push_back(std::move(statement));
+	statement = std::make_unique<GuardedLoopStatement>(counter, std::move(step), std::move(limit), inclusive, std::vector<std::string>{arrays.begin(), arrays.end()}, std::move(fast), std::move(fallback), pos);
+}
+
+// Rewrites loops of the form
+//
+//     while < i LIMIT     (or <= i LIMIT)
+//       ...
+//       = i + i STEP
+//     end
+//
+// into a ForStatement counting natively, when the increment is the only assignment to the counter and STEP and LIMIT
+// are number literals or variables not assigned in the loop. The counter is bound in the current scope while the loop
+// runs, just like the increment would. The original loop is kept as a fallback for when the counter, limit or step
+// aren't numbers, the step isn't positive, or comments would be propagated to the counter.
+static void TryCountLoop(std::unique_ptr<Statement>& statement)
+{
+	if (statement->tag != StatementTag::While) return;
+	auto& whileStatement = static_cast<WhileStatement&>(*statement);
+	if (whileStatement.condition->tag != ExpressionTag::Binary && whileStatement.condition->tag != ExpressionTag::TypedBinary) return;
+
+	const auto& condition = static_cast<const BinaryOperation&>(*whileStatement.condition);
+	if ((condition.op != TokenTag::LessThan && condition.op != TokenTag::LessEquals) || condition.a->tag != ExpressionTag::Identifier) return;
+	const std::string& counter = static_cast<const Identifier&>(*condition.a).name;
+
+	if (whileStatement.statements.empty() || whileStatement.statements.back()->tag != StatementTag::Assignment) return;
+	const auto& increment = static_cast<const AssignmentStatement&>(*whileStatement.statements.back());
+	if (increment.name != counter || increment.attachedComment) return;
+	if ((increment.value->tag != ExpressionTag::Binary && increment.value->tag != ExpressionTag::TypedBinary) || increment.value->attachedComment) return;
+
+	const auto& incrementOp = static_cast<const BinaryOperation&>(*increment.value);
+	if (incrementOp.op != TokenTag::Plus || incrementOp.a->tag != ExpressionTag::Identifier || incrementOp.a->attachedComment) return;
+	if (static_cast<const Identifier&>(*incrementOp.a).name != counter) return;
+	if ((incrementOp.b->tag != ExpressionTag::NumberLiteral && incrementOp.b->tag != ExpressionTag::Identifier) || incrementOp.b->attachedComment) return;
+
+	std::unordered_map<std::string, std::vector<const Expression*>> assignments;
+	CollectAssignments(whileStatement.statements, assignments);
+	if (assignments[counter].size() != 1) return;
+	if (incrementOp.b->tag == ExpressionTag::Identifier && assignments.count(static_cast<const Identifier&>(*incrementOp.b).name)) return;
+	if (condition.b->tag == ExpressionTag::Identifier && assignments.count(static_cast<const Identifier&>(*condition.b).name)) return;
+	if (condition.b->tag != ExpressionTag::NumberLiteral && condition.b->tag != ExpressionTag::Identifier) return;
+
+	Statements body;
+	const size_t n = whileStatement.statements.size() - 1;
+	body.reserve(n);
+	for (size_t i = 0; i < n; ++i) body.push_back(CloneStatement(*whileStatement.statements[i]));
+
+	const CodePos pos = statement->pos;
+	auto start = std::make_unique<Identifier>(counter, condition.a->pos, nullptr);
+	auto end = CloneExpression(*condition.b);
+	auto step = CloneExpression(*incrementOp.b);
+	const bool inclusive = condition.op == TokenTag::LessEquals;
+
+	Statements fallback;
+	fallback.push_back(std::move(statement));
+	statement = std::make_unique<ForStatement>(counter, std::move(start), std::move(end), std::move(step), inclusive, std::move(body), std::move(fallback), pos, nullptr);
+}
+
+// Replaces for loops whose whole body is one of the idioms in KernelTag with a KernelStatement. START, END and STEP
+// have to be number literals or variables, and so do values filled or stored, which the single statement body can't
+// assign. Sums and minimums/maximums can't have comments attached to the accumulation, so the accumulator ends up a
+// number without comment just like after the loop.
+static void TryKernel(std::unique_ptr<Statement>& statement)
+{
+	if (statement->tag != StatementTag::For) return;
+	const auto& forStatement = static_cast<const ForStatement&>(*statement);
+	if (!IsLoopOperand(*forStatement.start) || !IsLoopOperand(*forStatement.end) || (forStatement.step && !IsLoopOperand(*forStatement.step))) return;
+	if (forStatement.statements.size() != 1) return;
+
+	const std::string& counter = forStatement.counter;
+	const Statement& body = *forStatement.statements.front();
+
+	KernelTag kernel = KernelTag::Fill;
+	std::string array;
+	std::string source;
+	std::string accumulator;
+	const Expression* value = nullptr;
+	switch (body.tag)
+	{
+	case StatementTag::ArrayPush:
+	{
+		const auto& arrayPush = static_cast<const ArrayPushStatement&>(body);
+		if (!IsLoopOperand(*arrayPush.value)) return;
+		array = arrayPush.name;
+		value = arrayPush.value.get();
+		break;
+	}
+	case StatementTag::ArrayWrite:
+	case StatementTag::InBoundsArrayWrite:
+	{
+		const auto& arrayWrite = static_cast<const ArrayWriteStatement&>(body);
+		if (!IsIdentifier(*arrayWrite.index, counter)) return;
+		array = arrayWrite.name;
+		if (IsArrayRead(*arrayWrite.value, counter))
+		{
+			kernel = KernelTag::Copy;
+			source = GetReadArray(*arrayWrite.value);
+		}
+		else if (IsLoopOperand(*arrayWrite.value))
+		{
+			kernel = KernelTag::Store;
+			value = arrayWrite.value.get();
+		}
+		else
+		{
+			return;
+		}
+		break;
+	}
+	case StatementTag::Assignment:
+	{
+		const auto& assignment = static_cast<const AssignmentStatement&>(body);
+		if (assignment.attachedComment || assignment.value->attachedComment) return;
+		if (assignment.value->tag != ExpressionTag::Binary && assignment.value->tag != ExpressionTag::TypedBinary) return;
+
+		const auto& sum = static_cast<const BinaryOperation&>(*assignment.value);
+		if (sum.op != TokenTag::Plus) return;
+		const Expression* read = nullptr;
+		if (IsIdentifier(*sum.a, assignment.name) && !sum.a->attachedComment) read = sum.b.get();
+		else if (IsIdentifier(*sum.b, assignment.name) && !sum.b->attachedComment) read = sum.a.get();
+		if (!read || !IsPlainArrayRead(*read, counter)) return;
+
+		kernel = KernelTag::Sum;
+		source = GetReadArray(*read);
+		accumulator = assignment.name;
+		break;
+	}
+	case StatementTag::If:
+	{
+		const auto& ifStatement = static_cast<const IfStatement&>(body);
+		if (ifStatement.elifChain.size() != 1 || !ifStatement.elseBlock.empty()) return;
+
+		const auto& branch = ifStatement.elifChain.front();
+		if (branch.statements.size() != 1 || branch.statements.front()->tag != StatementTag::Assignment) return;
+		const auto& assignment = static_cast<const AssignmentStatement&>(*branch.statements.front());
+		if (assignment.attachedComment || !IsPlainArrayRead(*assignment.value, counter)) return;
+		source = GetReadArray(*assignment.value);
+
+		if (branch.condition->tag != ExpressionTag::Binary && branch.condition->tag != ExpressionTag::TypedBinary) return;
+		const auto& comparison = static_cast<const BinaryOperation&>(*branch.condition);
+		if (comparison.op != TokenTag::LessThan && comparison.op != TokenTag::GreaterThan) return;
+
+		const bool readFirst = IsArrayRead(*comparison.a, counter) && GetReadArray(*comparison.a) == source && IsIdentifier(*comparison.b, assignment.name);
+		const bool readSecond = IsArrayRead(*comparison.b, counter) && GetReadArray(*comparison.b) == source && IsIdentifier(*comparison.a, assignment.name);
+		if (!readFirst && !readSecond) return;
+
+		kernel = (comparison.op == TokenTag::LessThan) == readFirst ? KernelTag::Min : KernelTag::Max;
+		accumulator = assignment.name;
+		break;
+	}
+	default:
+		return;
+	}
+
+	if (array == counter || source == counter || accumulator == counter) return;
+	if (!accumulator.empty() && accumulator == source) return;
+
+	std::unique_ptr<Expression> kernelValue;
+	if (value && !IsIdentifier(*value, counter)) kernelValue = CloneExpression(*value);
+
+	const CodePos pos = statement->pos;
+	Statements loop;
+	loop.push_back(std::move(statement));
+	statement = std::make_unique<KernelStatement>(kernel, std::move(array), std::move(source), std::move(accumulator), std::move(kernelValue), std::move(loop), pos);
+}
+
+static bool IsLoopOperand(const Expression& expression)
+{
+	return expression.tag == ExpressionTag::NumberLiteral || expression.tag == ExpressionTag::Identifier || expression.tag == ExpressionTag::Constant;
+}
+
+static bool IsIdentifier(const Expression& expression, const std::string& name)
+{
+	return expression.tag == ExpressionTag::Identifier && static_cast<const Identifier&>(expression).name == name;
+}
+
+static bool HasCallsOrPops(const Statements& statements)
+{
+	for (const auto& statement : statements)
+	{
+		switch (statement->tag)
+		{
+		case StatementTag::If:
+		{
+			const auto& ifStatement = static_cast<const IfStatement&>(*statement);
+			for (const auto& elif : ifStatement.elifChain)
+			{
+				if (HasCalls(*elif.condition) || HasCallsOrPops(elif.statements)) return true;
+			}
+			if (HasCallsOrPops(ifStatement.elseBlock)) return true;
+			break;
+		}
+		case StatementTag::While:
+		{
+			const auto& whileStatement = static_cast<const WhileStatement&>(*statement);
+			if (HasCalls(*whileStatement.condition) || HasCallsOrPops(whileStatement.statements)) return true;
+			break;
+		}
+		case StatementTag::For:
+		{
+			const auto& forStatement = static_cast<const ForStatement&>(*statement);
+			if (HasCalls(*forStatement.start) || HasCalls(*forStatement.end) || (forStatement.step && HasCalls(*forStatement.step))) return true;
+			if (HasCallsOrPops(forStatement.statements) || HasCallsOrPops(forStatement.fallback)) return true;
+			break;
+		}
+		case StatementTag::GuardedLoop:
+			if (HasCallsOrPops(static_cast<const GuardedLoopStatement&>(*statement).fallback)) return true;
+			break;
+		case StatementTag::Kernel:
+			if (HasCallsOrPops(static_cast<const KernelStatement&>(*statement).loop)) return true;
+			break;
+		case StatementTag::Switch:
+			if (HasCallsOrPops(static_cast<const SwitchStatement&>(*statement).chain)) return true;
+			break;
+		case StatementTag::Fused:
+			if (HasCallsOrPops(static_cast<const FusedStatement&>(*statement).original)) return true;
+			break;
+		case StatementTag::Assignment:
+			if (HasCalls(*static_cast<const AssignmentStatement&>(*statement).value)) return true;
+			break;
+		case StatementTag::ArrayWrite:
+		case StatementTag::InBoundsArrayWrite:
+		{
+			const auto& arrayWrite = static_cast<const ArrayWriteStatement&>(*statement);
+			if (HasCalls(*arrayWrite.index) || HasCalls(*arrayWrite.value)) return true;
+			break;
+		}
+		case StatementTag::ArrayPush:
+			if (HasCalls(*static_cast<const ArrayPushStatement&>(*statement).value)) return true;
+			break;
+		case StatementTag::ArrayPop:
+			return true;
+		case StatementTag::Return:
+		case StatementTag::Expression:
+			if (HasCalls(*static_cast<const ExpressionStatement&>(*statement).value)) return true;
+			break;
+		}
+	}
+	return false;
+}
+
+static bool HasCalls(const Expression& expression)
+{
+	switch (expression.tag)
+	{
+	case ExpressionTag::False:
+	case ExpressionTag::True:
+	case ExpressionTag::NumberLiteral:
+	case ExpressionTag::FunctionLiteral:
+	case ExpressionTag::Identifier:
+	case ExpressionTag::Constant:
+		return false;
+	case ExpressionTag::ArrayLiteral:
+		for (const auto& value : static_cast<const ArrayLiteral&>(expression).values)
+		{
+			if (HasCalls(*value)) return true;
+		}
+		return false;
+	case ExpressionTag::Unary:
+		return HasCalls(*static_cast<const UnaryOperation&>(expression).a);
+	case ExpressionTag::Binary:
+	case ExpressionTag::TypedBinary:
+	case ExpressionTag::InBoundsRead:
+	{
+		const auto& binaryOp = static_cast<const BinaryOperation&>(expression);
+		return binaryOp.op == TokenTag::KeyMap || HasCalls(*binaryOp.a) || HasCalls(*binaryOp.b);
+	}
+	case ExpressionTag::Call:
+		return true;
+	}
+	return true;
+}
+
+static bool IsArrayRead(const Expression& expression, const std::string& counter)
+{
+	if (expression.tag != ExpressionTag::Binary && expression.tag != ExpressionTag::TypedBinary && expression.tag != ExpressionTag::InBoundsRead) return false;
+	const auto& binaryOp = static_cast<const BinaryOperation&>(expression);
+	return binaryOp.op == TokenTag::At && binaryOp.a->tag == ExpressionTag::Identifier && IsIdentifier(*binaryOp.b, counter);
+}
+
+// Array read without comments on the read, array name or index, so the value read has no comment either.
+static bool IsPlainArrayRead(const Expression& expression, const std::string& counter)
+{
+	if (!IsArrayRead(expression, counter) || expression.attachedComment) return false;
+	const auto& binaryOp = static_cast<const BinaryOperation&>(expression);
+	return !binaryOp.a->attachedComment && !binaryOp.b->attachedComment;
+}
+
+static const std::string& GetReadArray(const Expression& arrayRead)
+{
+	return static_cast<const Identifier&>(*static_cast<const BinaryOperation&>(arrayRead).a).name;
+}
+
+static void CollectIndexedArrays(const Statements& statements, const std::string& counter, NameSet& out)
+{
+	for (const auto& statement : statements)
+	{
+		switch (statement->tag)
+		{
+		case StatementTag::If:
+		{
+			const auto& ifStatement = static_cast<const IfStatement&>(*statement);
+			for (const auto& elif : ifStatement.elifChain)
+			{
+				CollectIndexedArrays(*elif.condition, counter, out);
+				CollectIndexedArrays(elif.statements, counter, out);
+			}
+			CollectIndexedArrays(ifStatement.elseBlock, counter, out);
+			break;
+		}
+		case StatementTag::While:
+		{
+			const auto& whileStatement = static_cast<const WhileStatement&>(*statement);
+			CollectIndexedArrays(*whileStatement.condition, counter, out);
+			CollectIndexedArrays(whileStatement.statements, counter, out);
+			break;
+		}
+		case StatementTag::For:
+		{
+			const auto& forStatement = static_cast<const ForStatement&>(*statement);
+			CollectIndexedArrays(forStatement.statements, counter, out);
+			CollectIndexedArrays(forStatement.fallback, counter, out);
+			break;
+		}
+		case StatementTag::GuardedLoop:
+			CollectIndexedArrays(static_cast<const GuardedLoopStatement&>(*statement).fallback, counter, out);
+			break;
+		case StatementTag::Kernel:
+			CollectIndexedArrays(static_cast<const KernelStatement&>(*statement).loop, counter, out);
+			break;
+		case StatementTag::Switch:
+			CollectIndexedArrays(static_cast<const SwitchStatement&>(*statement).chain, counter, out);
+			break;
+		case StatementTag::Fused:
+			CollectIndexedArrays(static_cast<const FusedStatement&>(*statement).original, counter, out);
+			break;
+		case StatementTag::Assignment:
+			CollectIndexedArrays(*static_cast<const AssignmentStatement&>(*statement).value, counter, out);
+			break;
+		case StatementTag::ArrayWrite:
+		case StatementTag::InBoundsArrayWrite:
+		{
+			const auto& arrayWrite = static_cast<const ArrayWriteStatement&>(*statement);
+			if (arrayWrite.index->tag == ExpressionTag::Identifier && static_cast<const Identifier&>(*arrayWrite.index).name == counter) out.insert(arrayWrite.name);
+			CollectIndexedArrays(*arrayWrite.index, counter, out);
+			CollectIndexedArrays(*arrayWrite.value, counter, out);
+			break;
+		}
+		case StatementTag::ArrayPush:
+			CollectIndexedArrays(*static_cast<const ArrayPushStatement&>(*statement).value, counter, out);
+			break;
+		case StatementTag::ArrayPop:
+			break;
+		case StatementTag::Return:
+		case StatementTag::Expression:
+			CollectIndexedArrays(*static_cast<const ExpressionStatement&>(*statement).value, counter, out);
+			break;
+		}
+	}
+}
+
+static void CollectIndexedArrays(const Expression& expression, const std::string& counter, NameSet& out)
+{
+	switch (expression.tag)
+	{
+	case ExpressionTag::False:
+	case ExpressionTag::True:
+	case ExpressionTag::NumberLiteral:
+	case ExpressionTag::FunctionLiteral:
+	case ExpressionTag::Identifier:
+	case ExpressionTag::Constant:
+		return;
+	case ExpressionTag::ArrayLiteral:
+		for (const auto& value : static_cast<const ArrayLiteral&>(expression).values) CollectIndexedArrays(*value, counter, out);
+		return;
+	case ExpressionTag::Unary:
+		CollectIndexedArrays(*static_cast<const UnaryOperation&>(expression).a, counter, out);
+		return;
+	case ExpressionTag::Binary:
+	case ExpressionTag::TypedBinary:
+	case ExpressionTag::InBoundsRead:
+	{
+		const auto& binaryOp = static_cast<const BinaryOperation&>(expression);
+		if (IsArrayRead(expression, counter)) out.insert(static_cast<const Identifier&>(*binaryOp.a).name);
+		CollectIndexedArrays(*binaryOp.a, counter, out);
+		CollectIndexedArrays(*binaryOp.b, counter, out);
+		return;
+	}
+	case ExpressionTag::Call:
+		return;
+	}
+}
+
+static void MarkInBounds(Statements& statements, const std::string& counter, const NameSet& arrays)
+{
+	for (auto& statement : statements)
+	{
+		switch (statement->tag)
+		{
+		case StatementTag::If:
+		{
+			auto& ifStatement = static_cast<IfStatement&>(*statement);
+			for (auto& elif : ifStatement.elifChain)
+			{
+				MarkInBounds(*elif.condition, counter, arrays);
+				MarkInBounds(elif.statements, counter, arrays);
+			}
+			MarkInBounds(ifStatement.elseBlock, counter, arrays);
+			break;
+		}
+		case StatementTag::While:
+		{
+			auto& whileStatement = static_cast<WhileStatement&>(*statement);
+			MarkInBounds(*whileStatement.condition, counter, arrays);
+			MarkInBounds(whileStatement.statements, counter, arrays);
+			break;
+		}
+		case StatementTag::For:
+		{
+			auto& forStatement = static_cast<ForStatement&>(*statement);
+			MarkInBounds(forStatement.statements, counter, arrays);
+			MarkInBounds(forStatement.fallback, counter, arrays);
+			break;
+		}
+		case StatementTag::GuardedLoop:
+		{
+			auto& guardedLoop = static_cast<GuardedLoopStatement&>(*statement);
+			MarkInBounds(guardedLoop.fast, counter, arrays);
+			MarkInBounds(guardedLoop.fallback, counter, arrays);
+			break;
+		}
+		case StatementTag::Kernel:
+			MarkInBounds(static_cast<KernelStatement&>(*statement).loop, counter, arrays);
+			break;
+		case StatementTag::Switch:
+			MarkInBounds(static_cast<SwitchStatement&>(*statement).chain, counter, arrays);
+			break;
+		case StatementTag::Fused:
+			MarkInBounds(static_cast<FusedStatement&>(*statement).original, counter, arrays);
+			break;
+		case StatementTag::Assignment:
+			MarkInBounds(*static_cast<AssignmentStatement&>(*statement).value, counter, arrays);
+			break;
+		case StatementTag::ArrayWrite:
+		case StatementTag::InBoundsArrayWrite:
+		{
+			auto& arrayWrite = static_cast<ArrayWriteStatement&>(*statement);
+			if (arrays.count(arrayWrite.name) && arrayWrite.index->tag == ExpressionTag::Identifier && static_cast<const Identifier&>(*arrayWrite.index).name == counter)
+			{
+				arrayWrite.tag = StatementTag::InBoundsArrayWrite;
+			}
+			MarkInBounds(*arrayWrite.index, counter, arrays);
+			MarkInBounds(*arrayWrite.value, counter, arrays);
+			break;
+		}
+		case StatementTag::ArrayPush:
+			MarkInBounds(*static_cast<ArrayPushStatement&>(*statement).value, counter, arrays);
+			break;
+		case StatementTag::ArrayPop:
+			break;
+		case StatementTag::Return:
+		case StatementTag::Expression:
+			MarkInBounds(*static_cast<ExpressionStatement&>(*statement).value, counter, arrays);
+			break;
+		}
+	}
+}
+
+static void MarkInBounds(Expression& expression, const std::string& counter, const NameSet& arrays)
+{
+	switch (expression.tag)
+	{
+	case ExpressionTag::False:
+	case ExpressionTag::True:
+	case ExpressionTag::NumberLiteral:
+	case ExpressionTag::FunctionLiteral:
+	case ExpressionTag::Identifier:
+	case ExpressionTag::Constant:
+		return;
+	case ExpressionTag::ArrayLiteral:
+		for (auto& value : static_cast<ArrayLiteral&>(expression).values) MarkInBounds(*value, counter, arrays);
+		return;
+	case ExpressionTag::Unary:
+		MarkInBounds(*static_cast<UnaryOperation&>(expression).a, counter, arrays);
+		return;
+	case ExpressionTag::Binary:
+	case ExpressionTag::TypedBinary:
+	case ExpressionTag::InBoundsRead:
+	{
+		auto& binaryOp = static_cast<BinaryOperation&>(expression);
+		if (IsArrayRead(expression, counter) && arrays.count(static_cast<const Identifier&>(*binaryOp.a).name))
+		{
+			expression.tag = ExpressionTag::InBoundsRead;
+		}
+		MarkInBounds(*binaryOp.a, counter, arrays);
+		MarkInBounds(*binaryOp.b, counter, arrays);
+		return;
+	}
+	case ExpressionTag::Call:
+		return;
+	}
+}
+
+// --- SWITCHES ----------------------------------------------------------------
+
+// Replaces if statements with at least MIN_SWITCH_ARMS conditions of the form `== VARIABLE NUMBER` (or `== NUMBER
+// VARIABLE`) on the same variable with SwitchStatement. Conditions are only compared until one holds and evaluating
+// them has no side effects, so finding the first arm whose number equals the variable does the same. Integers close
+// enough together get a table, others a hash map.
+static void TrySwitch(std::unique_ptr<Statement>& statement)
+{
+	const auto& ifStatement = static_cast<const IfStatement&>(*statement);
+	const size_t n = ifStatement.elifChain.size();
+	if (n < MIN_SWITCH_ARMS) return;
+
+	std::string variable;
+	std::vector<double> values;
+	values.reserve(n);
+	for (const auto& elif : ifStatement.elifChain)
+	{
+		if (elif.condition->tag != ExpressionTag::Binary) return;
+		const auto& comparison = static_cast<const BinaryOperation&>(*elif.condition);
+		if (comparison.op != TokenTag::EqualsEquals) return;
+
+		const Expression* name = comparison.a.get();
+		const Expression* number = comparison.b.get();
+		if (name->tag == ExpressionTag::NumberLiteral) std::swap(name, number);
+		if (name->tag != ExpressionTag::Identifier || number->tag != ExpressionTag::NumberLiteral) return;
+
+		const std::string& identifier = static_cast<const Identifier&>(*name).name;
+		if (variable.empty()) variable = identifier;
+		else if (identifier != variable) return;
+		values.push_back(static_cast<const NumberLiteral&>(*number).value);
+	}
+
+	const double first = *std::min_element(values.begin(), values.end());
+	const double last = *std::max_element(values.begin(), values.end());
+	const bool integers = std::all_of(values.begin(), values.end(), [](const double value) { return std::floor(value) == value; });
+
+	std::vector<size_t> table;
+	std::unordered_map<double, size_t> arms;
+	if (integers && last - first < static_cast<double>(MAX_SWITCH_TABLE_SPREAD * n))
+	{
+		table.assign(static_cast<size_t>(last - first) + 1, n);
+		for (size_t i = n; i-- > 0;) table[static_cast<size_t>(values[i] - first)] = i;
+	}
+	else
+	{
+		for (size_t i = 0; i < n; ++i) arms.emplace(values[i], i);
+	}
+
+	const CodePos pos = statement->pos;
+	Statements chain;
+	chain.push_back(std::move(statement));
+	statement = std::make_unique<SwitchStatement>(std::move(variable), first, std::move(table), std::move(arms), std::move(chain), pos);
+}
+
+// --- FUSION ------------------------------------------------------------------
+
+void Fuse(Statements& statements)
+{
+	for (auto& statement : statements) FuseStatement(statement);
+}
+
+// Fuses the statements nested in `statement`, then `statement` itself. Function literals are left alone, their bodies
+// are fused when the function gets hot.
+static void FuseStatement(std::unique_ptr<Statement>& statement)
+{
+	switch (statement->tag)
+	{
+	case StatementTag::If:
+	{
+		auto& ifStatement = static_cast<IfStatement&>(*statement);
+		for (auto& elif : ifStatement.elifChain) Fuse(elif.statements);
+		Fuse(ifStatement.elseBlock);
+		break;
+	}
+	case StatementTag::While:
+		Fuse(static_cast<WhileStatement&>(*statement).statements);
+		break;
+	case StatementTag::For:
+	{
+		auto& forStatement = static_cast<ForStatement&>(*statement);
+		Fuse(forStatement.statements);
+		Fuse(forStatement.fallback);
+		break;
+	}
+	case StatementTag::GuardedLoop:
+	{
+		auto& guardedLoop = static_cast<GuardedLoopStatement&>(*statement);
+		Fuse(guardedLoop.fast);
+		Fuse(guardedLoop.fallback);
+		break;
+	}
+	case StatementTag::Kernel:
+		// NOTE The loop stays a ForStatement, which the kernel runs instead.
+		FuseStatement(static_cast<KernelStatement&>(*statement).loop.front());
+		break;
+	case StatementTag::Switch:
+	{
+		// NOTE The chain stays an IfStatement, whose arms the switch runs.
+		auto& ifStatement = static_cast<IfStatement&>(*static_cast<SwitchStatement&>(*statement).chain.front());
+		for (auto& elif : ifStatement.elifChain) Fuse(elif.statements);
+		Fuse(ifStatement.elseBlock);
+		return;
+	}
+	case StatementTag::Fused:
+		return;
+	default:
+		break;
+	}
+	TryFuse(statement);
+}
+
+// Replaces `statement` with FusedStatement if it has one of the shapes in FusedTag. Nodes of the shape have no comments,
+// so running it doesn't create values that could print them.
+static void TryFuse(std::unique_ptr<Statement>& statement)
+{
+	if (statement->attachedComment) return;
+
+	FusedTag fused;
+	TokenTag op = TokenTag::Plus;
+	std::string variable;
+	const Expression* operand = nullptr; // variable or number literal
+	double number = 0.0;
+	double constant = 0.0;
+	switch (statement->tag)
+	{
+	case StatementTag::Assignment:
+	{
+		const auto& assignment = static_cast<const AssignmentStatement&>(*statement);
+		if (assignment.value->tag != ExpressionTag::Binary || assignment.value->attachedComment) return;
+		const auto& binaryOp = static_cast<const BinaryOperation&>(*assignment.value);
+		if (binaryOp.op != TokenTag::Plus && binaryOp.op != TokenTag::Minus) return;
+		if (!IsIdentifier(*binaryOp.a, assignment.name) || binaryOp.a->attachedComment) return;
+		if (binaryOp.b->tag != ExpressionTag::NumberLiteral || binaryOp.b->attachedComment) return;
+
+		// NOTE x - c is x + -c exactly.
+		fused = FusedTag::AddConstant;
+		variable = assignment.name;
+		number = static_cast<const NumberLiteral&>(*binaryOp.b).value;
+		if (binaryOp.op == TokenTag::Minus) number = -number;
+		break;
+	}
+	case StatementTag::While:
+	{
+		const auto& whileStatement = static_cast<const WhileStatement&>(*statement);
+		if (whileStatement.condition->tag != ExpressionTag::Binary || whileStatement.condition->attachedComment) return;
+		const auto& comparison = static_cast<const BinaryOperation&>(*whileStatement.condition);
+		if (!IsComparison(comparison.op) || comparison.a->tag != ExpressionTag::Identifier || !IsFusedOperand(*comparison.a) || !IsFusedOperand(*comparison.b)) return;
+
+		fused = FusedTag::CompareLoop;
+		op = comparison.op;
+		variable = static_cast<const Identifier&>(*comparison.a).name;
+		operand = comparison.b.get();
+		break;
+	}
+	case StatementTag::If:
+	{
+		const Expression& condition = *static_cast<const IfStatement&>(*statement).elifChain.front().condition;
+		if (condition.tag != ExpressionTag::Binary || condition.attachedComment) return;
+		const auto& comparison = static_cast<const BinaryOperation&>(condition);
+		if (!IsComparison(comparison.op) || comparison.a->tag != ExpressionTag::Binary || comparison.a->attachedComment) return;
+		if (comparison.b->tag != ExpressionTag::NumberLiteral || comparison.b->attachedComment) return;
+		const auto& modulo = static_cast<const BinaryOperation&>(*comparison.a);
+		if (modulo.op != TokenTag::Percent || modulo.a->tag != ExpressionTag::Identifier || !IsFusedOperand(*modulo.a) || !IsFusedOperand(*modulo.b)) return;
+
+		fused = FusedTag::ModuloTest;
+		op = comparison.op;
+		variable = static_cast<const Identifier&>(*modulo.a).name;
+		operand = modulo.b.get();
+		constant = static_cast<const NumberLiteral&>(*comparison.b).value;
+		break;
+	}
+	case StatementTag::ArrayWrite:
+	{
+		const auto& arrayWrite = static_cast<const ArrayWriteStatement&>(*statement);
+		if (arrayWrite.index->tag != ExpressionTag::Identifier || !IsFusedOperand(*arrayWrite.index)) return;
+		if (arrayWrite.value->tag != ExpressionTag::NumberLiteral || !IsFusedOperand(*arrayWrite.value)) return;
+
+		fused = FusedTag::StoreConstant;
+		variable = arrayWrite.name;
+		operand = arrayWrite.index.get();
+		constant = static_cast<const NumberLiteral&>(*arrayWrite.value).value;
+		break;
+	}
+	default:
+		return;
+	}
+
+	std::string operandName;
+	if (operand && operand->tag == ExpressionTag::Identifier) operandName = static_cast<const Identifier&>(*operand).name;
+	else if (operand) number = static_cast<const NumberLiteral&>(*operand).value;
+
+	const CodePos pos = statement->pos;
+	Statements original;
+	original.push_back(std::move(statement));
+	statement = std::make_unique<FusedStatement>(fused, op, std::move(variable), std::move(operandName), number, constant, std::move(original), pos);
+}
+
+static bool IsComparison(const TokenTag op)
+{
+	switch (op)
+	{
+	case TokenTag::LessThan:
+	case TokenTag::GreaterThan:
+	case TokenTag::LessEquals:
+	case TokenTag::GreaterEquals:
+	case TokenTag::EqualsEquals:
+	case TokenTag::NotEquals:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// Returns true if `expression` is a variable or number literal without comment.
+static bool IsFusedOperand(const Expression& expression)
+{
+	return (expression.tag == ExpressionTag::Identifier || expression.tag == ExpressionTag::NumberLiteral) && !expression.attachedComment;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "Parser.h"
+#include "Runtime.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+std::unique_ptr<Expression> CloneExpression(const Expression& expression);
+std::unique_ptr<Statement> CloneStatement(const Statement& statement);
+std::vector<std::unique_ptr<Statement>> CloneStatements(const std::vector<std::unique_ptr<Statement>>& statements);
+
+// Returns a copy of function body `statements` where binary operations with operand types implied by argument types
+// `argTypes` are retagged as ExpressionTag::TypedBinary. Returns null if no operation could be specialized.
+std::shared_ptr<std::vector<std::unique_ptr<Statement>>> SpecializeFunction(const std::vector<std::string>& args, const std::vector<TypeTag>& argTypes, const std::vector<std::unique_ptr<Statement>>& statements);
+
+// Returns a copy of function body `statements` where reads of variables captured from frozen scopes of `closure` are
+// replaced with Constant nodes. Returns null if no variable could be replaced.
+std::shared_ptr<std::vector<std::unique_ptr<Statement>>> SpecializeClosure(const std::vector<std::string>& args, const std::vector<std::unique_ptr<Statement>>& statements, const Ref<Scope>& closure);
+
+// Returns true if function body `statements` can't print, mutate arrays or create functions, and collects names it
+// reads from the closure into `freeVariables`.
+bool AnalyzePurity(const std::vector<std::string>& args, const std::vector<std::unique_ptr<Statement>>& statements, std::vector<std::string>& freeVariables);
+
+// Returns true if function body `statements` can create values referencing the scope of its call, which are function
+// values closing over it and comments resolving their references in it.
+bool CapturesScope(const std::vector<std::unique_ptr<Statement>>& statements);
+
+// Replaces while loops counting up to a limit with GuardedLoopStatement when array accesses indexed by the counter can
+// be proven in bounds on loop entry, and with native ForStatement loops. With `kernels` set, counted loops filling,
+// storing to, copying or reducing an array are replaced with KernelStatement. Elif chains comparing one variable with
+// numbers are replaced with SwitchStatement. Comments that can never be printed are removed and the expressions
+// computing such values marked with `commentUnused`. Bodies of function literals are optimized too.
+void Optimize(std::vector<std::unique_ptr<Statement>>& statements, bool kernels);
+
+// Replaces statements of the shapes in FusedTag with FusedStatement, which the tree walker runs as one operation. Runs
+// on optimized code that got hot, bodies of function literals are left to be fused when they get hot themselves.
+void Fuse(std::vector<std::unique_ptr<Statement>>& statements);
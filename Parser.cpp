@@ -23,6 +23,7 @@ static CodePos GetPos();
 [[nodiscard]] static Error ParseStatement(Statements& statements);
 [[nodiscard]] static Error ParseIf(Statements& statements);
 [[nodiscard]] static Error ParseWhile(Statements& statements);
+[[nodiscard]] static Error ParseFor(Statements& statements);
 [[nodiscard]] static Error ParseAssignment(Statements& statements);
 [[nodiscard]] static Error ParseArrayPush(Statements& statements);
 [[nodiscard]] static Error ParseArrayPop(Statements& statements);
@@ -230,6 +231,7 @@ static CodePos GetPos()
 		case TokenTag::EqualsEquals:
 		case TokenTag::NotEquals:
 		case TokenTag::At:
+		case TokenTag::KeyMap:
 		{
 			tokenPtr += 1;
 
@@ -258,6 +260,9 @@ static CodePos GetPos()
 	error = ParseWhile(statements);
 	if (error || success) return error;
 
+	error = ParseFor(statements);
+	if (error || success) return error;
+
 	error = ParseAssignment(statements);
 	if (error || success) return error;
 
@@ -354,6 +359,58 @@ static CodePos GetPos()
 	return Error::None;
 }
 
+[[nodiscard]] static Error ParseFor(Statements& statements)
+{
+	const CodePos pos = GetPos();
+
+	if (!EatToken(TokenTag::KeyFor))
+	{
+		success = false;
+		return Error::None;
+	}
+
+	std::unique_ptr<CommentToken> attachedComment = ConsumeLastComment();
+
+	if (!IsToken(TokenTag::Identifier))
+	{
+		return Error{"Expected identifier of loop counter after \"for\"", GetPos()};
+	}
+	const std::string& counter = GetToken<IdentifierToken>()->name;
+	tokenPtr += 1;
+
+	if (!EatToken(TokenTag::ParenOpen))
+	{
+		return Error{"Expected \"(\" to start loop range", GetPos()};
+	}
+
+	std::unique_ptr<Expression> start;
+	TRY(ParseExpression(start));
+
+	std::unique_ptr<Expression> end;
+	TRY(ParseExpression(end));
+
+	std::unique_ptr<Expression> step;
+	if (!EatToken(TokenTag::ParenClose))
+	{
+		TRY(ParseExpression(step));
+
+		if (!EatToken(TokenTag::ParenClose))
+		{
+			return Error{"Expected \")\" to end loop range", GetPos()};
+		}
+	}
+
+	Statements innerStatements;
+	while (!EatToken(TokenTag::KeyEnd))
+	{
+		TRY(ParseStatement(innerStatements));
+	}
+
+	success = true;
+	statements.emplace_back(std::make_unique<ForStatement>(counter, std::move(start), std::move(end), std::move(step), false, std::move(innerStatements), Statements{}, pos, std::move(attachedComment)));
+	return Error::None;
+}
+
 [[nodiscard]] static Error ParseAssignment(Statements& statements)
 {
 	const CodePos pos = GetPos();
@@ -6,6 +6,7 @@
 #include "Lexer.h"
 
 #include <memory>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -16,25 +17,56 @@ enum class ExpressionTag {
 	ArrayLiteral,    // ArrayLiteral
 	FunctionLiteral, // FunctionLiteral
 	Identifier,      // Identifier
+	Constant,        // Constant (value baked in by closure specialization)
 
 	Unary,           // UnaryOperation
 	Binary,          // BinaryOperation
+	TypedBinary,     // BinaryOperation (operand types proven by specialization)
+	InBoundsRead,    // BinaryOperation (array read with index proven in bounds by a loop guard)
 
 	Call,            // Call
 };
 
 enum class StatementTag {
-	If,         // IfStatement
-	While,      // WhileStatement
-	Assignment, // AssignmentStatement
-	ArrayWrite, // ArrayWriteStatement
-	ArrayPush,  // ArrayPushStatement
-	ArrayPop,   // ArrayPopStatement
-	Return,     // ExpressionStatement
-	Expression, // ExpressionStatement
+	If,                 // IfStatement
+	While,              // WhileStatement
+	For,                // ForStatement
+	GuardedLoop,        // GuardedLoopStatement
+	Assignment,         // AssignmentStatement
+	ArrayWrite,         // ArrayWriteStatement
+	InBoundsArrayWrite, // ArrayWriteStatement (index proven in bounds by a loop guard)
+	ArrayPush,          // ArrayPushStatement
+	ArrayPop,           // ArrayPopStatement
+	Return,             // ExpressionStatement
+	Expression,         // ExpressionStatement
+	Kernel,             // KernelStatement
+	Switch,             // SwitchStatement
+	Fused,              // FusedStatement
+};
+
+// Loop idioms run natively, `i` is the loop counter.
+enum class KernelTag {
+	Fill,  // push ARRAY VALUE
+	Store, // = @ ARRAY i VALUE
+	Copy,  // = @ ARRAY i @ SOURCE i
+	Sum,   // = ACCUMULATOR + ACCUMULATOR @ SOURCE i
+	Min,   // if < @ SOURCE i ACCUMULATOR = ACCUMULATOR @ SOURCE i end
+	Max,   // if > @ SOURCE i ACCUMULATOR = ACCUMULATOR @ SOURCE i end
+};
+
+// Statement shapes common in hot loops, run by the tree walker as one operation. OPERAND is a variable or a number.
+enum class FusedTag {
+	AddConstant,   // = VARIABLE + VARIABLE NUMBER, or - VARIABLE NUMBER
+	CompareLoop,   // while COMPARISON VARIABLE OPERAND
+	ModuloTest,    // if COMPARISON % VARIABLE OPERAND NUMBER, the first condition of the chain
+	StoreConstant, // = @ ARRAY VARIABLE NUMBER
 };
 
 struct Statement;
+struct FunctionCode;
+struct JitCode;
+struct Scope;
+class Value;
 
 // --- EXPRESSIONS -------------------------------------------------------------
 
@@ -42,6 +74,7 @@ struct Expression {
 	ExpressionTag tag;
 	CodePos pos;
 	std::unique_ptr<CommentToken> attachedComment;
+	bool commentUnused = false; // set by the optimizer when the comment of the value can't be observed
 
 	Expression(const ExpressionTag tag, const CodePos pos, std::unique_ptr<CommentToken> attachedComment) : tag{tag}, pos{pos}, attachedComment{std::move(attachedComment)} {}
 	virtual ~Expression() = default;
@@ -56,12 +89,23 @@ struct NumberLiteral : public Expression {
 struct FunctionLiteral : public Expression {
 	std::shared_ptr<std::vector<std::string>> args;
 	std::shared_ptr<std::vector<std::unique_ptr<Statement>>> statements;
+	std::shared_ptr<FunctionCode> code; // created by the interpreter on first evaluation
 
 	FunctionLiteral(std::shared_ptr<std::vector<std::string>> args, std::shared_ptr<std::vector<std::unique_ptr<Statement>>> statements, const CodePos pos, std::unique_ptr<CommentToken> attachedComment) : Expression{ExpressionTag::FunctionLiteral, pos, std::move(attachedComment)}, args{std::move(args)}, statements{std::move(statements)} {}
 };
 
+// Binding the tree walker last found a name in. While Scope::bindingVersion stays `version`, a lookup finds it again if
+// it starts in `scope` when `local` is set, otherwise if it starts in a scope without the name whose parent is `scope`.
+struct LookupCache {
+	const Scope* scope = nullptr;
+	bool local = false;
+	uint64_t version = 0;
+	Value* binding = nullptr; // null if nothing is cached
+};
+
 struct Identifier : public Expression {
 	std::string name;
+	mutable LookupCache cache;
 
 	Identifier(std::string name, const CodePos pos, std::unique_ptr<CommentToken> attachedComment) : Expression{ExpressionTag::Identifier, pos, std::move(attachedComment)}, name{std::move(name)} {}
 };
@@ -73,10 +117,18 @@ struct UnaryOperation : public Expression {
 	UnaryOperation(const TokenTag op, std::unique_ptr<Expression> a, const CodePos pos, std::unique_ptr<CommentToken> attachedComment) : Expression{ExpressionTag::Unary, pos, std::move(attachedComment)}, op{op}, a{std::move(a)} {}
 };
 
+// Operands a binary operation got when the tree walker ran it, which specializes the operation to them.
+enum class Quickening {
+	Unseen,  // not run yet
+	Plain,   // numbers or bools without comments, which the operation computes on as raw C++ values
+	Generic, // other operands, or a guard failed, so the operation runs on values
+};
+
 struct BinaryOperation : public Expression {
 	TokenTag op;
 	std::unique_ptr<Expression> a;
 	std::unique_ptr<Expression> b;
+	Quickening quickening = Quickening::Unseen;
 
 	BinaryOperation(const TokenTag op, std::unique_ptr<Expression> a, std::unique_ptr<Expression> b, const CodePos pos, std::unique_ptr<CommentToken> attachedComment) : Expression{ExpressionTag::Binary, pos, std::move(attachedComment)}, op{op}, a{std::move(a)}, b{std::move(b)} {}
 };
@@ -90,6 +142,7 @@ struct ArrayLiteral : public Expression {
 struct Call : public Expression {
 	std::unique_ptr<Expression> function;
 	std::vector<std::unique_ptr<Expression>> values;
+	mutable std::shared_ptr<std::vector<std::string>> checkedArgs; // arguments of the function last called here
 
 	Call(std::unique_ptr<Expression> function, std::vector<std::unique_ptr<Expression>> values, const CodePos pos, std::unique_ptr<CommentToken> attachedComment) : Expression{ExpressionTag::Call, pos, std::move(attachedComment)}, function{std::move(function)}, values{std::move(values)} {}
 };
@@ -122,13 +175,92 @@ struct IfStatement : public Statement {
 	IfStatement(std::vector<ConditionBlock> elifChain, std::vector<std::unique_ptr<Statement>> elseBlock, const CodePos pos, std::unique_ptr<CommentToken> attachedComment) : Statement{StatementTag::If, pos, std::move(attachedComment)}, elifChain{std::move(elifChain)}, elseBlock{std::move(elseBlock)} {}
 };
 
+// Iterations of a loop counted by the tree walker, which promotes the loop once they reach a threshold. A hot loop runs
+// as machine code with --jit where the JIT can compile it, otherwise it runs a fused copy of its body.
+struct LoopTier {
+	size_t iterations = 0;
+	bool hot = false;
+	std::vector<std::unique_ptr<Statement>> body; // fused copy of the loop body, empty if the loop runs its own
+};
+
 struct WhileStatement : public Statement {
 	std::unique_ptr<Expression> condition;
 	std::vector<std::unique_ptr<Statement>> statements;
+	mutable std::shared_ptr<JitCode> jit; // machine code, compiled when the loop gets hot with --jit
+	mutable LoopTier tier;
 
 	WhileStatement(std::unique_ptr<Expression> condition, std::vector<std::unique_ptr<Statement>> statements, const CodePos pos, std::unique_ptr<CommentToken> attachedComment) : Statement{StatementTag::While, pos, std::move(attachedComment)}, condition{std::move(condition)}, statements{std::move(statements)} {}
 };
 
+struct ForStatement : public Statement {
+	std::string counter;
+	std::unique_ptr<Expression> start;
+	std::unique_ptr<Expression> end;
+	std::unique_ptr<Expression> step; // null if not given (step 1)
+	bool inclusive;                   // only set for rewritten while loops
+	std::vector<std::unique_ptr<Statement>> statements;
+	std::vector<std::unique_ptr<Statement>> fallback; // original while loop, when rewritten by the optimizer
+	mutable std::shared_ptr<JitCode> jit;              // machine code, compiled when the loop gets hot with --jit
+	mutable LoopTier tier;
+
+	ForStatement(std::string counter, std::unique_ptr<Expression> start, std::unique_ptr<Expression> end, std::unique_ptr<Expression> step, const bool inclusive, std::vector<std::unique_ptr<Statement>> statements, std::vector<std::unique_ptr<Statement>> fallback, const CodePos pos, std::unique_ptr<CommentToken> attachedComment) : Statement{StatementTag::For, pos, std::move(attachedComment)}, counter{std::move(counter)}, start{std::move(start)}, end{std::move(end)}, step{std::move(step)}, inclusive{inclusive}, statements{std::move(statements)}, fallback{std::move(fallback)} {}
+};
+
+// Loop versioned by the optimizer. Array accesses in `fast` indexed by `counter` skip bounds checks, which is valid
+// when the guard holds on loop entry: counter and step are non-negative numbers and every array in `arrays` is longer
+// than the limit. Otherwise the original loop in `fallback` runs. Both versions are a single loop statement.
+struct GuardedLoopStatement : public Statement {
+	std::string counter;
+	std::unique_ptr<Expression> step;
+	std::unique_ptr<Expression> limit; // null if the loop runs up to the length of the only array in `arrays`
+	bool inclusive;
+	std::vector<std::string> arrays;
+	std::vector<std::unique_ptr<Statement>> fast;
+	std::vector<std::unique_ptr<Statement>> fallback;
+
+	GuardedLoopStatement(std::string counter, std::unique_ptr<Expression> step, std::unique_ptr<Expression> limit, const bool inclusive, std::vector<std::string> arrays, std::vector<std::unique_ptr<Statement>> fast, std::vector<std::unique_ptr<Statement>> fallback, const CodePos pos) : Statement{StatementTag::GuardedLoop, pos, nullptr}, counter{std::move(counter)}, step{std::move(step)}, limit{std::move(limit)}, inclusive{inclusive}, arrays{std::move(arrays)}, fast{std::move(fast)}, fallback{std::move(fallback)} {}
+};
+
+// For loop recognized by the optimizer as one of the idioms in KernelTag. The original ForStatement in `loop` runs
+// instead whenever the kernel couldn't do exactly the same (values aren't numbers, an index is out of bounds...).
+struct KernelStatement : public Statement {
+	KernelTag kernel;
+	std::string array;                 // written array (Fill, Store, Copy)
+	std::string source;                // read array (Copy, Sum, Min, Max)
+	std::string accumulator;           // Sum, Min, Max
+	std::unique_ptr<Expression> value; // Fill, Store, null if the value is the counter
+	std::vector<std::unique_ptr<Statement>> loop;
+
+	KernelStatement(const KernelTag kernel, std::string array, std::string source, std::string accumulator, std::unique_ptr<Expression> value, std::vector<std::unique_ptr<Statement>> loop, const CodePos pos) : Statement{StatementTag::Kernel, pos, nullptr}, kernel{kernel}, array{std::move(array)}, source{std::move(source)}, accumulator{std::move(accumulator)}, value{std::move(value)}, loop{std::move(loop)} {}
+};
+
+// If statement whose conditions all are `== VARIABLE INTEGER` with the same variable, recognized by the optimizer. The
+// arm to run is looked up by the variable's value, arm elifChain.size() is the else block. The original IfStatement in
+// `chain` runs instead when the variable isn't a number, so errors come from the same condition.
+struct SwitchStatement : public Statement {
+	std::string variable;
+	double first;                           // value of table[0]
+	std::vector<size_t> table;              // arm of each integer from `first`, empty if values are too sparse
+	std::unordered_map<double, size_t> arms; // arm of each value when `table` is empty
+	std::vector<std::unique_ptr<Statement>> chain;
+
+	SwitchStatement(std::string variable, const double first, std::vector<size_t> table, std::unordered_map<double, size_t> arms, std::vector<std::unique_ptr<Statement>> chain, const CodePos pos) : Statement{StatementTag::Switch, pos, nullptr}, variable{std::move(variable)}, first{first}, table{std::move(table)}, arms{std::move(arms)}, chain{std::move(chain)} {}
+};
+
+// Statement of a shape in FusedTag, recognized by the optimizer for the tree walker. The original statement in
+// `original` runs instead when a variable doesn't hold a number, so errors come from it.
+struct FusedStatement : public Statement {
+	FusedTag fused;
+	TokenTag op;          // comparison (CompareLoop, ModuloTest)
+	std::string variable; // assigned, compared or divided variable, the array for StoreConstant
+	std::string operand;  // second operand, empty if it's `number`, the index for StoreConstant
+	double number;        // second operand, the number added for AddConstant
+	double constant;      // number compared with (ModuloTest) or stored (StoreConstant)
+	std::vector<std::unique_ptr<Statement>> original;
+
+	FusedStatement(const FusedTag fused, const TokenTag op, std::string variable, std::string operand, const double number, const double constant, std::vector<std::unique_ptr<Statement>> original, const CodePos pos) : Statement{StatementTag::Fused, pos, nullptr}, fused{fused}, op{op}, variable{std::move(variable)}, operand{std::move(operand)}, number{number}, constant{constant}, original{std::move(original)} {}
+};
+
 struct AssignmentStatement : public Statement {
 	std::string name;
 	std::unique_ptr<Expression> value;
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <utility>
+
+#if defined(__SANITIZE_ADDRESS__)
+#define RJL_NO_POOL // blocks reused by the pool would hide uses after free from AddressSanitizer
+#endif
+
+// Memory for small runtime objects, carved out of chunks of its own. Freed blocks are kept in a free list of their size
+// class and handed out again, so the scopes, comments and functions calls create and drop all the time don't go
+// through malloc. Each thread has chunks and lists of its own, a block freed on another thread than the one allocating
+// it joins that thread's lists. Chunks are never given back, memory freed to the pool stays there for objects of the
+// same size class.
+struct Pool {
+	static constexpr size_t GRANULARITY = 16; // block sizes are multiples of it, which also aligns the blocks
+	static constexpr size_t CLASSES = 16;     // blocks up to CLASSES * GRANULARITY bytes are pooled
+	static constexpr size_t CHUNK_SIZE = 64 << 10;
+#ifdef RJL_NO_POOL
+	static constexpr size_t MAX_POOLED_SIZE = 0;
+#else
+	static constexpr size_t MAX_POOLED_SIZE = CLASSES * GRANULARITY;
+#endif
+
+	struct Stats {
+		size_t allocations; // blocks handed out
+		size_t reused;      // of those, taken from a free list
+		size_t chunks;      // allocated from malloc
+	};
+
+	struct FreeBlock {
+		FreeBlock* next;
+	};
+
+	// Free lists and unused part of the last chunk of a thread.
+	struct Lists {
+		FreeBlock* free[CLASSES];
+		char* next;
+		char* end;
+	};
+
+	static inline thread_local Stats stats;
+
+	static void* Allocate(const size_t size)
+	{
+		++stats.allocations;
+		if (size > MAX_POOLED_SIZE) return ::operator new(size);
+		const size_t sizeClass = (size - 1) / GRANULARITY;
+		if (FreeBlock* const block = lists.free[sizeClass])
+		{
+			lists.free[sizeClass] = block->next;
+			++stats.reused;
+			return block;
+		}
+
+		const size_t blockSize = (sizeClass + 1) * GRANULARITY;
+		if (static_cast<size_t>(lists.end - lists.next) < blockSize)
+		{
+			// NOTE The rest of the last chunk is lost, it's smaller than the largest block.
+			lists.next = static_cast<char*>(::operator new(CHUNK_SIZE));
+			lists.end = lists.next + CHUNK_SIZE;
+			++stats.chunks;
+		}
+		void* const block = lists.next;
+		lists.next += blockSize;
+		return block;
+	}
+
+	static void Free(void* const block, const size_t size)
+	{
+		if (size > MAX_POOLED_SIZE)
+		{
+			::operator delete(block);
+			return;
+		}
+		const size_t sizeClass = (size - 1) / GRANULARITY;
+		lists.free[sizeClass] = new (block) FreeBlock{lists.free[sizeClass]};
+	}
+
+	// Takes the lists of this thread, so another thread can go on with them once it ends instead of losing the memory.
+	static Lists Take() { return std::exchange(lists, Lists{}); }
+
+	// Replaces the lists of this thread, which have to be empty, with `other`.
+	static void Adopt(const Lists& other) { lists = other; }
+
+private:
+	static inline thread_local Lists lists;
+};
@@ -0,0 +1,433 @@
+#pragma once
+
+#include "Parser.h"
+#include "Pool.h"
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+enum class TypeTag {
+	Void,
+	Bool,
+	Number,
+	Array,    // refers to an Array
+	Function, // refers to a Function
+};
+
+// Doubles hold every integer of at most this magnitude exactly.
+constexpr double MAX_EXACT_INTEGER = 9007199254740992.0;
+
+struct Scope;
+struct Function;
+struct Chunk;
+struct CompiledBody;
+struct LaneCode;
+
+// Sets `out` to `value` if it's an integer of at most MAX_EXACT_INTEGER in magnitude. Returns false otherwise.
+inline bool TryGetInteger(const double value, int64_t& out)
+{
+	if (!(value >= -MAX_EXACT_INTEGER && value <= MAX_EXACT_INTEGER)) return false;
+	out = static_cast<int64_t>(value);
+	return static_cast<double>(out) == value;
+}
+
+// Result of the % operator, `a` modulo `b` with the sign of `b`. Integer operands, which most are, take an integer
+// division instead of two calls to fmod.
+inline double Modulo(const double a, const double b)
+{
+	int64_t x;
+	int64_t y;
+	// NOTE The sum with `b` is only exact, as it is for doubles, while it's at most MAX_EXACT_INTEGER in magnitude.
+	if (TryGetInteger(a, x) && TryGetInteger(b, y) && y != 0 && std::abs(y) <= static_cast<int64_t>(MAX_EXACT_INTEGER) / 2)
+	{
+		// NOTE fmod gives a zero the sign of the dividend, which is the sum with `b` in the last step.
+		const int64_t result = (x % y + y) % y;
+		return result == 0 && y < 0 ? -0.0 : static_cast<double>(result);
+	}
+	return std::fmod(std::fmod(a, b) + b, b);
+}
+
+// Base of runtime objects shared by the values and Refs referring to them, which count them. Counts aren't atomic, an
+// object can only be used by one thread at a time. Objects are allocated from the Pool, and have to be deleted as what
+// they are for their block to go back to the right size class.
+struct Counted {
+	size_t refs = 0;
+
+	static void* operator new(const size_t size) { return Pool::Allocate(size); }
+	static void operator delete(void* const block, const size_t size) { Pool::Free(block, size); }
+};
+
+// Counted reference to an object of type T, or null.
+template <typename T>
+class Ref {
+public:
+	Ref() = default;
+	Ref(std::nullptr_t) {}
+	Ref(T* const object) : object{object}
+	{
+		if (object) ++object->refs;
+	}
+	Ref(const Ref& other) : Ref{other.object} {}
+	Ref(Ref&& other) noexcept : object{std::exchange(other.object, nullptr)} {}
+	~Ref()
+	{
+		if (object && --object->refs == 0) delete object;
+	}
+
+	Ref& operator=(Ref other) noexcept
+	{
+		std::swap(object, other.object);
+		return *this;
+	}
+
+	T* get() const { return object; }
+	T& operator*() const { return *object; }
+	T* operator->() const { return object; }
+	explicit operator bool() const { return object != nullptr; }
+	bool operator==(const Ref& other) const { return object == other.object; }
+	bool operator!=(const Ref& other) const { return object != other.object; }
+
+	// Gives up the reference without uncounting it. Returns the object.
+	T* Detach() { return std::exchange(object, nullptr); }
+
+private:
+	T* object = nullptr;
+};
+
+template <typename T, typename... Args>
+Ref<T> MakeRef(Args&&... args)
+{
+	return Ref<T>{new T(std::forward<Args>(args)...)};
+}
+
+enum class CollectedTag : uint8_t {
+	Scope,
+	Function,
+	Comment,
+	Upvalue,
+};
+
+// Base of runtime objects that refer to others, so they can end up in reference cycles, which counting never frees. They
+// are linked into a list of all of them that the cycle collector walks.
+struct Collected : public Counted {
+	static inline Collected* first = nullptr;
+	static inline size_t live = 0;    // objects in the list
+	static inline size_t created = 0; // objects created since the last collection
+
+	Collected* previous = nullptr;
+	Collected* next;
+	size_t collectorRefs = 0; // used by the collector
+	CollectedTag tag;
+	bool reachable = false; // used by the collector
+
+	explicit Collected(const CollectedTag tag) : next{first}, tag{tag}
+	{
+		if (first) first->previous = this;
+		first = this;
+		++live;
+		++created;
+	}
+	Collected(const Collected&) = delete;
+	Collected& operator=(const Collected&) = delete;
+	~Collected()
+	{
+		if (previous) previous->next = next;
+		else first = next;
+		if (next) next->previous = previous;
+		--live;
+	}
+};
+
+struct Comment : public Collected {
+	std::unique_ptr<CommentToken> token;
+	Ref<Scope> scope;
+
+	Comment(const CommentToken& token, Ref<Scope> scope) : Collected{CollectedTag::Comment}, token{token.make_clone()}, scope{std::move(scope)} {}
+};
+
+// Elements of an array, shared by the values referring to it.
+struct Array : public Counted {
+	std::vector<double> elements;
+
+	explicit Array(std::vector<double> elements = {}) : elements{std::move(elements)} {}
+};
+
+// Value of an expression or variable, 16 bytes copied around by value. Numbers and bools are stored in it, arrays and
+// functions are counted objects it refers to. The type is kept in the low bits of the pointer to the attached comment,
+// which is null unless there is one.
+class Value {
+public:
+	union {
+		double number;   // if the type is Number
+		bool boolean;    // if the type is Bool
+		Counted* object; // the Array or Function if the type is one, counted by the value
+		uint64_t bits;
+	};
+
+	Value() : bits{0} {}
+	explicit Value(const double number, Ref<Comment> comment = nullptr) : number{number}, tagged{Tag(TypeTag::Number, comment.Detach())} {}
+	explicit Value(const bool boolean, Ref<Comment> comment = nullptr) : bits{boolean}, tagged{Tag(TypeTag::Bool, comment.Detach())} {}
+	explicit Value(Ref<Array> array, Ref<Comment> comment = nullptr) : object{array.Detach()}, tagged{Tag(TypeTag::Array, comment.Detach())} {}
+	explicit Value(Ref<Function> function, Ref<Comment> comment = nullptr);
+	// NOTE Pointers would convert to bool otherwise.
+	template <typename T>
+	explicit Value(T*, Ref<Comment> = nullptr) = delete;
+	Value(const Value& other) : bits{other.bits}, tagged{other.tagged} { Retain(); }
+	Value(Value&& other) noexcept : bits{other.bits}, tagged{std::exchange(other.tagged, 0)} {}
+	~Value() { Release(); }
+
+	// NOTE The old value is released last, it could own the scope `other` is bound in.
+	Value& operator=(Value other) noexcept
+	{
+		std::swap(bits, other.bits);
+		std::swap(tagged, other.tagged);
+		return *this;
+	}
+
+	TypeTag Type() const { return static_cast<TypeTag>(tagged & TYPE_MASK); }
+	Comment* GetComment() const { return reinterpret_cast<Comment*>(tagged & ~TYPE_MASK); }
+	void SetComment(Ref<Comment> comment)
+	{
+		Comment* const old = GetComment();
+		tagged = Tag(Type(), comment.Detach());
+		if (old && --old->refs == 0) delete old;
+	}
+
+	std::vector<double>& GetArray() const { return static_cast<Array*>(object)->elements; }
+	Ref<Array> GetArrayRef() const { return static_cast<Array*>(object); }
+	Function& GetFunction() const;
+	Ref<Function> GetFunctionRef() const;
+
+private:
+	static constexpr uintptr_t TYPE_MASK = 7;
+
+	uintptr_t tagged = 0;
+
+	static uintptr_t Tag(const TypeTag type, Comment* const comment) { return reinterpret_cast<uintptr_t>(comment) | static_cast<uintptr_t>(type); }
+	void Retain() const;
+	void Release();
+};
+
+static_assert(sizeof(Value) == 16, "Values are two words");
+static_assert(alignof(Comment) >= 8, "Types fit in the low bits of comment pointers");
+
+// Value of a captured variable that can't change anymore, replacing an Identifier in closure specialized code.
+struct Constant : public Expression {
+	Value value;
+
+	Constant(Value value, const CodePos pos, std::unique_ptr<CommentToken> attachedComment) : Expression{ExpressionTag::Constant, pos, std::move(attachedComment)}, value{std::move(value)} {}
+};
+
+// Body of a function specialized for one combination of argument types. Statements are null when the specialization
+// couldn't prove anything and the generic body is used instead.
+struct TypeSpecialization {
+	uint64_t signature;
+	std::shared_ptr<std::vector<std::unique_ptr<Statement>>> statements;
+
+	TypeSpecialization(const uint64_t signature, std::shared_ptr<std::vector<std::unique_ptr<Statement>>> statements) : signature{signature}, statements{std::move(statements)} {}
+};
+
+enum class Purity {
+	Unknown,
+	Pure,    // can't print, mutate arrays or create functions
+	Impure,
+};
+
+enum class Escape {
+	Unknown,
+	Captured, // function literals or comments in the body can keep the call's scope alive
+	Local,    // the call's scope is dropped on return, so its frame can be reused
+};
+
+// Code of a function literal, shared by every function value created from it.
+struct FunctionCode {
+	std::shared_ptr<std::vector<std::unique_ptr<Statement>>> statements;
+	size_t calls = 0; // calls run by the tree walker until the code got hot
+	bool hot = false; // set after enough calls, hot code is fused, specialized and compiled by the JIT
+	std::shared_ptr<std::vector<std::unique_ptr<Statement>>> fused; // fused copy of the body, null if not fused
+	std::vector<TypeSpecialization> specializations;
+	Purity purity = Purity::Unknown;
+	std::vector<std::string> freeVariables; // names read from the closure, set when purity is analyzed
+	Escape escape = Escape::Unknown;
+	std::shared_ptr<Chunk> chunk; // bytecode of the body, compiled on the first call run by the VM
+	std::vector<std::string> upvalues; // names the VM captures from the frame creating the function, in order
+	std::shared_ptr<CompiledBody> compiled; // closures of the body, compiled on the first call run by the closure engine
+	std::shared_ptr<JitCode> jit; // machine code of the body, compiled on the first hot call with --jit
+	std::shared_ptr<LaneCode> lanes; // body compiled to run in SIMD lanes, compiled on the first map operation
+
+	explicit FunctionCode(std::shared_ptr<std::vector<std::unique_ptr<Statement>>> statements) : statements{std::move(statements)} {}
+};
+
+struct MemoKeyHash {
+	size_t operator()(const std::vector<uint64_t>& key) const
+	{
+		uint64_t hash = 14695981039346656037u;
+		for (const uint64_t word : key) hash = (hash ^ word) * 1099511628211u;
+		return static_cast<size_t>(hash ^ (hash >> 32));
+	}
+};
+
+// Results of calls to a pure function keyed by argument types and values. They stay valid while free variables of the
+// function, and of functions those refer to, keep the values in `freeVariables`.
+struct MemoTable {
+	struct FreeVariable {
+		Ref<Scope> scope; // closure the name is read from
+		std::string name;
+		Value value; // void if unbound
+
+		FreeVariable(Ref<Scope> scope, std::string name, Value value) : scope{std::move(scope)}, name{std::move(name)}, value{std::move(value)} {}
+	};
+
+	std::vector<FreeVariable> freeVariables;
+	bool valid = false;    // false if some free variable can't be tracked, e.g. an array
+	bool disabled = false; // set when too few calls hit, so memoizing costs more than it saves
+	uint64_t epoch = 0;    // when the free variables were last checked
+	size_t hits = 0;
+	size_t misses = 0;
+	std::unordered_map<std::vector<uint64_t>, Value, MemoKeyHash> results;
+};
+
+struct Function : public Collected {
+	std::shared_ptr<std::vector<std::string>> args;
+	std::shared_ptr<FunctionCode> code;
+	Ref<Scope> closure;
+	std::shared_ptr<FunctionCode> closureCode; // code with captured constants baked in, null if not specialized
+	std::unique_ptr<MemoTable> memo;           // null until a call is memoized
+	size_t calls = 0;
+
+	Function(std::shared_ptr<std::vector<std::string>> args, std::shared_ptr<FunctionCode> code, Ref<Scope> closure);
+};
+
+// TODO NOTE Should we attach comments to function/array values or references?
+inline Value::Value(Ref<Function> function, Ref<Comment> comment) : object{function.Detach()}, tagged{Tag(TypeTag::Function, comment.Detach())} {}
+
+inline Function& Value::GetFunction() const { return *static_cast<Function*>(object); }
+inline Ref<Function> Value::GetFunctionRef() const { return static_cast<Function*>(object); }
+
+// Returns false for the value of a VM slot whose name isn't bound. Such slots hold voids with zero bits, an argument
+// bound to void has them set.
+inline bool IsBoundSlot(const Value& value)
+{
+	return value.Type() != TypeTag::Void || value.bits != 0;
+}
+
+// Variable of a VM call frame captured by a function or comment created in the frame. It refers to the frame's slot
+// while the call runs and holds the slot's last value once the call returned.
+struct Upvalue : public Collected {
+	std::string name;
+	std::vector<Value>* stack; // registers of the VM running the call, null once closed
+	size_t slot;
+	Value closed;
+
+	Upvalue(std::string name, std::vector<Value>* const stack, const size_t slot) : Collected{CollectedTag::Upvalue}, name{std::move(name)}, stack{stack}, slot{slot} {}
+
+	Value& Get() { return stack ? (*stack)[slot] : closed; }
+	bool IsBound() { return IsBoundSlot(Get()); }
+};
+
+struct Scope : public Collected {
+	// Changes when a name is bound in or unbound from a captured scope, or a captured scope is destroyed. Scopes are only
+	// parents of others once captured, so lookups cached by LookupCache stay valid while it's the same.
+	static inline uint64_t bindingVersion = 0;
+
+	std::unordered_map<std::string, Value> bindings;
+	std::vector<Ref<Upvalue>> upvalues; // variables of the VM frame creating the scope, found after `bindings`
+	Ref<Scope> parent_scope;
+	bool frozen = false;   // set when the call owning the scope returns, its bindings can't change after that
+	bool captured = false; // set when a function closes over the scope
+
+	Scope() : Collected{CollectedTag::Scope} {}
+	Scope(const Scope&) = delete;
+	Scope& operator=(const Scope&) = delete;
+	~Scope()
+	{
+		if (captured) ++bindingVersion;
+	}
+
+	bool TryGetValue(const std::string& name, Value*& out)
+	{
+		out = nullptr;
+
+		auto it = bindings.find(name);
+		if (it != bindings.end())
+		{
+			out = &it->second;
+			return true;
+		}
+		for (const Ref<Upvalue>& upvalue : upvalues)
+		{
+			if (upvalue->name != name) continue;
+			if (!upvalue->IsBound()) break;
+			out = &upvalue->Get();
+			return true;
+		}
+		return parent_scope ? parent_scope->TryGetValue(name, out) : false;
+	}
+
+	void Void(const std::string& name)
+	{
+		auto it = bindings.find(name);
+		if (it != bindings.end())
+		{
+			bindings.erase(it);
+			if (captured) ++bindingVersion;
+		}
+	}
+
+	// Returns the binding of `name` in this scope, which is void if it's new.
+	Value& Bind(const std::string& name)
+	{
+		auto [it, inserted] = bindings.try_emplace(name);
+		if (inserted && captured) ++bindingVersion;
+		return it->second;
+	}
+
+	void SetValue(const std::string& name, Value value)
+	{
+		Bind(name) = std::move(value);
+	}
+
+	// Same as SetValue with a number without comment.
+	void SetNumber(const std::string& name, const double value)
+	{
+		Bind(name) = Value{value};
+	}
+
+	// Adds `value` to the number without comment bound to `name` in this scope. Returns false if there is none.
+	bool TryAddNumber(const std::string& name, const double value)
+	{
+		auto it = bindings.find(name);
+		if (it == bindings.end() || it->second.Type() != TypeTag::Number || it->second.GetComment()) return false;
+		it->second.number += value;
+		return true;
+	}
+};
+
+// NOTE Deleting a function or comment can delete the scope it refers to, so these follow Scope.
+inline void Value::Retain() const
+{
+	// NOTE Voids, bools and numbers without comment are the only values with a tag this small.
+	if (tagged <= static_cast<uintptr_t>(TypeTag::Number)) return;
+	if (Type() == TypeTag::Array || Type() == TypeTag::Function) ++object->refs;
+	if (Comment* const comment = GetComment()) ++comment->refs;
+}
+
+inline void Value::Release()
+{
+	if (tagged <= static_cast<uintptr_t>(TypeTag::Number)) return;
+	if (Type() == TypeTag::Array && --object->refs == 0) delete static_cast<Array*>(object);
+	else if (Type() == TypeTag::Function && --object->refs == 0) delete static_cast<Function*>(object);
+	Comment* const comment = GetComment();
+	if (comment && --comment->refs == 0) delete comment;
+}
+
+inline Function::Function(std::shared_ptr<std::vector<std::string>> args, std::shared_ptr<FunctionCode> code, Ref<Scope> closure) : Collected{CollectedTag::Function}, args{std::move(args)}, code{std::move(code)}, closure{std::move(closure)}
+{
+	this->closure->captured = true;
+}
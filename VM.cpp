@@ -0,0 +1,1295 @@
+#include "VM.h"
+
+#include "Common.h"
+#include "Interpreter.h"
+
+#include <algorithm>
+#include <initializer_list>
+#include <unordered_set>
+#include <utility>
+
+// Register numbers are 16 bits, only expressions nested this deep run out of them.
+constexpr size_t MAX_REGISTERS = 65536;
+
+using Statements = std::vector<std::unique_ptr<Statement>>;
+using NameSet = std::unordered_set<std::string>;
+
+// State of a calling function while the function it called runs.
+struct Frame {
+	Chunk* chunk;
+	size_t pc;
+	size_t base;
+	const Ref<Scope>* scope; // closure of the calling function, kept alive by its value
+	uint16_t result; // register receiving the returned value, the callee's frame starts right above it
+};
+
+[[nodiscard]] static Error CompileStatements(Chunk& chunk, Statements& statements, size_t base);
+[[nodiscard]] static Error CompileIf(Chunk& chunk, IfStatement& ifStatement, size_t base, std::vector<uint32_t>& arms);
+[[nodiscard]] static Error CompileExpression(Chunk& chunk, Expression& expression, size_t target);
+[[nodiscard]] static Error UseRegister(Chunk& chunk, size_t target, CodePos pos);
+static size_t Emit(Chunk& chunk, Opcode op, size_t a, size_t b, size_t c, std::initializer_list<CodePos> positions = {});
+static void AttachComment(Chunk& chunk, const Expression& expression, size_t target);
+static void AttachComment(Chunk& chunk, const CommentToken& comment, size_t target);
+static void PatchJump(Chunk& chunk, size_t jump);
+static size_t AddVariable(Chunk& chunk, const std::string& name);
+static size_t AddCaptures(Chunk& chunk, const NameSet& names);
+static void CollectBoundNames(const Statements& statements, std::vector<std::string>& slots);
+static void CollectNames(const Statements& statements, NameSet& names);
+static void CollectNames(const Expression& expression, NameSet& names);
+static void CollectNames(const CommentToken* comment, NameSet& names);
+static Opcode GetBinaryOpcode(TokenTag op);
+static bool CanFail(const Expression& expression);
+[[nodiscard]] static Error CompileBody(FunctionCode& code, const std::vector<std::string>& args);
+[[nodiscard]] static Error Run(Chunk& topChunk, const Ref<Scope>& topScope, std::vector<Value> registers, bool& returned, Value& returnValue);
+[[nodiscard]] static Error Execute(Chunk& topChunk, const Ref<Scope>& topScope, std::vector<Value>& registers, std::vector<Ref<Upvalue>>& upvalues, bool& returned, Value& returnValue);
+[[nodiscard]] static Error CallFunction(const Function& function, double arg, Value& out);
+static Value* FindVariable(const Variable& variable, Value* regs, Scope& scope);
+static void BindNumber(const Variable& variable, Value* regs, Scope& scope, double value);
+static Ref<Scope> CaptureScope(const Chunk& chunk, const std::vector<uint32_t>& captures, const Ref<Scope>& scope, std::vector<Value>& registers, size_t base, std::vector<Ref<Upvalue>>& upvalues);
+static void CloseUpvalues(std::vector<Ref<Upvalue>>& upvalues, size_t base);
+static const char* CheckFirstOperand(Opcode op, const Value& a);
+static Error OperandError(const Chunk& chunk, const Instruction& instruction, bool aValid, const char* aMessage, const char* bMessage);
+static void CombineOperandComments(const Instruction& instruction, const Value& b, Value& out);
+static bool ForLoopRuns(const Instruction& instruction, double counter, double end, double step);
+
+Error RunBytecode(Statements& statements, const Ref<Scope>& scope, bool& returned)
+{
+	Chunk chunk;
+	TRY(CompileStatements(chunk, statements, 0));
+	Emit(chunk, Opcode::End, 0, 0, 0);
+	Value returnValue;
+	return Run(chunk, scope, {}, returned, returnValue);
+}
+
+// --- COMPILER ----------------------------------------------------------------
+
+// Compiles `statements` using registers from `base` up. Statements don't keep values in registers, except loop
+// counters for their bodies.
+[[nodiscard]] static Error CompileStatements(Chunk& chunk, Statements& statements, const size_t base)
+{
+	for (auto& statement : statements)
+	{
+		switch (statement->tag)
+		{
+		case StatementTag::If:
+		{
+			std::vector<uint32_t> arms;
+			TRY(CompileIf(chunk, static_cast<IfStatement&>(*statement), base, arms));
+			break;
+		}
+		case StatementTag::While:
+		{
+			auto& whileStatement = static_cast<WhileStatement&>(*statement);
+			const size_t top = chunk.code.size();
+			TRY(CompileExpression(chunk, *whileStatement.condition, base));
+			const size_t exit = Emit(chunk, Opcode::JumpIfFalse, base, 0, 0, {whileStatement.condition->pos});
+			chunk.code[exit].flags |= INSTRUCTION_LOOP_CONDITION;
+			TRY(CompileStatements(chunk, whileStatement.statements, base));
+			Emit(chunk, Opcode::Jump, 0, top, 0);
+			PatchJump(chunk, exit);
+			break;
+		}
+		case StatementTag::For:
+		{
+			auto& forStatement = static_cast<ForStatement&>(*statement);
+			TRY(CompileExpression(chunk, *forStatement.start, base));
+			TRY(CompileExpression(chunk, *forStatement.end, base + 1));
+			if (forStatement.step) TRY(CompileExpression(chunk, *forStatement.step, base + 2));
+			else
+			{
+				TRY(UseRegister(chunk, base + 2, statement->pos));
+				chunk.numbers.push_back(1.0);
+				Emit(chunk, Opcode::LoadNumber, base + 2, chunk.numbers.size() - 1, 0);
+			}
+
+			// NOTE A rewritten while loop checks its bounds like the tree walker does and runs the original loop unless
+			// they fit.
+			const bool rewritten = !forStatement.fallback.empty();
+			const size_t guard = rewritten ? Emit(chunk, Opcode::ForGuard, base, 0, 0) : 0;
+			const CodePos stepPos = forStatement.step ? forStatement.step->pos : statement->pos;
+			const size_t exit = Emit(chunk, Opcode::ForPrepare, base, 0, 0, {forStatement.start->pos, forStatement.end->pos, stepPos});
+			const size_t counter = AddVariable(chunk, forStatement.counter);
+			const size_t top = Emit(chunk, Opcode::ForBind, base, counter, 0);
+			TRY(CompileStatements(chunk, forStatement.statements, base + 3));
+			const size_t loop = Emit(chunk, Opcode::ForLoop, base, top, counter);
+			if (forStatement.inclusive)
+			{
+				chunk.code[exit].flags |= INSTRUCTION_INCLUSIVE;
+				chunk.code[loop].flags |= INSTRUCTION_INCLUSIVE;
+			}
+			if (rewritten)
+			{
+				const size_t skip = Emit(chunk, Opcode::Jump, 0, 0, 0);
+				PatchJump(chunk, guard);
+				TRY(CompileStatements(chunk, forStatement.fallback, base));
+				PatchJump(chunk, skip);
+			}
+			PatchJump(chunk, exit);
+			break;
+		}
+		case StatementTag::GuardedLoop:
+			TRY(CompileStatements(chunk, static_cast<GuardedLoopStatement&>(*statement).fallback, base));
+			break;
+		case StatementTag::Kernel:
+			TRY(CompileStatements(chunk, static_cast<KernelStatement&>(*statement).loop, base));
+			break;
+		case StatementTag::Fused:
+			TRY(CompileStatements(chunk, static_cast<FusedStatement&>(*statement).original, base));
+			break;
+		case StatementTag::Switch:
+		{
+			// NOTE The if chain runs when the variable isn't a number, Switch jumps to an arm of it otherwise.
+			auto& switchStatement = static_cast<SwitchStatement&>(*statement);
+			const size_t table = chunk.switches.size();
+			chunk.switches.push_back(SwitchTable{&switchStatement, {}});
+			Emit(chunk, Opcode::Switch, 0, table, AddVariable(chunk, switchStatement.variable));
+			std::vector<uint32_t> arms;
+			TRY(CompileIf(chunk, static_cast<IfStatement&>(*switchStatement.chain.front()), base, arms));
+			chunk.switches[table].arms = std::move(arms);
+			break;
+		}
+		case StatementTag::Assignment:
+		{
+			auto& assignment = static_cast<AssignmentStatement&>(*statement);
+			TRY(CompileExpression(chunk, *assignment.value, base));
+			if (assignment.attachedComment) AttachComment(chunk, *assignment.attachedComment, base);
+			const size_t variable = AddVariable(chunk, assignment.name);
+			const uint32_t slot = chunk.variables[variable].slot;
+			if (slot != NO_INDEX) Emit(chunk, Opcode::StoreSlot, base, slot, 0);
+			else Emit(chunk, Opcode::Store, base, variable, 0);
+			break;
+		}
+		case StatementTag::ArrayWrite:
+		case StatementTag::InBoundsArrayWrite:
+		{
+			auto& arrayWrite = static_cast<ArrayWriteStatement&>(*statement);
+			TRY(UseRegister(chunk, base, statement->pos));
+			Emit(chunk, Opcode::LoadArray, base, AddVariable(chunk, arrayWrite.name), 0, {statement->pos});
+			TRY(CompileExpression(chunk, *arrayWrite.index, base + 1));
+			Emit(chunk, Opcode::CheckIndex, base, base + 1, 0, {arrayWrite.index->pos});
+			TRY(CompileExpression(chunk, *arrayWrite.value, base + 2));
+			Emit(chunk, Opcode::WriteArray, base, base + 1, base + 2, {arrayWrite.index->pos, arrayWrite.value->pos});
+			break;
+		}
+		case StatementTag::ArrayPush:
+		{
+			auto& arrayPush = static_cast<ArrayPushStatement&>(*statement);
+			TRY(UseRegister(chunk, base, statement->pos));
+			Emit(chunk, Opcode::LoadArray, base, AddVariable(chunk, arrayPush.name), 0, {statement->pos});
+			TRY(CompileExpression(chunk, *arrayPush.value, base + 1));
+			Emit(chunk, Opcode::Push, base, base + 1, 0, {arrayPush.value->pos});
+			break;
+		}
+		case StatementTag::ArrayPop:
+			Emit(chunk, Opcode::Pop, 0, AddVariable(chunk, static_cast<ArrayPopStatement&>(*statement).name), 0, {statement->pos});
+			break;
+		case StatementTag::Return:
+		case StatementTag::Expression:
+		{
+			auto& expressionStatement = static_cast<ExpressionStatement&>(*statement);
+			TRY(CompileExpression(chunk, *expressionStatement.value, base));
+			if (statement->tag == StatementTag::Expression)
+			{
+				Emit(chunk, Opcode::Print, base, 0, 0);
+				break;
+			}
+			if (statement->attachedComment) AttachComment(chunk, *statement->attachedComment, base);
+			else if (expressionStatement.value->tag == ExpressionTag::Call) chunk.code.back().flags |= INSTRUCTION_TAIL_CALL;
+			Emit(chunk, Opcode::Return, base, 0, 0);
+			break;
+		}
+		}
+	}
+	return Error::None;
+}
+
+// Compiles an if statement, adding the address of the body of each elif and of the else block to `arms`.
+[[nodiscard]] static Error CompileIf(Chunk& chunk, IfStatement& ifStatement, const size_t base, std::vector<uint32_t>& arms)
+{
+	std::vector<size_t> exits;
+	for (auto& elif : ifStatement.elifChain)
+	{
+		TRY(CompileExpression(chunk, *elif.condition, base));
+		const size_t skip = Emit(chunk, Opcode::JumpIfFalse, base, 0, 0, {elif.condition->pos});
+		arms.push_back(static_cast<uint32_t>(chunk.code.size()));
+		TRY(CompileStatements(chunk, elif.statements, base));
+		exits.push_back(Emit(chunk, Opcode::Jump, 0, 0, 0));
+		PatchJump(chunk, skip);
+	}
+	arms.push_back(static_cast<uint32_t>(chunk.code.size()));
+	TRY(CompileStatements(chunk, ifStatement.elseBlock, base));
+	for (const size_t exit : exits) PatchJump(chunk, exit);
+	return Error::None;
+}
+
+// Compiles `expression` to leave its value in register `target`, using registers above it for operands.
+[[nodiscard]] static Error CompileExpression(Chunk& chunk, Expression& expression, const size_t target)
+{
+	TRY(UseRegister(chunk, target, expression.pos));
+
+	switch (expression.tag)
+	{
+	case ExpressionTag::False:
+		Emit(chunk, Opcode::LoadFalse, target, 0, 0);
+		break;
+	case ExpressionTag::True:
+		Emit(chunk, Opcode::LoadTrue, target, 0, 0);
+		break;
+	case ExpressionTag::NumberLiteral:
+		chunk.numbers.push_back(static_cast<const NumberLiteral&>(expression).value);
+		Emit(chunk, Opcode::LoadNumber, target, chunk.numbers.size() - 1, 0);
+		break;
+	case ExpressionTag::ArrayLiteral:
+		Emit(chunk, Opcode::NewArray, target, 0, 0);
+		for (auto& value : static_cast<ArrayLiteral&>(expression).values)
+		{
+			TRY(CompileExpression(chunk, *value, target + 1));
+			Emit(chunk, Opcode::AppendArray, target, target + 1, 0, {value->pos});
+		}
+		break;
+	case ExpressionTag::FunctionLiteral:
+	{
+		// NOTE Every function created from the literal captures the same slots, its code reads them by upvalue index.
+		auto& functionLiteral = static_cast<FunctionLiteral&>(expression);
+		NameSet names;
+		CollectNames(*functionLiteral.statements, names);
+		const size_t captures = AddCaptures(chunk, names);
+		if (!functionLiteral.code) functionLiteral.code = std::make_shared<FunctionCode>(functionLiteral.statements);
+		functionLiteral.code->upvalues.clear();
+		for (const uint32_t slot : chunk.captures[captures]) functionLiteral.code->upvalues.push_back(chunk.slots[slot]);
+		chunk.functions.push_back(&functionLiteral);
+		Emit(chunk, Opcode::NewFunction, target, chunk.functions.size() - 1, captures);
+		break;
+	}
+	case ExpressionTag::Identifier:
+	{
+		const size_t variable = AddVariable(chunk, static_cast<const Identifier&>(expression).name);
+		const uint32_t slot = chunk.variables[variable].slot;
+		if (slot != NO_INDEX) Emit(chunk, Opcode::LoadSlot, target, slot, variable);
+		else Emit(chunk, Opcode::LoadVariable, target, variable, 0);
+		break;
+	}
+	case ExpressionTag::Constant:
+		chunk.constants.push_back(&static_cast<const Constant&>(expression).value);
+		Emit(chunk, Opcode::LoadConstant, target, chunk.constants.size() - 1, 0);
+		break;
+	case ExpressionTag::Unary:
+	{
+		auto& unaryOp = static_cast<UnaryOperation&>(expression);
+		TRY(CompileExpression(chunk, *unaryOp.a, target));
+		switch (unaryOp.op)
+		{
+		case TokenTag::KeyNot: Emit(chunk, Opcode::Not, target, 0, 0, {unaryOp.a->pos}); break;
+		case TokenTag::KeyNeg: Emit(chunk, Opcode::Negate, target, 0, 0, {unaryOp.a->pos}); break;
+		case TokenTag::KeyVoid: Emit(chunk, Opcode::MakeVoid, target, 0, 0); break;
+		case TokenTag::Hash: Emit(chunk, Opcode::Length, target, 0, 0, {unaryOp.a->pos}); break;
+		default: return Error{"Internal error: Unrecognized unary operation.", unaryOp.pos};
+		}
+		break;
+	}
+	case ExpressionTag::Binary:
+	case ExpressionTag::TypedBinary:
+	case ExpressionTag::InBoundsRead:
+	{
+		auto& binaryOp = static_cast<BinaryOperation&>(expression);
+		const uint8_t flags = expression.commentUnused ? INSTRUCTION_COMMENT_UNUSED : 0;
+		TRY(CompileExpression(chunk, *binaryOp.a, target));
+
+		if (binaryOp.op == TokenTag::KeyAnd || binaryOp.op == TokenTag::KeyOr)
+		{
+			// NOTE A short-circuited result keeps the first operand's comment, the expression's comment isn't attached.
+			const bool isAnd = binaryOp.op == TokenTag::KeyAnd;
+			const size_t shortCircuit = Emit(chunk, isAnd ? Opcode::JumpAnd : Opcode::JumpOr, target, 0, 0, {binaryOp.a->pos});
+			TRY(CompileExpression(chunk, *binaryOp.b, target + 1));
+			chunk.code[Emit(chunk, isAnd ? Opcode::And : Opcode::Or, target, target + 1, 0, {binaryOp.b->pos})].flags = flags;
+			AttachComment(chunk, expression, target);
+			PatchJump(chunk, shortCircuit);
+			return Error::None;
+		}
+
+		const Opcode op = GetBinaryOpcode(binaryOp.op);
+		if (op == Opcode::End) return Error{"Internal error: Unrecognized binary operation.", binaryOp.pos};
+
+		// The first operand is checked before the second one runs, unless the second one can't fail or print.
+		if (CanFail(*binaryOp.b)) Emit(chunk, Opcode::CheckOperand, target, 0, static_cast<size_t>(op), {binaryOp.a->pos});
+		TRY(CompileExpression(chunk, *binaryOp.b, target + 1));
+		if (op == Opcode::Map) chunk.code[Emit(chunk, op, target, target + 1, 0, {binaryOp.a->pos, binaryOp.b->pos, binaryOp.pos})].flags = flags;
+		else chunk.code[Emit(chunk, op, target, target + 1, 0, {binaryOp.a->pos, binaryOp.b->pos})].flags = flags;
+		break;
+	}
+	case ExpressionTag::Call:
+	{
+		// NOTE Comments attached to calls aren't attached to their results.
+		auto& call = static_cast<Call&>(expression);
+		const size_t n = call.values.size();
+		TRY(CompileExpression(chunk, *call.function, target));
+		Emit(chunk, Opcode::PrepareCall, target, 0, n, {call.function->pos, call.pos});
+		for (size_t i = 0; i < n; ++i) TRY(CompileExpression(chunk, *call.values[i], target + 1 + i));
+		Emit(chunk, Opcode::Call, target, 0, n);
+		return Error::None;
+	}
+	}
+
+	AttachComment(chunk, expression, target);
+	return Error::None;
+}
+
+[[nodiscard]] static Error UseRegister(Chunk& chunk, const size_t target, const CodePos pos)
+{
+	if (target >= MAX_REGISTERS) return Error{"Expression is nested too deeply.", pos};
+	chunk.registerCount = std::max(chunk.registerCount, target + 1);
+	return Error::None;
+}
+
+static size_t Emit(Chunk& chunk, const Opcode op, const size_t a, const size_t b, const size_t c, const std::initializer_list<CodePos> positions)
+{
+	const auto pos = static_cast<uint32_t>(chunk.positions.size());
+	chunk.positions.insert(chunk.positions.end(), positions);
+	chunk.code.push_back(Instruction{op, 0, static_cast<uint16_t>(a), static_cast<uint32_t>(b), static_cast<uint32_t>(c), pos});
+	return chunk.code.size() - 1;
+}
+
+static void AttachComment(Chunk& chunk, const Expression& expression, const size_t target)
+{
+	if (!expression.attachedComment || expression.commentUnused) return;
+	AttachComment(chunk, *expression.attachedComment, target);
+}
+
+static void AttachComment(Chunk& chunk, const CommentToken& comment, const size_t target)
+{
+	NameSet names;
+	CollectNames(&comment, names);
+	chunk.comments.push_back(&comment);
+	Emit(chunk, Opcode::Attach, target, chunk.comments.size() - 1, AddCaptures(chunk, names));
+}
+
+// Makes the jump at index `jump` go to the next instruction emitted.
+static void PatchJump(Chunk& chunk, const size_t jump)
+{
+	chunk.code[jump].b = static_cast<uint32_t>(chunk.code.size());
+}
+
+static size_t AddVariable(Chunk& chunk, const std::string& name)
+{
+	const auto it = std::find_if(chunk.variables.begin(), chunk.variables.end(), [&](const Variable& variable) { return variable.name == name; });
+	if (it != chunk.variables.end()) return static_cast<size_t>(it - chunk.variables.begin());
+
+	// NOTE Arguments are bound in order, so of two with the same name the last one is read.
+	const auto slot = std::find(chunk.slots.rbegin(), chunk.slots.rend(), name);
+	const auto upvalue = std::find(chunk.upvalues.begin(), chunk.upvalues.end(), name);
+	chunk.variables.emplace_back(name, slot == chunk.slots.rend() ? NO_INDEX : static_cast<uint32_t>(chunk.slots.rend() - slot - 1), upvalue == chunk.upvalues.end() ? NO_INDEX : static_cast<uint32_t>(upvalue - chunk.upvalues.begin()));
+	return chunk.variables.size() - 1;
+}
+
+// Adds the list of slots holding `names` a function or comment captures. Returns its index in `captures`.
+static size_t AddCaptures(Chunk& chunk, const NameSet& names)
+{
+	std::vector<uint32_t> captures;
+	for (size_t i = 0; i < chunk.slots.size(); ++i)
+	{
+		const std::string& name = chunk.slots[i];
+		if (names.count(name) && std::find(chunk.slots.begin() + static_cast<std::ptrdiff_t>(i) + 1, chunk.slots.end(), name) == chunk.slots.end())
+		{
+			captures.push_back(static_cast<uint32_t>(i));
+		}
+	}
+	chunk.captures.push_back(std::move(captures));
+	return chunk.captures.size() - 1;
+}
+
+// Adds the names `statements` assign or count loops with to `slots`, unless they're in it already. Names bound in
+// function literals are theirs.
+static void CollectBoundNames(const Statements& statements, std::vector<std::string>& slots)
+{
+	const auto add = [&](const std::string& name) {
+		if (std::find(slots.begin(), slots.end(), name) == slots.end()) slots.push_back(name);
+	};
+	for (const auto& statement : statements)
+	{
+		switch (statement->tag)
+		{
+		case StatementTag::If:
+		{
+			const auto& ifStatement = static_cast<const IfStatement&>(*statement);
+			for (const auto& elif : ifStatement.elifChain) CollectBoundNames(elif.statements, slots);
+			CollectBoundNames(ifStatement.elseBlock, slots);
+			break;
+		}
+		case StatementTag::While:
+			CollectBoundNames(static_cast<const WhileStatement&>(*statement).statements, slots);
+			break;
+		case StatementTag::For:
+		{
+			const auto& forStatement = static_cast<const ForStatement&>(*statement);
+			add(forStatement.counter);
+			CollectBoundNames(forStatement.statements, slots);
+			CollectBoundNames(forStatement.fallback, slots);
+			break;
+		}
+		case StatementTag::GuardedLoop:
+			CollectBoundNames(static_cast<const GuardedLoopStatement&>(*statement).fallback, slots);
+			break;
+		case StatementTag::Kernel:
+			CollectBoundNames(static_cast<const KernelStatement&>(*statement).loop, slots);
+			break;
+		case StatementTag::Fused:
+			CollectBoundNames(static_cast<const FusedStatement&>(*statement).original, slots);
+			break;
+		case StatementTag::Switch:
+			CollectBoundNames(static_cast<const SwitchStatement&>(*statement).chain, slots);
+			break;
+		case StatementTag::Assignment:
+			add(static_cast<const AssignmentStatement&>(*statement).name);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+// Adds the names `statements` refer to, in code the VM compiles, comments and function literals, to `names`.
+static void CollectNames(const Statements& statements, NameSet& names)
+{
+	for (const auto& statement : statements)
+	{
+		CollectNames(statement->attachedComment.get(), names);
+		switch (statement->tag)
+		{
+		case StatementTag::If:
+		{
+			const auto& ifStatement = static_cast<const IfStatement&>(*statement);
+			for (const auto& elif : ifStatement.elifChain)
+			{
+				CollectNames(*elif.condition, names);
+				CollectNames(elif.statements, names);
+			}
+			CollectNames(ifStatement.elseBlock, names);
+			break;
+		}
+		case StatementTag::While:
+		{
+			const auto& whileStatement = static_cast<const WhileStatement&>(*statement);
+			CollectNames(*whileStatement.condition, names);
+			CollectNames(whileStatement.statements, names);
+			break;
+		}
+		case StatementTag::For:
+		{
+			const auto& forStatement = static_cast<const ForStatement&>(*statement);
+			names.insert(forStatement.counter);
+			CollectNames(*forStatement.start, names);
+			CollectNames(*forStatement.end, names);
+			if (forStatement.step) CollectNames(*forStatement.step, names);
+			CollectNames(forStatement.statements, names);
+			CollectNames(forStatement.fallback, names);
+			break;
+		}
+		case StatementTag::GuardedLoop:
+			CollectNames(static_cast<const GuardedLoopStatement&>(*statement).fallback, names);
+			break;
+		case StatementTag::Kernel:
+			CollectNames(static_cast<const KernelStatement&>(*statement).loop, names);
+			break;
+		case StatementTag::Fused:
+			CollectNames(static_cast<const FusedStatement&>(*statement).original, names);
+			break;
+		case StatementTag::Switch:
+		{
+			const auto& switchStatement = static_cast<const SwitchStatement&>(*statement);
+			names.insert(switchStatement.variable);
+			CollectNames(switchStatement.chain, names);
+			break;
+		}
+		case StatementTag::Assignment:
+		{
+			const auto& assignment = static_cast<const AssignmentStatement&>(*statement);
+			names.insert(assignment.name);
+			CollectNames(*assignment.value, names);
+			break;
+		}
+		case StatementTag::ArrayWrite:
+		case StatementTag::InBoundsArrayWrite:
+		{
+			const auto& arrayWrite = static_cast<const ArrayWriteStatement&>(*statement);
+			names.insert(arrayWrite.name);
+			CollectNames(*arrayWrite.index, names);
+			CollectNames(*arrayWrite.value, names);
+			break;
+		}
+		case StatementTag::ArrayPush:
+		{
+			const auto& arrayPush = static_cast<const ArrayPushStatement&>(*statement);
+			names.insert(arrayPush.name);
+			CollectNames(*arrayPush.value, names);
+			break;
+		}
+		case StatementTag::ArrayPop:
+			names.insert(static_cast<const ArrayPopStatement&>(*statement).name);
+			break;
+		case StatementTag::Return:
+		case StatementTag::Expression:
+			CollectNames(*static_cast<const ExpressionStatement&>(*statement).value, names);
+			break;
+		}
+	}
+}
+
+static void CollectNames(const Expression& expression, NameSet& names)
+{
+	CollectNames(expression.attachedComment.get(), names);
+	switch (expression.tag)
+	{
+	case ExpressionTag::ArrayLiteral:
+		for (const auto& value : static_cast<const ArrayLiteral&>(expression).values) CollectNames(*value, names);
+		break;
+	case ExpressionTag::FunctionLiteral:
+		CollectNames(*static_cast<const FunctionLiteral&>(expression).statements, names);
+		break;
+	case ExpressionTag::Identifier:
+		names.insert(static_cast<const Identifier&>(expression).name);
+		break;
+	case ExpressionTag::Unary:
+		CollectNames(*static_cast<const UnaryOperation&>(expression).a, names);
+		break;
+	case ExpressionTag::Binary:
+	case ExpressionTag::TypedBinary:
+	case ExpressionTag::InBoundsRead:
+	{
+		const auto& binaryOp = static_cast<const BinaryOperation&>(expression);
+		CollectNames(*binaryOp.a, names);
+		CollectNames(*binaryOp.b, names);
+		break;
+	}
+	case ExpressionTag::Call:
+	{
+		const auto& call = static_cast<const Call&>(expression);
+		CollectNames(*call.function, names);
+		for (const auto& value : call.values) CollectNames(*value, names);
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+static void CollectNames(const CommentToken* const comment, NameSet& names)
+{
+	if (!comment) return;
+	for (const auto& node : comment->nodes)
+	{
+		if (node->tag == CommentNodeTag::Identifier) names.insert(static_cast<const CommentIdentifierNode&>(*node).name);
+	}
+}
+
+// Returns Opcode::End for operators without an instruction of their own.
+static Opcode GetBinaryOpcode(const TokenTag op)
+{
+	switch (op)
+	{
+	case TokenTag::Plus: return Opcode::Add;
+	case TokenTag::Minus: return Opcode::Subtract;
+	case TokenTag::Star: return Opcode::Multiply;
+	case TokenTag::Slash: return Opcode::Divide;
+	case TokenTag::Percent: return Opcode::Modulo;
+	case TokenTag::LessThan: return Opcode::Less;
+	case TokenTag::GreaterThan: return Opcode::Greater;
+	case TokenTag::LessEquals: return Opcode::LessEquals;
+	case TokenTag::GreaterEquals: return Opcode::GreaterEquals;
+	case TokenTag::EqualsEquals: return Opcode::Equals;
+	case TokenTag::NotEquals: return Opcode::NotEquals;
+	case TokenTag::At: return Opcode::Read;
+	case TokenTag::KeyMap: return Opcode::Map;
+	case TokenTag::KeyXor: return Opcode::Xor;
+	default: return Opcode::End;
+	}
+}
+
+// Returns false if evaluating `expression` can't report an error or print anything.
+static bool CanFail(const Expression& expression)
+{
+	switch (expression.tag)
+	{
+	case ExpressionTag::False:
+	case ExpressionTag::True:
+	case ExpressionTag::NumberLiteral:
+	case ExpressionTag::FunctionLiteral:
+	case ExpressionTag::Identifier:
+	case ExpressionTag::Constant:
+		return false;
+	default:
+		return true;
+	}
+}
+
+// --- VM ----------------------------------------------------------------------
+
+#if defined(__GNUC__)
+#define RJL_COMPUTED_GOTO
+#endif
+
+#ifdef RJL_COMPUTED_GOTO
+#define TARGET(name) target_##name
+#define DISPATCH() do { instruction = &code[pc++]; goto *dispatchTable[static_cast<size_t>(instruction->op)]; } while (false)
+#else
+#define TARGET(name) case Opcode::name
+#define DISPATCH() goto dispatch
+#endif
+
+#define POS(i) chunk->positions[instruction->pos + (i)]
+
+#ifdef RJL_COMPUTED_GOTO
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic" // labels as values
+#endif
+
+// Runs `topChunk` in `topScope` with its arguments in `registers`.
+[[nodiscard]] static Error Run(Chunk& topChunk, const Ref<Scope>& topScope, std::vector<Value> registers, bool& returned, Value& returnValue)
+{
+	std::vector<Ref<Upvalue>> upvalues;
+	const Error error = Execute(topChunk, topScope, registers, upvalues, returned, returnValue);
+	// NOTE Upvalues of the top frame, or of any frame after an error, refer to registers about to be destroyed.
+	CloseUpvalues(upvalues, 0);
+	return error;
+}
+
+// Upvalues of the running frames, open ones, are kept in `upvalues` in the order of their frames.
+[[nodiscard]] static Error Execute(Chunk& topChunk, const Ref<Scope>& topScope, std::vector<Value>& registers, std::vector<Ref<Upvalue>>& upvalues, bool& returned, Value& returnValue)
+{
+	std::vector<Frame> callers;
+	registers.resize(topChunk.registerCount);
+
+	Chunk* chunk = &topChunk;
+	const Instruction* code = chunk->code.data();
+	size_t pc = 0;
+	size_t base = 0;
+	Value* regs = registers.data();
+	const Ref<Scope>* scope = &topScope;
+	const Instruction* instruction;
+
+#ifdef RJL_COMPUTED_GOTO
+	static const void* const dispatchTable[] = {
+#define RJL_OPCODE_LABEL(name) &&target_##name,
+		RJL_OPCODES(RJL_OPCODE_LABEL)
+#undef RJL_OPCODE_LABEL
+	};
+	DISPATCH();
+#else
+dispatch:
+	instruction = &code[pc++];
+	switch (instruction->op)
+#endif
+	{
+	TARGET(LoadFalse):
+	{
+		regs[instruction->a] = Value(false);
+		DISPATCH();
+	}
+	TARGET(LoadTrue):
+	{
+		regs[instruction->a] = Value(true);
+		DISPATCH();
+	}
+	TARGET(LoadNumber):
+	{
+		regs[instruction->a] = Value(chunk->numbers[instruction->b]);
+		DISPATCH();
+	}
+	TARGET(LoadConstant):
+	{
+		regs[instruction->a] = *chunk->constants[instruction->b];
+		DISPATCH();
+	}
+	TARGET(LoadVariable):
+	{
+		const Value* const value = FindVariable(chunk->variables[instruction->b], regs, **scope);
+		regs[instruction->a] = value ? *value : Value();
+		DISPATCH();
+	}
+	TARGET(LoadSlot):
+	{
+		const Value& slot = regs[instruction->b];
+		if (IsBoundSlot(slot)) regs[instruction->a] = slot;
+		else
+		{
+			const Value* const value = FindVariable(chunk->variables[instruction->c], regs, **scope);
+			regs[instruction->a] = value ? *value : Value();
+		}
+		DISPATCH();
+	}
+	TARGET(NewArray):
+	{
+		regs[instruction->a] = Value(MakeRef<Array>());
+		DISPATCH();
+	}
+	TARGET(AppendArray):
+	{
+		const Value& value = regs[instruction->b];
+		if (value.Type() != TypeTag::Number) return Error{"Array initializer is not a number.", POS(0)};
+		regs[instruction->a].GetArray().push_back(value.number);
+		DISPATCH();
+	}
+	TARGET(NewFunction):
+	{
+		const FunctionLiteral& functionLiteral = *chunk->functions[instruction->b];
+		auto closure = CaptureScope(*chunk, chunk->captures[instruction->c], *scope, registers, base, upvalues);
+		regs[instruction->a] = Value(MakeRef<Function>(functionLiteral.args, functionLiteral.code, std::move(closure)));
+		DISPATCH();
+	}
+	TARGET(Attach):
+	{
+		auto commentScope = CaptureScope(*chunk, chunk->captures[instruction->c], *scope, registers, base, upvalues);
+		regs[instruction->a].SetComment(MakeRef<Comment>(*chunk->comments[instruction->b], std::move(commentScope)));
+		DISPATCH();
+	}
+	TARGET(Not):
+	{
+		Value& value = regs[instruction->a];
+		if (value.Type() != TypeTag::Bool) return Error{"Logical not of non-boolean value.", POS(0)};
+		value.boolean = !value.boolean;
+		DISPATCH();
+	}
+	TARGET(Negate):
+	{
+		Value& value = regs[instruction->a];
+		if (value.Type() != TypeTag::Number) return Error{"Negation of non-number value.", POS(0)};
+		value.number = -value.number;
+		DISPATCH();
+	}
+	TARGET(MakeVoid):
+	{
+		Value& value = regs[instruction->a];
+		Ref<Comment> comment = value.GetComment();
+		value = Value();
+		value.SetComment(std::move(comment));
+		DISPATCH();
+	}
+	TARGET(Length):
+	{
+		Value& value = regs[instruction->a];
+		if (value.Type() != TypeTag::Array) return Error{"Array length operator used on non-array value.", POS(0)};
+		const double length = static_cast<double>(value.GetArray().size());
+		regs[instruction->a] = Value(length, value.GetComment());
+		DISPATCH();
+	}
+	TARGET(CheckOperand):
+	{
+		const char* const message = CheckFirstOperand(static_cast<Opcode>(instruction->c), regs[instruction->a]);
+		if (message) return Error{message, POS(0)};
+		DISPATCH();
+	}
+	TARGET(Add):
+	TARGET(Subtract):
+	TARGET(Multiply):
+	TARGET(Divide):
+	TARGET(Modulo):
+	{
+		Value& a = regs[instruction->a];
+		const Value& b = regs[instruction->b];
+		if (a.Type() != TypeTag::Number || b.Type() != TypeTag::Number)
+		{
+			return OperandError(*chunk, *instruction, a.Type() == TypeTag::Number, "Arithmetic operand is not a number.", "Arithmetic operand is not a number.");
+		}
+
+		double& aValue = a.number;
+		const double bValue = b.number;
+		switch (instruction->op)
+		{
+		case Opcode::Add: aValue += bValue; break;
+		case Opcode::Subtract: aValue -= bValue; break;
+		case Opcode::Multiply: aValue *= bValue; break;
+		case Opcode::Divide: aValue /= bValue; break;
+		default: aValue = Modulo(aValue, bValue); break;
+		}
+		CombineOperandComments(*instruction, b, a);
+		DISPATCH();
+	}
+	TARGET(Less):
+	TARGET(Greater):
+	TARGET(LessEquals):
+	TARGET(GreaterEquals):
+	TARGET(Equals):
+	TARGET(NotEquals):
+	{
+		Value& a = regs[instruction->a];
+		const Value& b = regs[instruction->b];
+		if (a.Type() != TypeTag::Number || b.Type() != TypeTag::Number)
+		{
+			return OperandError(*chunk, *instruction, a.Type() == TypeTag::Number, "Comparison operand is not a number.", "Arithmetic operand is not a number.");
+		}
+
+		const double aValue = a.number;
+		const double bValue = b.number;
+		bool result;
+		switch (instruction->op)
+		{
+		case Opcode::Less: result = aValue < bValue; break;
+		case Opcode::Greater: result = aValue > bValue; break;
+		case Opcode::LessEquals: result = aValue <= bValue; break;
+		case Opcode::GreaterEquals: result = aValue >= bValue; break;
+		case Opcode::Equals: result = aValue == bValue; break;
+		default: result = aValue != bValue; break;
+		}
+		regs[instruction->a] = Value(result, a.GetComment());
+		CombineOperandComments(*instruction, b, regs[instruction->a]);
+		DISPATCH();
+	}
+	TARGET(Read):
+	{
+		Value& a = regs[instruction->a];
+		const Value& b = regs[instruction->b];
+		if (a.Type() != TypeTag::Array || b.Type() != TypeTag::Number)
+		{
+			return OperandError(*chunk, *instruction, a.Type() == TypeTag::Array, "Array read array operand is not an array.", "Array read index operand is not a number.");
+		}
+
+		const std::vector<double>& array = a.GetArray();
+		const size_t index = static_cast<size_t>(b.number);
+		if (index >= array.size())
+		{
+			return Error{Format("Array index %zu out of bounds (array length is %zu).", index, array.size()), POS(1)};
+		}
+
+		regs[instruction->a] = Value(array[index], a.GetComment());
+		CombineOperandComments(*instruction, b, regs[instruction->a]);
+		DISPATCH();
+	}
+	TARGET(Map):
+	{
+		Value& a = regs[instruction->a];
+		const Value& b = regs[instruction->b];
+		if (a.Type() != TypeTag::Function || b.Type() != TypeTag::Array)
+		{
+			return OperandError(*chunk, *instruction, a.Type() == TypeTag::Function, "Map function operand is not a function.", "Map array operand is not an array.");
+		}
+
+		Function& function = a.GetFunction();
+		auto mapped = MakeRef<Array>();
+		TRY(MapArray(function, b.GetArray(), POS(2), [&](const double element, Value& result) {
+			return CallFunction(function, element, result);
+		}, mapped->elements));
+
+		a = Value(std::move(mapped), a.GetComment());
+		CombineOperandComments(*instruction, b, regs[instruction->a]);
+		DISPATCH();
+	}
+	TARGET(Xor):
+	{
+		Value& a = regs[instruction->a];
+		const Value& b = regs[instruction->b];
+		if (a.Type() != TypeTag::Bool || b.Type() != TypeTag::Bool)
+		{
+			return OperandError(*chunk, *instruction, a.Type() == TypeTag::Bool, "Logic operand is not boolean.", "Logic operand is not boolean.");
+		}
+
+		a.boolean = a.boolean != b.boolean;
+		CombineOperandComments(*instruction, b, a);
+		DISPATCH();
+	}
+	TARGET(JumpAnd):
+	{
+		const Value& value = regs[instruction->a];
+		if (value.Type() != TypeTag::Bool) return Error{"Logical operand is not boolean.", POS(0)};
+		if (!value.boolean) pc = instruction->b;
+		DISPATCH();
+	}
+	TARGET(JumpOr):
+	{
+		const Value& value = regs[instruction->a];
+		if (value.Type() != TypeTag::Bool) return Error{"Logic operand is not boolean.", POS(0)};
+		if (value.boolean) pc = instruction->b;
+		DISPATCH();
+	}
+	TARGET(And):
+	TARGET(Or):
+	{
+		// NOTE The first operand decided nothing, so the result is the second one's value.
+		Value& a = regs[instruction->a];
+		const Value& b = regs[instruction->b];
+		if (b.Type() != TypeTag::Bool) return Error{"Logic operand is not boolean.", POS(0)};
+		a.boolean = b.boolean;
+		CombineOperandComments(*instruction, b, a);
+		DISPATCH();
+	}
+	TARGET(Switch):
+	{
+		const SwitchTable& table = chunk->switches[instruction->b];
+		const Value* const value = FindVariable(chunk->variables[instruction->c], regs, **scope);
+		if (value && value->Type() == TypeTag::Number)
+		{
+			pc = table.arms[FindSwitchArm(*table.statement, value->number)];
+		}
+		DISPATCH();
+	}
+	TARGET(Jump):
+	{
+		pc = instruction->b;
+		DISPATCH();
+	}
+	TARGET(JumpIfFalse):
+	{
+		const Value& value = regs[instruction->a];
+		bool condition;
+		if (value.Type() == TypeTag::Bool) condition = value.boolean;
+		else if (value.Type() == TypeTag::Number) condition = value.number != 0.0;
+		else if (instruction->flags & INSTRUCTION_LOOP_CONDITION) return Error{"Loop condition is not a boolean and not a number.", POS(0)};
+		else return Error{"Condition is not a boolean and not a number.", POS(0)};
+		if (!condition) pc = instruction->b;
+		DISPATCH();
+	}
+	TARGET(Store):
+	{
+		Value& value = regs[instruction->a];
+		const std::string& name = chunk->variables[instruction->b].name;
+		if (value.Type() == TypeTag::Void) (*scope)->Void(name);
+		else (*scope)->Bind(name) = std::move(value);
+		DISPATCH();
+	}
+	TARGET(StoreSlot):
+	{
+		Value& value = regs[instruction->a];
+		if (value.Type() == TypeTag::Void) regs[instruction->b] = Value();
+		else regs[instruction->b] = std::move(value);
+		DISPATCH();
+	}
+	TARGET(LoadArray):
+	{
+		const std::string& name = chunk->variables[instruction->b].name;
+		const Value* const value = FindVariable(chunk->variables[instruction->b], regs, **scope);
+		if (!value) return Error{Format("No array named %s.", name.c_str()), POS(0)};
+		if (value->Type() != TypeTag::Array) return Error{Format("%s is not an array.", name.c_str()), POS(0)};
+		regs[instruction->a] = *value;
+		DISPATCH();
+	}
+	TARGET(CheckIndex):
+	{
+		const Value& index = regs[instruction->b];
+		if (index.Type() != TypeTag::Number) return Error{"Index to array is not a number.", POS(0)};
+		const size_t indexValue = static_cast<size_t>(index.number);
+		const std::vector<double>& array = regs[instruction->a].GetArray();
+		if (indexValue >= array.size())
+		{
+			return Error{Format("Array index %zu out of bounds (array length is %zu).", indexValue, array.size()), POS(0)};
+		}
+		DISPATCH();
+	}
+	TARGET(WriteArray):
+	{
+		const Value& value = regs[instruction->c];
+		if (value.Type() != TypeTag::Number) return Error{"Value written to array is not a number.", POS(1)};
+
+		// NOTE Evaluating the value could have shrunk the array since CheckIndex.
+		const size_t index = static_cast<size_t>(regs[instruction->b].number);
+		std::vector<double>& array = regs[instruction->a].GetArray();
+		if (index >= array.size())
+		{
+			return Error{Format("Array index %zu out of bounds (array length is %zu).", index, array.size()), POS(0)};
+		}
+		array[index] = value.number;
+		DISPATCH();
+	}
+	TARGET(Push):
+	{
+		const Value& value = regs[instruction->b];
+		if (value.Type() != TypeTag::Number) return Error{"Value pushed is not a number.", POS(0)};
+		regs[instruction->a].GetArray().push_back(value.number);
+		DISPATCH();
+	}
+	TARGET(Pop):
+	{
+		const std::string& name = chunk->variables[instruction->b].name;
+		const Value* const value = FindVariable(chunk->variables[instruction->b], regs, **scope);
+		if (!value) return Error{Format("No array named %s.", name.c_str()), POS(0)};
+		if (value->Type() != TypeTag::Array) return Error{Format("%s is not an array.", name.c_str()), POS(0)};
+		std::vector<double>& array = value->GetArray();
+		if (array.empty()) return Error{"Pop from an empty array.", POS(0)};
+		array.pop_back();
+		DISPATCH();
+	}
+	TARGET(ForGuard):
+	{
+		const Value& start = regs[instruction->a];
+		const Value& end = regs[instruction->a + 1];
+		const Value& step = regs[instruction->a + 2];
+		if (start.Type() != TypeTag::Number || start.GetComment() || end.Type() != TypeTag::Number || step.Type() != TypeTag::Number || step.GetComment() || !(step.number > 0.0))
+		{
+			pc = instruction->b;
+		}
+		DISPATCH();
+	}
+	TARGET(ForPrepare):
+	{
+		const Value& start = regs[instruction->a];
+		const Value& end = regs[instruction->a + 1];
+		const Value& step = regs[instruction->a + 2];
+		if (start.Type() != TypeTag::Number) return Error{"Loop start is not a number.", POS(0)};
+		if (end.Type() != TypeTag::Number) return Error{"Loop end is not a number.", POS(1)};
+		if (step.Type() != TypeTag::Number) return Error{"Loop step is not a number.", POS(2)};
+		const double stepValue = step.number;
+		if (stepValue == 0.0) return Error{"Loop step is zero.", POS(2)};
+
+		if (!ForLoopRuns(*instruction, start.number, end.number, stepValue)) pc = instruction->b;
+		DISPATCH();
+	}
+	TARGET(ForBind):
+	{
+		BindNumber(chunk->variables[instruction->b], regs, **scope, regs[instruction->a].number);
+		DISPATCH();
+	}
+	TARGET(ForLoop):
+	{
+		double& counter = regs[instruction->a].number;
+		const double end = regs[instruction->a + 1].number;
+		const double step = regs[instruction->a + 2].number;
+		counter += step;
+		if (ForLoopRuns(*instruction, counter, end, step)) pc = instruction->b;
+		else BindNumber(chunk->variables[instruction->c], regs, **scope, counter);
+		DISPATCH();
+	}
+	TARGET(PrepareCall):
+	{
+		const Value& value = regs[instruction->a];
+		if (value.Type() != TypeTag::Function) return Error{"Call on a a non-function value.", POS(0)};
+		const size_t n = value.GetFunction().args->size();
+		if (n != instruction->c)
+		{
+			return Error{Format("Provided %u argument(s) for function that takes %zu.", instruction->c, n), POS(1)};
+		}
+		if (StackExhausted((callers.size() + 1) * sizeof(Frame) + registers.size() * sizeof(Value))) return Error{"Stack overflow.", POS(1)};
+		CollectCyclesIfDue();
+		DISPATCH();
+	}
+	TARGET(Call):
+	{
+		const Function& function = regs[instruction->a].GetFunction();
+		FunctionCode& functionCode = *function.code;
+		TRY(CompileBody(functionCode, *function.args));
+
+		// NOTE The arguments are in the slots of the callee's frame already, which starts above the function.
+		const size_t n = instruction->c;
+		size_t calleeBase = base + instruction->a + 1;
+		for (size_t i = 0; i < n; ++i)
+		{
+			Value& arg = registers[calleeBase + i];
+			if (arg.Type() == TypeTag::Void) arg.bits = 1;
+		}
+
+		// NOTE The caller's register A keeps the function, and with it the chunk, alive during the call. A tail call
+		// hands that register to the callee and drops the frame of the returning function, whose registers and code
+		// aren't used again.
+		if ((instruction->flags & INSTRUCTION_TAIL_CALL) && !callers.empty())
+		{
+			CloseUpvalues(upvalues, base);
+			const Frame& caller = callers.back();
+			registers[caller.base + caller.result] = std::move(regs[instruction->a]);
+			for (size_t i = 0; i < n; ++i) registers[base + i] = std::move(registers[calleeBase + i]);
+			calleeBase = base;
+		}
+		else
+		{
+			callers.push_back(Frame{chunk, pc, base, scope, instruction->a});
+		}
+		chunk = functionCode.chunk.get();
+		code = chunk->code.data();
+		pc = 0;
+		base = calleeBase;
+		// NOTE Slots other than the arguments start out unbound, registers above them are dead.
+		registers.resize(base + n);
+		registers.resize(base + chunk->registerCount);
+		regs = registers.data() + base;
+		scope = &function.closure;
+		DISPATCH();
+	}
+	TARGET(Return):
+	{
+		returnValue = std::move(regs[instruction->a]);
+		if (callers.empty())
+		{
+			returned = true;
+			return Error::None;
+		}
+		goto returnToCaller;
+	}
+	TARGET(End):
+	{
+		if (callers.empty()) return Error::None;
+		returnValue = Value();
+		goto returnToCaller;
+	}
+	TARGET(Print):
+	{
+		PrintValue(regs[instruction->a], false);
+		DISPATCH();
+	}
+	}
+
+#ifndef RJL_COMPUTED_GOTO
+	return Error{"Internal error: Unrecognized instruction.", POS(0)};
+#endif
+
+returnToCaller:
+	{
+		Frame& caller = callers.back();
+		CloseUpvalues(upvalues, base);
+		registers.resize(base);
+		chunk = caller.chunk;
+		code = chunk->code.data();
+		pc = caller.pc;
+		base = caller.base;
+		registers.resize(base + chunk->registerCount);
+		regs = registers.data() + base;
+		scope = caller.scope;
+		regs[caller.result] = std::move(returnValue);
+		callers.pop_back();
+		DISPATCH();
+	}
+}
+
+#ifdef RJL_COMPUTED_GOTO
+#pragma GCC diagnostic pop
+#endif
+
+// Compiles the body of a function on its first call.
+[[nodiscard]] static Error CompileBody(FunctionCode& code, const std::vector<std::string>& args)
+{
+	if (code.chunk) return Error::None;
+
+	auto compiled = std::make_shared<Chunk>();
+	compiled->slots = args;
+	CollectBoundNames(*code.statements, compiled->slots);
+	compiled->upvalues = code.upvalues;
+	compiled->registerCount = compiled->slots.size();
+	TRY(CompileStatements(*compiled, *code.statements, compiled->slots.size()));
+	Emit(*compiled, Opcode::End, 0, 0, 0);
+	code.chunk = std::move(compiled);
+	return Error::None;
+}
+
+// Calls `function` of one argument outside of the running code, on a VM of its own, for map operations.
+[[nodiscard]] static Error CallFunction(const Function& function, const double arg, Value& out)
+{
+	TRY(CompileBody(*function.code, *function.args));
+
+	std::vector<Value> registers;
+	registers.emplace_back(arg);
+	bool returned = false;
+	TRY(Run(*function.code->chunk, function.closure, std::move(registers), returned, out));
+	if (!returned) out = Value();
+	return Error::None;
+}
+
+// Returns the value bound to `variable` in a frame with registers `regs` running in `scope`, null if it's unbound.
+static Value* FindVariable(const Variable& variable, Value* const regs, Scope& scope)
+{
+	if (variable.slot != NO_INDEX && IsBoundSlot(regs[variable.slot])) return &regs[variable.slot];
+
+	Scope* lookup = &scope;
+	if (variable.upvalue != NO_INDEX)
+	{
+		Upvalue& upvalue = *scope.upvalues[variable.upvalue];
+		if (upvalue.IsBound()) return &upvalue.Get();
+		// NOTE Scopes with upvalues bind nothing, the name can only be bound further out.
+		lookup = scope.parent_scope.get();
+	}
+	Value* value;
+	return lookup->TryGetValue(variable.name, value) ? value : nullptr;
+}
+
+static void BindNumber(const Variable& variable, Value* const regs, Scope& scope, const double value)
+{
+	if (variable.slot != NO_INDEX) regs[variable.slot] = Value(value);
+	else scope.SetNumber(variable.name, value);
+}
+
+// Returns the scope of a function or comment created by the frame at `base`, which captures the slots in `captures`.
+// Without any that's the scope the frame runs in, otherwise a scope inside it finding the slots as upvalues, shared
+// with other functions and comments capturing them.
+static Ref<Scope> CaptureScope(const Chunk& chunk, const std::vector<uint32_t>& captures, const Ref<Scope>& scope, std::vector<Value>& registers, const size_t base, std::vector<Ref<Upvalue>>& upvalues)
+{
+	if (captures.empty()) return scope;
+
+	auto captured = MakeRef<Scope>();
+	captured->parent_scope = scope;
+	captured->upvalues.reserve(captures.size());
+	for (const uint32_t slot : captures)
+	{
+		// NOTE Upvalues of the running frame are the last ones open.
+		Ref<Upvalue> upvalue;
+		for (auto it = upvalues.rbegin(); it != upvalues.rend() && (*it)->slot >= base; ++it)
+		{
+			if ((*it)->slot == base + slot)
+			{
+				upvalue = *it;
+				break;
+			}
+		}
+		if (!upvalue)
+		{
+			upvalue = MakeRef<Upvalue>(chunk.slots[slot], &registers, base + slot);
+			upvalues.push_back(upvalue);
+		}
+		captured->upvalues.push_back(std::move(upvalue));
+	}
+	return captured;
+}
+
+// Closes the upvalues of frames from `base` up, which are about to return, moving the values out of their slots.
+static void CloseUpvalues(std::vector<Ref<Upvalue>>& upvalues, const size_t base)
+{
+	while (!upvalues.empty() && upvalues.back()->slot >= base)
+	{
+		Upvalue& upvalue = *upvalues.back();
+		upvalue.closed = std::move((*upvalue.stack)[upvalue.slot]);
+		upvalue.stack = nullptr;
+		upvalues.pop_back();
+	}
+}
+
+// Returns the error message if `a` can't be the first operand of binary operation `op`.
+static const char* CheckFirstOperand(const Opcode op, const Value& a)
+{
+	switch (op)
+	{
+	case Opcode::Add:
+	case Opcode::Subtract:
+	case Opcode::Multiply:
+	case Opcode::Divide:
+	case Opcode::Modulo:
+		return a.Type() == TypeTag::Number ? nullptr : "Arithmetic operand is not a number.";
+	case Opcode::Less:
+	case Opcode::Greater:
+	case Opcode::LessEquals:
+	case Opcode::GreaterEquals:
+	case Opcode::Equals:
+	case Opcode::NotEquals:
+		return a.Type() == TypeTag::Number ? nullptr : "Comparison operand is not a number.";
+	case Opcode::Read:
+		return a.Type() == TypeTag::Array ? nullptr : "Array read array operand is not an array.";
+	case Opcode::Map:
+		return a.Type() == TypeTag::Function ? nullptr : "Map function operand is not a function.";
+	case Opcode::Xor:
+		return a.Type() == TypeTag::Bool ? nullptr : "Logic operand is not boolean.";
+	default:
+		return nullptr;
+	}
+}
+
+static Error OperandError(const Chunk& chunk, const Instruction& instruction, const bool aValid, const char* const aMessage, const char* const bMessage)
+{
+	if (!aValid) return Error{aMessage, chunk.positions[instruction.pos]};
+	return Error{bMessage, chunk.positions[instruction.pos + 1]};
+}
+
+// Same as the tree walker's rule: the result keeps a comment only if exactly one operand had one. A comment attached
+// to the expression itself is attached by a separate instruction.
+static void CombineOperandComments(const Instruction& instruction, const Value& b, Value& out)
+{
+	if (instruction.flags & INSTRUCTION_COMMENT_UNUSED) return;
+	if (out.GetComment() && b.GetComment()) out.SetComment(nullptr);
+	else if (b.GetComment()) out.SetComment(b.GetComment());
+}
+
+static bool ForLoopRuns(const Instruction& instruction, const double counter, const double end, const double step)
+{
+	if (step > 0.0) return instruction.flags & INSTRUCTION_INCLUSIVE ? counter <= end : counter < end;
+	return counter > end;
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "CodePos.h"
+#include "Error.h"
+#include "Parser.h"
+#include "Runtime.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Registers are numbered from the base of the running function's frame. Unless noted, an operation writes its result
+// to register A and comments of operands combine the same way as in the tree walker.
+#define RJL_OPCODES(X) \
+	X(LoadFalse)     /* A = false */ \
+	X(LoadTrue)      /* A = true */ \
+	X(LoadNumber)    /* A = numbers[B] */ \
+	X(LoadConstant)  /* A = constants[B] */ \
+	X(LoadVariable)  /* A = variables[B], void if unbound */ \
+	X(LoadSlot)      /* A = slot B, or variables[C] if the slot is unbound */ \
+	X(NewArray)      /* A = empty array */ \
+	X(AppendArray)   /* append number B to array A */ \
+	X(NewFunction)   /* A = function of functions[B] capturing captures[C] */ \
+	X(Attach)        /* attach comments[B] capturing captures[C] to A */ \
+	X(Not)           /* A = not A */ \
+	X(Negate)        /* A = neg A */ \
+	X(MakeVoid)      /* A = void A */ \
+	X(Length)        /* A = # A */ \
+	X(CheckOperand)  /* fail unless A is a valid first operand of opcode C, before B runs */ \
+	X(Add)           /* A = + A B */ \
+	X(Subtract)      /* A = - A B */ \
+	X(Multiply)      /* A = * A B */ \
+	X(Divide)        /* A = / A B */ \
+	X(Modulo)        /* A = % A B */ \
+	X(Less)          /* A = < A B */ \
+	X(Greater)       /* A = > A B */ \
+	X(LessEquals)    /* A = <= A B */ \
+	X(GreaterEquals) /* A = >= A B */ \
+	X(Equals)        /* A = == A B */ \
+	X(NotEquals)     /* A = != A B */ \
+	X(Read)          /* A = @ A B */ \
+	X(Map)           /* A = map A B */ \
+	X(Xor)           /* A = xor A B */ \
+	X(JumpAnd)       /* fail unless A is a bool, jump to B if it's false */ \
+	X(JumpOr)        /* fail unless A is a bool, jump to B if it's true */ \
+	X(And)           /* A = and A B, after JumpAnd */ \
+	X(Or)            /* A = or A B, after JumpOr */ \
+	X(Switch)        /* jump to the arm switches[B] selects by number variables[C], go on if it isn't a number */ \
+	X(Jump)          /* jump to B */ \
+	X(JumpIfFalse)   /* jump to B if condition A is false or zero */ \
+	X(Store)         /* variables[B] = A, unbound if A is void */ \
+	X(StoreSlot)     /* slot B = A, unbound if A is void */ \
+	X(LoadArray)     /* A = array variables[B] */ \
+	X(CheckIndex)    /* fail unless B is an index in bounds of array A */ \
+	X(WriteArray)    /* element B of array A = number C */ \
+	X(Push)          /* push number B to array A */ \
+	X(Pop)           /* pop from array variables[B] */ \
+	X(ForGuard)      /* jump to B unless loop start A, end A+1 and step A+2 fit a rewritten while loop */ \
+	X(ForPrepare)    /* check loop start A, end A+1 and step A+2, jump to B if the loop doesn't run */ \
+	X(ForBind)       /* variables[B] = counter A */ \
+	X(ForLoop)       /* step counter A, jump to B if the loop goes on, otherwise variables[C] = counter A */ \
+	X(PrepareCall)   /* fail unless A is a function taking C arguments */ \
+	X(Call)          /* A = call of function A with C arguments in registers from A+1, where its frame starts */ \
+	X(Return)        /* return A from the function */ \
+	X(End)           /* return void from the function, or stop at top level */ \
+	X(Print)         /* print A */
+
+enum class Opcode : uint8_t {
+#define RJL_OPCODE_ENUM(name) name,
+	RJL_OPCODES(RJL_OPCODE_ENUM)
+#undef RJL_OPCODE_ENUM
+};
+
+constexpr uint8_t INSTRUCTION_COMMENT_UNUSED = 1; // binary operations: skip combining comments
+constexpr uint8_t INSTRUCTION_LOOP_CONDITION = 2; // JumpIfFalse: condition of a while loop
+constexpr uint8_t INSTRUCTION_INCLUSIVE = 4;      // ForPrepare, ForLoop: the loop runs up to and including the end
+constexpr uint8_t INSTRUCTION_TAIL_CALL = 8;      // Call: the function returns the result, so the callee replaces it
+
+struct Instruction {
+	Opcode op;
+	uint8_t flags;
+	uint16_t a;
+	uint32_t b;
+	uint32_t c;
+	uint32_t pos; // first of the positions reported by errors, operands follow in order
+};
+
+constexpr uint32_t NO_INDEX = UINT32_MAX;
+
+// Variable named in a chunk. Names bound in a function body, its arguments and the names it assigns, live in slots,
+// the lowest registers of its frame. Names of the frame creating the function that it refers to are its upvalues.
+// Other names, and names whose slot or upvalue is unbound, are looked up in the scope the code runs in.
+struct Variable {
+	std::string name;
+	uint32_t slot;    // NO_INDEX unless bound in the body
+	uint32_t upvalue; // NO_INDEX unless captured
+
+	Variable(std::string name, const uint32_t slot, const uint32_t upvalue) : name{std::move(name)}, slot{slot}, upvalue{upvalue} {}
+};
+
+// Addresses of the arms of a switch statement, ordered as in its if chain with the else block last.
+struct SwitchTable {
+	const SwitchStatement* statement;
+	std::vector<uint32_t> arms;
+};
+
+// Bytecode of one function body or of top-level code. Pointers refer to the AST the chunk was compiled from.
+struct Chunk {
+	std::vector<Instruction> code;
+	std::vector<CodePos> positions;
+	std::vector<double> numbers;
+	std::vector<const Value*> constants;
+	std::vector<Variable> variables;
+	std::vector<const CommentToken*> comments;
+	std::vector<FunctionLiteral*> functions;
+	std::vector<std::vector<uint32_t>> captures; // slots a function or comment refers to, which become its upvalues
+	std::vector<SwitchTable> switches;
+	std::vector<std::string> slots;    // names bound in a function body, arguments first
+	std::vector<std::string> upvalues; // names the function captured, see FunctionCode::upvalues
+	size_t registerCount = 0;
+};
+
+// Compiles `statements` to bytecode and runs them in `scope`. Sets `returned` if the code returned at top level.
+[[nodiscard]] Error RunBytecode(std::vector<std::unique_ptr<Statement>>& statements, const Ref<Scope>& scope, bool& returned);
@@ -0,0 +1,20 @@
+#!/bin/bash
+
+# Times every script in Benchmarks with optional optimizations off and on, and translated to C++.
+
+g++ -std=c++17 -pedantic -Wall -Wextra -O2 -pthread -o rjl-bench Common.cpp Main.cpp Lexer.cpp Parser.cpp Interpreter.cpp Optimizer.cpp VM.cpp Closures.cpp Jit.cpp Lanes.cpp Collector.cpp EmitCpp.cpp || exit 1
+
+TIMEFORMAT="%Rs"
+for script in Benchmarks/*.rjl
+do
+	for options in "--no-kernels --no-memo --no-quicken --no-fuse --no-lanes" "" "--vm" "--closures" "--jit"
+	do
+		echo "$script ${options:-(default)}"
+		time ./rjl-bench $options "$script" || exit 1
+	done
+
+	echo "$script --emit-cpp"
+	./rjl-bench --emit-cpp "$script" > /tmp/rjl-bench.cpp || exit 1
+	g++ -std=c++17 -O2 -I . -o /tmp/rjl-bench-cpp /tmp/rjl-bench.cpp || exit 1
+	time /tmp/rjl-bench-cpp || exit 1
+done
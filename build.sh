@@ -1,3 +1,3 @@
 #!/bin/sh
 
-g++ -std=c++17 -pedantic -Wall -Wextra -g -o rjl Common.cpp Main.cpp Lexer.cpp Parser.cpp Interpreter.cpp
+g++ -std=c++17 -pedantic -Wall -Wextra -g -pthread -o rjl Common.cpp Main.cpp Lexer.cpp Parser.cpp Interpreter.cpp Optimizer.cpp VM.cpp Closures.cpp Jit.cpp Lanes.cpp Collector.cpp EmitCpp.cpp
@@ -0,0 +1,36 @@
+#!/bin/bash
+
+# Runs every script in Tests with each engine, and translated to C++, and compares what it prints with the expected
+# output next to it, which is what the tree walker prints.
+
+./build.sh || exit 1
+
+failed=0
+cd Tests
+for script in *.rjl
+do
+	expected="${script%.rjl}.expected"
+	for options in "" "--no-kernels --no-memo --no-quicken --no-fuse --no-lanes --no-caches" "--hot-calls 1 --hot-loops 1" "--vm" "--closures" "--jit" "--jit --hot-calls 1 --hot-loops 1"
+	do
+		if ! ../rjl $options "$script" 2>&1 | diff -u "$expected" - > /tmp/rjl-test.diff
+		then
+			echo "FAIL $script ${options:-(default)}"
+			head -n 20 /tmp/rjl-test.diff
+			failed=1
+		fi
+	done
+
+	if ! ../rjl --emit-cpp "$script" > /tmp/rjl-test.cpp || ! g++ -std=c++17 -I .. -o /tmp/rjl-test /tmp/rjl-test.cpp
+	then
+		echo "FAIL $script --emit-cpp (doesn't build)"
+		failed=1
+	elif ! /tmp/rjl-test 2>&1 | diff -u "$expected" - > /tmp/rjl-test.diff
+	then
+		echo "FAIL $script --emit-cpp"
+		head -n 20 /tmp/rjl-test.diff
+		failed=1
+	fi
+done
+
+[ $failed = 0 ] && echo "All tests passed"
+exit $failed